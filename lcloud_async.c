@@ -0,0 +1,581 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_async.c
+//  Description    : This is the implementation of the asynchronous file
+//                   interface.  Reads and writes are queued on a submission
+//                   ring and run in windows: the device blocks the window's
+//                   reads will miss are fetched up front in one pipelined
+//                   batch, and its writes land in a staging area that is
+//                   handed to the scheduler as writeback when the window
+//                   ends.  Each operation's result is then posted on the
+//                   completion ring.
+//
+//   Author        : Lucas Benning
+//   Last Modified : 5/4/20
+//
+
+// Include files
+#include <stdlib.h>
+#include <string.h>
+#include <cmpsc311_log.h>
+
+// Project include files
+#include <lcloud_filesys.h>
+#include <lcloud_fsinternal.h>
+#include <lcloud_cache.h>
+#include <lcloud_support.h>
+
+// Defines
+#define LC_ASYNC_CQ_DEPTH (2 * LC_ASYNC_DEPTH) // Completions held before the caller must harvest
+#define LC_ASYNC_STAGE_SLOTS (2 * LC_ASYNC_STAGE_BLOCKS) // Entries of the staging index (power of two)
+
+// Type definitions
+typedef struct {
+    LcAsyncToken token; // Its token
+    char write; // 1 for a write, 0 for a read
+    LcFHandle fh; // The file
+    size_t off; // Offset, LC_ASYNC_POS for the file position
+    char *buf; // Caller's buffer
+    size_t len; // Bytes to move
+    void *user; // Caller's value, handed back with the completion
+} LcAsyncOp;
+
+typedef struct {
+    LcBlock blk; // The device block
+    LcFHandle fh; // File that last wrote it
+    char dirty; // 1 if written in this window and not yet on the device
+} LcStageBlock;
+
+struct LcAsync {
+    LcAsyncOp sq[LC_ASYNC_DEPTH]; // Submission ring
+    uint32_t sq_head, sq_tail; // Next to run, next free (free-running)
+    LcCompletion cq[LC_ASYNC_CQ_DEPTH]; // Completion ring
+    uint32_t cq_head, cq_tail; // Next to harvest, next free (free-running)
+    LcAsyncToken next_token; // Token of the next operation
+
+    // Staging area of the window being run
+    LcStageBlock stage[LC_ASYNC_STAGE_BLOCKS]; // Staged blocks
+    char *stage_data; // Their contents
+    int32_t stage_index[LC_ASYNC_STAGE_SLOTS]; // Open-addressed index into stage, -1 if empty
+    uint32_t nstaged; // Entries in stage
+    LcBlock *xfer_blks[LC_ASYNC_STAGE_BLOCKS]; // Batch being sent
+    char *xfer_bufs[LC_ASYNC_STAGE_BLOCKS];
+    size_t *sim_pos; // Per file position while planning a window's prefetch
+    int sim_cap; // Entries in sim_pos
+};
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : stage_slot
+// Description  : Find the index entry of a block in the staging area
+//
+// Inputs       : aq - the queues
+//                blk - the device block
+// Outputs      : the index entry (holding -1 if the block is not staged)
+
+static int32_t * stage_slot( LcAsync *aq, LcBlock *blk ) {
+    uint32_t h = ((uint32_t) blk->dev * 2654435761u) ^ ((uint32_t) blk->sec * 40503u) ^ blk->blk;
+    for(h &= LC_ASYNC_STAGE_SLOTS - 1; ; h = (h + 1) & (LC_ASYNC_STAGE_SLOTS - 1)) {
+        int32_t s = aq->stage_index[h];
+        if(s == -1 || (aq->stage[s].blk.dev == blk->dev && aq->stage[s].blk.sec == blk->sec &&
+            aq->stage[s].blk.blk == blk->blk)) {
+            return(&aq->stage_index[h]);
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : stage_add
+// Description  : Stage a block (the caller checked there is room)
+//
+// Inputs       : aq - the queues
+//                slot - its empty index entry, from stage_slot
+//                blk - the device block
+// Outputs      : the staged block's entry
+
+static int32_t stage_add( LcAsync *aq, int32_t *slot, LcBlock *blk ) {
+    int32_t s = aq->nstaged++;
+    aq->stage[s].blk.dev = blk->dev;
+    aq->stage[s].blk.sec = blk->sec;
+    aq->stage[s].blk.blk = blk->blk;
+    aq->stage[s].fh = -1;
+    aq->stage[s].dirty = 0;
+    *slot = s;
+    return(s);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : stage_reset
+// Description  : Empty the staging area (its blocks must all be clean)
+//
+// Inputs       : aq - the queues
+// Outputs      : none
+
+static void stage_reset( LcAsync *aq ) {
+    memset(aq->stage_index, 0xff, sizeof(aq->stage_index));
+    aq->nstaged = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : stage_flush
+// Description  : Hand the dirty staged blocks to the scheduler as writeback
+//                (it copies them, and sends them behind the demand transfers
+//                of a later dispatch).  Each file's blocks take turns with
+//                the other files'.
+//
+// Inputs       : ctx - the filesystem
+//                aq - the queues
+// Outputs      : number of blocks queued, -1 if failure
+
+static int stage_flush( LcContext *ctx, LcAsync *aq ) {
+    LcFHandle fh = -1;
+    int n = 0, run = 0;
+
+    for(uint32_t s = 0; s <= aq->nstaged; s++) {
+        if(s < aq->nstaged && !aq->stage[s].dirty) continue;
+
+        // Queue the run of blocks the last file wrote when another file's start
+        if(n > run && (s == aq->nstaged || aq->stage[s].fh != fh) &&
+            lcloud_sched_queue(ctx, LC_XFER_WRITE, &aq->xfer_blks[run], &aq->xfer_bufs[run], n - run,
+            LC_IO_WRITEBACK, fh) == -1) {
+            return(-1);
+        }
+        if(s == aq->nstaged) break;
+        if(aq->stage[s].fh != fh) run = n;
+        fh = aq->stage[s].fh;
+        aq->xfer_blks[n] = &aq->stage[s].blk;
+        aq->xfer_bufs[n] = &aq->stage_data[(size_t) s * LC_DEVICE_BLOCK_SIZE];
+        aq->stage[s].dirty = 0;
+        n++;
+    }
+    return(n);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : stage_read
+// Description  : Read the blocks of the transfer batch from the devices and
+//                stage them while there is room
+//
+// Inputs       : ctx - the filesystem
+//                aq - the queues
+//                n - blocks in the batch
+//                fh - the file they are for
+// Outputs      : 0 if successful, -1 if failure
+
+static int stage_read( LcContext *ctx, LcAsync *aq, int n, LcFHandle fh ) {
+    int32_t *slot;
+
+    if(lcloud_sched_queue(ctx, LC_XFER_READ, aq->xfer_blks, aq->xfer_bufs, n, LC_IO_DEMAND, fh) == -1 ||
+        lcloud_sched_dispatch(ctx) == -1) {
+        return(-1);
+    }
+    for(int i = 0; i < n && aq->nstaged < LC_ASYNC_STAGE_BLOCKS; i++) {
+        slot = stage_slot(aq, aq->xfer_blks[i]);
+        if(*slot == -1) {
+            memcpy(&aq->stage_data[(size_t) stage_add(aq, slot, aq->xfer_blks[i]) * LC_DEVICE_BLOCK_SIZE],
+                aq->xfer_bufs[i], LC_DEVICE_BLOCK_SIZE);
+        }
+    }
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_async_xfer
+// Description  : Transfer blocks for an operation of the window being run.
+//                Writes are staged for the write-back at the end of the
+//                window; reads are served from the staging area, the
+//                blocks it does not hold are read from the devices in
+//                one batch and staged.
+//
+// Inputs       : ctx - the filesystem
+//                dir - LC_XFER_READ or LC_XFER_WRITE
+//                blks - the blocks to transfer
+//                bufs - buffer for each block (filled by reads)
+//                n - number of blocks
+//                fh - the file they are for
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_async_xfer( LcContext *ctx, int dir, LcBlock **blks, char **bufs, int n, LcFHandle fh ) {
+    LcAsync *aq = ctx->async;
+    int32_t *slot;
+    int nmiss = 0;
+
+    if(dir == LC_XFER_WRITE) {
+        for(int i = 0; i < n; i++) {
+            slot = stage_slot(aq, blks[i]);
+            if(*slot == -1) {
+                // Out of room: write back what is staged and start over
+                if(aq->nstaged == LC_ASYNC_STAGE_BLOCKS) {
+                    if(stage_flush(ctx, aq) == -1) return(-1);
+                    stage_reset(aq);
+                    slot = stage_slot(aq, blks[i]);
+                }
+                stage_add(aq, slot, blks[i]);
+            }
+            memcpy(&aq->stage_data[(size_t) *slot * LC_DEVICE_BLOCK_SIZE], bufs[i], LC_DEVICE_BLOCK_SIZE);
+            aq->stage[*slot].fh = fh;
+            aq->stage[*slot].dirty = 1;
+        }
+        return(0);
+    }
+
+    // Copy out what is staged, read the rest
+    for(int i = 0; i < n; i++) {
+        slot = stage_slot(aq, blks[i]);
+        if(*slot != -1) {
+            memcpy(bufs[i], &aq->stage_data[(size_t) *slot * LC_DEVICE_BLOCK_SIZE], LC_DEVICE_BLOCK_SIZE);
+            continue;
+        }
+        aq->xfer_blks[nmiss] = blks[i];
+        aq->xfer_bufs[nmiss] = bufs[i];
+        if(++nmiss == LC_ASYNC_STAGE_BLOCKS) {
+            if(stage_read(ctx, aq, nmiss, fh) == -1) return(-1);
+            nmiss = 0;
+        }
+    }
+    return((nmiss > 0) ? stage_read(ctx, aq, nmiss, fh) : 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : async_prefetch
+// Description  : Read the device blocks a window's operations will need and
+//                the cache does not hold into the staging area, in one
+//                batch: all the blocks its reads cover, and the partly
+//                written first and last block of its writes.  Positions
+//                are followed from op to op; a guess that turns out wrong
+//                only costs the op its own read.
+//
+// Inputs       : ctx - the filesystem
+//                aq - the queues (staging area empty)
+//                count - operations in the window, from sq_head
+// Outputs      : number of blocks read, -1 if failure
+
+static int async_prefetch( LcContext *ctx, LcAsync *aq, uint32_t count ) {
+    int n = 0;
+
+    if(aq->sim_cap < ctx->filec) {
+        size_t *grown;
+        if((grown = realloc(aq->sim_pos, ctx->filec * sizeof(size_t))) == NULL) return(-1);
+        aq->sim_pos = grown;
+        aq->sim_cap = ctx->filec;
+    }
+    for(uint32_t k = 0; k < count; k++) {
+        LcAsyncOp *op = &aq->sq[(aq->sq_head + k) % LC_ASYNC_DEPTH];
+        if(op->fh < 0 || op->fh >= ctx->filec) continue;
+        aq->sim_pos[op->fh] = ctx->files[op->fh].pos;
+    }
+
+    for(uint32_t k = 0; k < count && aq->nstaged < LC_ASYNC_STAGE_BLOCKS; k++) {
+        LcAsyncOp *op = &aq->sq[(aq->sq_head + k) % LC_ASYNC_DEPTH];
+        if(op->fh < 0 || op->fh >= ctx->filec || ctx->files[op->fh].open == 0 || op->len == 0) continue;
+        LcFile *file = &ctx->files[op->fh];
+        size_t off = (op->off == LC_ASYNC_POS) ? aq->sim_pos[op->fh] : op->off;
+        size_t end = off + op->len;
+        aq->sim_pos[op->fh] = end;
+        if(!op->write) {
+            if(off >= file->size) continue;
+            if(end > file->size) end = file->size;
+            aq->sim_pos[op->fh] = end;
+        }
+
+        uint32_t first = off / LC_DEVICE_BLOCK_SIZE, last = (end - 1) / LC_DEVICE_BLOCK_SIZE;
+        int n0 = n;
+        for(uint32_t b = first; b <= last && b < file->num_blocks && aq->nstaged < LC_ASYNC_STAGE_BLOCKS; b++) {
+            LcBlock *blk = &file->blocks[b];
+            if(blk->dev == LC_BLOCK_HOLE || blk->unwritten) continue;
+
+            // Writes only read the blocks they do not replace whole
+            if(op->write && ((b != first || off % LC_DEVICE_BLOCK_SIZE == 0) &&
+                (b != last || end % LC_DEVICE_BLOCK_SIZE == 0) && blk->frag_len == 0)) continue;
+            if(lccache_holds(ctx->cache, blk->dev, blk->sec, blk->blk)) continue;
+
+            int32_t *slot = stage_slot(aq, blk);
+            if(*slot != -1) continue;
+            int32_t s = stage_add(aq, slot, blk);
+            aq->xfer_blks[n] = &aq->stage[s].blk;
+            aq->xfer_bufs[n] = &aq->stage_data[(size_t) s * LC_DEVICE_BLOCK_SIZE];
+            n++;
+        }
+
+        // Each file's reads take turns with the others' on the devices
+        if(n > n0 && lcloud_sched_queue(ctx, LC_XFER_READ, &aq->xfer_blks[n0], &aq->xfer_bufs[n0], n - n0, LC_IO_DEMAND,
+            op->fh) == -1) {
+            stage_reset(aq);
+            return(-1);
+        }
+    }
+    if(n > 0 && lcloud_sched_dispatch(ctx) == -1) {
+        stage_reset(aq);
+        return(-1);
+    }
+    return(n);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : async_queues
+// Description  : Get a filesystem's async queues, creating them on first use
+//
+// Inputs       : ctx - the filesystem
+// Outputs      : the queues, NULL if failure
+
+static LcAsync * async_queues( LcContext *ctx ) {
+    LcAsync *aq;
+
+    if(ctx->async != NULL) return(ctx->async);
+    if((aq = calloc(1, sizeof(LcAsync))) == NULL ||
+        (aq->stage_data = malloc((size_t) LC_ASYNC_STAGE_BLOCKS * LC_DEVICE_BLOCK_SIZE)) == NULL) {
+        logMessage(LOG_ERROR_LEVEL, "Memory allocation error");
+        free(aq);
+        return(NULL);
+    }
+    aq->next_token = 1;
+    stage_reset(aq);
+    ctx->async = aq;
+    return(aq);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : async_queue
+// Description  : Put an operation on the submission ring (running the ring
+//                first if it is full)
+//
+// Inputs       : ctx - the filesystem
+//                write - 1 for a write, 0 for a read
+//                fh, off, buf, len, user - the operation
+// Outputs      : the operation's token, -1 if failure
+
+static LcAsyncToken async_queue( LcContext *ctx, int write, LcFHandle fh, size_t off, char *buf, size_t len, void *user ) {
+    LcAsync *aq;
+    LcAsyncOp *op;
+
+    if(fh < 0 || fh >= ctx->filec || ctx->files[fh].open == 0) {
+        logMessage(LOG_ERROR_LEVEL, "File not open");
+        return(-1);
+    }
+    if((aq = async_queues(ctx)) == NULL) return(-1);
+    if(aq->sq_tail - aq->sq_head == LC_ASYNC_DEPTH && lcsubmit_ctx(ctx) == -1) return(-1);
+
+    op = &aq->sq[aq->sq_tail % LC_ASYNC_DEPTH];
+    op->token = aq->next_token++;
+    op->write = write;
+    op->fh = fh;
+    op->off = off;
+    op->buf = buf;
+    op->len = len;
+    op->user = user;
+    aq->sq_tail++;
+    return(op->token);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcread_async_ctx
+// Description  : Queue a read of the file.  It runs, in submission order,
+//                at the next lcsubmit or lcwait; the buffer and the file
+//                must stay valid and open until its completion is posted.
+//
+// Inputs       : ctx - the filesystem
+//                fh - file handle for the file to read from
+//                off - offset to read at, LC_ASYNC_POS for the file position
+//                buf - place to put the data
+//                len - the length of the read
+//                user - value handed back with the completion
+// Outputs      : the operation's token, -1 if failure
+
+LcAsyncToken lcread_async_ctx( LcContext *ctx, LcFHandle fh, size_t off, char *buf, size_t len, void *user ) {
+    return(async_queue(ctx, 0, fh, off, buf, len, user));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcwrite_async_ctx
+// Description  : Queue a write to the file (see lcread_async_ctx)
+//
+// Inputs       : ctx - the filesystem
+//                fh - file handle for the file to write to
+//                off - offset to write at, LC_ASYNC_POS for the file position
+//                buf - pointer to data to write
+//                len - the length of the write
+//                user - value handed back with the completion
+// Outputs      : the operation's token, -1 if failure
+
+LcAsyncToken lcwrite_async_ctx( LcContext *ctx, LcFHandle fh, size_t off, char *buf, size_t len, void *user ) {
+    return(async_queue(ctx, 1, fh, off, buf, len, user));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcsubmit_ctx
+// Description  : Run the queued operations.  They run in windows of as many
+//                as the staging area and completion ring have room for:
+//                the window's missing blocks are prefetched in one batch,
+//                its operations run against the staging area, and its
+//                writes are handed to the scheduler as writeback before
+//                the completions are posted.  A completed write is seen by
+//                every later read, but only reaches the devices behind the
+//                demand transfers of a later dispatch, or at lcshutdown
+//                (whose result reports a write back that fails then).
+//
+// Inputs       : ctx - the filesystem
+// Outputs      : number of operations run, -1 if the completion ring is full
+
+int lcsubmit_ctx( LcContext *ctx ) {
+    LcAsync *aq = ctx->async;
+    int ran = 0;
+
+    if(aq == NULL) return(0);
+    while(aq->sq_head != aq->sq_tail) {
+        // Size the window by the blocks its operations can touch
+        uint32_t room = LC_ASYNC_CQ_DEPTH - (aq->cq_tail - aq->cq_head), count = 0, blocks = 0;
+        while(aq->sq_head + count != aq->sq_tail && count < room) {
+            LcAsyncOp *op = &aq->sq[(aq->sq_head + count) % LC_ASYNC_DEPTH];
+            uint32_t need = op->len / LC_DEVICE_BLOCK_SIZE + 2;
+            if(count > 0 && blocks + need > LC_ASYNC_STAGE_BLOCKS) break;
+            blocks += need;
+            count++;
+        }
+        if(count == 0) {
+            logMessage(LOG_ERROR_LEVEL, "Async completion ring full, harvest completions first");
+            return((ran > 0) ? ran : -1);
+        }
+
+        // Prefetch, then run the operations against the staging area
+        int fetched = async_prefetch(ctx, aq, count);
+        ctx->staging = 1;
+        for(uint32_t k = 0; k < count; k++) {
+            LcAsyncOp *op = &aq->sq[(aq->sq_head + k) % LC_ASYNC_DEPTH];
+            LcCompletion *cqe = &aq->cq[(aq->cq_tail + k) % LC_ASYNC_CQ_DEPTH];
+            cqe->token = op->token;
+            cqe->user = op->user;
+            cqe->result = -1;
+            if(op->off != LC_ASYNC_POS && lcseek_ctx(ctx, op->fh, op->off) == -1) continue;
+            cqe->result = op->write ? lcwrite_ctx(ctx, op->fh, op->buf, op->len) :
+                lcread_ctx(ctx, op->fh, op->buf, op->len);
+        }
+
+        // Queue the write back, failing the window's writes if that does not go through
+        int written = stage_flush(ctx, aq);
+        ctx->staging = 0;
+        stage_reset(aq);
+        if(written == -1) {
+            for(uint32_t k = 0; k < count; k++) {
+                if(aq->sq[(aq->sq_head + k) % LC_ASYNC_DEPTH].write) {
+                    aq->cq[(aq->cq_tail + k) % LC_ASYNC_CQ_DEPTH].result = -1;
+                }
+            }
+        }
+        logMessage(LcDriverLLevel, "Ran %u async operations (%d blocks prefetched, %d queued for write back)",
+            count, fetched, written);
+
+        aq->sq_head += count;
+        aq->cq_tail += count;
+        ran += count;
+    }
+    return(ran);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcpoll_ctx
+// Description  : Harvest completed operations without running any
+//
+// Inputs       : ctx - the filesystem
+//                cqes - (output) the completions, oldest first
+//                max - entries in cqes
+// Outputs      : number of completions harvested
+
+int lcpoll_ctx( LcContext *ctx, LcCompletion *cqes, int max ) {
+    LcAsync *aq = ctx->async;
+    int n = 0;
+
+    if(aq == NULL) return(0);
+    while(n < max && aq->cq_head != aq->cq_tail) {
+        cqes[n++] = aq->cq[aq->cq_head++ % LC_ASYNC_CQ_DEPTH];
+    }
+    return(n);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcwait_ctx
+// Description  : Run the queued operations if fewer than min have completed,
+//                then harvest up to max completions.  Returns with fewer
+//                than min only when nothing more is queued.
+//
+// Inputs       : ctx - the filesystem
+//                cqes - (output) the completions, oldest first
+//                min - completions to wait for
+//                max - entries in cqes
+// Outputs      : number of completions harvested, -1 if failure
+
+int lcwait_ctx( LcContext *ctx, LcCompletion *cqes, int min, int max ) {
+    LcAsync *aq = ctx->async;
+
+    if(aq == NULL) return(0);
+    if((int) (aq->cq_tail - aq->cq_head) < min && aq->sq_head != aq->sq_tail && lcsubmit_ctx(ctx) == -1) {
+        return(-1);
+    }
+    return(lcpoll_ctx(ctx, cqes, max));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_async_close
+// Description  : Run the operations still queued (so no write is lost) and
+//                free the async queues; unharvested completions are dropped
+//
+// Inputs       : ctx - the filesystem
+// Outputs      : 0 if successful, -1 if some queued operations could not run
+
+int lcloud_async_close( LcContext *ctx ) {
+    LcAsync *aq = ctx->async;
+    int ret = 0;
+
+    if(aq == NULL) return(0);
+    while(aq->sq_head != aq->sq_tail) {
+        aq->cq_head = aq->cq_tail;
+        if(lcsubmit_ctx(ctx) == -1) {
+            ret = -1;
+            break;
+        }
+    }
+    free(aq->stage_data);
+    free(aq->sim_pos);
+    free(aq);
+    ctx->async = NULL;
+    return(ret);
+}
+
+//
+// The functions without a context work on the default instance
+
+LcAsyncToken lcread_async( LcFHandle fh, size_t off, char *buf, size_t len, void *user ) {
+    return(lcread_async_ctx(lcctx_default(), fh, off, buf, len, user));
+}
+
+LcAsyncToken lcwrite_async( LcFHandle fh, size_t off, char *buf, size_t len, void *user ) {
+    return(lcwrite_async_ctx(lcctx_default(), fh, off, buf, len, user));
+}
+
+int lcsubmit( void ) {
+    return(lcsubmit_ctx(lcctx_default()));
+}
+
+int lcpoll( LcCompletion *cqes, int max ) {
+    return(lcpoll_ctx(lcctx_default(), cqes, max));
+}
+
+int lcwait( LcCompletion *cqes, int min, int max ) {
+    return(lcwait_ctx(lcctx_default(), cqes, min, max));
+}
@@ -0,0 +1,158 @@
+#!/bin/bash
+#
+# CMPSC311 - LionCloud Device
+# lcloud_bench.sh - run the standard benchmark matrix (workloads x cache
+#   capacities x eviction policies x transports), write the results as CSV
+#   and JSON, and flag regressions against the stored baseline.  Each
+#   configuration runs several times and the run with the median throughput
+#   is kept.  The gate checks the deterministic cache and bus counts;
+#   throughput and tail latency vary from run to run and machine to
+#   machine, so they are only gated when asked for.
+#
+# usage: lcloud_bench.sh [-u]
+#   -u - replace the baseline with this run's results
+#
+# Environment (defaults in parentheses):
+#   BENCH_CACHES         cache capacities in blocks ("0 64 1024")
+#   BENCH_POLICIES       eviction policies ("lru fifo clock")
+#   BENCH_TRANSPORTS     transports, any of shm, unix and tcp ("shm unix")
+#   BENCH_REPS           runs of each configuration, the median is kept (5)
+#   BENCH_TIMING         1 to also gate throughput and p99 latency (0)
+#   BENCH_TOLERANCE      allowed drop in throughput, percent (30)
+#   BENCH_LAT_TOLERANCE  allowed rise in p99 latency, percent (100)
+#   BENCH_BASELINE       baseline results (lcloud_bench_baseline.csv)
+#   BENCH_OUT            output directory (bench_results)
+#   BENCH_PORT           TCP port for the stand-in server (24600)
+#
+
+CACHES=${BENCH_CACHES:-"0 64 1024"}
+POLICIES=${BENCH_POLICIES:-"lru fifo clock"}
+TRANSPORTS=${BENCH_TRANSPORTS:-"shm unix"}
+REPS=${BENCH_REPS:-5}
+TIMING=${BENCH_TIMING:-0}
+TOLERANCE=${BENCH_TOLERANCE:-30}
+LAT_TOLERANCE=${BENCH_LAT_TOLERANCE:-100}
+BASELINE=${BENCH_BASELINE:-lcloud_bench_baseline.csv}
+OUT=${BENCH_OUT:-bench_results}
+PORT=${BENCH_PORT:-24600}
+SOCK=$OUT/lcloud-bench.sock
+RESULTS=$OUT/results.csv
+RUNS=$OUT/runs.csv
+
+cd "$(dirname "$0")" || exit 1
+mkdir -p "$OUT"
+rm -f "$RESULTS" "$OUT/results.json"
+
+# Generated workloads (fixed seeds, so every run sees the same operations)
+GENERATED="zipf hotspot large"
+./lcloud_wlgen -p zipf -o 50000 -n 2000 -P 2 -s 311 -N gen-zipf \
+    -c "$OUT/gen-zipf.lcwb" -m "$OUT/gen-zipf-manifest.txt" || exit 1
+./lcloud_wlgen -p hotspot -o 50000 -n 5000 -r 80 -s 312 -N gen-hotspot \
+    -c "$OUT/gen-hotspot.lcwb" -m "$OUT/gen-hotspot-manifest.txt" || exit 1
+./lcloud_wlgen -p large -o 4000 -n 64 -r 50 -s 313 -N gen-large \
+    -c "$OUT/gen-large.lcwb" -m "$OUT/gen-large-manifest.txt" || exit 1
+
+# Print "<workload> <manifest>" for every benchmark workload
+workloads() {
+    for w in 4a 4c 4e; do
+        echo "workload/cmpsc311-assign$w-workload.txt workload/cmpsc311-assign$w-manifest.txt"
+    done
+    for g in $GENERATED; do
+        echo "$OUT/gen-$g.lcwb $OUT/gen-$g-manifest.txt"
+    done
+}
+
+# Start the stand-in server for a manifest, stop it again
+SERVER=
+start_server() {
+    ./lcloud_simserver -p "$PORT" -u "$SOCK" "$1" >"$OUT/server.log" 2>&1 &
+    SERVER=$!
+    for i in $(seq 50); do
+        [ -S "$SOCK" ] && return 0
+        sleep 0.1
+    done
+    echo "lcloud_bench: server did not start for $1" >&2
+    return 1
+}
+stop_server() {
+    [ -n "$SERVER" ] && kill -INT "$SERVER" 2>/dev/null && wait "$SERVER" 2>/dev/null
+    SERVER=
+}
+trap stop_server EXIT
+
+# Run the matrix, lcloud_client appends a result line only on success; of a
+# configuration's runs the one with the median ops_per_sec goes in the results
+FAILED=0
+while read -r wl manifest; do
+    for t in $TRANSPORTS; do
+        case $t in
+        shm)  spec="shm:$manifest" ;;
+        unix) spec="unix:$SOCK" ;;
+        tcp)  spec="tcp:127.0.0.1:$PORT" ;;
+        *)    echo "lcloud_bench: unknown transport $t" >&2; exit 1 ;;
+        esac
+        if [ "$t" != shm ]; then
+            start_server "$manifest" || exit 1
+        fi
+        for c in $CACHES; do
+            for p in $POLICIES; do
+                rm -f "$RUNS"
+                for r in $(seq "$REPS"); do
+                    ./lcloud_client -c "$c" -e "$p" -t "$spec" -s "$RUNS" "$wl" 2>>"$OUT/client.log"
+                done
+                runs=$(tail -n +2 "$RUNS" 2>/dev/null | wc -l)
+                if [ "$runs" -ne "$REPS" ]; then
+                    echo "lcloud_bench: FAILED $(basename "$wl") $t cache=$c $p ($runs of $REPS runs)" >&2
+                    FAILED=1
+                else
+                    [ -f "$RESULTS" ] || head -1 "$RUNS" >"$RESULTS"
+                    tail -n +2 "$RUNS" | sort -t, -k7,7g | sed -n "$(( (runs + 1) / 2 ))p" >>"$RESULTS"
+                fi
+                # The policy does not matter without a cache
+                [ "$c" = 0 ] && break
+            done
+        done
+        stop_server
+    done
+done < <(workloads)
+
+# JSON copy of the results
+awk -F, 'NR == 1 { for (i = 1; i <= NF; i++) key[i] = $i; print "["; next }
+    { printf "%s  {", (NR > 2) ? ",\n" : ""
+      for (i = 1; i <= NF; i++)
+          printf "%s\"%s\": %s", (i > 1) ? ", " : "", key[i], ($i ~ /^[0-9.]+$/) ? $i : "\"" $i "\""
+      printf "}" }
+    END { print "\n]" }' "$RESULTS" >"$OUT/results.json"
+
+column -s, -t <"$RESULTS" 2>/dev/null || cat "$RESULTS"
+echo "Results: $RESULTS, $OUT/results.json"
+
+if [ "$1" = "-u" ]; then
+    cp "$RESULTS" "$BASELINE"
+    echo "Baseline updated: $BASELINE"
+    exit $FAILED
+fi
+if [ ! -f "$BASELINE" ]; then
+    echo "No baseline ($BASELINE), run with -u to create one"
+    exit $FAILED
+fi
+
+# Compare with the baseline: the cache and bus counts are deterministic,
+# throughput and tail latency (with BENCH_TIMING=1) get a tolerance
+awk -F, -v tol="$TOLERANCE" -v ltol="$LAT_TOLERANCE" -v timing="$TIMING" '
+    FNR == 1 { for (i = 1; i <= NF; i++) col[$i] = i; next }
+    { k = $1 "," $2 "," $3 "," $4 }
+    NR == FNR { hit[k] = $col["hit_ratio"]; bus[k] = $col["bus_ops_per_op"]
+                ops[k] = $col["ops_per_sec"]; p99[k] = $col["p99_us"]; next }
+    !(k in hit) { print "NEW        " k; next }
+    { if ($col["hit_ratio"] < hit[k] - 0.005) {
+          printf "REGRESSION %s hit_ratio %.4f -> %.4f\n", k, hit[k], $col["hit_ratio"]; bad++ }
+      if ($col["bus_ops_per_op"] > bus[k] * 1.01) {
+          printf "REGRESSION %s bus_ops_per_op %.4f -> %.4f\n", k, bus[k], $col["bus_ops_per_op"]; bad++ }
+      if (timing && $col["ops_per_sec"] < ops[k] * (1 - tol / 100)) {
+          printf "REGRESSION %s ops_per_sec %.0f -> %.0f\n", k, ops[k], $col["ops_per_sec"]; bad++ }
+      if (timing && $col["p99_us"] > p99[k] * (1 + ltol / 100)) {
+          printf "REGRESSION %s p99_us %.1f -> %.1f\n", k, p99[k], $col["p99_us"]; bad++ } }
+    END { if (bad) { print bad " regression(s) against the baseline"; exit 1 }
+          print "No regressions against the baseline" }' "$BASELINE" "$RESULTS" || FAILED=1
+exit $FAILED
@@ -8,151 +8,949 @@
 //   Last Modified : Thu 19 Mar 2020 09:27:55 AM EDT
 //
 
-// Includes 
+// Includes
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include <cmpsc311_log.h>
 #include <lcloud_support.h>
 #include <lcloud_cache.h>
 
+// Cache blocks are found through a hash of their address and kept on a
+// list ordered by recency (LRU) or insertion (FIFO); CLOCK sweeps the slots
+// in order instead.  Slots and their data are allocated once at init;
+// slots lccache_drop empties are reused before any block is evicted.
 typedef struct {
-    char *data;
+    char *data; // The cached block (points into block_data)
     LcDeviceId dev;
     uint16_t sec;
     uint16_t blk;
-    uint16_t t;
+    int prev; // Neighbour toward the head of the list, -1 if none
+    int next; // Neighbour toward the tail of the list, -1 if none
+    int hnext; // Next slot in the same hash bucket, -1 if none
+    char ref; // CLOCK reference bit
+    char free; // 1 if emptied by lccache_drop (on the free list)
 } LcCacheBlk;
 
-LcCacheBlk *cache_array;
-int hitc, missc;
-int max_blocks;
-int cache_size;
-uint16_t access_time = 0;
+// The second tier is a local file mapped into memory: a header, one slot
+// per block, then the block data.  Blocks evicted from memory are demoted
+// to it and copied back on a hit; they stay in the tier until CLOCK drops
+// them, and every put updates the tier's copy, so it never holds an older
+// version of a block.  A tier closed cleanly for the same device contents
+// is kept across runs.
+#define LC_L2_MAGIC "LCL2" // First four bytes of a second tier file
+#define LC_L2_VERSION 1
+
+typedef struct {
+    char magic[4]; // LC_L2_MAGIC
+    uint32_t version; // LC_L2_VERSION
+    uint32_t block_size; // LC_DEVICE_BLOCK_SIZE
+    uint32_t slots; // Capacity in blocks
+    uint64_t owner; // Device contents the blocks belong to
+    uint32_t clean; // 1 if closed cleanly (the slots describe the data)
+    uint32_t hand; // Next slot CLOCK inspects
+} LcCacheL2Header;
+
+typedef struct {
+    uint16_t sec;
+    uint16_t blk;
+    LcDeviceId dev;
+    uint8_t valid; // 1 if the slot holds a block
+    uint8_t ref; // CLOCK reference bit
+    uint8_t reserved;
+} LcCacheL2Slot;
+
+// A cache: its slots in memory, its configuration and its second tier
+struct LcCache {
+    LcCacheBlk *cache_array;
+    char *block_data; // Data for every slot, one allocation
+    int *hash_buckets; // First slot in each bucket, -1 if empty
+    uint32_t hash_mask; // Buckets - 1 (power of two)
+    int max_blocks;
+    int cache_size;
+    int list_head; // Most recently used (LRU) or newest (FIFO), -1 if empty
+    int list_tail; // Next victim for LRU and FIFO, -1 if empty
+    int clock_hand; // Next slot CLOCK inspects
+    int free_head; // Emptied slots, chained through next, -1 if none
+    LcCacheStats cache_stats;
+    int config_blocks; // Capacity override, -1 to use the caller's
+    LcCachePolicy config_policy;
+
+    char *l2_path; // Second tier file, NULL if there is none
+    int l2_blocks; // Its capacity
+    uint64_t l2_owner; // Device contents being cached
+    char *l2_map; // The mapped file, NULL while closed
+    size_t l2_map_len;
+    LcCacheL2Header *l2_header;
+    LcCacheL2Slot *l2_slots;
+    char *l2_data; // Data for every slot
+    int *l2_buckets; // First slot in each bucket, -1 if empty
+    int *l2_hnext; // Next slot in the same bucket, -1 if none
+    uint32_t l2_mask; // Buckets - 1 (power of two)
+};
+
+LcCache default_cache = { .list_head = -1, .list_tail = -1, .free_head = -1, .config_blocks = -1 }; // The cache the lcloud_ functions use
+const char *policy_names[LC_CACHE_MAX_POLICY] = { "lru", "fifo", "clock" };
 
 //
 // Functions
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : lcloud_getcache
-// Description  : Search the cache for a block 
+// Function     : cache_hash
+// Description  : Hash a block address
+//
+// Inputs       : did, sec, blk - the block address
+// Outputs      : the hash
+
+static uint32_t cache_hash( LcDeviceId did, uint16_t sec, uint16_t blk ) {
+    uint64_t key = ((uint64_t) did << 32) | ((uint32_t) sec << 16) | blk;
+    return((uint32_t) ((key * 0x9E3779B97F4A7C15ULL) >> 32));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_bucket
+// Description  : Hash a block address to its bucket
+//
+// Inputs       : did, sec, blk - the block address
+// Outputs      : the bucket index
+
+static uint32_t cache_bucket( LcCache *cache, LcDeviceId did, uint16_t sec, uint16_t blk ) {
+    return(cache_hash(did, sec, blk) & cache->hash_mask);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_find
+// Description  : Find the slot holding a block
+//
+// Inputs       : did, sec, blk - the block address
+// Outputs      : the slot, -1 if the block is not cached
+
+static int cache_find( LcCache *cache, LcDeviceId did, uint16_t sec, uint16_t blk ) {
+    if(cache->max_blocks == 0) return(-1);
+    for(int i = cache->hash_buckets[cache_bucket(cache, did, sec, blk)]; i != -1; i = cache->cache_array[i].hnext) {
+        if(cache->cache_array[i].dev == did && cache->cache_array[i].sec == sec && cache->cache_array[i].blk == blk) {
+            return(i);
+        }
+    }
+    return(-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_unlink
+// Description  : Remove a slot from the recency/insertion list
+//
+// Inputs       : i - the slot
+// Outputs      : none
+
+static void cache_unlink( LcCache *cache, int i ) {
+    if(cache->cache_array[i].prev != -1) {
+        cache->cache_array[cache->cache_array[i].prev].next = cache->cache_array[i].next;
+    } else {
+        cache->list_head = cache->cache_array[i].next;
+    }
+    if(cache->cache_array[i].next != -1) {
+        cache->cache_array[cache->cache_array[i].next].prev = cache->cache_array[i].prev;
+    } else {
+        cache->list_tail = cache->cache_array[i].prev;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_push_head
+// Description  : Put a slot at the head of the recency/insertion list
+//
+// Inputs       : i - the slot
+// Outputs      : none
+
+static void cache_push_head( LcCache *cache, int i ) {
+    cache->cache_array[i].prev = -1;
+    cache->cache_array[i].next = cache->list_head;
+    if(cache->list_head != -1) {
+        cache->cache_array[cache->list_head].prev = i;
+    } else {
+        cache->list_tail = i;
+    }
+    cache->list_head = i;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_push_tail
+// Description  : Put a slot at the tail of the recency/insertion list
+//
+// Inputs       : i - the slot
+// Outputs      : none
+
+static void cache_push_tail( LcCache *cache, int i ) {
+    cache->cache_array[i].next = -1;
+    cache->cache_array[i].prev = cache->list_tail;
+    if(cache->list_tail != -1) {
+        cache->cache_array[cache->list_tail].next = i;
+    } else {
+        cache->list_head = i;
+    }
+    cache->list_tail = i;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_cool
+// Description  : Make a cached block the next to go: the tail of the list
+//                for LRU and FIFO, no reference bit for CLOCK
+//
+// Inputs       : i - the slot
+// Outputs      : none
+
+static void cache_cool( LcCache *cache, int i ) {
+    if(cache->config_policy == LC_CACHE_CLOCK) {
+        cache->cache_array[i].ref = 0;
+    } else if(cache->list_tail != i) {
+        cache_unlink(cache, i);
+        cache_push_tail(cache, i);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
 //
-// Inputs       : did - device number of block to find
+// Function     : cache_touch
+// Description  : Record a use of a cached block under the configured policy
+//
+// Inputs       : i - the slot
+// Outputs      : none
+
+static void cache_touch( LcCache *cache, int i ) {
+    if(cache->config_policy == LC_CACHE_LRU && cache->list_head != i) {
+        cache_unlink(cache, i);
+        cache_push_head(cache, i);
+    } else if(cache->config_policy == LC_CACHE_CLOCK) {
+        cache->cache_array[i].ref = 1;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : l2_find
+// Description  : Find the second tier slot holding a block
+//
+// Inputs       : did, sec, blk - the block address
+// Outputs      : the slot, -1 if the block is not in the tier
+
+static int l2_find( LcCache *cache, LcDeviceId did, uint16_t sec, uint16_t blk ) {
+    if(cache->l2_map == NULL) return(-1);
+    for(int j = cache->l2_buckets[cache_hash(did, sec, blk) & cache->l2_mask]; j != -1; j = cache->l2_hnext[j]) {
+        if(cache->l2_slots[j].dev == did && cache->l2_slots[j].sec == sec && cache->l2_slots[j].blk == blk) {
+            return(j);
+        }
+    }
+    return(-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : l2_link
+// Description  : Add a second tier slot to the index
+//
+// Inputs       : j - the slot
+// Outputs      : none
+
+static void l2_link( LcCache *cache, int j ) {
+    uint32_t b = cache_hash(cache->l2_slots[j].dev, cache->l2_slots[j].sec, cache->l2_slots[j].blk) & cache->l2_mask;
+    cache->l2_hnext[j] = cache->l2_buckets[b];
+    cache->l2_buckets[b] = j;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : l2_evict
+// Description  : Choose a second tier slot for a new block, dropping the
+//                block it holds (CLOCK, stopping at the first empty slot)
+//
+// Inputs       : none
+// Outputs      : the freed slot
+
+static int l2_evict( LcCache *cache ) {
+    int j, *pp;
+    uint32_t hand = cache->l2_header->hand;
+
+    // Give blocks hit since the hand last passed a second chance
+    while(cache->l2_slots[hand].valid && cache->l2_slots[hand].ref) {
+        cache->l2_slots[hand].ref = 0;
+        hand = (hand + 1) % cache->l2_blocks;
+    }
+    j = hand;
+    cache->l2_header->hand = (hand + 1) % cache->l2_blocks;
+
+    if(cache->l2_slots[j].valid) {
+        for(pp = &cache->l2_buckets[cache_hash(cache->l2_slots[j].dev, cache->l2_slots[j].sec, cache->l2_slots[j].blk) & cache->l2_mask];
+            *pp != j; pp = &cache->l2_hnext[*pp]);
+        *pp = cache->l2_hnext[j];
+        cache->l2_slots[j].valid = 0;
+        cache->cache_stats.l2_evictions++;
+    }
+    return(j);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : l2_demote
+// Description  : Copy a block leaving memory to the second tier
+//
+// Inputs       : i - the cache slot holding it
+// Outputs      : none
+
+static void l2_demote( LcCache *cache, int i ) {
+    int j;
+
+    if(cache->l2_map == NULL) return;
+    if((j = l2_find(cache, cache->cache_array[i].dev, cache->cache_array[i].sec, cache->cache_array[i].blk)) == -1) {
+        j = l2_evict(cache);
+        cache->l2_slots[j].dev = cache->cache_array[i].dev;
+        cache->l2_slots[j].sec = cache->cache_array[i].sec;
+        cache->l2_slots[j].blk = cache->cache_array[i].blk;
+        cache->l2_slots[j].valid = 1;
+        cache->l2_slots[j].ref = 0;
+        l2_link(cache, j);
+    }
+    memcpy(&cache->l2_data[(size_t) j * LC_DEVICE_BLOCK_SIZE], cache->cache_array[i].data, LC_DEVICE_BLOCK_SIZE);
+    cache->cache_stats.demotions++;
+    logMessage(LcDriverLLevel, "Block [%d/%d/%d] demoted to second tier", cache->cache_array[i].dev, cache->cache_array[i].sec, cache->cache_array[i].blk);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : l2_open
+// Description  : Map the second tier file, keeping its blocks if the header
+//                shows it was closed cleanly with the same geometry and owner
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+static int l2_open( LcCache *cache ) {
+    int fd, kept = 0;
+    uint32_t buckets = 1;
+    size_t index_len = (sizeof(LcCacheL2Header) + (size_t) cache->l2_blocks * sizeof(LcCacheL2Slot) + 4095) & ~(size_t) 4095;
+
+    cache->l2_map_len = index_len + (size_t) cache->l2_blocks * LC_DEVICE_BLOCK_SIZE;
+    if((fd = open(cache->l2_path, O_RDWR | O_CREAT, 0600)) == -1 || ftruncate(fd, cache->l2_map_len) == -1 ||
+        (cache->l2_map = mmap(NULL, cache->l2_map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        logMessage(LOG_ERROR_LEVEL, "Cannot map second tier cache [%s]", cache->l2_path);
+        if(fd != -1) close(fd);
+        cache->l2_map = NULL;
+        return(-1);
+    }
+    close(fd);
+    cache->l2_header = (LcCacheL2Header *) cache->l2_map;
+    cache->l2_slots = (LcCacheL2Slot *) (cache->l2_map + sizeof(LcCacheL2Header));
+    cache->l2_data = cache->l2_map + index_len;
+
+    // Start empty unless the slots are known to describe the data
+    if(memcmp(cache->l2_header->magic, LC_L2_MAGIC, 4) != 0 || cache->l2_header->version != LC_L2_VERSION ||
+        cache->l2_header->block_size != LC_DEVICE_BLOCK_SIZE || cache->l2_header->slots != (uint32_t) cache->l2_blocks ||
+        cache->l2_header->owner != cache->l2_owner || cache->l2_header->clean != 1 || cache->l2_header->hand >= (uint32_t) cache->l2_blocks) {
+        memset(cache->l2_map, 0, index_len);
+        memcpy(cache->l2_header->magic, LC_L2_MAGIC, 4);
+        cache->l2_header->version = LC_L2_VERSION;
+        cache->l2_header->block_size = LC_DEVICE_BLOCK_SIZE;
+        cache->l2_header->slots = cache->l2_blocks;
+        cache->l2_header->owner = cache->l2_owner;
+    }
+
+    while(buckets < 2 * (uint32_t) cache->l2_blocks) buckets <<= 1;
+    cache->l2_buckets = malloc(buckets * sizeof(int));
+    cache->l2_hnext = malloc(cache->l2_blocks * sizeof(int));
+    if(cache->l2_buckets == NULL || cache->l2_hnext == NULL) {
+        logMessage(LOG_ERROR_LEVEL, "Memory allocation error");
+        return(-1);
+    }
+    cache->l2_mask = buckets - 1;
+    memset(cache->l2_buckets, 0xff, buckets * sizeof(int));
+    for(int j = 0; j < cache->l2_blocks; j++) {
+        if(cache->l2_slots[j].valid) {
+            l2_link(cache, j);
+            kept++;
+        }
+    }
+
+    // Until the tier is closed the slots may run ahead of the data on disk
+    cache->l2_header->clean = 0;
+    if(msync(cache->l2_map, index_len, MS_SYNC) == -1) {
+        logMessage(LOG_ERROR_LEVEL, "Cannot sync second tier cache [%s]", cache->l2_path);
+        return(-1);
+    }
+    logMessage(LcDriverLLevel, "Second tier cache [%s]: %d blocks, %d kept", cache->l2_path, cache->l2_blocks, kept);
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : l2_close
+// Description  : Write back and unmap the second tier, marking it clean
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+static int l2_close( LcCache *cache ) {
+    int ret = 0;
+
+    if(cache->l2_map != NULL) {
+        // The data and slots reach the file before the header says they match
+        if(msync(cache->l2_map, cache->l2_map_len, MS_SYNC) == -1) {
+            ret = -1;
+        } else {
+            cache->l2_header->clean = 1;
+            if(msync(cache->l2_map, sizeof(LcCacheL2Header), MS_SYNC) == -1) ret = -1;
+        }
+        if(ret == -1) logMessage(LOG_ERROR_LEVEL, "Cannot sync second tier cache [%s]", cache->l2_path);
+        munmap(cache->l2_map, cache->l2_map_len);
+    }
+    free(cache->l2_buckets);
+    free(cache->l2_hnext);
+    cache->l2_map = NULL;
+    cache->l2_header = NULL;
+    cache->l2_slots = NULL;
+    cache->l2_data = NULL;
+    cache->l2_buckets = NULL;
+    cache->l2_hnext = NULL;
+    return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_unhash
+// Description  : Remove a slot from its hash bucket
+//
+// Inputs       : i - the slot
+// Outputs      : none
+
+static void cache_unhash( LcCache *cache, int i ) {
+    int *pp;
+
+    for(pp = &cache->hash_buckets[cache_bucket(cache, cache->cache_array[i].dev, cache->cache_array[i].sec, cache->cache_array[i].blk)];
+        *pp != i; pp = &cache->cache_array[*pp].hnext);
+    *pp = cache->cache_array[i].hnext;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_evict
+// Description  : Choose a victim slot and drop its block from the index
+//
+// Inputs       : none
+// Outputs      : the freed slot
+
+static int cache_evict( LcCache *cache ) {
+    int i;
+
+    if(cache->config_policy == LC_CACHE_CLOCK) {
+        // Give referenced blocks a second chance
+        while(cache->cache_array[cache->clock_hand].ref) {
+            cache->cache_array[cache->clock_hand].ref = 0;
+            cache->clock_hand = (cache->clock_hand + 1) % cache->max_blocks;
+        }
+        i = cache->clock_hand;
+        cache->clock_hand = (cache->clock_hand + 1) % cache->max_blocks;
+    } else {
+        i = cache->list_tail;
+    }
+    cache_unlink(cache, i);
+    cache_unhash(cache, i);
+
+    cache->cache_stats.evictions++;
+    logMessage(LcDriverLLevel, "Block [%d/%d/%d] evicted from cache", cache->cache_array[i].dev, cache->cache_array[i].sec, cache->cache_array[i].blk);
+    l2_demote(cache, i);
+    return(i);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_insert
+// Description  : Add a block that is not cached, evicting if the cache is full
+//
+// Inputs       : did, sec, blk - the block address
+//                block - the block data
+// Outputs      : the slot now holding it
+
+static int cache_insert( LcCache *cache, LcDeviceId did, uint16_t sec, uint16_t blk, char *block ) {
+    int i;
+    uint32_t b;
+
+    // Use a free slot while there is one, otherwise evict
+    if(cache->free_head != -1) {
+        i = cache->free_head;
+        cache->free_head = cache->cache_array[i].next;
+        cache->cache_array[i].free = 0;
+    } else if(cache->cache_size < cache->max_blocks) {
+        i = cache->cache_size++;
+    } else {
+        i = cache_evict(cache);
+    }
+
+    // Update data, device, sector, and block info
+    memcpy(cache->cache_array[i].data, block, LC_DEVICE_BLOCK_SIZE);
+    cache->cache_array[i].dev = did;
+    cache->cache_array[i].sec = sec;
+    cache->cache_array[i].blk = blk;
+    cache->cache_array[i].ref = 1;
+    b = cache_bucket(cache, did, sec, blk);
+    cache->cache_array[i].hnext = cache->hash_buckets[b];
+    cache->hash_buckets[b] = i;
+    cache_push_head(cache, i);
+    cache->cache_stats.inserts++;
+    return(i);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lccache_get
+// Description  : Search the cache for a block
+//
+// Inputs       : cache - the cache
+//                did - device number of block to find
 //                sec - sector number of block to find
 //                blk - block number of block to find
 // Outputs      : cache block if found (pointer), NULL if not or failure
 
-char * lcloud_getcache( LcDeviceId did, uint16_t sec, uint16_t blk ) {
-    for(int i = 0; i < cache_size; i++) {
-        if(cache_array[i].dev == did && cache_array[i].sec == sec && cache_array[i].blk == blk) {
-            hitc += 1;
-            char *data_ptr = cache_array[i].data;
-            logMessage(LcDriverLLevel, "CACHE HIT: Block [%d/%d/%d] (t = %d) retrieved from cache", cache_array[i].dev, cache_array[i].sec, cache_array[i].blk, cache_array[i].t);
-            return(data_ptr);
-        }
+char * lccache_get( LcCache *cache, LcDeviceId did, uint16_t sec, uint16_t blk ) {
+    int i, j;
+    char block[LC_DEVICE_BLOCK_SIZE];
+
+    if((i = cache_find(cache, did, sec, blk)) != -1) {
+        cache->cache_stats.hits++;
+        cache_touch(cache, i);
+        logMessage(LcDriverLLevel, "CACHE HIT: Block [%d/%d/%d] retrieved from cache", did, sec, blk);
+        return(cache->cache_array[i].data);
+    }
+    cache->cache_stats.misses++;
+
+    // Promote a block found in the second tier (copied out first, the
+    // demotion making room for it may reuse its slot)
+    if((j = l2_find(cache, did, sec, blk)) != -1) {
+        memcpy(block, &cache->l2_data[(size_t) j * LC_DEVICE_BLOCK_SIZE], LC_DEVICE_BLOCK_SIZE);
+        cache->l2_slots[j].ref = 1;
+        cache->cache_stats.l2_hits++;
+        logMessage(LcDriverLLevel, "CACHE HIT: Block [%d/%d/%d] retrieved from second tier", did, sec, blk);
+        return(cache->cache_array[cache_insert(cache, did, sec, blk, block)].data);
     }
+    if(cache->l2_map != NULL) cache->cache_stats.l2_misses++;
     logMessage(LcDriverLLevel, "CACHE MISS: Block [%d/%d/%d] not found in cache", did, sec, blk);
-    missc += 1;
     /* Return not found */
     return( NULL );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : lcloud_putcache
-// Description  : Put a value in the cache 
+// Function     : lccache_holds
+// Description  : Check whether either tier of a cache holds a block, without
+//                counting a lookup or changing what will be evicted
 //
-// Inputs       : did - device number of block to insert
+// Inputs       : cache - the cache
+//                did - device number of block to find
+//                sec - sector number of block to find
+//                blk - block number of block to find
+// Outputs      : 1 if the block is held, 0 if not
+
+int lccache_holds( LcCache *cache, LcDeviceId did, uint16_t sec, uint16_t blk ) {
+    return(cache_find(cache, did, sec, blk) != -1 || l2_find(cache, did, sec, blk) != -1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lccache_put
+// Description  : Put a value in the cache
+//
+// Inputs       : cache - the cache
+//                did - device number of block to insert
 //                sec - sector number of block to insert
 //                blk - block number of block to insert
 // Outputs      : 0 if succesfully inserted, -1 if failure
 
-int lcloud_putcache( LcDeviceId did, uint16_t sec, uint16_t blk, char *block ) {
-    int i;
-    // Check if block is already in cache and update data and access time
-    for(int j = 0; j < cache_size; j++) {
-        if(cache_array[j].dev == did && cache_array[j].sec == sec && cache_array[j].blk == blk) {
-            if((cache_array[j].data = realloc(cache_array[j].data, LC_DEVICE_BLOCK_SIZE * sizeof(LC_DEVICE_BLOCK_SIZE))) == NULL) return(-1);
-            memcpy(cache_array[j].data, block, LC_DEVICE_BLOCK_SIZE);
-            cache_array[j].t = access_time;
-            access_time += 1;
-            logMessage(LcDriverLLevel, "Block [%d/%d/%d] (t = %d) updated in cache", cache_array[j].dev, cache_array[j].sec, cache_array[j].blk, cache_array[j].t);
-            return(0);
-        }
+int lccache_put( LcCache *cache, LcDeviceId did, uint16_t sec, uint16_t blk, char *block ) {
+    int i, j;
+
+    // A zero-sized cache holds nothing
+    if(cache->max_blocks == 0) return(0);
+
+    // Keep the second tier's copy current
+    if((j = l2_find(cache, did, sec, blk)) != -1) {
+        memcpy(&cache->l2_data[(size_t) j * LC_DEVICE_BLOCK_SIZE], block, LC_DEVICE_BLOCK_SIZE);
     }
-    // If size of cache is not maximum, add new block to cache
-    if(cache_size < max_blocks) {
-        cache_size += 1;
-        i = cache_size - 1;
-        if((cache_array[i].data = malloc(LC_DEVICE_BLOCK_SIZE * sizeof(char))) == NULL) return(-1);
-    // Else, choose oldest block in cache to evict
-    } else {
-        int oldest = 0;
-        for(int j = 1; j < cache_size; j++) {
-            if(cache_array[j].t < cache_array[oldest].t) {
-                oldest = j;
-            }
-        }
-        i = oldest;
-        logMessage(LcDriverLLevel, "Block [%d/%d/%d] (t = %d) evicted from cache", cache_array[i].dev, cache_array[i].sec, cache_array[i].blk, cache_array[i].t);
-        if((cache_array[i].data = realloc(cache_array[i].data, LC_DEVICE_BLOCK_SIZE * sizeof(char))) == NULL) return(-1);
+
+    // Check if block is already in cache and update data and recency
+    if((i = cache_find(cache, did, sec, blk)) != -1) {
+        memcpy(cache->cache_array[i].data, block, LC_DEVICE_BLOCK_SIZE);
+        cache_touch(cache, i);
+        logMessage(LcDriverLLevel, "Block [%d/%d/%d] updated in cache", did, sec, blk);
+        return(0);
     }
-    // Update data, device, sector, and block info
-    memcpy(cache_array[i].data, block, LC_DEVICE_BLOCK_SIZE);
-    cache_array[i].dev = did;
-    cache_array[i].sec = sec;
-    cache_array[i].blk = blk;
-    cache_array[i].t = access_time;
-    logMessage(LcDriverLLevel, "Block [%d/%d/%d] (t = %d) written to cache", did, sec, blk, access_time);
-    access_time += 1;
+
+    cache_insert(cache, did, sec, blk, block);
+    logMessage(LcDriverLLevel, "Block [%d/%d/%d] written to cache", did, sec, blk);
     /* Return successfully */
     return( 0 );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : lcloud_initcache
+// Function     : lccache_put_cold
+// Description  : Put a value in the cache as the next block to evict, for
+//                data that will not be used again soon (a block already
+//                cached is updated and keeps its place)
+//
+// Inputs       : cache - the cache
+//                did - device number of block to insert
+//                sec - sector number of block to insert
+//                blk - block number of block to insert
+// Outputs      : 0 if succesfully inserted, -1 if failure
+
+int lccache_put_cold( LcCache *cache, LcDeviceId did, uint16_t sec, uint16_t blk, char *block ) {
+    int i, j;
+
+    if(cache->max_blocks == 0) return(0);
+    if((j = l2_find(cache, did, sec, blk)) != -1) {
+        memcpy(&cache->l2_data[(size_t) j * LC_DEVICE_BLOCK_SIZE], block, LC_DEVICE_BLOCK_SIZE);
+    }
+    if((i = cache_find(cache, did, sec, blk)) != -1) {
+        memcpy(cache->cache_array[i].data, block, LC_DEVICE_BLOCK_SIZE);
+        return(0);
+    }
+    cache_cool(cache, cache_insert(cache, did, sec, blk, block));
+    cache->cache_stats.cold_inserts++;
+    logMessage(LcDriverLLevel, "Block [%d/%d/%d] written to cache (cold)", did, sec, blk);
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lccache_cool
+// Description  : Make a cached block the next to evict
+//
+// Inputs       : cache - the cache
+//                did - device number of the block
+//                sec - sector number of the block
+//                blk - block number of the block
+// Outputs      : 1 if the block was cached, 0 if not
+
+int lccache_cool( LcCache *cache, LcDeviceId did, uint16_t sec, uint16_t blk ) {
+    int i;
+
+    if((i = cache_find(cache, did, sec, blk)) == -1) return(0);
+    cache_cool(cache, i);
+    return(1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lccache_drop
+// Description  : Take a block out of memory now, freeing its slot for the
+//                next insert (cached blocks are never newer than the
+//                devices' and the scheduler's copies, so nothing is lost;
+//                a second tier copy stays)
+//
+// Inputs       : cache - the cache
+//                did - device number of the block
+//                sec - sector number of the block
+//                blk - block number of the block
+// Outputs      : 1 if the block was cached, 0 if not
+
+int lccache_drop( LcCache *cache, LcDeviceId did, uint16_t sec, uint16_t blk ) {
+    int i;
+
+    if((i = cache_find(cache, did, sec, blk)) == -1) return(0);
+    cache_unlink(cache, i);
+    cache_unhash(cache, i);
+    cache->cache_array[i].ref = 0;
+    cache->cache_array[i].free = 1;
+    cache->cache_array[i].next = cache->free_head;
+    cache->free_head = i;
+    logMessage(LcDriverLLevel, "Block [%d/%d/%d] dropped from cache", did, sec, blk);
+    return(1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lccache_capacity
+// Description  : Get the number of blocks a cache holds in memory
+//
+// Inputs       : cache - the cache
+// Outputs      : the capacity (0 until the cache is initialized)
+
+int lccache_capacity( LcCache *cache ) {
+    return(cache->max_blocks);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lccache_init
 // Description  : Initialze the cache by setting up metadata a cache elements.
 //
-// Inputs       : maxblocks - the max number number of blocks 
+// Inputs       : cache - the cache
+//                maxblocks - the max number number of blocks (unless
+//                            lccache_configure set a capacity)
 // Outputs      : 0 if successful, -1 if failure
 
-int lcloud_initcache( int maxblocks ) {
-    if((cache_array = malloc(maxblocks * sizeof(LcCacheBlk))) == NULL) {
+int lccache_init( LcCache *cache, int maxblocks ) {
+    uint32_t buckets = 1;
+
+    if(cache->config_blocks >= 0) maxblocks = cache->config_blocks;
+    while(buckets < 2 * (uint32_t) maxblocks) buckets <<= 1;
+
+    cache->cache_array = calloc(maxblocks + 1, sizeof(LcCacheBlk));
+    cache->block_data = malloc((size_t) maxblocks * LC_DEVICE_BLOCK_SIZE + 1);
+    cache->hash_buckets = malloc(buckets * sizeof(int));
+    if(cache->cache_array == NULL || cache->block_data == NULL || cache->hash_buckets == NULL) {
+        lccache_close(cache);
         return(-1);
     }
-    max_blocks = maxblocks;
-    for(int i = 0; i < max_blocks; i++) {
-        cache_array[i].dev = -1;
-        cache_array[i].sec = -1;
-        cache_array[i].blk = -1;
-        cache_array[i].t = -1;
+    cache->max_blocks = maxblocks;
+    cache->cache_size = 0;
+    cache->list_head = cache->list_tail = -1;
+    cache->clock_hand = 0;
+    cache->free_head = -1;
+    cache->hash_mask = buckets - 1;
+    memset(cache->hash_buckets, 0xff, buckets * sizeof(int));
+    memset(&cache->cache_stats, 0, sizeof(cache->cache_stats));
+    for(int i = 0; i < cache->max_blocks; i++) {
+        cache->cache_array[i].data = &cache->block_data[(size_t) i * LC_DEVICE_BLOCK_SIZE];
+    }
+
+    // The second tier only receives blocks evicted from memory
+    if(cache->l2_path != NULL && cache->max_blocks > 0 && l2_open(cache) == -1) {
+        lccache_close(cache);
+        return(-1);
     }
+    logMessage(LcDriverLLevel, "Cache initialized: %d blocks, %s eviction", cache->max_blocks, policy_names[cache->config_policy]);
     /* Return successfully */
     return( 0 );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : lcloud_closecache
+// Function     : lccache_close
 // Description  : Clean up the cache when program is closing
 //
-// Inputs       : none
+// Inputs       : cache - the cache
 // Outputs      : 0 if successful, -1 if failure
 
-int lcloud_closecache( void ) {
-    for(int i = 0; i < cache_size; i++) {
-        free(cache_array[i].data);
-        cache_array[i].data = NULL;
+int lccache_close( LcCache *cache ) {
+    int ret;
+
+    // Keep what is in memory for the next run
+    if(cache->l2_map != NULL) {
+        for(int i = 0; i < cache->cache_size; i++) {
+            if(!cache->cache_array[i].free) l2_demote(cache, i);
+        }
     }
-    free(cache_array);
-    cache_array = NULL;
+    ret = l2_close(cache);
 
-    logMessage(LcDriverLLevel, "Total cache hits: %d", hitc);
-    logMessage(LcDriverLLevel, "Total cache misses: %d",missc);
-    logMessage(LcDriverLLevel, "Hit ratio: %f", (float) hitc / (hitc + missc));
+    free(cache->cache_array);
+    free(cache->block_data);
+    free(cache->hash_buckets);
+    cache->cache_array = NULL;
+    cache->block_data = NULL;
+    cache->hash_buckets = NULL;
+    cache->max_blocks = cache->cache_size = 0;
+
+    logMessage(LcDriverLLevel, "Total cache hits: %lu", cache->cache_stats.hits);
+    logMessage(LcDriverLLevel, "Total cache misses: %lu", cache->cache_stats.misses);
+    logMessage(LcDriverLLevel, "Hit ratio: %f", (cache->cache_stats.hits + cache->cache_stats.misses == 0) ? 0.0 :
+        (double) cache->cache_stats.hits / (cache->cache_stats.hits + cache->cache_stats.misses));
+    if(cache->l2_path != NULL) {
+        logMessage(LcDriverLLevel, "Second tier hits: %lu, misses: %lu, demotions: %lu", cache->cache_stats.l2_hits,
+            cache->cache_stats.l2_misses, cache->cache_stats.demotions);
+    }
 
     /* Return successfully */
-    return( 0 );
-}
\ No newline at end of file
+    return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lccache_configure
+// Description  : Choose the cache capacity and eviction policy, takes effect
+//                at the next lccache_init
+//
+// Inputs       : cache - the cache
+//                maxblocks - capacity in blocks (0 disables), -1 for the default
+//                policy - the eviction policy
+// Outputs      : 0 if successful, -1 if failure
+
+int lccache_configure( LcCache *cache, int maxblocks, LcCachePolicy policy ) {
+    if(policy >= LC_CACHE_MAX_POLICY) return(-1);
+    cache->config_blocks = maxblocks;
+    cache->config_policy = policy;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_cache_policy
+// Description  : Look up an eviction policy by name
+//
+// Inputs       : name - the policy name
+// Outputs      : the policy, -1 if unknown
+
+int lcloud_cache_policy( const char *name ) {
+    for(int i = 0; i < LC_CACHE_MAX_POLICY; i++) {
+        if(strcmp(name, policy_names[i]) == 0) return(i);
+    }
+    return(-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lccache_policy_name
+// Description  : Name of the configured eviction policy
+//
+// Inputs       : cache - the cache
+// Outputs      : the name
+
+const char * lccache_policy_name( LcCache *cache ) {
+    return(policy_names[cache->config_policy]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lccache_stats
+// Description  : Get the cache counters (they survive lccache_close)
+//
+// Inputs       : cache - the cache
+//                stats - (output) the counters
+// Outputs      : none
+
+void lccache_stats( LcCache *cache, LcCacheStats *stats ) {
+    *stats = cache->cache_stats;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lccache_l2_configure
+// Description  : Choose the second tier file and capacity, takes effect at
+//                the next lccache_init
+//
+// Inputs       : cache - the cache
+//                path - the file, NULL for no second tier
+//                maxblocks - capacity in blocks
+// Outputs      : 0 if successful, -1 if failure
+
+int lccache_l2_configure( LcCache *cache, const char *path, int maxblocks ) {
+    char *copy = NULL;
+
+    if(path != NULL && (maxblocks <= 0 || (copy = strdup(path)) == NULL)) return(-1);
+    free(cache->l2_path);
+    cache->l2_path = copy;
+    cache->l2_blocks = maxblocks;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lccache_l2_owner
+// Description  : Name the device contents being cached; a second tier file
+//                written for other contents starts empty at the next
+//                lccache_init
+//
+// Inputs       : cache - the cache
+//                owner - the identity of the contents
+// Outputs      : none
+
+void lccache_l2_owner( LcCache *cache, uint64_t owner ) {
+    cache->l2_owner = owner;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lccache_create
+// Description  : Create a cache, configured with the defaults (initialize it
+//                with lccache_init)
+//
+// Inputs       : none
+// Outputs      : the cache, NULL if failure
+
+LcCache * lccache_create( void ) {
+    LcCache *cache;
+
+    if((cache = calloc(1, sizeof(LcCache))) == NULL) {
+        logMessage(LOG_ERROR_LEVEL, "Memory allocation error");
+        return(NULL);
+    }
+    cache->list_head = cache->list_tail = -1;
+    cache->free_head = -1;
+    cache->config_blocks = -1;
+    cache->config_policy = LC_CACHE_LRU;
+    return(cache);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lccache_destroy
+// Description  : Close and free a cache made by lccache_create
+//
+// Inputs       : cache - the cache
+// Outputs      : 0 if successful, -1 if failure (writing back the second tier)
+
+int lccache_destroy( LcCache *cache ) {
+    int ret = (cache->cache_array != NULL) ? lccache_close(cache) : 0;
+
+    free(cache->l2_path);
+    free(cache);
+    return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lccache_default
+// Description  : The cache the lcloud_ cache functions use
+//
+// Inputs       : none
+// Outputs      : the cache
+
+LcCache * lccache_default( void ) {
+    return(&default_cache);
+}
+
+//
+// The lcloud_ functions work on the default cache
+
+char * lcloud_getcache( LcDeviceId did, uint16_t sec, uint16_t blk ) {
+    return(lccache_get(&default_cache, did, sec, blk));
+}
+
+int lcloud_putcache( LcDeviceId did, uint16_t sec, uint16_t blk, char *block ) {
+    return(lccache_put(&default_cache, did, sec, blk, block));
+}
+
+int lcloud_initcache( int maxblocks ) {
+    return(lccache_init(&default_cache, maxblocks));
+}
+
+int lcloud_closecache( void ) {
+    return(lccache_close(&default_cache));
+}
+
+int lcloud_cache_configure( int maxblocks, LcCachePolicy policy ) {
+    return(lccache_configure(&default_cache, maxblocks, policy));
+}
+
+const char * lcloud_cache_policy_name( void ) {
+    return(lccache_policy_name(&default_cache));
+}
+
+void lcloud_cache_stats( LcCacheStats *stats ) {
+    lccache_stats(&default_cache, stats);
+}
+
+int lcloud_cache_l2_configure( const char *path, int maxblocks ) {
+    return(lccache_l2_configure(&default_cache, path, maxblocks));
+}
+
+void lcloud_cache_l2_owner( uint64_t owner ) {
+    lccache_l2_owner(&default_cache, owner);
+}
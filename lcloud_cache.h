@@ -11,21 +11,95 @@
 //   Last Modified : Thu 19 Mar 2020 09:27:55 AM EDT
 //
 
-// Includes 
+// Includes
 #include <stdint.h>
 #include <lcloud_controller.h>
 
-// Defines 
+// Defines
 #define LC_CACHE_MAXBLOCKS 64
+#define LC_CACHE_L2_BLOCKS 4096 // Default second tier capacity
+
+// Type definitions
+typedef enum {
+    LC_CACHE_LRU = 0, // Evict the least recently used block
+    LC_CACHE_FIFO = 1, // Evict the block inserted first
+    LC_CACHE_CLOCK = 2, // Second chance: sweep, clearing reference bits
+    LC_CACHE_MAX_POLICY = 3,
+} LcCachePolicy;
+
+typedef struct {
+    uint64_t hits; // Lookups that found the block
+    uint64_t misses; // Lookups that did not
+    uint64_t inserts; // Blocks added
+    uint64_t evictions; // Blocks evicted to make room
+    uint64_t l2_hits; // Lookups missing in memory found in the second tier
+    uint64_t l2_misses; // Lookups missing in both tiers
+    uint64_t demotions; // Evicted blocks moved to the second tier
+    uint64_t l2_evictions; // Blocks the second tier dropped to make room
+    uint64_t cold_inserts; // Blocks added as the next to evict (lccache_put_cold)
+} LcCacheStats;
+
+typedef struct LcCache LcCache; // A block cache (lcloud_cache.c)
 
 //
 // Functional Prototypes
 
+LcCache * lccache_create( void );
+    // Create a cache with the default configuration
+
+int lccache_destroy( LcCache *cache );
+    // Close and free a cache
+
+LcCache * lccache_default( void );
+    // The cache the lcloud_ functions below use
+
+char * lccache_get( LcCache *cache, LcDeviceId did, uint16_t sec, uint16_t blk );
+    // Search a cache for a block
+
+int lccache_holds( LcCache *cache, LcDeviceId did, uint16_t sec, uint16_t blk );
+    // Check for a block without counting a lookup or touching its recency
+
+int lccache_put( LcCache *cache, LcDeviceId did, uint16_t sec, uint16_t blk, char *block );
+    // Put a value in a cache
+
+int lccache_put_cold( LcCache *cache, LcDeviceId did, uint16_t sec, uint16_t blk, char *block );
+    // Put a value in a cache as the next block to evict
+
+int lccache_cool( LcCache *cache, LcDeviceId did, uint16_t sec, uint16_t blk );
+    // Make a cached block the next to evict
+
+int lccache_drop( LcCache *cache, LcDeviceId did, uint16_t sec, uint16_t blk );
+    // Take a block out of memory, freeing its slot
+
+int lccache_capacity( LcCache *cache );
+    // Blocks a cache holds in memory
+
+int lccache_init( LcCache *cache, int maxblocks );
+    // Set up a cache's slots (and open its second tier)
+
+int lccache_close( LcCache *cache );
+    // Release a cache's slots (writing back its second tier)
+
+int lccache_configure( LcCache *cache, int maxblocks, LcCachePolicy policy );
+    // Override the capacity (if >= 0) and policy used by the next lccache_init
+
+const char * lccache_policy_name( LcCache *cache );
+    // Name of a cache's configured policy
+
+void lccache_stats( LcCache *cache, LcCacheStats *stats );
+    // Counters since a cache was initialized
+
+int lccache_l2_configure( LcCache *cache, const char *path, int maxblocks );
+    // Back a cache with a second tier of maxblocks in a local file (NULL to stop)
+
+void lccache_l2_owner( LcCache *cache, uint64_t owner );
+    // Identify the device contents a cache's second tier holds blocks of
+
 char * lcloud_getcache( LcDeviceId did, uint16_t sec, uint16_t blk );
-    // Search the cache for a block 
+    // Search the cache for a block
 
 int lcloud_putcache( LcDeviceId did, uint16_t sec, uint16_t blk, char *block );
-    // Put a value in the cache 
+    // Put a value in the cache
 
 int lcloud_initcache( int maxblocks );
     // Initialze the cache by setting up metadata a cache elements.
@@ -33,4 +107,22 @@ int lcloud_initcache( int maxblocks );
 int lcloud_closecache( void );
     // Clean up the cache when program is closing.
 
+int lcloud_cache_configure( int maxblocks, LcCachePolicy policy );
+    // Override the capacity (if >= 0) and policy used by the next lcloud_initcache
+
+int lcloud_cache_policy( const char *name );
+    // Policy for a name ("lru", "fifo", "clock"), -1 if unknown
+
+const char * lcloud_cache_policy_name( void );
+    // Name of the configured policy
+
+void lcloud_cache_stats( LcCacheStats *stats );
+    // Counters since the cache was initialized
+
+int lcloud_cache_l2_configure( const char *path, int maxblocks );
+    // Back the cache with a second tier of maxblocks in a local file (NULL to stop)
+
+void lcloud_cache_l2_owner( uint64_t owner );
+    // Identify the device contents the second tier holds blocks of
+
 #endif
@@ -0,0 +1,2052 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_check.c
+//  Description    : This is the regression check harness for the filesystem
+//                   interface.  Each check drives a fresh filesystem instance
+//                   (lcctx_create) on in-process devices, keeps a model of
+//                   every file it writes and compares what the filesystem
+//                   reads back against it.  The checks that reload the
+//                   metadata checkpoint need a server whose devices keep
+//                   their contents (lcloud_simserver -m); they are skipped
+//                   unless one is given (lcloud_check.sh starts one).
+//
+//   Author        : Lucas Benning
+//   Last Modified : 4/30/20
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <pthread.h>
+
+// Project Includes
+#include <cmpsc311_log.h>
+#include <lcloud_support.h>
+#include <lcloud_filesys.h>
+#include <lcloud_network.h>
+#include <lcloud_cache.h>
+#include <lcloud_controller.h>
+#include <lcloud_fsinternal.h>
+#include <lcloud_trace.h>
+
+// Defines
+#define LC_CHECK_ARGUMENTS "hvt:m:f:"
+#define LC_CHECK_MANIFEST "workload/cmpsc311-assign4e-manifest.txt" // Devices of the in-process checks
+#define LC_CHECK_CACHE 8 // Cache capacity of a check's instance (its files outgrow it)
+#define LC_CHECK_MAX_FILE (64 * LC_DEVICE_BLOCK_SIZE) // Largest file a check models
+#define LC_CHECK_ASYNC_FILES 16 // Files the async checks queue operations on
+#define LC_CHECK_ADVISE_CACHE 64 // Cache capacity of the advice checks
+#define LC_CHECK_SCAN_BLOCKS 1000 // Blocks of the file the advice checks scan
+#define LC_CHECK_THREADS 4 // Threads of the concurrent instances check, one instance each
+#define LC_CHECK_THREAD_FILES 12 // Files each of them writes
+#define LC_CHECK_KEY "lcloud_check key" // Cipher key and IV of the reload checks (LCLOUD_CIPHER_KEYLEN each)
+#define LC_CHECK_IV "lcloud_check iv."
+#define LC_CHECK_L2_BLOCKS 64 // Second tier capacity of the warm restart check
+#define LC_CHECK_PREFETCH_FILES 16 // Files of the prefetcher check's repeated stream (twice the cache)
+#define LC_CHECK_PREFETCH_READS 2000 // Reads of its random stream
+#define USAGE                                                                         \
+    "USAGE: lcloud_check [-h] [-v] [-t <transport>] [-m <checkpoint>] [-f <filter>]\n" \
+    "\n"                                                                              \
+    "where:\n"                                                                        \
+    "    -h - help mode (display this message)\n"                                     \
+    "    -v - verbose output\n"                                                       \
+    "    -t - transport to a server keeping its device contents\n"                    \
+    "         (lcloud_simserver -m), for the checks that reload a checkpoint\n"       \
+    "    -m - metadata checkpoint those checks write (default lcloud_check.meta)\n"   \
+    "    -f - only run checks whose name contains <filter>\n"                         \
+    "\n"
+
+// Type definitions
+typedef struct {
+    const char *server; // Transport to a server keeping device contents, or NULL
+    const char *checkpoint; // Checkpoint of the reload checks
+    char why[256]; // Why the check in progress failed
+} LcCheck;
+
+typedef int (*LcCheckBody)( LcCheck *ck );
+
+typedef struct {
+    const char *name; // Check name (-f matches it)
+    LcCheckBody body; // The check, 0 if it passed
+    int persistent; // 1 if it needs the server keeping its devices (-t)
+} LcCheckEntry;
+
+typedef struct {
+    char data[LC_CHECK_MAX_FILE]; // What the file should hold
+    size_t size; // Its size
+} LcCheckModel;
+
+typedef struct {
+    LcCheck ck; // The thread's harness state (its own reason for failing)
+    int id; // Thread number
+    int result; // 0 if its part passed
+} LcCheckThread;
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ck_fail
+// Description  : Record why the check in progress failed
+//
+// Inputs       : ck - the harness state
+//                fmt - printf style format of the reason, followed by its arguments
+// Outputs      : -1 (the check's result)
+
+static int ck_fail( LcCheck *ck, const char *fmt, ... ) {
+    va_list args;
+
+    va_start(args, fmt);
+    vsnprintf(ck->why, sizeof(ck->why), fmt, args);
+    va_end(args);
+    return(-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ck_quiet
+// Description  : Silence (or restore) error messages around calls that are
+//                expected to fail
+//
+// Inputs       : quiet - 1 to silence, 0 to restore
+// Outputs      : none
+
+static void ck_quiet( int quiet ) {
+    if(quiet) {
+        disableLogLevels(LOG_ERROR_LEVEL);
+    } else {
+        enableLogLevels(LOG_ERROR_LEVEL);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ck_context
+// Description  : Create a filesystem instance for a check
+//
+// Inputs       : transport - the server transport
+//                cache - cache capacity in blocks
+// Outputs      : the instance, NULL if failure
+
+static LcContext * ck_context( const char *transport, int cache ) {
+    LcContext *ctx;
+
+    if((ctx = lcctx_create()) == NULL) return(NULL);
+    if(lcclient_set_transport(lcctx_client(ctx), transport) == -1 ||
+        lccache_configure(lcctx_cache(ctx), cache, LC_CACHE_LRU) == -1) {
+        lcctx_destroy(ctx);
+        return(NULL);
+    }
+    return(ctx);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ck_bus_ops
+// Description  : Block transfers an instance has made so far
+//
+// Inputs       : ctx - the instance
+// Outputs      : block reads plus block writes
+
+static uint64_t ck_bus_ops( LcContext *ctx ) {
+    LcClientStats stats;
+
+    lcclient_get_stats(lcctx_client(ctx), &stats);
+    return(stats.block_reads + stats.block_writes);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ck_round_trips
+// Description  : Exchanges with the server an instance has made so far
+//
+// Inputs       : ctx - the instance
+// Outputs      : round trips
+
+static uint64_t ck_round_trips( LcContext *ctx ) {
+    LcClientStats stats;
+
+    lcclient_get_stats(lcctx_client(ctx), &stats);
+    return(stats.round_trips);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ck_bus_reads
+// Description  : Block reads an instance has made so far
+//
+// Inputs       : ctx - the instance
+// Outputs      : the count
+
+static uint64_t ck_bus_reads( LcContext *ctx ) {
+    LcClientStats stats;
+
+    lcclient_get_stats(lcctx_client(ctx), &stats);
+    return(stats.block_reads);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ck_fill
+// Description  : Put new bytes in a range of a model (the bytes follow from seed, so
+//                two fills with one seed write the same data)
+//
+// Inputs       : model - the model
+//                off, len - the range (within LC_CHECK_MAX_FILE)
+//                seed - picks the data
+// Outputs      : the range's bytes in the model
+
+static char * ck_fill( LcCheckModel *model, size_t off, size_t len, uint32_t seed ) {
+    char *data = &model->data[off];
+
+    for(size_t i = 0; i < len; i++) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = (char) (seed >> 16);
+    }
+    if(off + len > model->size) model->size = off + len;
+    return(data);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ck_write
+// Description  : Write new bytes at an offset of an open file and of its model
+//
+// Inputs       : ck - the harness state
+//                ctx - the instance
+//                fh - the open file
+//                model - its model
+//                off, len - the range
+//                seed - picks the data
+// Outputs      : 0 if successful, -1 if failure
+
+static int ck_write( LcCheck *ck, LcContext *ctx, LcFHandle fh, LcCheckModel *model, size_t off, size_t len, uint32_t seed ) {
+    char *data;
+
+    if(off + len > LC_CHECK_MAX_FILE) return(ck_fail(ck, "write of %zu at %zu past the model", len, off));
+    data = ck_fill(model, off, len, seed);
+    if(lcseek_ctx(ctx, fh, off) == -1 || lcwrite_ctx(ctx, fh, data, len) != (int) len) {
+        return(ck_fail(ck, "write of %zu at %zu failed", len, off));
+    }
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ck_verify
+// Description  : Read a whole file back and compare it with its model (and the block
+//                after its end with zeros, which is what a read past the end gets)
+//
+// Inputs       : ck - the harness state
+//                ctx - the instance
+//                path - the file (closed, it is opened and closed again)
+//                model - what it should hold
+// Outputs      : 0 if it matches, -1 if not
+
+static int ck_verify( LcCheck *ck, LcContext *ctx, const char *path, LcCheckModel *model ) {
+    size_t len = model->size + LC_DEVICE_BLOCK_SIZE;
+    LcFHandle fh;
+    char *buf;
+    int got, ret = 0;
+
+    if((buf = malloc(len)) == NULL) return(ck_fail(ck, "out of memory"));
+    if((fh = lcopen_ctx(ctx, path)) == -1) {
+        free(buf);
+        return(ck_fail(ck, "cannot open %s", path));
+    }
+    lcseek_ctx(ctx, fh, 0);
+    got = lcread_ctx(ctx, fh, buf, len);
+    lcclose_ctx(ctx, fh);
+    if(got != (int) len) {
+        ret = ck_fail(ck, "read of %s failed", path);
+    }
+    for(size_t i = 0; ret == 0 && i < len; i++) {
+        if(buf[i] != ((i < model->size) ? model->data[i] : 0)) {
+            ret = ck_fail(ck, "%s differs at byte %zu (size %zu)", path, i, model->size);
+        }
+    }
+    free(buf);
+    return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : check_clone_diverge
+// Description  : A clone shares the source's blocks without moving data, and
+//                writes to either file after the clone leave the other alone
+//
+// Inputs       : ck - the harness state
+// Outputs      : 0 if the check passed, -1 if not
+
+static int check_clone_diverge( LcCheck *ck ) {
+    static LcCheckModel src, copy;
+    int caches[] = { 0, LC_CHECK_CACHE };
+    LcContext *ctx;
+    LcFsStats stats;
+    LcFHandle fs, fc;
+    uint64_t ops;
+    int ret, refused;
+
+    for(int c = 0; c < 2; c++) {
+        if((ctx = ck_context("shm:" LC_CHECK_MANIFEST, caches[c])) == NULL) return(ck_fail(ck, "no instance"));
+        memset(&src, 0, sizeof(src));
+        ret = -1;
+
+        // Ten blocks and a partial one, cloned while the source is open
+        if((fs = lcopen_ctx(ctx, "src")) == -1) {
+            ck_fail(ck, "cannot create src");
+            goto done;
+        }
+        if(ck_write(ck, ctx, fs, &src, 0, 10 * LC_DEVICE_BLOCK_SIZE + 100, 1) == -1) goto done;
+        ops = ck_bus_ops(ctx);
+        if(lcclone_ctx(ctx, "src", "copy") == -1) {
+            ck_fail(ck, "clone failed");
+            goto done;
+        }
+        if(ck_bus_ops(ctx) != ops) {
+            ck_fail(ck, "clone made %lu block transfers", (unsigned long) (ck_bus_ops(ctx) - ops));
+            goto done;
+        }
+        ck_quiet(1);
+        refused = (lcclone_ctx(ctx, "src", "copy") == -1 && lcclone_ctx(ctx, "none", "other") == -1);
+        ck_quiet(0);
+        if(!refused) {
+            ck_fail(ck, "clone onto an existing file or of a missing one succeeded");
+            goto done;
+        }
+        lcstats_ctx(ctx, &stats);
+        if(stats.blocks_cloned != 11) {
+            ck_fail(ck, "%lu blocks cloned, expected 11", (unsigned long) stats.blocks_cloned);
+            goto done;
+        }
+        copy = src;
+        if(ck_verify(ck, ctx, "copy", &copy) == -1) goto done;
+
+        // Partial and whole block writes to the copy, one past its end, a partial
+        // write to the source
+        if((fc = lcopen_ctx(ctx, "copy")) == -1) {
+            ck_fail(ck, "cannot open copy");
+            goto done;
+        }
+        if(ck_write(ck, ctx, fc, &copy, 300, 50, 2) == -1 ||
+            ck_write(ck, ctx, fc, &copy, 5 * LC_DEVICE_BLOCK_SIZE, LC_DEVICE_BLOCK_SIZE, 3) == -1 ||
+            ck_write(ck, ctx, fc, &copy, copy.size - 20, 600, 4) == -1 ||
+            ck_write(ck, ctx, fs, &src, 2 * LC_DEVICE_BLOCK_SIZE + 10, 20, 5) == -1) {
+            goto done;
+        }
+        lcclose_ctx(ctx, fc);
+        lcclose_ctx(ctx, fs);
+        if(ck_verify(ck, ctx, "src", &src) == -1 || ck_verify(ck, ctx, "copy", &copy) == -1) goto done;
+        lcstats_ctx(ctx, &stats);
+        if(stats.blocks_copied == 0) {
+            ck_fail(ck, "no shared block was copied");
+            goto done;
+        }
+        ret = 0;
+
+done:
+        if(lcctx_destroy(ctx) == -1 && ret == 0) ret = ck_fail(ck, "shutdown failed");
+        if(ret == -1) return(-1);
+    }
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : check_clone_packed
+// Description  : Cloning a file whose tail is packed into a shared block gives the
+//                copy a tail of its own
+//
+// Inputs       : ck - the harness state
+// Outputs      : 0 if the check passed, -1 if not
+
+static int check_clone_packed( LcCheck *ck ) {
+    static LcCheckModel small, tail, small2, tail2;
+    LcContext *ctx;
+    LcFsStats stats;
+    LcFHandle fs, ft, fs2, ft2;
+    int ret = -1;
+
+    if((ctx = ck_context("shm:" LC_CHECK_MANIFEST, LC_CHECK_CACHE)) == NULL) return(ck_fail(ck, "no instance"));
+    lcpack_ctx(ctx, 1);
+    memset(&small, 0, sizeof(small));
+    memset(&tail, 0, sizeof(tail));
+
+    // A file smaller than a block, and one with three blocks and a tail
+    if((fs = lcopen_ctx(ctx, "small")) == -1 || (ft = lcopen_ctx(ctx, "tail")) == -1) {
+        ck_fail(ck, "cannot create the files");
+        goto done;
+    }
+    if(ck_write(ck, ctx, fs, &small, 0, 100, 1) == -1 ||
+        ck_write(ck, ctx, ft, &tail, 0, 3 * LC_DEVICE_BLOCK_SIZE + 40, 2) == -1) {
+        goto done;
+    }
+    lcclose_ctx(ctx, fs);
+    lcclose_ctx(ctx, ft);
+    if(lcclone_ctx(ctx, "small", "small2") == -1 || lcclone_ctx(ctx, "tail", "tail2") == -1) {
+        ck_fail(ck, "clone failed");
+        goto done;
+    }
+    lcstats_ctx(ctx, &stats);
+    if(stats.blocks_cloned != 3) {
+        ck_fail(ck, "%lu blocks cloned, expected 3", (unsigned long) stats.blocks_cloned);
+        goto done;
+    }
+    small2 = small;
+    tail2 = tail;
+    if(ck_verify(ck, ctx, "small2", &small2) == -1 || ck_verify(ck, ctx, "tail2", &tail2) == -1) goto done;
+
+    // Write into each tail, and grow the copies
+    if((fs = lcopen_ctx(ctx, "small")) == -1 || (ft = lcopen_ctx(ctx, "tail")) == -1 ||
+        (fs2 = lcopen_ctx(ctx, "small2")) == -1 || (ft2 = lcopen_ctx(ctx, "tail2")) == -1) {
+        ck_fail(ck, "cannot open the files");
+        goto done;
+    }
+    if(ck_write(ck, ctx, fs2, &small2, 10, 20, 3) == -1 ||
+        ck_write(ck, ctx, ft2, &tail2, tail2.size, 20, 4) == -1 ||
+        ck_write(ck, ctx, fs, &small, 50, 70, 5) == -1 ||
+        ck_write(ck, ctx, ft, &tail, 3 * LC_DEVICE_BLOCK_SIZE, 10, 6) == -1 ||
+        ck_write(ck, ctx, fs2, &small2, 90, LC_DEVICE_BLOCK_SIZE, 7) == -1) {
+        goto done;
+    }
+    lcclose_ctx(ctx, fs);
+    lcclose_ctx(ctx, ft);
+    lcclose_ctx(ctx, fs2);
+    lcclose_ctx(ctx, ft2);
+    if(ck_verify(ck, ctx, "small", &small) == -1 || ck_verify(ck, ctx, "tail", &tail) == -1 ||
+        ck_verify(ck, ctx, "small2", &small2) == -1 || ck_verify(ck, ctx, "tail2", &tail2) == -1) {
+        goto done;
+    }
+    ret = 0;
+
+done:
+    if(lcctx_destroy(ctx) == -1 && ret == 0) ret = ck_fail(ck, "shutdown failed");
+    return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ck_file_holds
+// Description  : Look for some bytes in a file
+//
+// Inputs       : path - the file
+//                bytes, len - what to look for
+// Outputs      : 1 if the file holds them, 0 if not, -1 if it cannot be read
+
+static int ck_file_holds( const char *path, const char *bytes, size_t len ) {
+    char *data;
+    long size;
+    FILE *fp;
+    int found = 0;
+
+    if((fp = fopen(path, "rb")) == NULL) return(-1);
+    if(fseek(fp, 0, SEEK_END) == -1 || (size = ftell(fp)) < 0 || (data = malloc(size + 1)) == NULL) {
+        fclose(fp);
+        return(-1);
+    }
+    rewind(fp);
+    if(fread(data, 1, size, fp) != (size_t) size) size = 0;
+    fclose(fp);
+    for(long i = 0; !found && i + (long) len <= size; i++) {
+        found = (memcmp(&data[i], bytes, len) == 0);
+    }
+    free(data);
+    return(found);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : check_clone_reload
+// Description  : A clone reloaded from the checkpoint still shares its blocks
+//                with the source: after the reload, writes to either file copy
+//                the shared blocks instead of changing both files.  The
+//                checkpoint does not hold the cipher key, and refuses to load
+//                with another (a retry with the right one then works).
+//
+// Inputs       : ck - the harness state
+// Outputs      : 0 if the check passed, -1 if not
+
+static int check_clone_reload( LcCheck *ck ) {
+    static LcCheckModel src, copy;
+    LcContext *ctx = NULL;
+    LcFsStats stats;
+    LcFHandle fs, fc;
+    int ret = -1;
+
+    unlink(ck->checkpoint);
+    memset(&src, 0, sizeof(src));
+    for(int run = 0; run < 3; run++) {
+        if((ctx = ck_context(ck->server, LC_CHECK_CACHE)) == NULL) return(ck_fail(ck, "no instance"));
+        if(lcpersist_ctx(ctx, ck->checkpoint) == -1) {
+            ck_fail(ck, "cannot use checkpoint %s", ck->checkpoint);
+            goto done;
+        }
+        lcpack_ctx(ctx, 1);
+        if(run == 1) {
+            if(ck_file_holds(ck->checkpoint, LC_CHECK_KEY, LCLOUD_CIPHER_KEYLEN) != 0 ||
+                ck_file_holds(ck->checkpoint, LC_CHECK_IV, LCLOUD_CIPHER_KEYLEN) != 0) {
+                ck_fail(ck, "the checkpoint holds the cipher key");
+                goto done;
+            }
+            lcclient_set_cipher(lcctx_client(ctx), LC_CHECK_IV, LC_CHECK_KEY);
+            ck_quiet(1);
+            if(lcinit_ctx(ctx, NULL) != -1) {
+                ck_quiet(0);
+                ck_fail(ck, "the checkpoint loaded with another cipher key");
+                goto done;
+            }
+            ck_quiet(0);
+        }
+        lcclient_set_cipher(lcctx_client(ctx), LC_CHECK_KEY, LC_CHECK_IV);
+
+        switch(run) {
+        case 0: // Clone a file with a packed tail, then change the source
+            if((fs = lcopen_ctx(ctx, "src")) == -1) {
+                ck_fail(ck, "cannot create src");
+                goto done;
+            }
+            if(ck_write(ck, ctx, fs, &src, 0, 6 * LC_DEVICE_BLOCK_SIZE + 77, 1) == -1) goto done;
+            lcclose_ctx(ctx, fs);
+            if(lcclone_ctx(ctx, "src", "copy") == -1) {
+                ck_fail(ck, "clone failed");
+                goto done;
+            }
+            copy = src;
+            if((fs = lcopen_ctx(ctx, "src")) == -1) {
+                ck_fail(ck, "cannot open src");
+                goto done;
+            }
+            if(ck_write(ck, ctx, fs, &src, LC_DEVICE_BLOCK_SIZE + 5, 30, 2) == -1) goto done;
+            lcclose_ctx(ctx, fs);
+            break;
+
+        case 1: // Reloaded: both files, then writes to blocks they still share
+            if(ck_verify(ck, ctx, "copy", &copy) == -1 || ck_verify(ck, ctx, "src", &src) == -1) goto done;
+            if((fs = lcopen_ctx(ctx, "src")) == -1 || (fc = lcopen_ctx(ctx, "copy")) == -1) {
+                ck_fail(ck, "cannot open the reloaded files");
+                goto done;
+            }
+            if(ck_write(ck, ctx, fc, &copy, 3 * LC_DEVICE_BLOCK_SIZE + 8, 16, 3) == -1 ||
+                ck_write(ck, ctx, fs, &src, 4 * LC_DEVICE_BLOCK_SIZE, LC_DEVICE_BLOCK_SIZE, 4) == -1 ||
+                ck_write(ck, ctx, fc, &copy, 6 * LC_DEVICE_BLOCK_SIZE + 70, 20, 5) == -1) {
+                goto done;
+            }
+            lcclose_ctx(ctx, fs);
+            lcclose_ctx(ctx, fc);
+            lcstats_ctx(ctx, &stats);
+            if(stats.blocks_copied == 0) {
+                ck_fail(ck, "no shared block was copied after the reload");
+                goto done;
+            }
+            if(ck_verify(ck, ctx, "copy", &copy) == -1 || ck_verify(ck, ctx, "src", &src) == -1) goto done;
+            break;
+
+        default: // Reloaded again: the writes after the first reload held
+            if(ck_verify(ck, ctx, "copy", &copy) == -1 || ck_verify(ck, ctx, "src", &src) == -1) goto done;
+            break;
+        }
+        if(lcctx_destroy(ctx) == -1) {
+            ctx = NULL;
+            ck_fail(ck, "shutdown failed");
+            goto done;
+        }
+        ctx = NULL;
+    }
+    ret = 0;
+
+done:
+    if(ctx != NULL) lcctx_destroy(ctx);
+    unlink(ck->checkpoint);
+    return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : check_async_window
+// Description  : Operations queued together run in order, each seeing the ones
+//                before it, and post one completion each; reads queued together
+//                share bus batches, taking fewer round trips than reading in turn
+//
+// Inputs       : ck - the harness state
+// Outputs      : 0 if the check passed, -1 if not
+
+static int check_async_window( LcCheck *ck ) {
+    static LcCheckModel models[LC_CHECK_ASYNC_FILES];
+    LcCompletion cqes[4 * LC_CHECK_ASYNC_FILES];
+    LcAsyncToken tokens[4 * LC_CHECK_ASYNC_FILES];
+    char bufs[LC_CHECK_ASYNC_FILES][LC_DEVICE_BLOCK_SIZE], name[32];
+    LcFHandle fh[LC_CHECK_ASYNC_FILES];
+    LcContext *ctx;
+    uint64_t sync_trips, async_trips;
+    int n, got, ret = -1;
+
+    if((ctx = ck_context("shm:" LC_CHECK_MANIFEST, LC_CHECK_CACHE)) == NULL) return(ck_fail(ck, "no instance"));
+
+    // Files of three blocks, then a small read from each in turn
+    for(int f = 0; f < LC_CHECK_ASYNC_FILES; f++) {
+        snprintf(name, sizeof(name), "async%d", f);
+        memset(&models[f], 0, sizeof(models[f]));
+        if((fh[f] = lcopen_ctx(ctx, name)) == -1) {
+            ck_fail(ck, "cannot create %s", name);
+            goto done;
+        }
+        if(ck_write(ck, ctx, fh[f], &models[f], 0, 3 * LC_DEVICE_BLOCK_SIZE, f + 1) == -1) goto done;
+    }
+    sync_trips = ck_round_trips(ctx);
+    for(int f = 0; f < LC_CHECK_ASYNC_FILES; f++) {
+        lcseek_ctx(ctx, fh[f], 40);
+        lcread_ctx(ctx, fh[f], bufs[f], 100);
+    }
+    sync_trips = ck_round_trips(ctx) - sync_trips;
+
+    // The same reads one block on, queued together and run by lcwait
+    async_trips = ck_round_trips(ctx);
+    for(int f = 0; f < LC_CHECK_ASYNC_FILES; f++) {
+        if((tokens[f] = lcread_async_ctx(ctx, fh[f], LC_DEVICE_BLOCK_SIZE + 40, bufs[f], 100, &models[f])) == -1) {
+            ck_fail(ck, "cannot queue a read");
+            goto done;
+        }
+    }
+    for(got = 0; got < LC_CHECK_ASYNC_FILES; got += n) {
+        if((n = lcwait_ctx(ctx, &cqes[got], LC_CHECK_ASYNC_FILES - got, LC_CHECK_ASYNC_FILES - got)) <= 0) {
+            ck_fail(ck, "%d of %d reads completed", got, LC_CHECK_ASYNC_FILES);
+            goto done;
+        }
+    }
+    async_trips = ck_round_trips(ctx) - async_trips;
+    for(int f = 0; f < LC_CHECK_ASYNC_FILES; f++) {
+        if(cqes[f].token != tokens[f] || cqes[f].user != &models[f] || cqes[f].result != 100 ||
+            memcmp(bufs[f], &models[f].data[LC_DEVICE_BLOCK_SIZE + 40], 100) != 0) {
+            ck_fail(ck, "read %d completed wrong (result %d)", f, cqes[f].result);
+            goto done;
+        }
+    }
+    if(async_trips >= sync_trips) {
+        ck_fail(ck, "queued reads took %lu round trips, reading in turn %lu",
+            (unsigned long) async_trips, (unsigned long) sync_trips);
+        goto done;
+    }
+
+    // Per file: a partial write, a read across it, a whole block write and a write
+    // at the file position (where the whole block write left it), run by lcsubmit
+    n = 0;
+    for(int f = 0; f < LC_CHECK_ASYNC_FILES; f++) {
+        tokens[n++] = lcwrite_async_ctx(ctx, fh[f], 100, ck_fill(&models[f], 100, 50, 100 + f), 50, NULL);
+        tokens[n++] = lcread_async_ctx(ctx, fh[f], 80, bufs[f], 170, &models[f]);
+        tokens[n++] = lcwrite_async_ctx(ctx, fh[f], LC_DEVICE_BLOCK_SIZE,
+            ck_fill(&models[f], LC_DEVICE_BLOCK_SIZE, LC_DEVICE_BLOCK_SIZE, 200 + f), LC_DEVICE_BLOCK_SIZE, NULL);
+        tokens[n++] = lcwrite_async_ctx(ctx, fh[f], LC_ASYNC_POS, ck_fill(&models[f], 2 * LC_DEVICE_BLOCK_SIZE, 10, 300 + f), 10, NULL);
+        if(tokens[n - 4] == -1 || tokens[n - 3] == -1 || tokens[n - 2] == -1 || tokens[n - 1] == -1) {
+            ck_fail(ck, "cannot queue the operations");
+            goto done;
+        }
+    }
+    if(lcpoll_ctx(ctx, cqes, n) != 0) {
+        ck_fail(ck, "completions posted before lcsubmit");
+        goto done;
+    }
+    if(lcsubmit_ctx(ctx) != n) {
+        ck_fail(ck, "lcsubmit did not run the %d operations", n);
+        goto done;
+    }
+    if((got = lcpoll_ctx(ctx, cqes, n)) != n) {
+        ck_fail(ck, "%d of %d operations completed", got, n);
+        goto done;
+    }
+    for(int i = 0; i < n; i++) {
+        LcCheckModel *model = (LcCheckModel *) cqes[i].user;
+        if(cqes[i].token != tokens[i] || cqes[i].result == -1) {
+            ck_fail(ck, "operation %d completed wrong (result %d)", i, cqes[i].result);
+            goto done;
+        }
+        if(model != NULL && memcmp(bufs[model - models], &model->data[80], 170) != 0) {
+            ck_fail(ck, "read %d did not see the write queued before it", i);
+            goto done;
+        }
+    }
+    for(int f = 0; f < LC_CHECK_ASYNC_FILES; f++) {
+        lcclose_ctx(ctx, fh[f]);
+        snprintf(name, sizeof(name), "async%d", f);
+        if(ck_verify(ck, ctx, name, &models[f]) == -1) goto done;
+    }
+    ret = 0;
+
+done:
+    if(lcctx_destroy(ctx) == -1 && ret == 0) ret = ck_fail(ck, "shutdown failed");
+    return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : check_async_edges
+// Description  : An operation on a closed file is refused (or fails, if the file
+//                closes while it is queued), and operations larger than the
+//                staging area still complete
+//
+// Inputs       : ck - the harness state
+// Outputs      : 0 if the check passed, -1 if not
+
+static int check_async_edges( LcCheck *ck ) {
+    size_t big = (LC_ASYNC_STAGE_BLOCKS + 300) * LC_DEVICE_BLOCK_SIZE + 17;
+    char *wbuf = NULL, *rbuf = NULL, small[16];
+    LcCompletion cqes[2];
+    LcContext *ctx;
+    LcFHandle fa, fb, fbig;
+    LcAsyncToken refused;
+    int ret = -1;
+
+    if((ctx = ck_context("shm:" LC_CHECK_MANIFEST, LC_CHECK_CACHE)) == NULL) return(ck_fail(ck, "no instance"));
+    if((wbuf = malloc(big)) == NULL || (rbuf = malloc(big)) == NULL) {
+        ck_fail(ck, "out of memory");
+        goto done;
+    }
+    if((fa = lcopen_ctx(ctx, "a")) == -1 || (fb = lcopen_ctx(ctx, "b")) == -1 || (fbig = lcopen_ctx(ctx, "big")) == -1) {
+        ck_fail(ck, "cannot create the files");
+        goto done;
+    }
+
+    // Closed before queueing, and closed while queued
+    lcclose_ctx(ctx, fa);
+    ck_quiet(1);
+    refused = lcread_async_ctx(ctx, fa, 0, small, sizeof(small), NULL);
+    ck_quiet(0);
+    if(refused != -1) {
+        ck_fail(ck, "a read of a closed file was queued");
+        goto done;
+    }
+    if(lcread_async_ctx(ctx, fb, 0, small, sizeof(small), NULL) == -1) {
+        ck_fail(ck, "cannot queue a read");
+        goto done;
+    }
+    lcclose_ctx(ctx, fb);
+    ck_quiet(1);
+    if(lcwait_ctx(ctx, cqes, 1, 1) != 1 || cqes[0].result != -1) {
+        ck_quiet(0);
+        ck_fail(ck, "a read of a file closed while it was queued did not fail");
+        goto done;
+    }
+    ck_quiet(0);
+
+    // A write and a read of more blocks than a window stages
+    for(size_t i = 0; i < big; i++) {
+        wbuf[i] = (char) (i * 31 + i / 4096);
+    }
+    if(lcwrite_async_ctx(ctx, fbig, 0, wbuf, big, NULL) == -1 || lcread_async_ctx(ctx, fbig, 0, rbuf, big, NULL) == -1) {
+        ck_fail(ck, "cannot queue the large operations");
+        goto done;
+    }
+    if(lcwait_ctx(ctx, cqes, 2, 2) != 2 || cqes[0].result != (int) big || cqes[1].result != (int) big) {
+        ck_fail(ck, "large operations did not complete");
+        goto done;
+    }
+    if(memcmp(wbuf, rbuf, big) != 0) {
+        ck_fail(ck, "large read did not return the large write");
+        goto done;
+    }
+    ret = 0;
+
+done:
+    free(wbuf);
+    free(rbuf);
+    if(lcctx_destroy(ctx) == -1 && ret == 0) ret = ck_fail(ck, "shutdown failed");
+    return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ck_scan_byte
+// Description  : Byte of the advice checks' large file at an offset
+//
+// Inputs       : off - the offset
+// Outputs      : the byte
+
+static char ck_scan_byte( size_t off ) {
+    return((char) (off * 13 + off / LC_DEVICE_BLOCK_SIZE));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ck_advise_run
+// Description  : Read a small hot file over and over while scanning through a large
+//                file given some advice, checking the data, and count what the reads
+//                cost
+//
+// Inputs       : ck - the harness state
+//                advice - the advice for the large file
+//                bus - (output) block transfers of the reads
+//                trips - (output) round trips of the reads
+// Outputs      : 0 if successful, -1 if failure
+
+static int ck_advise_run( LcCheck *ck, LcAdvice advice, uint64_t *bus, uint64_t *trips ) {
+    static LcCheckModel hot;
+    static char scan[LC_CHECK_SCAN_BLOCKS * LC_DEVICE_BLOCK_SIZE];
+    char buf[LC_DEVICE_BLOCK_SIZE];
+    LcContext *ctx;
+    LcFHandle fh, fs;
+    size_t pos = 0;
+    int ret = -1;
+
+    if((ctx = ck_context("shm:" LC_CHECK_MANIFEST, LC_CHECK_ADVISE_CACHE)) == NULL) return(ck_fail(ck, "no instance"));
+    memset(&hot, 0, sizeof(hot));
+    for(size_t i = 0; i < sizeof(scan); i++) {
+        scan[i] = ck_scan_byte(i);
+    }
+    if((fh = lcopen_ctx(ctx, "hot")) == -1 || (fs = lcopen_ctx(ctx, "scan")) == -1) {
+        ck_fail(ck, "cannot create the files");
+        goto done;
+    }
+    if(ck_write(ck, ctx, fh, &hot, 0, LC_CHECK_ADVISE_CACHE / 2 * LC_DEVICE_BLOCK_SIZE, 1) == -1) goto done;
+    if(lcwrite_ctx(ctx, fs, scan, sizeof(scan)) != (int) sizeof(scan) || lcadvise_ctx(ctx, fs, 0, 0, advice) == -1) {
+        ck_fail(ck, "cannot set up the large file");
+        goto done;
+    }
+
+    // Rounds of the whole hot file and the next stretch of the large one
+    *bus = ck_bus_ops(ctx);
+    *trips = ck_round_trips(ctx);
+    lcseek_ctx(ctx, fs, 0);
+    for(int round = 0; round < 20; round++) {
+        lcseek_ctx(ctx, fh, 0);
+        for(size_t off = 0; off < hot.size; off += LC_DEVICE_BLOCK_SIZE) {
+            if(lcread_ctx(ctx, fh, buf, LC_DEVICE_BLOCK_SIZE) == -1 || memcmp(buf, &hot.data[off], LC_DEVICE_BLOCK_SIZE) != 0) {
+                ck_fail(ck, "hot file differs at byte %zu", off);
+                goto done;
+            }
+        }
+        for(int k = 0; k < 50; k++, pos += LC_DEVICE_BLOCK_SIZE) {
+            if(lcread_ctx(ctx, fs, buf, LC_DEVICE_BLOCK_SIZE) == -1 || memcmp(buf, &scan[pos], LC_DEVICE_BLOCK_SIZE) != 0) {
+                ck_fail(ck, "large file differs at byte %zu", pos);
+                goto done;
+            }
+        }
+    }
+    *bus = ck_bus_ops(ctx) - *bus;
+    *trips = ck_round_trips(ctx) - *trips;
+    ret = 0;
+
+done:
+    if(lcctx_destroy(ctx) == -1 && ret == 0) ret = ck_fail(ck, "shutdown failed");
+    return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : check_advise_noreuse
+// Description  : A large file read once with NOREUSE advice does not push a small
+//                hot file out of the cache
+//
+// Inputs       : ck - the harness state
+// Outputs      : 0 if the check passed, -1 if not
+
+static int check_advise_noreuse( LcCheck *ck ) {
+    uint64_t bus, trips, bus_noreuse, trips_noreuse;
+
+    if(ck_advise_run(ck, LC_ADV_NORMAL, &bus, &trips) == -1 ||
+        ck_advise_run(ck, LC_ADV_NOREUSE, &bus_noreuse, &trips_noreuse) == -1) {
+        return(-1);
+    }
+    if(bus_noreuse >= bus) {
+        return(ck_fail(ck, "%lu block transfers with NOREUSE, %lu without",
+            (unsigned long) bus_noreuse, (unsigned long) bus));
+    }
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : check_advise_sequential
+// Description  : Reading a file with SEQUENTIAL advice reads ahead, taking fewer
+//                round trips
+//
+// Inputs       : ck - the harness state
+// Outputs      : 0 if the check passed, -1 if not
+
+static int check_advise_sequential( LcCheck *ck ) {
+    uint64_t bus, trips, bus_seq, trips_seq;
+
+    if(ck_advise_run(ck, LC_ADV_NORMAL, &bus, &trips) == -1 ||
+        ck_advise_run(ck, LC_ADV_SEQUENTIAL, &bus_seq, &trips_seq) == -1) {
+        return(-1);
+    }
+    if(trips_seq >= trips) {
+        return(ck_fail(ck, "%lu round trips with SEQUENTIAL, %lu without",
+            (unsigned long) trips_seq, (unsigned long) trips));
+    }
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : check_advise_cache
+// Description  : WILLNEED brings a range into the cache in the round trip of
+//                its first read, DONTNEED takes a range's blocks out of it (under
+//                CLOCK too), and advice for a closed file or of an unknown kind is
+//                refused
+//
+// Inputs       : ck - the harness state
+// Outputs      : 0 if the check passed, -1 if not
+
+static int check_advise_cache( LcCheck *ck ) {
+    static LcCheckModel models[3];
+    const char *names[3] = { "x", "y", "z" };
+    char buf[LC_DEVICE_BLOCK_SIZE];
+    LcFHandle fh[3];
+    LcContext *ctx;
+    uint64_t ops, trips;
+    size_t len = LC_CHECK_ADVISE_CACHE / 2 * LC_DEVICE_BLOCK_SIZE;
+    int ret = -1, refused, held;
+
+    if((ctx = ck_context("shm:" LC_CHECK_MANIFEST, LC_CHECK_ADVISE_CACHE)) == NULL) return(ck_fail(ck, "no instance"));
+
+    // Three files of half the cache each, written with the cache then emptied
+    for(int f = 0; f < 3; f++) {
+        memset(&models[f], 0, sizeof(models[f]));
+        if((fh[f] = lcopen_ctx(ctx, names[f])) == -1) {
+            ck_fail(ck, "cannot create %s", names[f]);
+            goto done;
+        }
+        if(ck_write(ck, ctx, fh[f], &models[f], 0, len, f + 1) == -1) goto done;
+    }
+    if(lccache_configure(lcctx_cache(ctx), LC_CHECK_ADVISE_CACHE, LC_CACHE_LRU) == -1) {
+        ck_fail(ck, "cannot empty the cache");
+        goto done;
+    }
+
+    // WILLNEED x waits for nothing, then reading it takes the first read's round trip
+    ops = ck_bus_ops(ctx);
+    if(lcadvise_ctx(ctx, fh[0], 0, 0, LC_ADV_WILLNEED) == -1 || ck_bus_ops(ctx) != ops) {
+        ck_fail(ck, "WILLNEED failed or went to the devices itself");
+        goto done;
+    }
+    trips = ck_round_trips(ctx);
+    lcseek_ctx(ctx, fh[0], 0);
+    for(size_t off = 0; off < len; off += LC_DEVICE_BLOCK_SIZE) {
+        if(lcread_ctx(ctx, fh[0], buf, LC_DEVICE_BLOCK_SIZE) == -1 || memcmp(buf, &models[0].data[off], LC_DEVICE_BLOCK_SIZE) != 0) {
+            ck_fail(ck, "x differs at byte %zu after WILLNEED", off);
+            goto done;
+        }
+    }
+    if(ck_round_trips(ctx) - trips != 1) {
+        ck_fail(ck, "reading x after WILLNEED took %lu round trips", (unsigned long) (ck_round_trips(ctx) - trips));
+        goto done;
+    }
+
+    // Read y after x, DONTNEED y: reading z then evicts y, not x (the older one)
+    lcseek_ctx(ctx, fh[1], 0);
+    lcseek_ctx(ctx, fh[2], 0);
+    for(size_t off = 0; off < len; off += LC_DEVICE_BLOCK_SIZE) {
+        lcread_ctx(ctx, fh[1], buf, LC_DEVICE_BLOCK_SIZE);
+    }
+    if(lcadvise_ctx(ctx, fh[1], 0, 0, LC_ADV_DONTNEED) == -1) {
+        ck_fail(ck, "DONTNEED failed");
+        goto done;
+    }
+    for(size_t off = 0; off < len; off += LC_DEVICE_BLOCK_SIZE) {
+        lcread_ctx(ctx, fh[2], buf, LC_DEVICE_BLOCK_SIZE);
+    }
+    ops = ck_bus_ops(ctx);
+    lcseek_ctx(ctx, fh[0], 0);
+    for(size_t off = 0; off < len; off += LC_DEVICE_BLOCK_SIZE) {
+        lcread_ctx(ctx, fh[0], buf, LC_DEVICE_BLOCK_SIZE);
+    }
+    if(ck_bus_ops(ctx) != ops) {
+        ck_fail(ck, "x was evicted though y was DONTNEED");
+        goto done;
+    }
+
+    // Under CLOCK, DONTNEED leaves none of y cached
+    lccache_configure(lcctx_cache(ctx), LC_CHECK_ADVISE_CACHE, LC_CACHE_CLOCK);
+    lcseek_ctx(ctx, fh[1], 0);
+    for(size_t off = 0; off < len; off += LC_DEVICE_BLOCK_SIZE) {
+        lcread_ctx(ctx, fh[1], buf, LC_DEVICE_BLOCK_SIZE);
+    }
+    lcadvise_ctx(ctx, fh[1], 0, 0, LC_ADV_DONTNEED);
+    held = 0;
+    for(uint32_t b = 0; b < ctx->files[fh[1]].num_blocks; b++) {
+        LcBlock *blk = &ctx->files[fh[1]].blocks[b];
+        held += lccache_holds(lcctx_cache(ctx), blk->dev, blk->sec, blk->blk);
+    }
+    if(held > 0) {
+        ck_fail(ck, "%d blocks of y still cached after DONTNEED under CLOCK", held);
+        goto done;
+    }
+
+    // Refused advice
+    lcclose_ctx(ctx, fh[2]);
+    ck_quiet(1);
+    refused = (lcadvise_ctx(ctx, fh[2], 0, 0, LC_ADV_WILLNEED) == -1 && lcadvise_ctx(ctx, fh[0], 0, 0, (LcAdvice) 99) == -1);
+    ck_quiet(0);
+    if(!refused) {
+        ck_fail(ck, "advice for a closed file or of an unknown kind was taken");
+        goto done;
+    }
+    ret = 0;
+
+done:
+    if(lcctx_destroy(ctx) == -1 && ret == 0) ret = ck_fail(ck, "shutdown failed");
+    return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ck_runs
+// Description  : Physically contiguous runs of device blocks a file range maps to
+//
+// Inputs       : ctx - the instance
+//                fh - the open file
+//                len - the range (from the start of the file)
+// Outputs      : the runs, -1 if failure
+
+static int ck_runs( LcContext *ctx, LcFHandle fh, size_t len ) {
+    LcIoPlan plan;
+    int runs;
+
+    memset(&plan, 0, sizeof(plan));
+    runs = (plan_io(ctx, &ctx->files[fh], 0, len, &plan) == -1) ? -1 : (int) plan.num_runs;
+    free(plan.segs);
+    free(plan.runs);
+    return(runs);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : check_fallocate_extent
+// Description  : Files opened with a size hint or reserved with lcfallocate stay
+//                on one run of device blocks while written in turn with others
+//
+// Inputs       : ck - the harness state
+// Outputs      : 0 if the check passed, -1 if not
+
+static int check_fallocate_extent( LcCheck *ck ) {
+    static LcCheckModel models[4];
+    const char *names[4] = { "hint1", "hint2", "reserved", "plain" };
+    size_t len = 60 * LC_DEVICE_BLOCK_SIZE + 100;
+    LcFHandle fh[4];
+    LcContext *ctx;
+    int runs[4], ret = -1;
+
+    if((ctx = ck_context("shm:" LC_CHECK_MANIFEST, LC_CHECK_CACHE)) == NULL) return(ck_fail(ck, "no instance"));
+
+    // Two files with a hint, one reserved after it is opened, one neither
+    for(int f = 0; f < 4; f++) {
+        memset(&models[f], 0, sizeof(models[f]));
+        fh[f] = (f < 2) ? lcopen_hint_ctx(ctx, names[f], len) : lcopen_ctx(ctx, names[f]);
+        if(fh[f] == -1 || (f == 2 && lcfallocate_ctx(ctx, fh[f], 0, len) == -1)) {
+            ck_fail(ck, "cannot create %s", names[f]);
+            goto done;
+        }
+    }
+
+    // Written a thousand bytes at a time, in turn
+    for(size_t off = 0; off < len; off += 1000) {
+        for(int f = 0; f < 4; f++) {
+            if(ck_write(ck, ctx, fh[f], &models[f], off, (len - off < 1000) ? len - off : 1000, off + f) == -1) goto done;
+        }
+    }
+    for(int f = 0; f < 4; f++) {
+        if((runs[f] = ck_runs(ctx, fh[f], len)) == -1) {
+            ck_fail(ck, "cannot plan %s", names[f]);
+            goto done;
+        }
+        lcclose_ctx(ctx, fh[f]);
+        if(ck_verify(ck, ctx, names[f], &models[f]) == -1) goto done;
+    }
+    if(runs[0] != 1 || runs[1] != 1 || runs[2] != 1 || runs[3] == 1) {
+        ck_fail(ck, "runs of the hinted, reserved and plain files: %d %d %d %d", runs[0], runs[1], runs[2], runs[3]);
+        goto done;
+    }
+    ret = 0;
+
+done:
+    if(lcctx_destroy(ctx) == -1 && ret == 0) ret = ck_fail(ck, "shutdown failed");
+    return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : check_fallocate_reserved
+// Description  : Reserved blocks read as zeros until written, even where the
+//                devices hold an earlier run's data, and partial writes into them
+//                leave the rest zero; reserving written blocks keeps their data
+//
+// Inputs       : ck - the harness state
+// Outputs      : 0 if the check passed, -1 if not
+
+static int check_fallocate_reserved( LcCheck *ck ) {
+    static LcCheckModel junk, file;
+    LcContext *ctx = NULL;
+    LcFHandle fh;
+    int ret = -1;
+
+    // Leave data on the device blocks a new instance hands out first
+    if((ctx = ck_context(ck->server, LC_CHECK_CACHE)) == NULL) return(ck_fail(ck, "no instance"));
+    memset(&junk, 0, sizeof(junk));
+    if((fh = lcopen_ctx(ctx, "junk")) == -1) {
+        ck_fail(ck, "cannot create junk");
+        goto done;
+    }
+    if(ck_write(ck, ctx, fh, &junk, 0, LC_CHECK_MAX_FILE, 1) == -1) goto done;
+    if(lcctx_destroy(ctx) == -1) {
+        ctx = NULL;
+        ck_fail(ck, "shutdown failed");
+        goto done;
+    }
+
+    // A written block, reserved blocks after it, partial writes into some of them
+    if((ctx = ck_context(ck->server, LC_CHECK_CACHE)) == NULL) return(ck_fail(ck, "no instance"));
+    memset(&file, 0, sizeof(file));
+    if((fh = lcopen_ctx(ctx, "file")) == -1) {
+        ck_fail(ck, "cannot create file");
+        goto done;
+    }
+    if(ck_write(ck, ctx, fh, &file, 0, 300, 2) == -1) goto done;
+    ck_quiet(1);
+    if(lcfallocate_ctx(ctx, fh + 1, 0, 100) != -1) {
+        ck_quiet(0);
+        ck_fail(ck, "reserved blocks for a file that is not open");
+        goto done;
+    }
+    ck_quiet(0);
+    if(lcfallocate_ctx(ctx, fh, 0, 40 * LC_DEVICE_BLOCK_SIZE) == -1) {
+        ck_fail(ck, "lcfallocate failed");
+        goto done;
+    }
+    if(ck_write(ck, ctx, fh, &file, 7 * LC_DEVICE_BLOCK_SIZE + 50, 3, 3) == -1 ||
+        ck_write(ck, ctx, fh, &file, 20 * LC_DEVICE_BLOCK_SIZE + 200, 100, 4) == -1 ||
+        ck_write(ck, ctx, fh, &file, 39 * LC_DEVICE_BLOCK_SIZE, 10, 5) == -1) {
+        goto done;
+    }
+    lcclose_ctx(ctx, fh);
+    if(ck_verify(ck, ctx, "file", &file) == -1) goto done;
+    ret = 0;
+
+done:
+    if(ctx != NULL && lcctx_destroy(ctx) == -1 && ret == 0) ret = ck_fail(ck, "shutdown failed");
+    return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ck_owner
+// Description  : Find which of some files a device block belongs to
+//
+// Inputs       : ctx - the instance
+//                fh - the open files
+//                n - number of files
+//                rec - a bus record of the block
+// Outputs      : its file's index in fh, -1 if none
+
+static int ck_owner( LcContext *ctx, LcFHandle *fh, int n, const LcTraceRec *rec ) {
+    for(int f = 0; f < n; f++) {
+        LcFile *file = &ctx->files[fh[f]];
+        for(uint32_t b = 0; b < file->num_blocks; b++) {
+            if(file->blocks[b].dev == rec->dev && file->blocks[b].sec == rec->sec && file->blocks[b].blk == rec->blk) {
+                return(f);
+            }
+        }
+    }
+    return(-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : check_sched_writeback
+// Description  : The writeback of an async window is held until something else
+//                goes to the devices; then the demand reads go first and the
+//                writeback of two files takes turns on the devices (traced on
+//                the default instance, the one the block trace follows)
+//
+// Inputs       : ck - the harness state
+// Outputs      : 0 if the check passed, -1 if not
+
+static int check_sched_writeback( LcCheck *ck ) {
+    static LcCheckModel models[3];
+    LcContext *ctx = lcctx_default();
+    size_t len = 32 * LC_DEVICE_BLOCK_SIZE;
+    char buf[4 * LC_DEVICE_BLOCK_SIZE], name[32], path[256];
+    LcCompletion cqes[2];
+    LcFHandle fh[3];
+    LcTrace tr;
+    uint64_t ops;
+    int traced = 0, reads = 0, writes = 0, first_half[2] = { 0, 0 }, ret = -1;
+
+    snprintf(path, sizeof(path), "%s.trace", ck->checkpoint);
+    memset(&tr, 0, sizeof(tr));
+    if(client_set_transport("shm:" LC_CHECK_MANIFEST) == -1 || lcloud_cache_configure(LC_CHECK_CACHE, LC_CACHE_LRU) == -1) {
+        return(ck_fail(ck, "no instance"));
+    }
+
+    // A file written now, then two written by one async window
+    for(int f = 0; f < 3; f++) {
+        snprintf(name, sizeof(name), "wb%d", f);
+        memset(&models[f], 0, sizeof(models[f]));
+        if((fh[f] = lcopen_ctx(ctx, name)) == -1) {
+            ck_fail(ck, "cannot create %s", name);
+            goto done;
+        }
+    }
+    if(ck_write(ck, ctx, fh[2], &models[2], 0, 8 * LC_DEVICE_BLOCK_SIZE, 3) == -1) goto done;
+    for(int f = 0; f < 2; f++) {
+        if(lcwrite_async_ctx(ctx, fh[f], 0, ck_fill(&models[f], 0, len, f + 1), len, NULL) == -1) {
+            ck_fail(ck, "cannot queue a write");
+            goto done;
+        }
+    }
+    ops = ck_bus_ops(ctx);
+    if(lcsubmit_ctx(ctx) != 2 || lcpoll_ctx(ctx, cqes, 2) != 2 || cqes[0].result != (int) len || cqes[1].result != (int) len) {
+        ck_fail(ck, "the async writes did not complete");
+        goto done;
+    }
+    if(ck_bus_ops(ctx) != ops) {
+        ck_fail(ck, "the writeback went to the devices on its own");
+        goto done;
+    }
+
+    // A read of the first file takes the writeback along, behind it
+    if(lcloud_trace_start(path) == -1) {
+        ck_fail(ck, "cannot trace to %s", path);
+        goto done;
+    }
+    traced = 1;
+    lcseek_ctx(ctx, fh[2], 0);
+    if(lcread_ctx(ctx, fh[2], buf, sizeof(buf)) != (int) sizeof(buf) || memcmp(buf, models[2].data, sizeof(buf)) != 0) {
+        ck_fail(ck, "read with the writeback held went wrong");
+        goto done;
+    }
+    traced = 0;
+    if(lcloud_trace_stop() == -1 || lcloud_trace_open(&tr, path) == -1) {
+        ck_fail(ck, "cannot read the trace back");
+        goto done;
+    }
+    for(uint64_t r = 0; r < tr.num_recs; r++) {
+        if(tr.recs[r].kind != LC_TRACE_BUS) continue;
+        if(tr.recs[r].op == LC_XFER_READ) {
+            if(writes > 0) {
+                ck_fail(ck, "a read went behind %d writeback blocks", writes);
+                goto done;
+            }
+            reads++;
+            continue;
+        }
+        int f = ck_owner(ctx, fh, 2, &tr.recs[r]);
+        if(f == -1) {
+            ck_fail(ck, "wrote a block neither file holds");
+            goto done;
+        }
+        if(writes++ < 32) first_half[f]++;
+    }
+    if(reads == 0 || writes != 64) {
+        ck_fail(ck, "%d reads and %d writeback blocks went with the read (want some and 64)", reads, writes);
+        goto done;
+    }
+    if(first_half[0] == 0 || first_half[1] == 0) {
+        ck_fail(ck, "one file's writeback went ahead of the other's (%d and %d of the first 32 blocks)",
+            first_half[0], first_half[1]);
+        goto done;
+    }
+    for(int f = 0; f < 3; f++) {
+        lcclose_ctx(ctx, fh[f]);
+        snprintf(name, sizeof(name), "wb%d", f);
+        if(ck_verify(ck, ctx, name, &models[f]) == -1) goto done;
+    }
+    ret = 0;
+
+done:
+    if(traced) lcloud_trace_stop();
+    lcloud_trace_close(&tr);
+    unlink(path);
+    if(lcshutdown() == -1 && ret == 0) ret = ck_fail(ck, "shutdown of the default instance failed");
+    return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : check_ctx_independent
+// Description  : Instances, the default one included, keep their own files,
+//                devices, cache and counters: the same file names in each hold
+//                different data
+//
+// Inputs       : ck - the harness state
+// Outputs      : 0 if the check passed, -1 if not
+
+static int check_ctx_independent( LcCheck *ck ) {
+    static LcCheckModel models[3];
+    LcContext *ctxs[3] = { NULL, NULL, lcctx_default() };
+    LcFHandle fh[3];
+    LcFsStats stats;
+    int caches[3] = { 0, LC_CHECK_CACHE, 64 }, ret = -1;
+
+    if((ctxs[0] = ck_context("shm:" LC_CHECK_MANIFEST, caches[0])) == NULL ||
+        (ctxs[1] = ck_context("shm:" LC_CHECK_MANIFEST, caches[1])) == NULL ||
+        client_set_transport("shm:" LC_CHECK_MANIFEST) == -1 || lcloud_cache_configure(caches[2], LC_CACHE_LRU) == -1) {
+        ck_fail(ck, "no instance");
+        goto done;
+    }
+
+    // One file name in each instance, written in turn (the default one through
+    // the functions without a context)
+    for(int c = 0; c < 3; c++) {
+        memset(&models[c], 0, sizeof(models[c]));
+        fh[c] = (c == 2) ? lcopen("shared") : lcopen_ctx(ctxs[c], "shared");
+        if(fh[c] == -1) {
+            ck_fail(ck, "cannot create the file in instance %d", c);
+            goto done;
+        }
+    }
+    for(size_t off = 0; off < 40 * LC_DEVICE_BLOCK_SIZE; off += 700) {
+        for(int c = 0; c < 3; c++) {
+            if(ck_write(ck, ctxs[c], fh[c], &models[c], off, 700, off * 3 + c) == -1) goto done;
+        }
+    }
+    for(int c = 0; c < 3; c++) {
+        if(((c == 2) ? lcclose(fh[c]) : lcclose_ctx(ctxs[c], fh[c])) == -1 || ck_verify(ck, ctxs[c], "shared", &models[c]) == -1) {
+            goto done;
+        }
+        lcstats_ctx(ctxs[c], &stats);
+        if(stats.blocks_written == 0 || lccache_capacity(lcctx_cache(ctxs[c])) != caches[c]) {
+            ck_fail(ck, "instance %d has another's counters or cache", c);
+            goto done;
+        }
+    }
+    ret = 0;
+
+done:
+    for(int c = 0; c < 2; c++) {
+        if(ctxs[c] != NULL && lcctx_destroy(ctxs[c]) == -1 && ret == 0) ret = ck_fail(ck, "shutdown failed");
+    }
+    if(lcshutdown() == -1 && ret == 0) ret = ck_fail(ck, "shutdown of the default instance failed");
+    return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ck_thread
+// Description  : One thread of the concurrent instances check: write files on an
+//                instance of its own and read them back
+//
+// Inputs       : arg - the thread's LcCheckThread
+// Outputs      : NULL
+
+static void * ck_thread( void *arg ) {
+    LcCheckThread *t = (LcCheckThread *) arg;
+    LcCheckModel *models;
+    LcContext *ctx;
+    LcFHandle fh;
+    char name[32];
+
+    t->result = -1;
+    if((models = calloc(LC_CHECK_THREAD_FILES, sizeof(LcCheckModel))) == NULL) {
+        ck_fail(&t->ck, "out of memory");
+        return(NULL);
+    }
+    if((ctx = ck_context("shm:" LC_CHECK_MANIFEST, LC_CHECK_CACHE + t->id)) == NULL) {
+        ck_fail(&t->ck, "no instance");
+        free(models);
+        return(NULL);
+    }
+    for(int f = 0; f < LC_CHECK_THREAD_FILES; f++) {
+        snprintf(name, sizeof(name), "f%d", f);
+        if((fh = lcopen_ctx(ctx, name)) == -1) {
+            ck_fail(&t->ck, "thread %d cannot create %s", t->id, name);
+            goto done;
+        }
+        for(size_t off = 0; off < 20 * LC_DEVICE_BLOCK_SIZE; off += 500) {
+            if(ck_write(&t->ck, ctx, fh, &models[f], off, 500, (t->id << 16) + off + f) == -1) goto done;
+        }
+        lcclose_ctx(ctx, fh);
+    }
+    for(int f = 0; f < LC_CHECK_THREAD_FILES; f++) {
+        snprintf(name, sizeof(name), "f%d", f);
+        if(ck_verify(&t->ck, ctx, name, &models[f]) == -1) goto done;
+    }
+    t->result = 0;
+
+done:
+    if(lcctx_destroy(ctx) == -1 && t->result == 0) t->result = ck_fail(&t->ck, "thread %d shutdown failed", t->id);
+    free(models);
+    return(NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : check_ctx_threads
+// Description  : Instances used from several threads at once do not disturb
+//                each other
+//
+// Inputs       : ck - the harness state
+// Outputs      : 0 if the check passed, -1 if not
+
+static int check_ctx_threads( LcCheck *ck ) {
+    LcCheckThread threads[LC_CHECK_THREADS];
+    pthread_t tids[LC_CHECK_THREADS];
+    int started = 0, ret = 0;
+
+    memset(threads, 0, sizeof(threads));
+    for(; started < LC_CHECK_THREADS; started++) {
+        threads[started].id = started;
+        if(pthread_create(&tids[started], NULL, ck_thread, &threads[started]) != 0) {
+            ret = ck_fail(ck, "cannot start thread %d", started);
+            break;
+        }
+    }
+    for(int i = 0; i < started; i++) {
+        pthread_join(tids[i], NULL);
+        if(threads[i].result == -1 && ret == 0) {
+            memcpy(ck->why, threads[i].ck.why, sizeof(ck->why));
+            ret = -1;
+        }
+    }
+    return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : check_io_boundary
+// Description  : Reads and writes ending exactly on a 1024 byte boundary, and one
+//                byte past it, move the right bytes and read only the device
+//                blocks they touch (whole blocks written are not read first)
+//
+// Inputs       : ck - the harness state
+// Outputs      : 0 if the check passed, -1 if not
+
+static int check_io_boundary( LcCheck *ck ) {
+    static LcCheckModel model;
+    static const struct { size_t off, len; uint64_t reads; } rd[] = {
+        { 0, 1024, 4 }, { 0, 1025, 5 }, { 512, 512, 2 }, { 512, 513, 3 }, { 1023, 1, 1 }, { 1023, 2, 2 } };
+    static const struct { size_t off, len; uint64_t reads; } wr[] = {
+        { 0, 1024, 0 }, { 256, 768, 0 }, { 0, 1025, 1 }, { 512, 513, 1 }, { 1023, 2, 2 }, { 2048, 1024, 0 }, { 3072, 1025, 0 } };
+    char buf[1025 + 16];
+    LcContext *ctx;
+    LcFHandle fh;
+    uint64_t reads;
+    int ret = -1;
+
+    // No cache, so every block a read touches comes from the devices
+    if((ctx = ck_context("shm:" LC_CHECK_MANIFEST, 0)) == NULL) return(ck_fail(ck, "no instance"));
+    memset(&model, 0, sizeof(model));
+    if((fh = lcopen_ctx(ctx, "edges")) == -1) {
+        ck_fail(ck, "cannot create edges");
+        goto done;
+    }
+    if(ck_write(ck, ctx, fh, &model, 0, 2048, 1) == -1) goto done;
+
+    // Reads, with the bytes after the range left alone
+    for(size_t i = 0; i < sizeof(rd) / sizeof(rd[0]); i++) {
+        memset(buf, 0x5a, sizeof(buf));
+        reads = ck_bus_reads(ctx);
+        if(lcseek_ctx(ctx, fh, rd[i].off) == -1 || lcread_ctx(ctx, fh, buf, rd[i].len) != (int) rd[i].len ||
+            memcmp(buf, &model.data[rd[i].off], rd[i].len) != 0) {
+            ck_fail(ck, "read of %zu at %zu differs", rd[i].len, rd[i].off);
+            goto done;
+        }
+        for(size_t b = rd[i].len; b < sizeof(buf); b++) {
+            if(buf[b] != 0x5a) {
+                ck_fail(ck, "read of %zu at %zu wrote byte %zu of the buffer", rd[i].len, rd[i].off, b);
+                goto done;
+            }
+        }
+        if(ck_bus_reads(ctx) - reads != rd[i].reads) {
+            ck_fail(ck, "read of %zu at %zu read %lu blocks, expected %lu", rd[i].len, rd[i].off,
+                (unsigned long) (ck_bus_reads(ctx) - reads), (unsigned long) rd[i].reads);
+            goto done;
+        }
+    }
+
+    // Writes, inside the file and growing it
+    for(size_t i = 0; i < sizeof(wr) / sizeof(wr[0]); i++) {
+        reads = ck_bus_reads(ctx);
+        if(ck_write(ck, ctx, fh, &model, wr[i].off, wr[i].len, 10 + i) == -1) goto done;
+        if(ck_bus_reads(ctx) - reads != wr[i].reads) {
+            ck_fail(ck, "write of %zu at %zu read %lu blocks, expected %lu", wr[i].len, wr[i].off,
+                (unsigned long) (ck_bus_reads(ctx) - reads), (unsigned long) wr[i].reads);
+            goto done;
+        }
+    }
+    lcclose_ctx(ctx, fh);
+    if(ck_verify(ck, ctx, "edges", &model) == -1) goto done;
+    ret = 0;
+
+done:
+    if(lcctx_destroy(ctx) == -1 && ret == 0) ret = ck_fail(ck, "shutdown failed");
+    return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : check_write_elide
+// Description  : Rewriting a file's bytes as they are sends nothing to the devices
+//                and counts the blocks as elided; changing one byte is written
+//
+// Inputs       : ck - the harness state
+// Outputs      : 0 if the check passed, -1 if not
+
+static int check_write_elide( LcCheck *ck ) {
+    static LcCheckModel model;
+    LcFsStats before, after;
+    LcContext *ctx;
+    LcFHandle fh;
+    uint64_t ops;
+    int ret = -1;
+
+    // Four blocks, all of them in the cache
+    if((ctx = ck_context("shm:" LC_CHECK_MANIFEST, LC_CHECK_CACHE)) == NULL) return(ck_fail(ck, "no instance"));
+    memset(&model, 0, sizeof(model));
+    if((fh = lcopen_ctx(ctx, "same")) == -1) {
+        ck_fail(ck, "cannot create same");
+        goto done;
+    }
+    if(ck_write(ck, ctx, fh, &model, 0, 4 * LC_DEVICE_BLOCK_SIZE, 1) == -1) goto done;
+
+    // The same bytes again, whole blocks then part of one
+    lcstats_ctx(ctx, &before);
+    ops = ck_bus_ops(ctx);
+    if(ck_write(ck, ctx, fh, &model, 0, 4 * LC_DEVICE_BLOCK_SIZE, 1) == -1 ||
+        lcseek_ctx(ctx, fh, 300) == -1 || lcwrite_ctx(ctx, fh, &model.data[300], 50) != 50) {
+        ck_fail(ck, "rewrite failed");
+        goto done;
+    }
+    lcstats_ctx(ctx, &after);
+    if(ck_bus_ops(ctx) != ops || after.writes_elided - before.writes_elided != 5 || after.blocks_written != before.blocks_written) {
+        ck_fail(ck, "rewriting the same bytes made %lu block transfers, %lu elided, %lu written",
+            (unsigned long) (ck_bus_ops(ctx) - ops), (unsigned long) (after.writes_elided - before.writes_elided),
+            (unsigned long) (after.blocks_written - before.blocks_written));
+        goto done;
+    }
+
+    // One byte changed is written, and only its block
+    model.data[2 * LC_DEVICE_BLOCK_SIZE + 7] ^= 1;
+    before = after;
+    ops = ck_bus_ops(ctx);
+    if(lcseek_ctx(ctx, fh, 2 * LC_DEVICE_BLOCK_SIZE) == -1 ||
+        lcwrite_ctx(ctx, fh, &model.data[2 * LC_DEVICE_BLOCK_SIZE], LC_DEVICE_BLOCK_SIZE) != LC_DEVICE_BLOCK_SIZE) {
+        ck_fail(ck, "write of the changed byte failed");
+        goto done;
+    }
+    lcstats_ctx(ctx, &after);
+    if(ck_bus_ops(ctx) - ops != 1 || after.writes_elided != before.writes_elided || after.blocks_written - before.blocks_written != 1) {
+        ck_fail(ck, "changing one byte made %lu block transfers, %lu elided, %lu written",
+            (unsigned long) (ck_bus_ops(ctx) - ops), (unsigned long) (after.writes_elided - before.writes_elided),
+            (unsigned long) (after.blocks_written - before.blocks_written));
+        goto done;
+    }
+    lcclose_ctx(ctx, fh);
+    if(ck_verify(ck, ctx, "same", &model) == -1) goto done;
+    ret = 0;
+
+done:
+    if(lcctx_destroy(ctx) == -1 && ret == 0) ret = ck_fail(ck, "shutdown failed");
+    return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : check_dedup_share
+// Description  : Two files' identical blocks share one device block, written
+//                over in one file it stays in the other, and the device block
+//                goes to the free list when the last file block leaves it
+//
+// Inputs       : ck - the harness state
+// Outputs      : 0 if the check passed, -1 if not
+
+static int check_dedup_share( LcCheck *ck ) {
+    static LcCheckModel a, b;
+    LcContext *ctx;
+    LcFHandle fa, fb;
+    LcBlock shared;
+    uint32_t nfree;
+    int ret = -1;
+
+    if((ctx = ck_context("shm:" LC_CHECK_MANIFEST, LC_CHECK_CACHE)) == NULL) return(ck_fail(ck, "no instance"));
+    memset(&a, 0, sizeof(a));
+    memset(&b, 0, sizeof(b));
+    lcdedup_ctx(ctx, 1);
+
+    // The first blocks of a and b hold the same bytes, their second ones do not
+    if((fa = lcopen_ctx(ctx, "a")) == -1 || (fb = lcopen_ctx(ctx, "b")) == -1) {
+        ck_fail(ck, "cannot create a and b");
+        goto done;
+    }
+    if(ck_write(ck, ctx, fa, &a, 0, LC_DEVICE_BLOCK_SIZE, 1) == -1 ||
+        ck_write(ck, ctx, fa, &a, LC_DEVICE_BLOCK_SIZE, LC_DEVICE_BLOCK_SIZE, 2) == -1 ||
+        ck_write(ck, ctx, fb, &b, 0, LC_DEVICE_BLOCK_SIZE, 1) == -1 ||
+        ck_write(ck, ctx, fb, &b, LC_DEVICE_BLOCK_SIZE, LC_DEVICE_BLOCK_SIZE, 3) == -1) {
+        goto done;
+    }
+    shared = ctx->files[fb].blocks[0];
+    if(memcmp(&ctx->files[fa].blocks[0], &shared, sizeof(LcBlock)) != 0 || lcloud_dedup_refs(ctx, &shared) != 2) {
+        ck_fail(ck, "identical blocks do not share a device block (%u references)", lcloud_dedup_refs(ctx, &shared));
+        goto done;
+    }
+
+    // Writing over a's copy leaves b's
+    if(ck_write(ck, ctx, fa, &a, 0, LC_DEVICE_BLOCK_SIZE, 4) == -1) goto done;
+    if(memcmp(&ctx->files[fb].blocks[0], &shared, sizeof(LcBlock)) != 0 ||
+        memcmp(&ctx->files[fa].blocks[0], &shared, sizeof(LcBlock)) == 0 || lcloud_dedup_refs(ctx, &shared) != 1) {
+        ck_fail(ck, "writing over a shared block did not give a its own");
+        goto done;
+    }
+    lcclose_ctx(ctx, fa);
+    lcclose_ctx(ctx, fb);
+    if(ck_verify(ck, ctx, "a", &a) == -1 || ck_verify(ck, ctx, "b", &b) == -1) goto done;
+
+    // b's block takes the contents of a's second: the device block it leaves is free
+    nfree = ctx->free_nblks;
+    if((fb = lcopen_ctx(ctx, "b")) == -1) {
+        ck_fail(ck, "cannot open b");
+        goto done;
+    }
+    memcpy(b.data, &a.data[LC_DEVICE_BLOCK_SIZE], LC_DEVICE_BLOCK_SIZE);
+    if(lcseek_ctx(ctx, fb, 0) == -1 || lcwrite_ctx(ctx, fb, b.data, LC_DEVICE_BLOCK_SIZE) != LC_DEVICE_BLOCK_SIZE) {
+        ck_fail(ck, "write to b failed");
+        goto done;
+    }
+    if(memcmp(&ctx->files[fb].blocks[0], &ctx->files[fa].blocks[1], sizeof(LcBlock)) != 0 || ctx->free_nblks != nfree + 1 ||
+        ctx->free_blks[nfree].dev != shared.dev || ctx->free_blks[nfree].sec != shared.sec || ctx->free_blks[nfree].blk != shared.blk) {
+        ck_fail(ck, "the device block no file maps any more is not on the free list");
+        goto done;
+    }
+    lcclose_ctx(ctx, fb);
+    if(ck_verify(ck, ctx, "a", &a) == -1 || ck_verify(ck, ctx, "b", &b) == -1) goto done;
+    ret = 0;
+
+done:
+    if(lcctx_destroy(ctx) == -1 && ret == 0) ret = ck_fail(ck, "shutdown failed");
+    return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : check_cache_warm
+// Description  : A second tier closed cleanly serves the next run's reads
+//                without going to the devices, and one written under another
+//                cipher key (other device contents) is ignored
+//
+// Inputs       : ck - the harness state
+// Outputs      : 0 if the check passed, -1 if not
+
+static int check_cache_warm( LcCheck *ck ) {
+    static LcCheckModel model;
+    char l2[256], buf[LC_DEVICE_BLOCK_SIZE];
+    LcBlock blks[2 * LC_CHECK_CACHE];
+    LcContext *ctx = NULL;
+    LcCacheStats cs;
+    LcFHandle fh;
+    uint64_t reads;
+    int ret = -1, held;
+
+    snprintf(l2, sizeof(l2), "%s.l2", ck->checkpoint);
+    unlink(ck->checkpoint);
+    unlink(l2);
+    memset(&model, 0, sizeof(model));
+    for(int run = 0; run < 3; run++) {
+        if((ctx = ck_context(ck->server, LC_CHECK_CACHE)) == NULL) return(ck_fail(ck, "no instance"));
+        if(lccache_l2_configure(lcctx_cache(ctx), l2, LC_CHECK_L2_BLOCKS) == -1) {
+            ck_fail(ck, "cannot configure the second tier");
+            goto done;
+        }
+
+        // The last run has other device contents (another key, no checkpoint)
+        if(run < 2) {
+            lcclient_set_cipher(lcctx_client(ctx), LC_CHECK_KEY, LC_CHECK_IV);
+            if(lcpersist_ctx(ctx, ck->checkpoint) == -1) {
+                ck_fail(ck, "cannot use checkpoint %s", ck->checkpoint);
+                goto done;
+            }
+        } else {
+            lcclient_set_cipher(lcctx_client(ctx), LC_CHECK_IV, LC_CHECK_KEY);
+        }
+        if(lcinit_ctx(ctx, NULL) == -1) {
+            ck_fail(ck, "power on %d failed", run);
+            goto done;
+        }
+
+        switch(run) {
+        case 0: // Twice the memory tier's blocks, all of them in the second tier at shutdown
+            if((fh = lcopen_ctx(ctx, "warm")) == -1) {
+                ck_fail(ck, "cannot create warm");
+                goto done;
+            }
+            if(ck_write(ck, ctx, fh, &model, 0, 2 * LC_CHECK_CACHE * LC_DEVICE_BLOCK_SIZE, 1) == -1) goto done;
+            lcclose_ctx(ctx, fh);
+            break;
+
+        case 1: // Same key: every block comes from the second tier
+            if((fh = lcopen_ctx(ctx, "warm")) == -1) {
+                ck_fail(ck, "cannot open warm");
+                goto done;
+            }
+            reads = ck_bus_reads(ctx);
+            for(size_t off = 0; off < model.size; off += LC_DEVICE_BLOCK_SIZE) {
+                if(lcread_ctx(ctx, fh, buf, LC_DEVICE_BLOCK_SIZE) == -1 || memcmp(buf, &model.data[off], LC_DEVICE_BLOCK_SIZE) != 0) {
+                    ck_fail(ck, "warm differs at byte %zu after the restart", off);
+                    goto done;
+                }
+            }
+            lccache_stats(lcctx_cache(ctx), &cs);
+            if(ck_bus_reads(ctx) != reads || cs.l2_hits != 2 * LC_CHECK_CACHE) {
+                ck_fail(ck, "warm restart read %lu blocks from the devices, %lu from the second tier",
+                    (unsigned long) (ck_bus_reads(ctx) - reads), (unsigned long) cs.l2_hits);
+                goto done;
+            }
+            memcpy(blks, ctx->files[fh].blocks, sizeof(blks));
+            lcclose_ctx(ctx, fh);
+            break;
+
+        default: // Another key: the second tier starts empty
+            held = 0;
+            for(int b = 0; b < 2 * LC_CHECK_CACHE; b++) {
+                held += lccache_holds(lcctx_cache(ctx), blks[b].dev, blks[b].sec, blks[b].blk);
+            }
+            if(held > 0) {
+                ck_fail(ck, "%d blocks kept in a second tier written under another key", held);
+                goto done;
+            }
+            break;
+        }
+        if(lcctx_destroy(ctx) == -1) {
+            ctx = NULL;
+            ck_fail(ck, "shutdown failed");
+            goto done;
+        }
+        ctx = NULL;
+    }
+    ret = 0;
+
+done:
+    if(ctx != NULL) lcctx_destroy(ctx);
+    unlink(ck->checkpoint);
+    unlink(l2);
+    return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : check_io_sparse
+// Description  : A write after a seek past the end leaves a hole that takes no
+//                device blocks and reads as zeros without going to the devices
+//
+// Inputs       : ck - the harness state
+// Outputs      : 0 if the check passed, -1 if not
+
+static int check_io_sparse( LcCheck *ck ) {
+    static LcCheckModel model;
+    static char buf[LC_CHECK_MAX_FILE];
+    LcContext *ctx;
+    LcFHandle fh;
+    uint64_t reads;
+    int ret = -1, holes = 0;
+
+    // No cache, so every block with data is read from the devices
+    if((ctx = ck_context("shm:" LC_CHECK_MANIFEST, 0)) == NULL) return(ck_fail(ck, "no instance"));
+    memset(&model, 0, sizeof(model));
+    if((fh = lcopen_ctx(ctx, "sparse")) == -1) {
+        ck_fail(ck, "cannot create sparse");
+        goto done;
+    }
+
+    // 100 bytes, then 100 more from the middle of block 10
+    if(ck_write(ck, ctx, fh, &model, 0, 100, 1) == -1 ||
+        ck_write(ck, ctx, fh, &model, 10 * LC_DEVICE_BLOCK_SIZE + 50, 100, 2) == -1) {
+        goto done;
+    }
+    for(uint32_t b = 0; b < ctx->files[fh].num_blocks; b++) {
+        holes += (ctx->files[fh].blocks[b].dev == LC_BLOCK_HOLE);
+    }
+    if(ctx->files[fh].size != model.size || holes != 9) {
+        ck_fail(ck, "size %zu with %d holes, expected %zu with 9", ctx->files[fh].size, holes, model.size);
+        goto done;
+    }
+
+    // Reading it all only reads the two blocks written
+    reads = ck_bus_reads(ctx);
+    if(lcseek_ctx(ctx, fh, 0) == -1 || lcread_ctx(ctx, fh, buf, model.size) != (int) model.size ||
+        memcmp(buf, model.data, model.size) != 0) {
+        ck_fail(ck, "sparse differs from its model");
+        goto done;
+    }
+    if(ck_bus_reads(ctx) - reads != 2) {
+        ck_fail(ck, "reading sparse read %lu blocks, expected 2", (unsigned long) (ck_bus_reads(ctx) - reads));
+        goto done;
+    }
+
+    // Filling part of the hole takes a block for it alone
+    if(ck_write(ck, ctx, fh, &model, 5 * LC_DEVICE_BLOCK_SIZE + 10, 20, 3) == -1) goto done;
+    if(ctx->files[fh].blocks[5].dev == LC_BLOCK_HOLE || ctx->files[fh].blocks[4].dev != LC_BLOCK_HOLE ||
+        ctx->files[fh].blocks[6].dev != LC_BLOCK_HOLE) {
+        ck_fail(ck, "a write into the hole took other blocks than its own");
+        goto done;
+    }
+    lcclose_ctx(ctx, fh);
+    if(ck_verify(ck, ctx, "sparse", &model) == -1) goto done;
+    ret = 0;
+
+done:
+    if(lcctx_destroy(ctx) == -1 && ret == 0) ret = ck_fail(ck, "shutdown failed");
+    return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ck_same_block
+// Description  : Whether two file blocks are stored in the same device block
+//
+// Inputs       : a, b - the blocks
+// Outputs      : 1 if they are, 0 if not
+
+static int ck_same_block( LcBlock *a, LcBlock *b ) {
+    return(a->dev == b->dev && a->sec == b->sec && a->blk == b->blk);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : check_pack_grow
+// Description  : Small files are packed into one device block, and growing two
+//                of them past their fragments moves them without touching the
+//                third (whose block the freed fragments are reused in)
+//
+// Inputs       : ck - the harness state
+// Outputs      : 0 if the check passed, -1 if not
+
+static int check_pack_grow( LcCheck *ck ) {
+    static LcCheckModel m1, m2, m3;
+    LcContext *ctx;
+    LcFHandle f1, f2, f3;
+    LcBlock was;
+    int ret = -1;
+
+    // No cache, so every read comes from the devices
+    if((ctx = ck_context("shm:" LC_CHECK_MANIFEST, 0)) == NULL) return(ck_fail(ck, "no instance"));
+    memset(&m1, 0, sizeof(m1));
+    memset(&m2, 0, sizeof(m2));
+    memset(&m3, 0, sizeof(m3));
+    lcpack_ctx(ctx, 1);
+    if((f1 = lcopen_ctx(ctx, "small1")) == -1 || (f2 = lcopen_ctx(ctx, "small2")) == -1 || (f3 = lcopen_ctx(ctx, "small3")) == -1) {
+        ck_fail(ck, "cannot create the small files");
+        goto done;
+    }
+    if(ck_write(ck, ctx, f1, &m1, 0, 100, 1) == -1 || ck_write(ck, ctx, f2, &m2, 0, 60, 2) == -1 ||
+        ck_write(ck, ctx, f3, &m3, 0, 40, 5) == -1) {
+        goto done;
+    }
+    lcclose_ctx(ctx, f3);
+    if(ctx->files[f1].blocks[0].frag_len == 0 || ctx->files[f2].blocks[0].frag_len == 0 ||
+        !ck_same_block(&ctx->files[f1].blocks[0], &ctx->files[f2].blocks[0]) ||
+        !ck_same_block(&ctx->files[f1].blocks[0], &ctx->files[f3].blocks[0])) {
+        ck_fail(ck, "the small files are not packed into one device block");
+        goto done;
+    }
+
+    // small1 outgrows its fragment (small2 was packed after it, so it moves)
+    was = ctx->files[f2].blocks[0];
+    if(ck_write(ck, ctx, f1, &m1, 100, 100, 3) == -1) goto done;
+    if(ctx->files[f1].blocks[0].frag_len < 200 || memcmp(&ctx->files[f2].blocks[0], &was, sizeof(LcBlock)) != 0) {
+        ck_fail(ck, "growing small1 left it in its fragment or moved small2");
+        goto done;
+    }
+    lcclose_ctx(ctx, f1);
+    lcclose_ctx(ctx, f2);
+    if(ck_verify(ck, ctx, "small1", &m1) == -1 || ck_verify(ck, ctx, "small2", &m2) == -1) goto done;
+
+    // small2 outgrows a device block: a block of its own and a packed tail
+    if((f1 = lcopen_ctx(ctx, "small1")) == -1 || (f2 = lcopen_ctx(ctx, "small2")) == -1) {
+        ck_fail(ck, "cannot open small1 and small2");
+        goto done;
+    }
+    if(ck_write(ck, ctx, f2, &m2, 60, 240, 4) == -1) goto done;
+    if(ctx->files[f2].blocks[0].frag_len != 0 || ctx->files[f2].blocks[1].frag_len == 0) {
+        ck_fail(ck, "small2 grown past a block is not a whole block and a packed tail");
+        goto done;
+    }
+    lcclose_ctx(ctx, f1);
+    lcclose_ctx(ctx, f2);
+    if(ck_verify(ck, ctx, "small1", &m1) == -1 || ck_verify(ck, ctx, "small2", &m2) == -1 ||
+        ck_verify(ck, ctx, "small3", &m3) == -1) {
+        goto done;
+    }
+    ret = 0;
+
+done:
+    if(lcctx_destroy(ctx) == -1 && ret == 0) ret = ck_fail(ck, "shutdown failed");
+    return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : check_prefetch_stream
+// Description  : The prefetcher's predictions pay off on a stream of files read
+//                again and again in the same order, and a random stream throttles
+//                it down to fetching nothing
+//
+// Inputs       : ck - the harness state
+// Outputs      : 0 if the check passed, -1 if not
+
+static int check_prefetch_stream( LcCheck *ck ) {
+    static LcCheckModel models[LC_CHECK_PREFETCH_FILES], scan;
+    char buf[LC_DEVICE_BLOCK_SIZE], name[32];
+    LcFHandle fh[LC_CHECK_PREFETCH_FILES], fs;
+    LcPrefetchStats ps;
+    LcContext *ctx;
+    uint32_t seed = 1;
+    int ret = -1;
+
+    if((ctx = ck_context("shm:" LC_CHECK_MANIFEST, LC_CHECK_CACHE)) == NULL) return(ck_fail(ck, "no instance"));
+    if(lcprefetch_ctx(ctx, LC_PREFETCH_DEGREE) == -1) {
+        ck_fail(ck, "cannot turn the prefetcher on");
+        goto done;
+    }
+
+    // One block files, read in the same order a few times (they do not all fit the cache)
+    for(int f = 0; f < LC_CHECK_PREFETCH_FILES; f++) {
+        snprintf(name, sizeof(name), "stream%d", f);
+        memset(&models[f], 0, sizeof(models[f]));
+        if((fh[f] = lcopen_ctx(ctx, name)) == -1) {
+            ck_fail(ck, "cannot create %s", name);
+            goto done;
+        }
+        if(ck_write(ck, ctx, fh[f], &models[f], 0, LC_DEVICE_BLOCK_SIZE, f + 1) == -1) goto done;
+    }
+    for(int pass = 0; pass < 6; pass++) {
+        for(int f = 0; f < LC_CHECK_PREFETCH_FILES; f++) {
+            if(lcseek_ctx(ctx, fh[f], 0) == -1 || lcread_ctx(ctx, fh[f], buf, LC_DEVICE_BLOCK_SIZE) == -1 ||
+                memcmp(buf, models[f].data, LC_DEVICE_BLOCK_SIZE) != 0) {
+                ck_fail(ck, "stream%d differs on pass %d", f, pass);
+                goto done;
+            }
+        }
+    }
+    lcprefetch_stats_ctx(ctx, &ps);
+    if(ps.useful < ps.issued / 2 || ps.useful == 0 || ps.degree != LC_PREFETCH_DEGREE) {
+        ck_fail(ck, "repeated stream: %lu of %lu predictions useful, degree %d", (unsigned long) ps.useful,
+            (unsigned long) ps.issued, ps.degree);
+        goto done;
+    }
+
+    // Blocks of one file read in random order
+    memset(&scan, 0, sizeof(scan));
+    if((fs = lcopen_ctx(ctx, "random")) == -1) {
+        ck_fail(ck, "cannot create random");
+        goto done;
+    }
+    if(ck_write(ck, ctx, fs, &scan, 0, LC_CHECK_MAX_FILE, 99) == -1) goto done;
+    for(int r = 0; r < LC_CHECK_PREFETCH_READS; r++) {
+        seed = seed * 1103515245 + 12345;
+        size_t off = (size_t) ((seed >> 16) % (LC_CHECK_MAX_FILE / LC_DEVICE_BLOCK_SIZE)) * LC_DEVICE_BLOCK_SIZE;
+        if(lcseek_ctx(ctx, fs, off) == -1 || lcread_ctx(ctx, fs, buf, LC_DEVICE_BLOCK_SIZE) == -1 ||
+            memcmp(buf, &scan.data[off], LC_DEVICE_BLOCK_SIZE) != 0) {
+            ck_fail(ck, "random differs at byte %zu", off);
+            goto done;
+        }
+    }
+    lcprefetch_stats_ctx(ctx, &ps);
+    if(ps.degree != 0 || ps.throttles == 0) {
+        ck_fail(ck, "random stream left the prefetch degree at %d", ps.degree);
+        goto done;
+    }
+    ret = 0;
+
+done:
+    if(lcctx_destroy(ctx) == -1 && ret == 0) ret = ck_fail(ck, "shutdown failed");
+    return(ret);
+}
+
+// The checks, in the order they run
+LcCheckEntry checks[] = {
+    { "io/boundary", check_io_boundary, 0 },
+    { "io/sparse", check_io_sparse, 0 },
+    { "pack/grow", check_pack_grow, 0 },
+    { "write/elide", check_write_elide, 0 },
+    { "dedup/share", check_dedup_share, 0 },
+    { "cache/warm", check_cache_warm, 1 },
+    { "prefetch/stream", check_prefetch_stream, 0 },
+    { "clone/diverge", check_clone_diverge, 0 },
+    { "clone/packed-tail", check_clone_packed, 0 },
+    { "clone/reload", check_clone_reload, 1 },
+    { "async/window", check_async_window, 0 },
+    { "async/edges", check_async_edges, 0 },
+    { "advise/noreuse", check_advise_noreuse, 0 },
+    { "advise/sequential", check_advise_sequential, 0 },
+    { "advise/cache", check_advise_cache, 0 },
+    { "fallocate/extent", check_fallocate_extent, 0 },
+    { "fallocate/reserved", check_fallocate_reserved, 1 },
+    { "sched/writeback", check_sched_writeback, 0 },
+    { "ctx/independent", check_ctx_independent, 0 },
+    { "ctx/threads", check_ctx_threads, 0 },
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the regression check harness
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if every check run passed, -1 if not
+
+int main( int argc, char *argv[] ) {
+    LcCheck ck;
+    const char *filter = NULL;
+    int ch, verbose = 0, failed = 0;
+
+    memset(&ck, 0, sizeof(ck));
+    ck.checkpoint = "lcloud_check.meta";
+
+    // Process the command line parameters
+    while((ch = getopt(argc, argv, LC_CHECK_ARGUMENTS)) != -1) {
+        switch(ch) {
+        case 'h': // Help, print usage
+            fprintf(stderr, USAGE);
+            return(-1);
+
+        case 'v': // Verbose Flag
+            verbose = 1;
+            break;
+
+        case 't': // Server keeping its devices
+            ck.server = optarg;
+            break;
+
+        case 'm': // Checkpoint
+            ck.checkpoint = optarg;
+            break;
+
+        case 'f': // Filter
+            filter = optarg;
+            break;
+
+        default: // Default (unknown)
+            fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+            return(-1);
+        }
+    }
+    initializeLogWithFilehandle(CMPSC311_LOG_STDERR);
+    LcDriverLLevel = registerLogLevel("LCLOUD_DRIVER", 0);
+    if(verbose) {
+        enableLogLevels(LcDriverLLevel);
+    }
+
+    // Run the checks
+    for(size_t i = 0; i < sizeof(checks) / sizeof(checks[0]); i++) {
+        if(filter != NULL && strstr(checks[i].name, filter) == NULL) continue;
+        if(checks[i].persistent && ck.server == NULL) {
+            printf("%-28s skipped (needs a server keeping its devices, -t)\n", checks[i].name);
+            continue;
+        }
+        ck.why[0] = '\0';
+        if(checks[i].body(&ck) == 0) {
+            printf("%-28s ok\n", checks[i].name);
+        } else {
+            printf("%-28s FAILED: %s\n", checks[i].name, ck.why);
+            failed++;
+        }
+    }
+    if(failed > 0) {
+        printf("%d check(s) failed\n", failed);
+        return(-1);
+    }
+    return(0);
+}
@@ -0,0 +1,41 @@
+#!/bin/bash
+#
+# CMPSC311 - LionCloud Device
+# lcloud_check.sh - run the filesystem regression checks (lcloud_check),
+#   with a stand-in server whose devices keep their contents in image
+#   files, so the checks that reload the metadata checkpoint run too.
+#
+# usage: lcloud_check.sh [<lcloud_check options>]
+#
+# Environment (defaults in parentheses):
+#   CHECK_OUT       output directory (check_results)
+#   CHECK_MANIFEST  devices of the server (workload/cmpsc311-assign4e-manifest.txt)
+#
+
+OUT=${CHECK_OUT:-check_results}
+MANIFEST=${CHECK_MANIFEST:-workload/cmpsc311-assign4e-manifest.txt}
+SOCK=$OUT/lcloud-check.sock
+
+cd "$(dirname "$0")" || exit 1
+mkdir -p "$OUT"
+rm -rf "$OUT/images" "$OUT/check.meta"
+mkdir "$OUT/images" || exit 1
+
+# Start the stand-in server (Unix-domain socket only), stop it on exit
+rm -f "$SOCK"
+./lcloud_simserver -p 0 -u "$SOCK" -m "$OUT/images" "$MANIFEST" >"$OUT/server.log" 2>&1 &
+SERVER=$!
+stop_server() {
+    kill -INT "$SERVER" 2>/dev/null && wait "$SERVER" 2>/dev/null
+}
+trap stop_server EXIT
+for i in $(seq 50); do
+    [ -S "$SOCK" ] && break
+    sleep 0.1
+done
+if [ ! -S "$SOCK" ]; then
+    echo "lcloud_check: server did not start, see $OUT/server.log" >&2
+    exit 1
+fi
+
+./lcloud_check -t "unix:$SOCK" -m "$OUT/check.meta" "$@"
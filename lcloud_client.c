@@ -9,11 +9,10 @@
 //
 
 // Include Files
-#include <signal.h>
 #include <sys/types.h>
-#include <sys/socket.h>
-#include <arpa/inet.h>
+#include <sys/uio.h>
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <assert.h>
@@ -21,166 +20,427 @@
 
 // Project Include Files
 #include <lcloud_network.h>
+#include <lcloud_transport.h>
+#include <lcloud_registers.h>
+#include <lcloud_support.h>
 #include <cmpsc311_log.h>
 #include <cmpsc311_util.h>
 #include <gcrypt.h>
 
-int32_t socket_handle = -1;
-struct sockaddr_in addr;
-gcry_cipher_hd_t cipher_handle;
-char *cipher_key;
-char *cipher_iv;
-size_t key_length;
-size_t blk_length;
+// A client: its transport, the cipher blocks are encrypted with, and counters
+struct LcClient {
+    LcTransport client_transport; // The transport to the server
+    char transport_ready; // 1 once client_transport has been set up
+    char connected; // 1 while the transport is open
+    gcry_cipher_hd_t cipher_handle;
+    char *cipher_key;
+    char *cipher_iv;
+    size_t key_length;
+    size_t blk_length;
+    char preset_key[LCLOUD_CIPHER_KEYLEN]; // Key and IV to use instead of random ones
+    char preset_iv[LCLOUD_CIPHER_KEYLEN];
+    char preset; // 1 if preset_key and preset_iv are set
+
+    // Scratch space for encrypted payloads of a batch that is being sent/received
+    char *tx_scratch;
+    int tx_scratch_blocks;
+    char rx_scratch[LCLOUD_MAX_BATCH][LC_DEVICE_BLOCK_SIZE];
+    LcClientStats client_stats; // Bus counters
+};
+
+LcClient default_client; // The client the client_ functions use
 
 //
 // Functions
 
-extern int extract_lcloud_registers(LCloudRegisterFrame resp, int *b0, int *b1, int *c0, int *c1,
- int *c2, int *d0, int *d1);
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcclient_set_transport
+// Description  : Select the transport used to reach the server.  Must be
+//                called before the first request (or after power off).
+//
+// Inputs       : client - the client
+//                spec - transport specification (see lcloud_transport_parse)
+// Outputs      : 0 if successful, -1 if failure
+
+int lcclient_set_transport( LcClient *client, const char *spec ) {
+    if(client->connected) {
+        logMessage(LOG_ERROR_LEVEL, "Cannot change transport while connected");
+        return(-1);
+    }
+    if(lcloud_transport_parse(&client->client_transport, spec) == -1) return(-1);
+    client->transport_ready = 1;
+    return(0);
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : client_lcloud_bus_request
-// Description  : This the client regstateeration that sends a request to the 
-//                lion client server.   It will:
+// Function     : lcclient_connect
+// Description  : Set up the cipher and connect to the LionCloud server
 //
-//                1) if INIT make a connection to the server
-//                2) send any request to the server, returning results
-//                3) if CLOSE, will close the connection
+// Inputs       : client - the client
+// Outputs      : 0 if successful, -1 if failure
+
+int lcclient_connect( LcClient *client ) {
+    if(client->connected) return(0);
+
+    /*
+    Thanks libgcrypt reference manual! GNU documentation is pretty baller.
+    This client encrypts all data sent to the LCloud server and decrypts it upon
+    retrieval.
+    The cache is still stored in plaintext.
+    I have no clue how AES works and I could probably improve the error handling for
+    these gcrypt functions, but this'll do for now.
+    */
+
+    // Open AES128 CBC cipher on cipher_handle
+    if(gcry_cipher_open(&client->cipher_handle, GCRY_CIPHER_AES128, GCRY_CIPHER_MODE_CBC, 0)) {
+        logMessage(LOG_ERROR_LEVEL, "Error opening cipher");
+        return(-1);
+    }
+    // Set key and block lengths (I think they're the same for AES, but whatever)
+    client->key_length = gcry_cipher_get_algo_keylen(GCRY_CIPHER_AES128);
+    client->blk_length = gcry_cipher_get_algo_blklen(GCRY_CIPHER_AES128);
+    // Allocate memory for key and IV and set to random data (or the preset ones, so
+    // blocks written by an earlier run can be read)
+    client->cipher_key = malloc(client->key_length);
+    client->cipher_iv = malloc(client->blk_length);
+    if(client->cipher_key == NULL || client->cipher_iv == NULL) {
+        logMessage(LOG_ERROR_LEVEL, "Memory allocation error");
+        goto fail;
+    }
+    if(client->preset && client->key_length <= LCLOUD_CIPHER_KEYLEN && client->blk_length <= LCLOUD_CIPHER_KEYLEN) {
+        memcpy(client->cipher_key, client->preset_key, client->key_length);
+        memcpy(client->cipher_iv, client->preset_iv, client->blk_length);
+    } else {
+        gcry_randomize(client->cipher_key, client->key_length, GCRY_WEAK_RANDOM);
+        gcry_randomize(client->cipher_iv, client->blk_length, GCRY_WEAK_RANDOM);
+    }
+    // Set cipher key using said randomized data
+    if(gcry_cipher_setkey(client->cipher_handle, client->cipher_key, client->key_length)) {
+        logMessage(LOG_ERROR_LEVEL, "Error setting cipher key");
+        goto fail;
+    }
+
+    // Connect to the server over the selected transport (TCP by default)
+    if(!client->transport_ready && lcclient_set_transport(client, NULL) == -1) goto fail;
+    if(client->client_transport.ops->open(&client->client_transport) == -1) goto fail;
+    logMessage(LcDriverLLevel, "Connected to LionCloud over %s transport", client->client_transport.ops->name);
+    client->connected = 1;
+    return(0);
+
+fail:
+    // Release the cipher and its key and IV, ready for the next try
+    gcry_cipher_close(client->cipher_handle);
+    free(client->cipher_key);
+    free(client->cipher_iv);
+    client->cipher_handle = NULL;
+    client->cipher_key = NULL;
+    client->cipher_iv = NULL;
+    return(-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
 //
-// Inputs       : reg - the request reqisters for the command
-//                buf - the block to be read/written from (READ/WRITE)
-// Outputs      : the response structure encoded as needed
+// Function     : lcclient_set_cipher
+// Description  : Set the key and IV the next connection encrypts blocks with
+//
+// Inputs       : client - the client
+//                key, iv - LCLOUD_CIPHER_KEYLEN bytes each, NULL for random ones
+// Outputs      : 0 if successful, -1 if failure
 
-LCloudRegisterFrame client_lcloud_bus_request( LCloudRegisterFrame reg, void *buf ) {
+int lcclient_set_cipher( LcClient *client, const char *key, const char *iv ) {
+    if(key == NULL || iv == NULL) {
+        client->preset = 0;
+        return(0);
+    }
+    memcpy(client->preset_key, key, LCLOUD_CIPHER_KEYLEN);
+    memcpy(client->preset_iv, iv, LCLOUD_CIPHER_KEYLEN);
+    client->preset = 1;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcclient_get_cipher
+// Description  : Get the key and IV of the open connection, or when there is
+//                none the preset ones the next connection will use
+//
+// Inputs       : client - the client
+//                key, iv - (output) LCLOUD_CIPHER_KEYLEN bytes each
+// Outputs      : 0 if successful, -1 if not connected and none are preset
+
+int lcclient_get_cipher( LcClient *client, char *key, char *iv ) {
+    if(!client->connected && client->preset) {
+        memcpy(key, client->preset_key, LCLOUD_CIPHER_KEYLEN);
+        memcpy(iv, client->preset_iv, LCLOUD_CIPHER_KEYLEN);
+        return(0);
+    }
+    if(!client->connected || client->key_length > LCLOUD_CIPHER_KEYLEN || client->blk_length > LCLOUD_CIPHER_KEYLEN) return(-1);
+    memset(key, 0, LCLOUD_CIPHER_KEYLEN);
+    memset(iv, 0, LCLOUD_CIPHER_KEYLEN);
+    memcpy(key, client->cipher_key, client->key_length);
+    memcpy(iv, client->cipher_iv, client->blk_length);
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_disconnect
+// Description  : Close the connection and release the cipher
+//
+// Inputs       : client - the client
+// Outputs      : 0 if successful, -1 if failure
+
+static int client_disconnect( LcClient *client ) {
+    int ret = client->client_transport.ops->close(&client->client_transport);
+    client->connected = 0;
+
+    // Close cipher descriptor and free any alloc'd memory
+    gcry_cipher_close(client->cipher_handle);
+    free(client->cipher_key);
+    free(client->cipher_iv);
+    free(client->tx_scratch);
+    client->tx_scratch = NULL;
+    client->tx_scratch_blocks = 0;
+    return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_crypt_block
+// Description  : Encrypt or decrypt a single device block
+//
+// Inputs       : client - the client
+//                out - the destination block
+//                in - the source block
+//                encrypt - 1 to encrypt, 0 to decrypt
+// Outputs      : 0 if successful, -1 if failure
+
+static int client_crypt_block( LcClient *client, void *out, const void *in, int encrypt ) {
+    gcry_error_t gcryErr;
+
+    // Set IV for cipher
+    // Does this need to be done for every encrypt/decrypt? I have no idea.
+    if(gcry_cipher_setiv(client->cipher_handle, client->cipher_iv, client->blk_length)) {
+        logMessage(LOG_ERROR_LEVEL, "Error setting cipher IV");
+        return(-1);
+    }
+    if(encrypt) {
+        gcryErr = gcry_cipher_encrypt(client->cipher_handle, out, LC_DEVICE_BLOCK_SIZE, in, LC_DEVICE_BLOCK_SIZE);
+    } else {
+        gcryErr = gcry_cipher_decrypt(client->cipher_handle, out, LC_DEVICE_BLOCK_SIZE, in, LC_DEVICE_BLOCK_SIZE);
+    }
+    if(gcryErr) {
+        logMessage(LOG_ERROR_LEVEL, "Error %s buffer", encrypt ? "encrypting" : "decrypting");
+        return(-1);
+    }
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcclient_batch
+// Description  : Pipelines a batch of requests to the lion cloud server.  All
+//                frames (and encrypted payloads of writes) are gathered into
+//                as few writev calls as possible, then the responses are
+//                parsed back out of the receive buffer in order.
+//
+// Inputs       : client - the client
+//                regs - the request registers for each command
+//                bufs - the block for each command (NULL if not a transfer)
+//                resps - the response frame for each command (output)
+//                n - the number of requests in the batch
+// Outputs      : 0 if successful, -1 if failure
+
+int lcclient_batch( LcClient *client, LCloudRegisterFrame *regs, void **bufs, LCloudRegisterFrame *resps, int n ) {
     int b0, b1, c0, c1, c2, d0, d1;
-    size_t buf_size = LC_DEVICE_BLOCK_SIZE;
-    char encrypt_buf[buf_size];
-    char reg_buf[sizeof(LCloudRegisterFrame)];
-    LCloudRegisterFrame inet_reg = htonll64(reg); // Convert register frame to network byte order
-    LCloudRegisterFrame inet_resp, resp;
+    LCloudRegisterFrame inet_regs[LCLOUD_MAX_BATCH];
+    LCloudRegisterFrame inet_resps[LCLOUD_MAX_BATCH];
+    struct iovec iov[2 * LCLOUD_MAX_BATCH];
+    int iovcnt, nwrites, i, base, cnt;
 
     // Create connection if it doesn't exist
-    if(socket_handle == -1) {
-        /* 
-        Thanks libgcrypt reference manual! GNU documentation is pretty baller.
-        This client encrypts all data sent to the LCloud server and decrypts it upon
-        retrieval.
-        The cache is still stored in plaintext.
-        I have no clue how AES works and I could probably improve the error handling for
-        these gcrypt functions, but this'll do for now.
-        */
-
-        // Open AES128 CBC cipher on cipher_handle
-        if(gcry_cipher_open(&cipher_handle, GCRY_CIPHER_AES128, GCRY_CIPHER_MODE_CBC, 0)) {
-            logMessage(LOG_ERROR_LEVEL, "Error opening cipher");
-            return(-1);
+    if(!client->connected && lcclient_connect(client) == -1) return(-1);
+
+    for(base = 0; base < n; base += LCLOUD_MAX_BATCH) {
+        cnt = (n - base < LCLOUD_MAX_BATCH) ? n - base : LCLOUD_MAX_BATCH;
+
+        // Make sure there is room to hold every encrypted payload in the batch
+        if(client->tx_scratch_blocks < cnt) {
+            char *scratch;
+            if((scratch = realloc(client->tx_scratch, cnt * LC_DEVICE_BLOCK_SIZE)) == NULL) return(-1);
+            client->tx_scratch = scratch;
+            client->tx_scratch_blocks = cnt;
         }
-        // Set key and block lengths (I think they're the same for AES, but whatever)
-        key_length = gcry_cipher_get_algo_keylen(GCRY_CIPHER_AES128);
-        blk_length = gcry_cipher_get_algo_blklen(GCRY_CIPHER_AES128);
-        // Allocate memory for key and IV and set to random data
-        if((cipher_key = malloc(key_length)) == NULL) return(-1);
-        if((cipher_iv = malloc(blk_length)) == NULL) return(-1);
-        gcry_randomize(cipher_key, key_length, GCRY_WEAK_RANDOM);
-        gcry_randomize(cipher_iv, blk_length, GCRY_WEAK_RANDOM);
-        // Set cipher key using said randomized data
-        if(gcry_cipher_setkey(cipher_handle, cipher_key, key_length)) {
-            logMessage(LOG_ERROR_LEVEL, "Error setting cipher key");
-            return(-1);
+
+        // Build one gather list of frames and payloads for the whole batch
+        iovcnt = 0;
+        nwrites = 0;
+        for(i = 0; i < cnt; i++) {
+            // Extract registers to determine operations to perform
+            if(extract_lcloud_registers(regs[base + i], &b0, &b1, &c0, &c1, &c2, &d0, &d1) == -1) return(-1);
+
+            // Convert register frame to network byte order
+            inet_regs[i] = htonll64(regs[base + i]);
+            iov[iovcnt].iov_base = &inet_regs[i];
+            iov[iovcnt].iov_len = sizeof(LCloudRegisterFrame);
+            iovcnt++;
+            if(c0 == LC_BLOCK_XFER && c2 == LC_XFER_READ) client->client_stats.block_reads++;
+
+            if(c0 == LC_BLOCK_XFER && c2 == LC_XFER_WRITE) {
+                char *encrypt_buf = &client->tx_scratch[nwrites * LC_DEVICE_BLOCK_SIZE];
+                if(client_crypt_block(client, encrypt_buf, bufs[base + i], 1) == -1) return(-1);
+                iov[iovcnt].iov_base = encrypt_buf;
+                iov[iovcnt].iov_len = LC_DEVICE_BLOCK_SIZE;
+                iovcnt++;
+                nwrites++;
+            }
         }
+        if(client->client_transport.ops->send(&client->client_transport, iov, iovcnt) == -1) return(-1);
+        client->client_stats.requests += cnt;
+        client->client_stats.block_writes += nwrites;
+        client->client_stats.round_trips++;
 
-        // Specify connection type and port
-        addr.sin_family = AF_INET;
-        addr.sin_port = htons(LCLOUD_DEFAULT_PORT);
+        // Collect the responses (and read payloads) in one scatter list
+        iovcnt = 0;
+        for(i = 0; i < cnt; i++) {
+            extract_lcloud_registers(regs[base + i], &b0, &b1, &c0, &c1, &c2, &d0, &d1);
+            iov[iovcnt].iov_base = &inet_resps[i];
+            iov[iovcnt].iov_len = sizeof(LCloudRegisterFrame);
+            iovcnt++;
+            if(c0 == LC_BLOCK_XFER && c2 == LC_XFER_READ) {
+                iov[iovcnt].iov_base = client->rx_scratch[i];
+                iov[iovcnt].iov_len = LC_DEVICE_BLOCK_SIZE;
+                iovcnt++;
+            }
+        }
+        if(client->client_transport.ops->recv(&client->client_transport, iov, iovcnt) == -1) return(-1);
 
-        // Convert address string to binary address
-        if(inet_aton(LCLOUD_DEFAULT_IP, &(addr.sin_addr)) == 0) return(-1);
-        // Create socket with address data
-        if((socket_handle = socket(AF_INET, SOCK_STREAM, 0)) == -1) return(-1);
-        // Connect to server
-        if(connect(socket_handle, (const struct sockaddr*) &(addr), sizeof(addr)) == -1) return(-1);
-    }
+        // Decode the responses in the order the requests were sent
+        for(i = 0; i < cnt; i++) {
+            extract_lcloud_registers(regs[base + i], &b0, &b1, &c0, &c1, &c2, &d0, &d1);
+            resps[base + i] = ntohll64(inet_resps[i]);
 
-    // Extract registers to determine operations to perform
-    if(extract_lcloud_registers(reg, &b0, &b1, &c0, &c1, &c2, &d0, &d1) == -1) return(-1);
-
-    // Copy network register frame to char buffer and send to server
-    memcpy(reg_buf, (char*) &inet_reg, sizeof(LCloudRegisterFrame));
-    if(write(socket_handle, reg_buf, sizeof(LCloudRegisterFrame)) == -1) return(-1);
-    // Reset register frame buffer
-    memset(reg_buf, 0, sizeof(LCloudRegisterFrame));
-
-    switch(c0) {
-        case(LC_BLOCK_XFER):
-            if(c2 == LC_XFER_READ) {
-                // Read server response and buffer data
-                if(read(socket_handle, reg_buf, sizeof(LCloudRegisterFrame)) == -1) return(-1);  
-                if(read(socket_handle, encrypt_buf, buf_size) == -1) return(-1);
-                // Set IV for cipher
-                // Does this need to be done for every encrypt/decrypt? I have no idea.
-                if(gcry_cipher_setiv(cipher_handle, cipher_iv, blk_length)) {
-                    logMessage(LOG_ERROR_LEVEL, "Error setting cipher IV");
-                    return(-1);
-                }
-                // Decrypt data retrieved from device to buf
-                gcry_error_t gcryErr = gcry_cipher_decrypt(
-                    cipher_handle, 
-                    (void*) buf, 
-                    buf_size, 
-                    (const void*) encrypt_buf, 
-                    buf_size);
-                if(gcryErr) {
-                    // gcry_err_code_t err_code= gcry_err_code(gcryErr);
-                    // gcry_err_source_t err_source = gcry_err_source(gcryErr);
-                    logMessage(LOG_ERROR_LEVEL, "Error decrypting buffer");
-                    return(-1);
-                }
-            } else if(c2 == LC_XFER_WRITE) {
-                // Set IV for cipher
-                if(gcry_cipher_setiv(cipher_handle, cipher_iv, blk_length)) {
-                    logMessage(LOG_ERROR_LEVEL, "Error setting cipher IV");
-                    return(-1);
-                }
-                // Encrypt data in buf to encrypt_buf
-                gcry_error_t gcryErr = gcry_cipher_encrypt(
-                    cipher_handle, 
-                    (void*) encrypt_buf, 
-                    buf_size,
-                    (const void*) buf, 
-                    buf_size);
-                if(gcryErr) {
-                    // gcry_err_code_t err_code= gcry_err_code(gcryErr);
-                    // gcry_err_source_t err_source = gcry_err_source(gcryErr);
-                    logMessage(LOG_ERROR_LEVEL, "Error encrypting buffer");
-                    return(-1);
-                }    
-                // Write buffer data and read server response
-                if(write(socket_handle, encrypt_buf, LC_DEVICE_BLOCK_SIZE) == -1) return(-1);
-                if(read(socket_handle, reg_buf, sizeof(LCloudRegisterFrame)) == -1) return(-1);
+            if(c0 == LC_BLOCK_XFER && c2 == LC_XFER_READ) {
+                // Decrypt the block to the caller's buffer
+                if(client_crypt_block(client, bufs[base + i], client->rx_scratch[i], 0) == -1) return(-1);
+            } else if(c0 == LC_POWER_OFF) {
+                // Server is going away, close connection
+                if(client_disconnect(client) == -1) return(-1);
             }
-            break;
-        case(LC_POWER_OFF):
-            // Read server response and close connection
-            if(read(socket_handle, reg_buf, sizeof(LCloudRegisterFrame)) == -1) return(-1);
-            if(close(socket_handle) == -1) return(-1);
-            socket_handle = -1; // Reset socket descriptor
-
-            // Close cipher descriptor and free any alloc'd memory
-            gcry_cipher_close(cipher_handle);
-            free(cipher_key);
-            free(cipher_iv);
-            break;
-        default:
-            // Read server response
-            if(read(socket_handle, reg_buf, sizeof(LCloudRegisterFrame)) == -1) return(-1);
-            break;
+        }
     }
-    
-    // Copy register frame buffer to registerframe and convert to host byte order
-    memcpy((char*) &inet_resp, reg_buf, sizeof(LCloudRegisterFrame));
-    resp = htonll64(inet_resp);
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcclient_request
+// Description  : This the client regstateeration that sends a request to the
+//                lion client server.   It will:
+//
+//                1) if INIT make a connection to the server
+//                2) send any request to the server, returning results
+//                3) if CLOSE, will close the connection
+//
+// Inputs       : client - the client
+//                reg - the request reqisters for the command
+//                buf - the block to be read/written from (READ/WRITE)
+// Outputs      : the response structure encoded as needed
+
+LCloudRegisterFrame lcclient_request( LcClient *client, LCloudRegisterFrame reg, void *buf ) {
+    LCloudRegisterFrame resp;
+    if(lcclient_batch(client, &reg, &buf, &resp, 1) == -1) return(-1);
     return(resp);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcclient_get_stats
+// Description  : Get the bus counters of a client
+//
+// Inputs       : client - the client
+//                stats - (output) the counters
+// Outputs      : none
+
+void lcclient_get_stats( LcClient *client, LcClientStats *stats ) {
+    *stats = client->client_stats;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcclient_create
+// Description  : Create a client with its own transport (the default until
+//                lcclient_set_transport), cipher and counters
+//
+// Inputs       : none
+// Outputs      : the client, NULL if failure
+
+LcClient * lcclient_create( void ) {
+    LcClient *client;
+    if((client = calloc(1, sizeof(LcClient))) == NULL) {
+        logMessage(LOG_ERROR_LEVEL, "Memory allocation error");
+        return(NULL);
+    }
+    return(client);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcclient_destroy
+// Description  : Disconnect (if connected) and free a client made by
+//                lcclient_create
+//
+// Inputs       : client - the client
+// Outputs      : 0 if successful, -1 if failure
+
+int lcclient_destroy( LcClient *client ) {
+    int ret = (client->connected) ? client_disconnect(client) : 0;
+    free(client);
+    return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcclient_default
+// Description  : The client the client_ functions use
+//
+// Inputs       : none
+// Outputs      : the client
+
+LcClient * lcclient_default( void ) {
+    return(&default_client);
+}
+
+//
+// The client_ functions work on the default client
+
+int client_set_transport( const char *spec ) {
+    return(lcclient_set_transport(&default_client, spec));
+}
+
+int client_connect( void ) {
+    return(lcclient_connect(&default_client));
+}
+
+int client_set_cipher( const char *key, const char *iv ) {
+    return(lcclient_set_cipher(&default_client, key, iv));
+}
+
+int client_get_cipher( char *key, char *iv ) {
+    return(lcclient_get_cipher(&default_client, key, iv));
+}
+
+int client_lcloud_bus_batch( LCloudRegisterFrame *regs, void **bufs, LCloudRegisterFrame *resps, int n ) {
+    return(lcclient_batch(&default_client, regs, bufs, resps, n));
+}
+
+LCloudRegisterFrame client_lcloud_bus_request( LCloudRegisterFrame reg, void *buf ) {
+    return(lcclient_request(&default_client, reg, buf));
+}
+
+void client_get_stats( LcClientStats *stats ) {
+    lcclient_get_stats(&default_client, stats);
+}
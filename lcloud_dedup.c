@@ -0,0 +1,551 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_dedup.c
+//  Description    : This is the implementation of device block sharing.
+//                   A device block may back several file blocks (a file
+//                   cloned by lcclone shares its source's blocks): a table
+//                   counts the file blocks mapped to each shared one (a
+//                   block it has no entry for backs exactly one), and a
+//                   block written over while shared is copied instead.
+//                   With deduplication on (lcdedup), a content index maps
+//                   the fingerprint of every whole block written to the
+//                   device block holding it, so a block whose contents are
+//                   already on a device is mapped to that block rather
+//                   than written.  Device blocks no file block maps any
+//                   more go to a free list new blocks are taken from.
+//
+//   Author        : Lucas Benning
+//   Last Modified : 5/8/20
+//
+
+// Include files
+#include <stdlib.h>
+#include <string.h>
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+
+// Project include files
+#include <lcloud_filesys.h>
+#include <lcloud_fsinternal.h>
+#include <lcloud_meta.h>
+#include <lcloud_cache.h>
+#include <lcloud_support.h>
+
+// Defines
+#define LC_DEDUP_PRINT 20 // Bytes of a fingerprint (generate_md5_signature hashes with CMPSC311_HASH_TYPE)
+#define LC_DEDUP_SLOTS 1024 // Initial slots of each table (power of two, doubled at 3/4 full)
+
+// Type definitions
+typedef struct {
+    uint64_t key; // Device block, 0 if the slot is empty
+    uint32_t refs; // File blocks mapped to it
+    char indexed; // 1 if the content index holds its fingerprint
+    unsigned char print[LC_DEDUP_PRINT]; // Fingerprint of its contents (if indexed)
+} LcDedupBlk;
+
+typedef struct {
+    uint64_t key; // Device block holding the contents, 0 if the slot is empty
+    unsigned char print[LC_DEDUP_PRINT]; // Fingerprint of the contents
+} LcDedupPrint;
+
+struct LcDedup {
+    LcDedupBlk *blks; // Device blocks shared or indexed
+    uint32_t nblks; // Slots in use
+    uint32_t blks_cap; // Slots (power of two)
+    LcDedupPrint *prints; // Content index
+    uint32_t nprints; // Slots in use
+    uint32_t prints_cap; // Slots (power of two)
+    unsigned char print[LC_DEDUP_PRINT]; // Fingerprint of the last block looked up
+};
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : block_key
+// Description  : Name a device block in the tables
+//
+// Inputs       : blk - the device block
+// Outputs      : the key (never 0)
+
+static uint64_t block_key( LcBlock *blk ) {
+    return((((uint64_t) blk->dev << 32) | ((uint64_t) blk->sec << 16) | blk->blk) + 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : key_hash
+// Description  : Spread a key over a table
+//
+// Inputs       : key - the key
+//                size - slots of the table (power of two)
+// Outputs      : the first slot to probe
+
+static uint32_t key_hash( uint64_t key, uint32_t size ) {
+    return((uint32_t) ((key * 0x9e3779b97f4a7c15ULL) >> 32) & (size - 1));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : key_compare
+// Description  : Order keys for qsort
+//
+// Inputs       : a, b - the keys
+// Outputs      : -1, 0 or 1 as a is below, equal to or above b
+
+static int key_compare( const void *a, const void *b ) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return((x > y) - (x < y));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : print_hash
+// Description  : Spread a fingerprint over the content index
+//
+// Inputs       : print - the fingerprint
+//                size - slots of the index (power of two)
+// Outputs      : the first slot to probe
+
+static uint32_t print_hash( const unsigned char *print, uint32_t size ) {
+    uint32_t h;
+    memcpy(&h, print, sizeof(h));
+    return(h & (size - 1));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : blk_find
+// Description  : Find the slot of a device block in the block table
+//
+// Inputs       : dd - the tables
+//                key - the device block
+// Outputs      : the slot, or the empty slot it would go in
+
+static uint32_t blk_find( LcDedup *dd, uint64_t key ) {
+    uint32_t s;
+    for(s = key_hash(key, dd->blks_cap); dd->blks[s].key != 0 && dd->blks[s].key != key; s = (s + 1) & (dd->blks_cap - 1));
+    return(s);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : print_find
+// Description  : Find the slot of a fingerprint in the content index
+//
+// Inputs       : dd - the tables
+//                print - the fingerprint
+// Outputs      : the slot, or the empty slot it would go in
+
+static uint32_t print_find( LcDedup *dd, const unsigned char *print ) {
+    uint32_t s;
+    for(s = print_hash(print, dd->prints_cap); dd->prints[s].key != 0 && memcmp(dd->prints[s].print, print, LC_DEDUP_PRINT) != 0;
+        s = (s + 1) & (dd->prints_cap - 1));
+    return(s);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : blk_delete
+// Description  : Empty a slot of the block table, moving back the entries
+//                after it that probed past it
+//
+// Inputs       : dd - the tables
+//                s - the slot
+// Outputs      : none
+
+static void blk_delete( LcDedup *dd, uint32_t s ) {
+    uint32_t mask = dd->blks_cap - 1, t, home;
+
+    for(t = (s + 1) & mask; dd->blks[t].key != 0; t = (t + 1) & mask) {
+        home = key_hash(dd->blks[t].key, dd->blks_cap);
+        if(((t - home) & mask) >= ((t - s) & mask)) {
+            dd->blks[s] = dd->blks[t];
+            s = t;
+        }
+    }
+    memset(&dd->blks[s], 0, sizeof(LcDedupBlk));
+    dd->nblks--;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : print_delete
+// Description  : Empty a slot of the content index, moving back the entries
+//                after it that probed past it
+//
+// Inputs       : dd - the tables
+//                s - the slot
+// Outputs      : none
+
+static void print_delete( LcDedup *dd, uint32_t s ) {
+    uint32_t mask = dd->prints_cap - 1, t, home;
+
+    for(t = (s + 1) & mask; dd->prints[t].key != 0; t = (t + 1) & mask) {
+        home = print_hash(dd->prints[t].print, dd->prints_cap);
+        if(((t - home) & mask) >= ((t - s) & mask)) {
+            dd->prints[s] = dd->prints[t];
+            s = t;
+        }
+    }
+    memset(&dd->prints[s], 0, sizeof(LcDedupPrint));
+    dd->nprints--;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : dedup_grow
+// Description  : Make room for one more entry in each table, doubling a
+//                table that is 3/4 full (or allocating the tables)
+//
+// Inputs       : ctx - the filesystem
+// Outputs      : the tables, NULL if failure
+
+static LcDedup * dedup_grow( LcContext *ctx ) {
+    LcDedup *dd = ctx->dedup;
+    LcDedupBlk *blks;
+    LcDedupPrint *prints;
+    uint32_t cap;
+
+    if(dd == NULL) {
+        if((dd = calloc(1, sizeof(LcDedup))) == NULL ||
+            (dd->blks = calloc(LC_DEDUP_SLOTS, sizeof(LcDedupBlk))) == NULL ||
+            (dd->prints = calloc(LC_DEDUP_SLOTS, sizeof(LcDedupPrint))) == NULL) {
+            logMessage(LOG_ERROR_LEVEL, "Memory allocation error");
+            if(dd != NULL) free(dd->blks);
+            free(dd);
+            return(NULL);
+        }
+        dd->blks_cap = LC_DEDUP_SLOTS;
+        dd->prints_cap = LC_DEDUP_SLOTS;
+        ctx->dedup = dd;
+    }
+
+    // Rehash a table into one twice the size
+    if(4 * (dd->nblks + 1) > 3 * dd->blks_cap) {
+        cap = dd->blks_cap;
+        blks = dd->blks;
+        if((dd->blks = calloc(2 * cap, sizeof(LcDedupBlk))) == NULL) {
+            logMessage(LOG_ERROR_LEVEL, "Memory allocation error");
+            dd->blks = blks;
+            return(NULL);
+        }
+        dd->blks_cap = 2 * cap;
+        for(uint32_t s = 0; s < cap; s++) {
+            if(blks[s].key != 0) dd->blks[blk_find(dd, blks[s].key)] = blks[s];
+        }
+        free(blks);
+    }
+    if(4 * (dd->nprints + 1) > 3 * dd->prints_cap) {
+        cap = dd->prints_cap;
+        prints = dd->prints;
+        if((dd->prints = calloc(2 * cap, sizeof(LcDedupPrint))) == NULL) {
+            logMessage(LOG_ERROR_LEVEL, "Memory allocation error");
+            dd->prints = prints;
+            return(NULL);
+        }
+        dd->prints_cap = 2 * cap;
+        for(uint32_t s = 0; s < cap; s++) {
+            if(prints[s].key != 0) dd->prints[print_find(dd, prints[s].print)] = prints[s];
+        }
+        free(prints);
+    }
+    return(dd);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : block_free
+// Description  : Add a device block to the free list
+//
+// Inputs       : ctx - the filesystem
+//                blk - the device block
+// Outputs      : 0 if successful, -1 if failure
+
+static int block_free( LcContext *ctx, LcBlock *blk ) {
+    if(ctx->free_nblks == ctx->free_blks_cap) {
+        LcBlock *grown;
+        uint32_t cap = (ctx->free_blks_cap == 0) ? 64 : ctx->free_blks_cap * 2;
+        if((grown = realloc(ctx->free_blks, cap * sizeof(LcBlock))) == NULL) {
+            logMessage(LOG_ERROR_LEVEL, "Memory allocation error");
+            return(-1);
+        }
+        ctx->free_blks = grown;
+        ctx->free_blks_cap = cap;
+    }
+    ctx->free_blks[ctx->free_nblks] = *blk;
+    ctx->free_blks[ctx->free_nblks].unwritten = 0;
+    ctx->free_nblks++;
+
+    // Its cached contents will not be read again
+    lccache_cool(ctx->cache, blk->dev, blk->sec, blk->blk);
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_dedup_refs
+// Description  : Count the file blocks mapped to a device block
+//
+// Inputs       : ctx - the filesystem
+//                blk - the device block (mapped by at least one file block)
+// Outputs      : the count
+
+uint32_t lcloud_dedup_refs( LcContext *ctx, LcBlock *blk ) {
+    uint32_t s;
+
+    if(ctx->dedup == NULL) return(1);
+    s = blk_find(ctx->dedup, block_key(blk));
+    return((ctx->dedup->blks[s].key == 0) ? 1 : ctx->dedup->blks[s].refs);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_dedup_ref
+// Description  : Count one more file block mapped to a device block
+//
+// Inputs       : ctx - the filesystem
+//                blk - the device block
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_dedup_ref( LcContext *ctx, LcBlock *blk ) {
+    LcDedup *dd;
+    uint32_t s;
+
+    if((dd = dedup_grow(ctx)) == NULL) return(-1);
+    s = blk_find(dd, block_key(blk));
+    if(dd->blks[s].key == 0) {
+        dd->blks[s].key = block_key(blk);
+        dd->blks[s].refs = 1;
+        dd->nblks++;
+    }
+    dd->blks[s].refs++;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_dedup_unref
+// Description  : Count one file block fewer mapped to a device block; when
+//                none is left the block is forgotten and freed
+//
+// Inputs       : ctx - the filesystem
+//                blk - the device block
+// Outputs      : 1 if it was freed, 0 if other file blocks still map it,
+//                -1 if failure
+
+int lcloud_dedup_unref( LcContext *ctx, LcBlock *blk ) {
+    LcDedup *dd = ctx->dedup;
+    uint32_t s;
+
+    if(dd != NULL) {
+        s = blk_find(dd, block_key(blk));
+        if(dd->blks[s].key != 0 && dd->blks[s].refs > 1) {
+            if(--dd->blks[s].refs == 1 && !dd->blks[s].indexed) blk_delete(dd, s);
+            return(0);
+        }
+    }
+    lcloud_dedup_forget(ctx, blk);
+    return((block_free(ctx, blk) == -1) ? -1 : 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_dedup_find
+// Description  : Fingerprint a block's new contents and look them up in the
+//                content index (the fingerprint is kept for lcloud_dedup_record)
+//
+// Inputs       : ctx - the filesystem (deduplicating)
+//                data - the contents
+//                blk - (output) the device block holding them, if found
+// Outputs      : 1 if found, 0 if not, -1 if failure
+
+int lcloud_dedup_find( LcContext *ctx, char *data, LcBlock *blk ) {
+    unsigned char sig[64];
+    uint32_t sigsz = sizeof(sig), s;
+    LcDedup *dd;
+    uint64_t key;
+
+    if((dd = dedup_grow(ctx)) == NULL) return(-1);
+    if(generate_md5_signature(data, LC_DEVICE_BLOCK_SIZE, (char *) sig, &sigsz) == -1 || sigsz < LC_DEDUP_PRINT) {
+        logMessage(LOG_ERROR_LEVEL, "Failure fingerprinting a block");
+        return(-1);
+    }
+    memcpy(dd->print, sig, LC_DEDUP_PRINT);
+    s = print_find(dd, dd->print);
+    if(dd->prints[s].key == 0) return(0);
+
+    key = dd->prints[s].key - 1;
+    memset(blk, 0, sizeof(LcBlock));
+    blk->dev = (LcDeviceId) (key >> 32);
+    blk->sec = (uint16_t) (key >> 16);
+    blk->blk = (uint16_t) key;
+    return(1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_dedup_record
+// Description  : Index a device block under the fingerprint lcloud_dedup_find
+//                last computed (the contents about to be written to it)
+//
+// Inputs       : ctx - the filesystem (deduplicating)
+//                blk - the device block (not indexed)
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_dedup_record( LcContext *ctx, LcBlock *blk ) {
+    LcDedup *dd;
+    uint32_t s, p;
+
+    if((dd = dedup_grow(ctx)) == NULL) return(-1);
+    p = print_find(dd, dd->print);
+    if(dd->prints[p].key != 0) return(0);
+    s = blk_find(dd, block_key(blk));
+    if(dd->blks[s].key == 0) {
+        dd->blks[s].key = block_key(blk);
+        dd->blks[s].refs = 1;
+        dd->nblks++;
+    }
+    dd->blks[s].indexed = 1;
+    memcpy(dd->blks[s].print, dd->print, LC_DEDUP_PRINT);
+    dd->prints[p].key = block_key(blk);
+    memcpy(dd->prints[p].print, dd->print, LC_DEDUP_PRINT);
+    dd->nprints++;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_dedup_forget
+// Description  : Drop a device block from the content index (its contents
+//                are about to change, or it is being freed)
+//
+// Inputs       : ctx - the filesystem
+//                blk - the device block
+// Outputs      : none
+
+void lcloud_dedup_forget( LcContext *ctx, LcBlock *blk ) {
+    LcDedup *dd = ctx->dedup;
+    uint32_t s;
+
+    if(dd == NULL) return;
+    s = blk_find(dd, block_key(blk));
+    if(dd->blks[s].key == 0 || !dd->blks[s].indexed) return;
+    print_delete(dd, print_find(dd, dd->blks[s].print));
+    dd->blks[s].indexed = 0;
+    if(dd->blks[s].refs == 1) blk_delete(dd, s);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_dedup_count
+// Description  : Rebuild the reference counts from every file's block map
+//                (those not loaded yet are read from the checkpoint)
+//
+// Inputs       : ctx - the filesystem
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_dedup_count( LcContext *ctx ) {
+    uint64_t *keys, n = 0;
+    LcBlock blk;
+
+    // Collect the written whole blocks and sort them: a device block mapped
+    // k times shows up k times in a row
+    for(int i = 0; i < ctx->filec; i++) {
+        n += ctx->files[i].num_blocks;
+    }
+    if((keys = malloc((n + 1) * sizeof(uint64_t))) == NULL) {
+        logMessage(LOG_ERROR_LEVEL, "Memory allocation error");
+        return(-1);
+    }
+    n = 0;
+    for(int i = 0; i < ctx->filec; i++) {
+        LcFile *file = &ctx->files[i];
+        for(uint32_t b = 0; b < file->num_blocks; b++) {
+            // Maps not loaded yet are read from the checkpoint (not aligned there)
+            if(file->blocks != NULL) {
+                blk = file->blocks[b];
+            } else {
+                memcpy(&blk, ctx->meta->map + file->map_off + (size_t) b * sizeof(LcBlock), sizeof(LcBlock));
+            }
+            if(blk.dev != LC_BLOCK_HOLE && !blk.unwritten && blk.frag_len == 0) keys[n++] = block_key(&blk);
+        }
+    }
+    qsort(keys, n, sizeof(uint64_t), key_compare);
+
+    for(uint64_t i = 0, j; i < n; i = j) {
+        for(j = i + 1; j < n && keys[j] == keys[i]; j++);
+        if(j - i > 1) {
+            LcDedup *dd;
+            uint32_t s;
+            if((dd = dedup_grow(ctx)) == NULL) {
+                free(keys);
+                return(-1);
+            }
+            s = blk_find(dd, keys[i]);
+            dd->blks[s].key = keys[i];
+            dd->blks[s].refs = j - i;
+            dd->nblks++;
+        }
+    }
+    free(keys);
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_dedup_close
+// Description  : Free the reference counts and content index
+//
+// Inputs       : ctx - the filesystem
+// Outputs      : none
+
+void lcloud_dedup_close( LcContext *ctx ) {
+    if(ctx->dedup == NULL) return;
+    free(ctx->dedup->blks);
+    free(ctx->dedup->prints);
+    free(ctx->dedup);
+    ctx->dedup = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcdedup_ctx
+// Description  : Turn deduplication of whole blocks by content on or off.  While
+//                on, a block written with contents a device block already holds
+//                is mapped to that block instead of being written.  Blocks are
+//                indexed as they are written (the index is not kept across
+//                runs).  Turning it off drops the index; blocks already shared
+//                stay shared, and are copied when written.
+//
+// Inputs       : ctx - the filesystem
+//                enable - 1 to deduplicate, 0 to stop
+// Outputs      : 0 if successful, -1 if failure
+
+int lcdedup_ctx( LcContext *ctx, int enable ) {
+    LcDedup *dd = ctx->dedup;
+
+    ctx->dedup_blocks = (enable != 0);
+    if(enable || dd == NULL) return(0);
+    for(uint32_t s = 0; s < dd->blks_cap; s++) {
+        dd->blks[s].indexed = 0;
+    }
+    for(uint32_t s = 0; s < dd->blks_cap; ) {
+        if(dd->blks[s].key != 0 && dd->blks[s].refs == 1) {
+            blk_delete(dd, s);
+        } else {
+            s++;
+        }
+    }
+    memset(dd->prints, 0, dd->prints_cap * sizeof(LcDedupPrint));
+    dd->nprints = 0;
+    return(0);
+}
+
+//
+// The functions without a context work on the default instance
+
+int lcdedup( int enable ) {
+    return(lcdedup_ctx(lcctx_default(), enable));
+}
@@ -0,0 +1,273 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_devsim.c
+//  Description    : This is the implementation of the in-tree LionCloud
+//                   device emulation.
+//
+//   Author        : Lucas Benning
+//   Last Modified : 4/22/20
+//
+
+// Include files
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <cmpsc311_log.h>
+
+// Project include files
+#include <lcloud_devsim.h>
+#include <lcloud_registers.h>
+#include <lcloud_support.h>
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_devsim_init
+// Description  : Build the device geometry from a hardware manifest.  Each
+//                non-comment line holds "<device id> <sectors> <blocks>",
+//                optionally followed by the device latency (usec) and
+//                bandwidth (KB/sec) for the performance model.
+//
+// Inputs       : sim - the emulation state to initialize
+//                manifest - path of the hardware manifest
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_devsim_init( LcDevSim *sim, const char *manifest ) {
+    char line[256];
+    unsigned int id, sec, blk, lat, kbps;
+    int fields;
+    FILE *fhandle;
+
+    memset(sim, 0, sizeof(LcDevSim));
+    if((fhandle = fopen(manifest, "r")) == NULL) {
+        logMessage(LOG_ERROR_LEVEL, "Failure opening hardware manifest [%s]: %s", manifest, strerror(errno));
+        return(-1);
+    }
+
+    while(fgets(line, sizeof(line), fhandle) != NULL) {
+        lat = kbps = 0;
+        if(line[0] == '#' || (fields = sscanf(line, "%u %u %u %u %u", &id, &sec, &blk, &lat, &kbps)) < 3) continue;
+        if(id >= LC_DEVSIM_MAX_DEVICES || sec == 0 || blk == 0 || sec > UINT16_MAX || blk > UINT16_MAX) {
+            logMessage(LOG_ERROR_LEVEL, "Bad device in manifest [%s]: %s", manifest, line);
+            fclose(fhandle);
+            return(-1);
+        }
+        sim->devices[id].id = id;
+        sim->devices[id].state = LC_DEVICE_UNINITIALIZED;
+        sim->devices[id].num_sec = sec;
+        sim->devices[id].num_blk = blk;
+        sim->devices[id].latency_us = lat;
+        sim->devices[id].bandwidth = (uint64_t) kbps * 1024;
+        sim->devices[id].modeled = (fields > 3);
+        sim->present |= (1 << id);
+        logMessage(LcControllerLLevel, "Emulated device %u: %u sectors x %u blocks", id, sec, blk);
+    }
+    fclose(fhandle);
+
+    if(sim->present == 0) {
+        logMessage(LOG_ERROR_LEVEL, "No devices found in hardware manifest [%s]", manifest);
+        return(-1);
+    }
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_devsim_set_backing
+// Description  : Back the devices with memory-mapped image files (one per
+//                device, named lcloud-dev-<id>.img) so contents persist
+//
+// Inputs       : sim - the emulation state
+//                dir - the directory holding the images
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_devsim_set_backing( LcDevSim *sim, const char *dir ) {
+    if(strlen(dir) >= LC_DEVSIM_PATHLEN) return(-1);
+    strcpy(sim->backing_dir, dir);
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_devsim_set_model
+// Description  : Set the default performance model, devices that had a
+//                latency/bandwidth in the manifest keep their own values
+//
+// Inputs       : sim - the emulation state
+//                latency_us - per-transfer latency (usec)
+//                bandwidth - transfer rate (bytes/sec), 0 for unlimited
+// Outputs      : none
+
+void lcloud_devsim_set_model( LcDevSim *sim, uint32_t latency_us, uint64_t bandwidth ) {
+    for(int i = 0; i < LC_DEVSIM_MAX_DEVICES; i++) {
+        LcSimDevice *dev = &sim->devices[i];
+        if((sim->present & (1 << i)) == 0 || dev->modeled) continue;
+        dev->latency_us = latency_us;
+        dev->bandwidth = bandwidth;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_devsim_due
+// Description  : Queue a request behind the device's outstanding work.  Each
+//                device serves one transfer at a time; different devices
+//                work in parallel.  Non-transfer requests complete at once.
+//
+// Inputs       : sim - the emulation state
+//                reg - the request register frame
+//                now - the current time (usec)
+// Outputs      : the time (usec) the request completes
+
+uint64_t lcloud_devsim_due( LcDevSim *sim, LCloudRegisterFrame reg, uint64_t now ) {
+    int b0, b1, c0, c1, c2, d0, d1;
+    LcSimDevice *dev;
+    uint64_t start;
+
+    extract_lcloud_registers(reg, &b0, &b1, &c0, &c1, &c2, &d0, &d1);
+    if(c0 != LC_BLOCK_XFER || c1 >= LC_DEVSIM_MAX_DEVICES || (sim->present & (1 << c1)) == 0) {
+        return(now);
+    }
+
+    dev = &sim->devices[c1];
+    start = (dev->busy_until > now) ? dev->busy_until : now;
+    dev->busy_until = start + dev->latency_us;
+    if(dev->bandwidth > 0) {
+        dev->busy_until += (LC_DEVICE_BLOCK_SIZE * 1000000ULL) / dev->bandwidth;
+    }
+    return(dev->busy_until);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : devsim_attach
+// Description  : Allocate (or map from its image file) a device's contents
+//
+// Inputs       : sim - the emulation state
+//                dev - the device
+// Outputs      : 0 if successful, -1 if failure
+
+static int devsim_attach( LcDevSim *sim, LcSimDevice *dev ) {
+    size_t len = (size_t) dev->num_sec * dev->num_blk * LC_DEVICE_BLOCK_SIZE;
+    char path[LC_DEVSIM_PATHLEN + 32];
+    int fd;
+
+    if(sim->backing_dir[0] == '\0') {
+        dev->data = calloc(1, len);
+        return((dev->data == NULL) ? -1 : 0);
+    }
+
+    snprintf(path, sizeof(path), "%s/lcloud-dev-%d.img", sim->backing_dir, dev->id);
+    if((fd = open(path, O_RDWR | O_CREAT, 0600)) == -1 || ftruncate(fd, len) == -1) {
+        logMessage(LOG_ERROR_LEVEL, "Failure opening device image [%s]: %s", path, strerror(errno));
+        if(fd != -1) close(fd);
+        return(-1);
+    }
+    dev->data = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(dev->data == MAP_FAILED) {
+        dev->data = NULL;
+        return(-1);
+    }
+    dev->mapped = 1;
+    logMessage(LcControllerLLevel, "Device %d backed by [%s]", dev->id, path);
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_devsim_request
+// Description  : Process one request the way the LionCloud server would.  The
+//                response echoes the operation with B0 set and the status in
+//                B1; transfers echo device, direction, sector and block.
+//
+// Inputs       : sim - the emulation state
+//                reg - the request register frame
+//                blk - the block payload (written for reads, read for writes)
+// Outputs      : the response register frame
+
+LCloudRegisterFrame lcloud_devsim_request( LcDevSim *sim, LCloudRegisterFrame reg, char *blk ) {
+    int b0, b1, c0, c1, c2, d0, d1;
+    LcSimDevice *dev;
+    size_t off;
+
+    extract_lcloud_registers(reg, &b0, &b1, &c0, &c1, &c2, &d0, &d1);
+    switch(c0) {
+        case(LC_POWER_ON):
+            sim->powered = 1;
+            return(create_lcloud_register(1, LC_SUCCESS, LC_POWER_ON, 0, 0, 0, 0));
+
+        case(LC_DEVPROBE):
+            return(create_lcloud_register(1, LC_SUCCESS, LC_DEVPROBE, 0, 0, sim->present, 0));
+
+        case(LC_DEVINIT):
+            if(c1 >= LC_DEVSIM_MAX_DEVICES || (sim->present & (1 << c1)) == 0) {
+                return(create_lcloud_register(1, LC_NO_DEVICE, LC_DEVINIT, 0, c1, 0, 0));
+            }
+            dev = &sim->devices[c1];
+            if(dev->data == NULL && devsim_attach(sim, dev) == -1) {
+                dev->state = LC_DEVICE_ERRORED;
+                return(create_lcloud_register(1, LC_BAD_PARAMS, LC_DEVINIT, 0, c1, 0, 0));
+            }
+            dev->state = LC_DEVICE_ONLINE;
+            return(create_lcloud_register(1, LC_SUCCESS, LC_DEVINIT, 0, c1, dev->num_sec, dev->num_blk));
+
+        case(LC_BLOCK_XFER):
+            if(c1 >= LC_DEVSIM_MAX_DEVICES || (sim->present & (1 << c1)) == 0) {
+                if(c2 == LC_XFER_READ) memset(blk, 0, LC_DEVICE_BLOCK_SIZE);
+                return(create_lcloud_register(1, LC_NO_DEVICE, LC_BLOCK_XFER, c1, c2, d0, d1));
+            }
+            dev = &sim->devices[c1];
+            if(dev->state != LC_DEVICE_ONLINE || d0 >= dev->num_sec || d1 >= dev->num_blk ||
+                (c2 != LC_XFER_READ && c2 != LC_XFER_WRITE)) {
+                if(c2 == LC_XFER_READ) memset(blk, 0, LC_DEVICE_BLOCK_SIZE);
+                return(create_lcloud_register(1, LC_BAD_PARAMS, LC_BLOCK_XFER, c1, c2, d0, d1));
+            }
+            off = ((size_t) d0 * dev->num_blk + d1) * LC_DEVICE_BLOCK_SIZE;
+            if(c2 == LC_XFER_READ) {
+                memcpy(blk, &dev->data[off], LC_DEVICE_BLOCK_SIZE);
+                dev->reads++;
+            } else {
+                memcpy(&dev->data[off], blk, LC_DEVICE_BLOCK_SIZE);
+                dev->writes++;
+            }
+            return(create_lcloud_register(1, LC_SUCCESS, LC_BLOCK_XFER, c1, c2, d0, d1));
+
+        case(LC_POWER_OFF):
+            sim->powered = 0;
+            return(create_lcloud_register(1, LC_SUCCESS, LC_POWER_OFF, 0, 0, 0, 0));
+
+        default:
+            logMessage(LOG_ERROR_LEVEL, "Emulated device got bad operation [%d]", c0);
+            return(create_lcloud_register(1, LC_BAD_PARAMS, c0, 0, 0, 0, 0));
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_devsim_close
+// Description  : Release the emulated devices
+//
+// Inputs       : sim - the emulation state
+// Outputs      : 0 if successful
+
+int lcloud_devsim_close( LcDevSim *sim ) {
+    for(int i = 0; i < LC_DEVSIM_MAX_DEVICES; i++) {
+        LcSimDevice *dev = &sim->devices[i];
+        if(dev->mapped) {
+            munmap(dev->data, (size_t) dev->num_sec * dev->num_blk * LC_DEVICE_BLOCK_SIZE);
+        } else {
+            free(dev->data);
+        }
+        dev->data = NULL;
+        dev->mapped = 0;
+    }
+    sim->present = 0;
+    return(0);
+}
@@ -0,0 +1,71 @@
+#ifndef LCLOUD_DEVSIM_INCLUDED
+#define LCLOUD_DEVSIM_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_devsim.h
+//  Description    : This is the interface of the in-tree emulation of the
+//                   LionCloud devices.  It answers register frames the same
+//                   way the LionCloud server does, so it can stand in for the
+//                   server behind an in-process transport.
+//
+//   Author        : Lucas Benning
+//   Last Modified : 4/22/20
+//
+
+// Includes
+#include <stdint.h>
+#include <lcloud_controller.h>
+
+// Defines
+#define LC_DEVSIM_MAX_DEVICES 16 // Device ids fit in the 16 bit probe mask
+#define LC_DEVSIM_PATHLEN 512 // Longest backing file path
+
+// Type definitions
+typedef struct {
+    LcDeviceId id; // The device identifier
+    LcDeviceState state; // Uninitialized until the first DEVINIT
+    uint16_t num_sec; // Number of sectors
+    uint16_t num_blk; // Number of blocks per sector
+    char *data; // Device contents (num_sec * num_blk blocks)
+    char mapped; // 1 if data is a mapping of a backing file
+
+    // Performance model, a transfer occupies the device for
+    // latency_us + LC_DEVICE_BLOCK_SIZE / bandwidth
+    uint32_t latency_us; // Fixed per-transfer latency (usec)
+    uint64_t bandwidth; // Transfer rate (bytes/sec), 0 for unlimited
+    char modeled; // 1 if the manifest gave this device its own model
+    uint64_t busy_until; // Time (usec) the device finishes its queued work
+    uint64_t reads; // Number of blocks read
+    uint64_t writes; // Number of blocks written
+} LcSimDevice;
+
+typedef struct {
+    LcSimDevice devices[LC_DEVSIM_MAX_DEVICES]; // Devices indexed by id
+    uint16_t present; // Bit mask of devices in the manifest
+    char powered; // 1 once POWER_ON has been received
+    char backing_dir[LC_DEVSIM_PATHLEN]; // Directory of device image files, "" for memory
+} LcDevSim;
+
+//
+// Functional Prototypes
+
+int lcloud_devsim_init( LcDevSim *sim, const char *manifest );
+    // Build the device geometry from a hardware manifest file
+
+int lcloud_devsim_set_backing( LcDevSim *sim, const char *dir );
+    // Back devices with memory-mapped image files in dir (call before DEVINIT)
+
+void lcloud_devsim_set_model( LcDevSim *sim, uint32_t latency_us, uint64_t bandwidth );
+    // Set the latency/bandwidth of devices the manifest did not configure
+
+uint64_t lcloud_devsim_due( LcDevSim *sim, LCloudRegisterFrame reg, uint64_t now );
+    // Queue the request on its device, returning the time (usec) it completes
+
+LCloudRegisterFrame lcloud_devsim_request( LcDevSim *sim, LCloudRegisterFrame reg, char *blk );
+    // Process one request, blk is the payload read from/written to
+
+int lcloud_devsim_close( LcDevSim *sim );
+    // Release the emulated devices
+
+#endif
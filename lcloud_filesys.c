@@ -11,6 +11,7 @@
 // Include files
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <cmpsc311_log.h>
 
 // Project include files
@@ -19,101 +20,29 @@
 #include <lcloud_cache.h>
 #include <lcloud_support.h>
 #include <lcloud_network.h>
+#include <lcloud_registers.h>
+#include <lcloud_fsinternal.h>
+#include <lcloud_trace.h>
+#include <lcloud_meta.h>
 
 //
 // File system interface implementation
-// Define LcFile struct to store file metadata
-typedef struct {
-    uint16_t sec;
-    uint16_t blk;
-    LcDeviceId dev;
-} LcBlock;
-
-typedef struct {
-    char *path;
-    LcFHandle handle;
-    size_t pos;
-    size_t size;
-    LcBlock *blocks;
-    char open;
-} LcFile;
-
-typedef struct {
-    LcDeviceId id;
-    uint16_t num_sec;
-    uint16_t num_blk;
-    uint16_t next_sec;
-    uint16_t next_blk;
-    char full;
-} LcDevice;
-
-LcFile *files = NULL; // Array of files
-LcDevice *devices = NULL; // Array of present devices
-int filec; // Number of files
-int devc; // Number of devices
-char pwr = 0; // 1 if powered on, 0 if off
-
-////////////////////////////////////////////////////////////////////////////////
-//
-// Function     : create_lcloud_register
-// Description  : Packs registers b0 through d1 into an LCloudRegisterFrame (unsigned 64 bit integer)
-//
-// Inputs       : b0 ... d1: the values of each LCloud register
-// Outputs      : packed LCloudRegisterframe
-LCloudRegisterFrame create_lcloud_register(int b0, int b1, int c0, int c1, int c2, int d0, int d1) {
-    int b, c, d;
-    LCloudRegisterFrame out;
-
-    b = b0 << 4 | b1; 
-    c = c0 << 16 | c1 << 8 | c2;
-    d = d0 << 16 | d1;
-
-    out = b;
-    out = out << 24 | c;
-    out = out << 32 | d;
-    return(out);
-}
-
-////////////////////////////////////////////////////////////////////////////////
-//
-// Function     : extract_lcloud_registers
-// Description  : Extracts packed LCloudRegisterFrame into its constituent registers
-//
-// Inputs       : resp: packed register frame
-//                b0 ... d1: pointers for the values of each LCloud register
-// Outputs      : 0 if success
-int extract_lcloud_registers(LCloudRegisterFrame resp, int *b0, int *b1, int *c0, int *c1,
- int *c2, int *d0, int *d1) {
-    // Query bits and assign to appropriate register
-    *b0 = ((resp & 0xF000000000000000) >> 60);
-    *b1 = ((resp & 0x0F00000000000000) >> 56);
-    *c0 = ((resp & 0x00FF000000000000) >> 48);
-    *c1 = ((resp & 0x0000FF0000000000) >> 40);
-    *c2 = ((resp & 0x000000FF00000000) >> 32);
-    *d0 = ((resp & 0x00000000FFFF0000) >> 16);
-    *d1 = (resp & 0x000000000000FFFF);
-
-    // Check if any error occurred from response
-    if (*b0 == 1 && *b1 != 1) {
-        return(-1);
-    }
 
-    return(0);
-}
+static LcContext default_ctx = { .pack_blk = { .dev = LC_BLOCK_HOLE } }; // Instance of the functions without a context
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : devprobe_bus
 // Description  : Sends a devprobe signal to the lcloud devices and returns the
 //                id of the device present
-// Inputs       : pointer to array of device IDs
+// Inputs       : ctx: the filesystem
 // Outputs      : 0 if success, -1 if failure
-int devprobe_bus(void) {
+int devprobe_bus(LcContext *ctx) {
     int b0, b1, c0, c1, c2, d0, d1;
     LCloudRegisterFrame resp, devprobe;
     int count = 0;
     if((devprobe = create_lcloud_register(0, 0, LC_DEVPROBE, 0, 0, 0, 0)) == -1 ||
-        (resp = client_lcloud_bus_request(devprobe, NULL)) == -1 ||
+        (resp = lcclient_request(ctx->client, devprobe, NULL)) == -1 ||
         extract_lcloud_registers(resp, &b0, &b1, &c0, &c1, &c2, &d0, &d1) == -1 ||
         b0 != 1 || b1 != 1 || c0 != LC_DEVPROBE) {
         return(-1);
@@ -122,12 +51,12 @@ int devprobe_bus(void) {
     for(int i = 16; i >= 0; i--) {
         if(((d0 & (0x1 << i)) >> i) == 1) {
             if(count == 0) {
-                devices = (LcDevice*) malloc(sizeof(LcDevice));
+                ctx->devices = (LcDevice*) malloc(sizeof(LcDevice));
             } else {
-                devices = (LcDevice*) realloc(devices, (count + 1)*sizeof(LcDevice));
+                ctx->devices = (LcDevice*) realloc(ctx->devices, (count + 1)*sizeof(LcDevice));
             }
-            devices[count].id = i;
-            devc++;
+            ctx->devices[count].id = i;
+            ctx->devc++;
             count++;
         }        
     }
@@ -139,14 +68,14 @@ int devprobe_bus(void) {
 // Function     : pwr_on_bus
 // Description  : Sends a power on signal to the lcloud devices on the cluster
 //
-// Inputs       : void
+// Inputs       : ctx: the filesystem
 // Outputs      : 0 if success, -1 if failure
-int pwr_on_bus(void) {
+int pwr_on_bus(LcContext *ctx) {
     int b0, b1, c0, c1, c2, d0, d1;
     LCloudRegisterFrame pwr_on, resp;
-    pwr = 1;
+    ctx->pwr = 1;
     if((pwr_on = create_lcloud_register(0, 0, LC_POWER_ON, 0, 0, 0, 0)) == -1 ||
-        (resp = client_lcloud_bus_request(pwr_on, NULL)) == -1 ||
+        (resp = lcclient_request(ctx->client, pwr_on, NULL)) == -1 ||
         extract_lcloud_registers(resp, &b0, &b1, &c0, &c1, &c2, &d0, &d1) == -1 ||
         b0 != 1 || b1 != 1 || c0 != LC_POWER_ON) {
         return(-1);
@@ -159,14 +88,14 @@ int pwr_on_bus(void) {
 // Function     : pwr_off_bus
 // Description  : Sends a poer off signal to the lcloud devices on the cluster
 //
-// Inputs       : void
+// Inputs       : ctx: the filesystem
 // Outputs      : 0 if success, -1 if failure
-int pwr_off_bus(void) {
+int pwr_off_bus(LcContext *ctx) {
     int b0, b1, c0, c1, c2, d0, d1;
     LCloudRegisterFrame resp, pwr_off;
-    pwr = 0;
+    ctx->pwr = 0;
     if((pwr_off = create_lcloud_register(0, 0, LC_POWER_OFF, 0, 0, 0, 0)) == -1 ||
-        (resp = client_lcloud_bus_request(pwr_off, NULL)) == -1 ||
+        (resp = lcclient_request(ctx->client, pwr_off, NULL)) == -1 ||
         extract_lcloud_registers(resp, &b0, &b1, &c0, &c1, &c2, &d0, &d1) == -1 ||
         b0 != 1 || b1 != 1 || c0 != LC_POWER_OFF) {
         return(-1);
@@ -176,98 +105,288 @@ int pwr_off_bus(void) {
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : read_bus
-// Description  : Sends a read signal to the specified lcloud device, reads the content
-//                from specified sector and block and copies to buf
+// Function     : device_xfer
+// Description  : Sends a batch of block transfers to the lcloud devices, pipelined
+//                on the bus in the order given, and checks the response to each
+//                (the scheduler sends its round trips through here)
 //
-// Inputs       : buf: pointer to buffer
-//                dev_id: device id to write to
-//                sec: sector to write to
-//                blk: block to write to
+// Inputs       : ctx: the filesystem
+//                dirs: LC_XFER_READ or LC_XFER_WRITE for each block
+//                blks: the blocks to transfer
+//                bufs: buffer for each block (filled by reads)
+//                n: number of blocks
 // Outputs      : 0 if success, -1 if failure
-int read_bus(char *buf, int dev_id, int sec, int blk) {
+int device_xfer(LcContext *ctx, const char *dirs, LcBlock **blks, char **bufs, int n) {
     int b0, b1, c0, c1, c2, d0, d1;
-    LCloudRegisterFrame resp, read;
-    if((read = create_lcloud_register(0, 0, LC_BLOCK_XFER, dev_id, LC_XFER_READ, sec, blk)) == -1 ||
-        (resp = client_lcloud_bus_request(read, buf)) == -1 ||
-        extract_lcloud_registers(resp, &b0, &b1, &c0, &c1, &c2, &d0, &d1) == -1 || 
-        b0 != 1 || b1 != 1 || c0 != LC_BLOCK_XFER) {
-        return(-1);
+    LCloudRegisterFrame regs[LCLOUD_MAX_BATCH], resps[LCLOUD_MAX_BATCH];
+    for(int base = 0; base < n; base += LCLOUD_MAX_BATCH) {
+        int cnt = (n - base < LCLOUD_MAX_BATCH) ? n - base : LCLOUD_MAX_BATCH;
+        for(int i = 0; i < cnt; i++) {
+            LcBlock *blk = blks[base + i];
+            if(ctx == &default_ctx) {
+                // The block trace is process-wide: it follows the default instance
+                lcloud_trace_bus(dirs[base + i], blk->dev, blk->sec, blk->blk);
+            }
+            regs[i] = create_lcloud_register(0, 0, LC_BLOCK_XFER, blk->dev, dirs[base + i], blk->sec, blk->blk);
+        }
+        if(lcclient_batch(ctx->client, regs, (void **) &bufs[base], resps, cnt) == -1) {
+            return(-1);
+        }
+        for(int i = 0; i < cnt; i++) {
+            if(extract_lcloud_registers(resps[i], &b0, &b1, &c0, &c1, &c2, &d0, &d1) == -1 ||
+                b0 != 1 || b1 != 1 || c0 != LC_BLOCK_XFER) {
+                LcBlock *blk = blks[base + i];
+                logMessage(LOG_ERROR_LEVEL, "%s error on block [%d/%d/%d]", (dirs[base + i] == LC_XFER_READ) ? "Read" : "Write",
+                    blk->dev, blk->sec, blk->blk);
+                return(-1);
+            }
+        }
     }
     return(0);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : write_bus
-// Description  : Sends a write signal to the specified lcloud device, writes the contents
-//                of buf to the specified sector and block
+// Function     : xfer_bus
+// Description  : Transfers a batch of blocks: through the staging area while an async
+//                window runs (lcsubmit), otherwise through the device scheduler
 //
-// Inputs       : buf: pointer to buffer
-//                dev_id: device id to write to
-//                sec: sector to write to
-//                blk: block to write to
+// Inputs       : ctx: the filesystem
+//                fh: the file they are for, -1 if none
+//                dir: LC_XFER_READ or LC_XFER_WRITE
+//                blks: the blocks to transfer
+//                bufs: buffer for each block (filled by reads)
+//                n: number of blocks
 // Outputs      : 0 if success, -1 if failure
-int write_bus(char *buf, int dev_id, int sec, int blk) {
-    int b0, b1, c0, c1, c2, d0, d1;
-    LCloudRegisterFrame resp, write;
-    if((write = create_lcloud_register(0, 0, LC_BLOCK_XFER, dev_id, LC_XFER_WRITE, sec, blk)) == -1 ||
-        (resp = client_lcloud_bus_request(write, buf)) == -1 ||
-        extract_lcloud_registers(resp, &b0, &b1, &c0, &c1, &c2, &d0, &d1) == -1 ||
-        b0 != 1 || b1 != 1 || c0 != LC_BLOCK_XFER) {
+int xfer_bus(LcContext *ctx, LcFHandle fh, int dir, LcBlock **blks, char **bufs, int n) {
+    if(ctx->staging) {
+        return(lcloud_async_xfer(ctx, dir, blks, bufs, n, fh));
+    }
+    if(lcloud_sched_queue(ctx, dir, blks, bufs, n, LC_IO_DEMAND, fh) == -1) return(-1);
+    return(lcloud_sched_dispatch(ctx));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : read_bus
+// Description  : Reads a batch of blocks from the lcloud devices
+//
+// Inputs       : ctx: the filesystem
+//                fh: the file they are for, -1 if none
+//                blks: the blocks to read
+//                bufs: buffer for each block
+//                n: number of blocks
+// Outputs      : 0 if success, -1 if failure
+int read_bus(LcContext *ctx, LcFHandle fh, LcBlock **blks, char **bufs, int n) {
+    return(xfer_bus(ctx, fh, LC_XFER_READ, blks, bufs, n));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : read_bus_ahead
+// Description  : Reads a batch of blocks for a file, the first ndemand for the
+//                read in progress and the rest ahead of need.  The blocks read
+//                ahead only go in the round trips the others need, if there are
+//                others: the buffer entries of those that did not go are set to
+//                NULL.
+//
+// Inputs       : ctx: the filesystem
+//                fh: the file
+//                blks: the blocks to read
+//                bufs: buffer for each block
+//                ndemand: number of blocks the read needs
+//                n: number of blocks
+// Outputs      : 0 if success, -1 if failure
+static int read_bus_ahead(LcContext *ctx, LcFHandle fh, LcBlock **blks, char **bufs, int ndemand, int n) {
+    if(ctx->staging) {
+        return(lcloud_async_xfer(ctx, LC_XFER_READ, blks, bufs, n, fh));
+    }
+    if(lcloud_sched_queue(ctx, LC_XFER_READ, blks, bufs, ndemand, LC_IO_DEMAND, fh) == -1 ||
+        lcloud_sched_queue(ctx, LC_XFER_READ, blks + ndemand, bufs + ndemand, n - ndemand, LC_IO_PREFETCH, fh) == -1) {
         return(-1);
     }
-    return(0);
+    return(lcloud_sched_dispatch(ctx));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : write_bus
+// Description  : Writes a batch of blocks to the lcloud devices
+//
+// Inputs       : ctx: the filesystem
+//                fh: the file they are for, -1 if none
+//                blks: the blocks to write
+//                bufs: contents of each block
+//                n: number of blocks
+// Outputs      : 0 if success, -1 if failure
+int write_bus(LcContext *ctx, LcFHandle fh, LcBlock **blks, char **bufs, int n) {
+    return(xfer_bus(ctx, fh, LC_XFER_WRITE, blks, bufs, n));
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : devinit_bus
-// Description  : Sends a devinit signal to the specified lcloud device. Sets number of sectors and blocks
-//                to the device data structure
-// Inputs       : dev: LcDevice struct of device to initialize
+// Description  : Sends a devinit signal to each of the lcloud devices, pipelined on the bus. Sets
+//                number of sectors and blocks to the device data structures
+// Inputs       : ctx: the filesystem
+//                devs: LcDevice structs of the devices to initialize
+//                n: number of devices
 // Outputs      : 0 if success, -1 if failure
-int devinit_bus(LcDevice *dev) {
+int devinit_bus(LcContext *ctx, LcDevice *devs, int n) {
     int b0, b1, c0, c1, c2, d0, d1;
-    LCloudRegisterFrame resp, devinit;
-    if((devinit = create_lcloud_register(0, 0, LC_DEVINIT, dev->id, 0, 0, 0)) == -1 ||
-        (resp = client_lcloud_bus_request(devinit, NULL)) == -1 ||
-        extract_lcloud_registers(resp, &b0, &b1, &c0, &c1, &c2, &d0, &d1) == -1 ||
-        b0 != 1 || b1 != 1 || c0 != LC_DEVINIT || c2 != dev->id) {
+    LCloudRegisterFrame regs[LCLOUD_MAX_BATCH], resps[LCLOUD_MAX_BATCH];
+    for(int base = 0; base < n; base += LCLOUD_MAX_BATCH) {
+        int cnt = (n - base < LCLOUD_MAX_BATCH) ? n - base : LCLOUD_MAX_BATCH;
+        for(int i = 0; i < cnt; i++) {
+            regs[i] = create_lcloud_register(0, 0, LC_DEVINIT, devs[base + i].id, 0, 0, 0);
+        }
+        if(lcclient_batch(ctx->client, regs, NULL, resps, cnt) == -1) {
             return(-1);
         }
-    dev->num_sec = d0;
-    dev->num_blk = d1;
+        for(int i = 0; i < cnt; i++) {
+            LcDevice *dev = &devs[base + i];
+            if(extract_lcloud_registers(resps[i], &b0, &b1, &c0, &c1, &c2, &d0, &d1) == -1 ||
+                b0 != 1 || b1 != 1 || c0 != LC_DEVINIT || c2 != dev->id) {
+                logMessage(LOG_ERROR_LEVEL, "Initialization error on device %d", dev->id);
+                return(-1);
+            }
+            dev->num_sec = d0;
+            dev->num_blk = d1;
+            dev->next_sec = 0;
+            dev->next_blk = 0;
+            dev->full = 0;
+        }
+    }
     return(0);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : device_take
+// Description  : Assigns the next free block of a device to a file block
+//
+// Inputs       : dev: the device (not full)
+//                blk: the file block
+// Outputs      : void
+static void device_take(LcDevice *dev, LcBlock *blk) {
+    blk->dev = dev->id;
+    blk->sec = dev->next_sec;
+    blk->blk = dev->next_blk;
+    blk->frag_off = 0;
+    blk->frag_len = 0;
+
+    dev->next_blk += 1;
+    if(dev->next_blk == dev->num_blk) {
+        dev->next_sec += 1;
+        dev->next_blk = 0;
+    }
+
+    if(dev->next_sec == dev->num_sec) {
+        dev->full = 1;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : device_free
+// Description  : Counts the blocks a device has left (they are contiguous, blocks are
+//                handed out in order)
+//
+// Inputs       : dev: the device
+// Outputs      : number of free blocks
+static uint32_t device_free(LcDevice *dev) {
+    if(dev->full) return(0);
+    return((uint32_t) (dev->num_sec - dev->next_sec) * dev->num_blk - dev->next_blk);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : block_take
+// Description  : Assigns the next available device block to a block (one freed by
+//                block sharing first)
+//
+// Inputs       : ctx: the filesystem
+//                blk: the block
+// Outputs      : 0 if success, -1 if every device is full
+static int block_take(LcContext *ctx, LcBlock *blk) {
+    if(ctx->free_nblks > 0) {
+        *blk = ctx->free_blks[--ctx->free_nblks];
+        return(0);
+    }
+    for(int i = 0; i < ctx->devc; i++) {
+        if(ctx->devices[i].full == 0) {
+            device_take(&ctx->devices[i], blk);
+            blk->unwritten = 0;
+            return(0);
+        }
+    }
+    logMessage(LOG_ERROR_LEVEL, "No free blocks left on the devices");
+    return(-1);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : block_assign_helper
 // Description  : Assigns blocks start through end in given file to next available blocks
-// Inputs       : file: LcFile pointer
+// Inputs       : ctx: the filesystem
+//                file: LcFile pointer
 //                start, end: block indices to start and end assignment  
-// Outputs      : 0 if success
-int block_assign_helper(LcFile *file, int start, int end) {
+// Outputs      : 0 if success, -1 if every device is full
+int block_assign_helper(LcContext *ctx, LcFile *file, int start, int end) {
+    for(int b = start; b < end; b++) {
+        if(block_take(ctx, &file->blocks[b]) == -1) {
+            return(-1);
+        }
+    }
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : extent_assign_helper
+// Description  : Assigns the holes among blocks start through end in given file to
+//                consecutive device blocks: all on the first device with room for them,
+//                otherwise split over the devices with the most room
+// Inputs       : ctx: the filesystem
+//                file: LcFile pointer
+//                start, end: block indices to start and end assignment
+// Outputs      : 0 if success, -1 if the devices do not have enough free blocks
+int extent_assign_helper(LcContext *ctx, LcFile *file, int start, int end) {
+    uint32_t holes = 0, avail = 0;
     for(int b = start; b < end; b++) {
-        for(int i = 0; i < devc; i++) {
-            LcDevice *dev = &devices[i];
-            if(dev->full == 0) {
-                file->blocks[b].dev = dev->id;
-                file->blocks[b].sec = dev->next_sec;
-                file->blocks[b].blk = dev->next_blk;
-
-                dev->next_blk += 1;
-                if(dev->next_blk == dev->num_blk) {
-                    dev->next_sec += 1;
-                    dev->next_blk = 0;
-                }
-
-                if(dev->next_sec == dev->num_sec) {
-                    dev->full = 1;
-                }
+        holes += (file->blocks[b].dev == LC_BLOCK_HOLE);
+    }
+    for(int i = 0; i < ctx->devc; i++) {
+        avail += device_free(&ctx->devices[i]);
+    }
+    if(holes > avail) {
+        logMessage(LOG_ERROR_LEVEL, "Cannot reserve %u blocks, %u free on the devices", holes, avail);
+        return(-1);
+    }
+
+    int b = start;
+    while(holes > 0) {
+        // First fit, or the device with the most room for a partial extent
+        LcDevice *dev = NULL;
+        for(int i = 0; i < ctx->devc; i++) {
+            if(device_free(&ctx->devices[i]) >= holes) {
+                dev = &ctx->devices[i];
                 break;
             }
+            if(dev == NULL || device_free(&ctx->devices[i]) > device_free(dev)) {
+                dev = &ctx->devices[i];
+            }
+        }
+
+        // Fill the holes in file order from the device's next block
+        uint32_t take = device_free(dev);
+        if(take > holes) take = holes;
+        holes -= take;
+        for(; take > 0; b++) {
+            if(file->blocks[b].dev == LC_BLOCK_HOLE) {
+                device_take(dev, &file->blocks[b]);
+                take--;
+            }
         }
     }
     return(0);
@@ -275,98 +394,632 @@ int block_assign_helper(LcFile *file, int start, int end) {
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : lcopen
-// Description  : Open the file for for reading and writing
+// Function     : block_map_grow
+// Description  : Extends a file's block map to n blocks, the new entries are holes
 //
-// Inputs       : path - the path/filename of the file to be read
-// Outputs      : file handle if successful test, -1 if failure
-LcFHandle lcopen( const char *path ) {
-    // Check if file is already open
-    for(int i = 0; i < filec; i++) {
-        if(strcmp(files[i].path, path) == 0 && files[i].open == 1) {
-            logMessage(LOG_ERROR_LEVEL, "File already open");
+// Inputs       : file: LcFile pointer
+//                n: number of blocks
+// Outputs      : 0 if success, -1 if failure
+static int block_map_grow(LcFile *file, uint32_t n) {
+    LcBlock *blocks;
+    if(n <= file->num_blocks) return(0);
+    if((blocks = (LcBlock*) realloc(file->blocks, n * sizeof(LcBlock))) == NULL) {
+        logMessage(LOG_ERROR_LEVEL, "Memory allocation error");
+        return(-1);
+    }
+    file->blocks = blocks;
+    for(uint32_t b = file->num_blocks; b < n; b++) {
+        file->blocks[b].dev = LC_BLOCK_HOLE;
+        file->blocks[b].sec = 0;
+        file->blocks[b].blk = 0;
+        file->blocks[b].unwritten = 0;
+        file->blocks[b].frag_off = 0;
+        file->blocks[b].frag_len = 0;
+    }
+    file->num_blocks = n;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : block_fetch
+// Description  : Gets the contents of a device block, from the cache if it holds it
+//
+// Inputs       : ctx: the filesystem
+//                blk: the block
+//                buf: buffer for the contents
+// Outputs      : 0 if success, -1 if failure
+static int block_fetch(LcContext *ctx, LcBlock *blk, char *buf) {
+    char *cache_blk = lccache_get(ctx->cache, blk->dev, blk->sec, blk->blk);
+    if(cache_blk != NULL) {
+        memcpy(buf, cache_blk, LC_DEVICE_BLOCK_SIZE);
+        return(0);
+    }
+    if(read_bus(ctx, -1, &blk, &buf, 1) == -1) {
+        return(-1);
+    }
+    return(lccache_put(ctx->cache, blk->dev, blk->sec, blk->blk, buf));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : pack_size
+// Description  : Gives the fragment a last block holding n bytes packs into
+//
+// Inputs       : ctx: the filesystem
+//                n: bytes in the block
+// Outputs      : fragment length, 0 if the block should be a device block of its own
+static uint32_t pack_size(LcContext *ctx, size_t n) {
+    uint32_t frag = (n + LC_PACK_FRAG - 1) / LC_PACK_FRAG * LC_PACK_FRAG;
+    return((ctx->pack_tails && n > 0 && frag < LC_DEVICE_BLOCK_SIZE) ? frag : 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : pack_release
+// Description  : Returns a packed tail's fragment to the free fragments
+//
+// Inputs       : ctx: the filesystem
+//                blk: the packed block
+// Outputs      : 0 if success, -1 if failure
+static int pack_release(LcContext *ctx, LcBlock *blk) {
+    if(ctx->pack_nfree == ctx->pack_free_cap) {
+        LcBlock *grown;
+        uint32_t cap = (ctx->pack_free_cap == 0) ? 64 : ctx->pack_free_cap * 2;
+        if((grown = realloc(ctx->pack_free, cap * sizeof(LcBlock))) == NULL) {
+            logMessage(LOG_ERROR_LEVEL, "Memory allocation error");
             return(-1);
         }
+        ctx->pack_free = grown;
+        ctx->pack_free_cap = cap;
     }
+    ctx->pack_free[ctx->pack_nfree++] = *blk;
+    return(0);
+}
 
-    // Check if the device cluster is powered on - if not, sends pwr_on signal
-    if(pwr == 0) {
-        if(pwr_on_bus() == -1) return(-1);
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : pack_alloc
+// Description  : Gives a block a fragment of len bytes: the best fitting free fragment,
+//                else the next bytes of the current shared block (a new shared block
+//                when it is out of room, the rest of the old one becomes free)
+//
+// Inputs       : ctx: the filesystem
+//                blk: the block (a hole)
+//                len: fragment length (a multiple of LC_PACK_FRAG)
+// Outputs      : 1 if nothing else is stored in the fragment's device block yet,
+//                0 if it is shared, -1 if every device is full
+static int pack_alloc(LcContext *ctx, LcBlock *blk, uint32_t len) {
+    int best = -1;
+    for(uint32_t i = 0; i < ctx->pack_nfree; i++) {
+        if(ctx->pack_free[i].frag_len >= len && (best == -1 || ctx->pack_free[i].frag_len < ctx->pack_free[best].frag_len)) {
+            best = i;
+        }
+    }
+    if(best != -1) {
+        *blk = ctx->pack_free[best];
+        ctx->pack_free[best] = ctx->pack_free[--ctx->pack_nfree];
+        return(0);
+    }
 
-        // Probe for available devices, store in device array
-        if(devprobe_bus() == -1) return(-1);
+    if(ctx->pack_blk.dev == LC_BLOCK_HOLE || ctx->pack_fill + len > LC_DEVICE_BLOCK_SIZE) {
+        if(ctx->pack_blk.dev != LC_BLOCK_HOLE && ctx->pack_fill < LC_DEVICE_BLOCK_SIZE) {
+            ctx->pack_blk.frag_off = ctx->pack_fill;
+            ctx->pack_blk.frag_len = LC_DEVICE_BLOCK_SIZE - ctx->pack_fill;
+            if(pack_release(ctx, &ctx->pack_blk) == -1) return(-1);
+        }
+        if(block_take(ctx, &ctx->pack_blk) == -1) return(-1);
+        ctx->pack_fill = 0;
+        ctx->pack_blocks++;
+    }
+    *blk = ctx->pack_blk;
+    blk->frag_off = ctx->pack_fill;
+    blk->frag_len = len;
+    ctx->pack_fill += len;
+    return(blk->frag_off == 0);
+}
 
-        // Initialize devices
-        for(int i = 0; i < devc; i++) {
-            // Retrieve sector and block info from devices
-            if(devinit_bus(&devices[i]) == -1) {
-                return(-1);
-            } 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : pack_place
+// Description  : Places a file's last bytes in a new fragment with room for want bytes,
+//                or in a device block of its own if that is too many to pack
+//
+// Inputs       : ctx: the filesystem
+//                blk: the block (it gets the fragment or device block)
+//                data: the bytes
+//                keep: number of bytes
+//                want: bytes the block has to hold
+// Outputs      : 0 if success, -1 if failure
+static int pack_place(LcContext *ctx, LcBlock *blk, char *data, size_t keep, size_t want) {
+    char tmp[LC_DEVICE_BLOCK_SIZE], *bp = tmp;
+    uint32_t frag = pack_size(ctx, want);
+    int fresh;
 
-            devices[i].next_sec = 0;
-            devices[i].next_blk = 0;
-            devices[i].full = 0;
-        }
+    if(frag > 0) {
+        if((fresh = pack_alloc(ctx, blk, frag)) == -1) return(-1);
+    } else {
+        if(block_take(ctx, blk) == -1) return(-1);
+        fresh = 1;
+    }
+    if(fresh) {
+        memset(tmp, 0, LC_DEVICE_BLOCK_SIZE);
+    } else if(block_fetch(ctx, blk, tmp) == -1) {
+        return(-1);
+    }
+    memset(tmp + blk->frag_off, 0, (blk->frag_len > 0) ? blk->frag_len : LC_DEVICE_BLOCK_SIZE);
+    memcpy(tmp + blk->frag_off, data, keep);
+    if(write_bus(ctx, -1, &blk, &bp, 1) == -1) return(-1);
+    return(lccache_put(ctx->cache, blk->dev, blk->sec, blk->blk, tmp));
+}
 
-        // Initialize cache
-        if(lcloud_initcache(LC_CACHE_MAXBLOCKS) == -1) return(-1);
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : pack_move
+// Description  : Moves a file's packed last block to a fragment with room for want
+//                bytes, or to a device block of its own if that is too many to pack
+//
+// Inputs       : ctx: the filesystem
+//                file: LcFile pointer
+//                b: the packed block
+//                keep: bytes of the file in the block
+//                want: bytes the block has to hold
+// Outputs      : 0 if success, -1 if failure
+static int pack_move(LcContext *ctx, LcFile *file, uint32_t b, size_t keep, size_t want) {
+    char data[LC_DEVICE_BLOCK_SIZE], tmp[LC_DEVICE_BLOCK_SIZE];
+    LcBlock *blk = &file->blocks[b];
+    uint32_t frag = pack_size(ctx, want);
+
+    // The last fragment carved from the current shared block grows in place (the bytes
+    // after it were zeroed when the block was opened)
+    if(frag > 0 && blk->dev == ctx->pack_blk.dev && blk->sec == ctx->pack_blk.sec && blk->blk == ctx->pack_blk.blk &&
+        blk->frag_off + blk->frag_len == ctx->pack_fill && blk->frag_off + frag <= LC_DEVICE_BLOCK_SIZE) {
+        blk->frag_len = frag;
+        ctx->pack_fill = blk->frag_off + frag;
+        return(0);
     }
 
-    // Check if file has been created already
-    for(int i = 0; i < filec; i++) {
-        if(strcmp(files[i].path, path) == 0) {
-            files[i].open = 1;
-            return(files[i].handle);
+    // Save the file's bytes, free the fragment
+    if(block_fetch(ctx, blk, tmp) == -1) return(-1);
+    memcpy(data, tmp + blk->frag_off, keep);
+    if(pack_release(ctx, blk) == -1) return(-1);
+
+    // Place them in the new fragment or block
+    return(pack_place(ctx, blk, data, keep, want));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : block_share_write
+// Description  : Gets a whole block ready for new contents: with deduplication on, a
+//                device block already holding them is shared instead of writing it;
+//                otherwise a block other file blocks share is copied (the block gets a
+//                device block of its own) and the new contents are indexed
+//
+// Inputs       : ctx: the filesystem
+//                blk: the block (not a hole or packed)
+//                data: its new contents
+// Outputs      : 1 if it now shares a device block, 2 if its device block already holds
+//                the contents, 0 if it must be written, -1 if failure
+static int block_share_write(LcContext *ctx, LcBlock *blk, char *data) {
+    LcBlock found;
+    int known = 0;
+    if(ctx->dedup_blocks && (known = lcloud_dedup_find(ctx, data, &found)) == -1) {
+        return(-1);
+    }
+    if(known) {
+        if(found.dev == blk->dev && found.sec == blk->sec && found.blk == blk->blk) return(2);
+        if(lcloud_dedup_ref(ctx, &found) == -1 || lcloud_dedup_unref(ctx, blk) == -1) return(-1);
+        *blk = found;
+        ctx->stats.blocks_deduped++;
+        return(1);
+    }
+
+    if(lcloud_dedup_refs(ctx, blk) > 1) {
+        if(lcloud_dedup_unref(ctx, blk) == -1 || block_take(ctx, blk) == -1) return(-1);
+        ctx->stats.blocks_copied++;
+    } else {
+        lcloud_dedup_forget(ctx, blk);
+    }
+    return(ctx->dedup_blocks ? lcloud_dedup_record(ctx, blk) : 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : block_follows
+// Description  : Checks whether block b is the device block right after block a
+//
+// Inputs       : ctx: the filesystem
+//                a, b: the blocks
+// Outputs      : 1 if b follows a, 0 if not
+static int block_follows(LcContext *ctx, LcBlock *a, LcBlock *b) {
+    if(a->dev != b->dev || a->dev == LC_BLOCK_HOLE) return(0);
+    if(b->sec == a->sec && b->blk == a->blk + 1) return(1);
+    if(b->sec != a->sec + 1 || b->blk != 0) return(0);
+
+    // Crossing into the next sector: a must be the sector's last block
+    for(int i = 0; i < ctx->devc; i++) {
+        if(ctx->devices[i].id == a->dev) return(a->blk == ctx->devices[i].num_blk - 1);
+    }
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : plan_io
+// Description  : Splits the byte range [off, off + len) of a file into one segment per
+//                block it touches (exactly, no block past the end), and groups
+//                consecutive segments on consecutive device blocks into runs
+//
+// Inputs       : ctx: the filesystem
+//                file: LcFile pointer (blocks covering the range in its map, holes allowed)
+//                off, len: the byte range
+//                plan: the plan to fill (its arrays are reused and grown)
+// Outputs      : 0 if success, -1 if failure
+int plan_io(LcContext *ctx, LcFile *file, size_t off, size_t len, LcIoPlan *plan) {
+    size_t first = off / LC_DEVICE_BLOCK_SIZE;
+    uint32_t n = (len == 0) ? 0 : (off + len - 1) / LC_DEVICE_BLOCK_SIZE - first + 1;
+
+    // Grow the plan's arrays
+    if(n > plan->cap) {
+        LcIoSeg *segs;
+        LcIoRun *runs;
+        if((segs = realloc(plan->segs, n * sizeof(LcIoSeg))) == NULL) return(-1);
+        plan->segs = segs;
+        if((runs = realloc(plan->runs, n * sizeof(LcIoRun))) == NULL) return(-1);
+        plan->runs = runs;
+        plan->cap = n;
+    }
+
+    plan->num_segs = n;
+    plan->num_runs = 0;
+    for(uint32_t i = 0; i < n; i++) {
+        LcIoSeg *seg = &plan->segs[i];
+        seg->index = first + i;
+        seg->off = (i == 0) ? off % LC_DEVICE_BLOCK_SIZE : 0;
+        seg->len = (len < (size_t) (LC_DEVICE_BLOCK_SIZE - seg->off)) ? len : LC_DEVICE_BLOCK_SIZE - seg->off;
+        len -= seg->len;
+
+        // Start a new run unless this block follows the previous one on the device
+        if(i == 0 || !block_follows(ctx, &file->blocks[seg->index - 1], &file->blocks[seg->index])) {
+            plan->runs[plan->num_runs].first = i;
+            plan->runs[plan->num_runs].count = 0;
+            plan->num_runs++;
         }
+        plan->runs[plan->num_runs - 1].count++;
     }
-    
-    // Create a new file
-    // Allocate memory for file table
-    if(filec == 0) {
-        if((files = (LcFile*) malloc(sizeof(LcFile))) == NULL) {
-            logMessage(LOG_ERROR_LEVEL, "Memory allocation error");
-            return(-1);
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : io_reserve
+// Description  : Makes sure the I/O scratch space holds n segments
+//
+// Inputs       : ctx: the filesystem
+//                n: number of segments
+// Outputs      : 0 if success, -1 if failure
+static int io_reserve(LcContext *ctx, uint32_t n) {
+    char *data, **bufs, *fresh;
+    LcBlock **blks;
+    uint32_t *miss;
+    if(n <= ctx->io_cap) return(0);
+
+    // Keep each array as soon as it grows, so a failure leaves none lost (they
+    // all still hold the old capacity)
+    if((data = realloc(ctx->io_data, (size_t) n * LC_DEVICE_BLOCK_SIZE)) == NULL) goto fail;
+    ctx->io_data = data;
+    if((blks = realloc(ctx->io_blks, n * sizeof(LcBlock *))) == NULL) goto fail;
+    ctx->io_blks = blks;
+    if((bufs = realloc(ctx->io_bufs, n * sizeof(char *))) == NULL) goto fail;
+    ctx->io_bufs = bufs;
+    if((miss = realloc(ctx->io_miss, n * sizeof(uint32_t))) == NULL) goto fail;
+    ctx->io_miss = miss;
+    if((fresh = realloc(ctx->io_fresh, n)) == NULL) goto fail;
+    ctx->io_fresh = fresh;
+    ctx->io_cap = n;
+    return(0);
+
+fail:
+    logMessage(LOG_ERROR_LEVEL, "Memory allocation error");
+    return(-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : io_seg_data
+// Description  : Offset in the caller's buffer of a planned segment's data
+//
+// Inputs       : plan: the plan
+//                i: the segment
+// Outputs      : the offset
+static size_t io_seg_data(LcIoPlan *plan, uint32_t i) {
+    return((i == 0) ? 0 : (size_t) i * LC_DEVICE_BLOCK_SIZE - plan->segs[0].off);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : advice_at
+// Description  : Gives the access pattern lcadvise set for a block of a file
+//
+// Inputs       : file: LcFile pointer
+//                index: block of the file
+// Outputs      : the advice, LC_ADV_NORMAL if none covers the block
+static LcAdvice advice_at(LcFile *file, uint32_t index) {
+    size_t off = (size_t) index * LC_DEVICE_BLOCK_SIZE;
+    if(file->advice == LC_ADV_NORMAL || off + LC_DEVICE_BLOCK_SIZE <= file->adv_off ||
+        (file->adv_len > 0 && off >= file->adv_off + file->adv_len)) {
+        return(LC_ADV_NORMAL);
+    }
+    return(file->advice);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_fill
+// Description  : Puts a block of a file in the cache, as the next to evict if the
+//                file was advised it will not be reused
+//
+// Inputs       : ctx: the filesystem
+//                file: LcFile pointer
+//                index: block of the file
+//                buf: the block's contents
+// Outputs      : 0 if success, -1 if failure
+static int cache_fill(LcContext *ctx, LcFile *file, uint32_t index, char *buf) {
+    LcBlock *blk = &file->blocks[index];
+    if(advice_at(file, index) == LC_ADV_NOREUSE) {
+        return(lccache_put_cold(ctx->cache, blk->dev, blk->sec, blk->blk, buf));
+    }
+    return(lccache_put(ctx->cache, blk->dev, blk->sec, blk->blk, buf));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fetch_range
+// Description  : Adds the written blocks from block first on that the cache does not
+//                hold to the I/O batch, up to a limit
+//
+// Inputs       : ctx: the filesystem
+//                file: LcFile pointer
+//                first, end: block indices of the range
+//                n: entries already in the batch (io_data has room for limit more
+//                   after slot base)
+//                base: first io_data slot to use
+//                limit: blocks to add at most
+// Outputs      : blocks added
+static int fetch_range(LcContext *ctx, LcFile *file, uint32_t first, uint32_t end, int n, uint32_t base, int limit) {
+    int added = 0;
+    if(end > file->num_blocks) end = file->num_blocks;
+    for(uint32_t b = first; b < end && added < limit; b++) {
+        LcBlock *blk = &file->blocks[b];
+        if(blk->dev == LC_BLOCK_HOLE || blk->unwritten || lccache_holds(ctx->cache, blk->dev, blk->sec, blk->blk)) {
+            continue;
         }
-    } else {
-        if((files = (LcFile*) realloc(files, (filec + 1) * sizeof(LcFile))) == NULL) {
-            logMessage(LOG_ERROR_LEVEL, "Memory allocation error");
+        ctx->io_blks[n + added] = blk;
+        ctx->io_bufs[n + added] = &ctx->io_data[(size_t) (base + added) * LC_DEVICE_BLOCK_SIZE];
+        ctx->io_miss[n + added] = b;
+        added++;
+    }
+    return(added);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_owner
+// Description  : Identify the device contents for the second tier cache.
+//                Blocks are encrypted with the connection's key, which the
+//                caller gives again at every power on that reads them (the
+//                checkpoint only checks it), so it names the contents the
+//                cached blocks belong to.
+//
+// Inputs       : ctx: the filesystem
+// Outputs      : hash of the key and IV, 0 if there is no key
+static uint64_t cache_owner(LcContext *ctx) {
+    char key[2 * LCLOUD_CIPHER_KEYLEN];
+    uint64_t h = 0xcbf29ce484222325ULL;
+    if(lcclient_get_cipher(ctx->client, key, key + LCLOUD_CIPHER_KEYLEN) == -1) return(0);
+    for(size_t i = 0; i < sizeof(key); i++) {
+        h = (h ^ (uint8_t) key[i]) * 0x100000001b3ULL;
+    }
+    return(h);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : file_table_reserve
+// Description  : Make room in the file table for at least n files
+//
+// Inputs       : ctx: the filesystem
+//                n: files the table must hold
+// Outputs      : 0 if success, -1 if failure
+static int file_table_reserve(LcContext *ctx, int n) {
+    LcFile *table;
+    int cap = (ctx->files_cap > 0) ? ctx->files_cap : LC_FILE_TABLE_INIT;
+    if(n <= ctx->files_cap) return(0);
+    while(cap < n) cap *= 2;
+    if((table = (LcFile*) realloc(ctx->files, cap * sizeof(LcFile))) == NULL) {
+        logMessage(LOG_ERROR_LEVEL, "Memory allocation error");
+        return(-1);
+    }
+    ctx->files = table;
+    ctx->files_cap = cap;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : init_phase
+// Description  : Time a bring-up phase
+//
+// Inputs       : mark: when the phase started, moved to now
+// Outputs      : nanoseconds since mark
+static uint64_t init_phase(struct timespec *mark) {
+    struct timespec now;
+    uint64_t ns;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ns = (uint64_t) (now.tv_sec - mark->tv_sec) * 1000000000ULL + now.tv_nsec - mark->tv_nsec;
+    *mark = now;
+    return(ns);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcinit_ctx
+// Description  : Bring up the filesystem ahead of the first open: load the metadata
+//                checkpoint, connect, power on, probe and initialize the devices (all
+//                their devinit requests in one pipelined batch), and allocate the
+//                cache and file table
+//
+// Inputs       : ctx - the filesystem
+//                stats: (output) time spent in each phase, or NULL
+// Outputs      : 0 if success (or already up), -1 if failure
+int lcinit_ctx( LcContext *ctx, LcInitStats *stats ) {
+    LcInitStats st;
+    struct timespec start, mark;
+
+    memset(&st, 0, sizeof(st));
+    if(ctx->pwr == 1) {
+        if(stats != NULL) *stats = st;
+        return(0);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    mark = start;
+
+    // Load the metadata checkpoint's directory, if there is one
+    if(lcloud_meta_load(ctx) == -1) return(-1);
+    st.meta_ns = init_phase(&mark);
+
+    if(lcclient_connect(ctx->client) == -1) goto fail;
+    st.connect_ns = init_phase(&mark);
+
+    if(pwr_on_bus(ctx) == -1) goto fail;
+    st.power_ns = init_phase(&mark);
+
+    // Probe for available devices, store in device array
+    if(devprobe_bus(ctx) == -1) goto fail;
+    st.probe_ns = init_phase(&mark);
+
+    // Retrieve sector and block info from devices
+    if(devinit_bus(ctx, ctx->devices, ctx->devc) == -1) goto fail;
+    if(lcloud_meta_devices(ctx) == -1) goto fail;
+    st.devinit_ns = init_phase(&mark);
+
+    // Initialize cache (its second tier keeps blocks of these device contents) and file table
+    lccache_l2_owner(ctx->cache, cache_owner(ctx));
+    if(lccache_init(ctx->cache, LC_CACHE_MAXBLOCKS) == -1) goto fail;
+    if(file_table_reserve(ctx, LC_FILE_TABLE_INIT) == -1) goto fail;
+    st.table_ns = init_phase(&mark);
+
+    st.total_ns = init_phase(&start);
+    st.devices = ctx->devc;
+    logMessage(LcDriverLLevel, "Filesystem up in %.3f ms (%d devices): checkpoint %.3f, connect %.3f, power on %.3f, "
+        "probe %.3f, devinit %.3f, cache and file table %.3f ms", st.total_ns / 1e6, ctx->devc, st.meta_ns / 1e6,
+        st.connect_ns / 1e6, st.power_ns / 1e6, st.probe_ns / 1e6, st.devinit_ns / 1e6, st.table_ns / 1e6);
+    if(stats != NULL) *stats = st;
+    return(0);
+
+fail:
+    // What the checkpoint loaded would be loaded over at the next try
+    lcloud_meta_unload(ctx);
+    return(-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcopen_ctx
+// Description  : Open the file for for reading and writing
+//
+// Inputs       : ctx - the filesystem
+//                path - the path/filename of the file to be read
+// Outputs      : file handle if successful test, -1 if failure
+LcFHandle lcopen_ctx( LcContext *ctx, const char *path ) {
+    // Check if file is already open
+    for(int i = 0; i < ctx->filec; i++) {
+        if(strcmp(ctx->files[i].path, path) == 0 && ctx->files[i].open == 1) {
+            logMessage(LOG_ERROR_LEVEL, "File already open");
             return(-1);
         }
     }
 
+    // Bring the filesystem up if lcinit has not
+    if(ctx->pwr == 0 && lcinit_ctx(ctx, NULL) == -1) return(-1);
+
+    // Check if file has been created already
+    for(int i = 0; i < ctx->filec; i++) {
+        if(strcmp(ctx->files[i].path, path) == 0) {
+            // Block maps of checkpointed files are loaded on first open
+            if(ctx->files[i].blocks == NULL && ctx->files[i].num_blocks > 0 && lcloud_meta_load_map(ctx, &ctx->files[i]) == -1) {
+                return(-1);
+            }
+            ctx->files[i].open = 1;
+            ctx->files[i].advice = LC_ADV_NORMAL;
+            ctx->files[i].will_first = ctx->files[i].will_end = 0;
+            return(ctx->files[i].handle);
+        }
+    }
+    
+    // Create a new file
+    // Make room in the file table
+    if(file_table_reserve(ctx, ctx->filec + 1) == -1) return(-1);
 
     // Copy path string to file struct
-    if((files[filec].path = malloc(strlen(path) + 1)) == NULL) return(-1);
-    strcpy(files[filec].path, path);
+    if((ctx->files[ctx->filec].path = malloc(strlen(path) + 1)) == NULL) return(-1);
+    strcpy(ctx->files[ctx->filec].path, path);
 
     // Initialize open file to default fields
-    files[filec].handle = filec;
-    files[filec].pos = 0;
-    files[filec].size = 0;
-    files[filec].blocks = NULL;
-    files[filec].open = 1;
-    filec++;
-
-    return(files[filec - 1].handle);
+    ctx->files[ctx->filec].handle = ctx->filec;
+    ctx->files[ctx->filec].pos = 0;
+    ctx->files[ctx->filec].size = 0;
+    ctx->files[ctx->filec].blocks = NULL;
+    ctx->files[ctx->filec].num_blocks = 0;
+    ctx->files[ctx->filec].open = 1;
+    ctx->files[ctx->filec].map_off = 0;
+    ctx->files[ctx->filec].dirty = 1;
+    ctx->files[ctx->filec].advice = LC_ADV_NORMAL;
+    ctx->files[ctx->filec].will_first = ctx->files[ctx->filec].will_end = 0;
+    ctx->filec++;
+
+    return(ctx->files[ctx->filec - 1].handle);
 } 
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : lcread
+// Function     : lcopen_hint_ctx
+// Description  : Open the file for reading and writing, reserving contiguous device
+//                blocks for the size it is expected to reach
+//
+// Inputs       : ctx - the filesystem
+//                path - the path/filename of the file to be read
+//                size - the expected size of the file in bytes (0 for no hint)
+// Outputs      : file handle if successful test, -1 if failure
+LcFHandle lcopen_hint_ctx( LcContext *ctx, const char *path, size_t size ) {
+    LcFHandle fh;
+    if((fh = lcopen_ctx(ctx, path)) == -1) return(-1);
+    if(size > 0 && lcfallocate_ctx(ctx, fh, 0, size) == -1) {
+        lcclose_ctx(ctx, fh);
+        return(-1);
+    }
+    return(fh);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcread_ctx
 // Description  : Read data from the file 
 //
-// Inputs       : fh - file handle for the file to read from
+// Inputs       : ctx - the filesystem
+//                fh - file handle for the file to read from
 //                buf - place to put the data
 //                len - the length of the read
 // Outputs      : number of bytes read, -1 if failure
-int lcread( LcFHandle fh, char *buf, size_t len ) {
+int lcread_ctx( LcContext *ctx, LcFHandle fh, char *buf, size_t len ) {
     // File handle is incorrent, file is not open
-    if(fh >= filec || files[fh].open == 0) {
+    if(fh >= ctx->filec || ctx->files[fh].open == 0) {
         logMessage(LOG_ERROR_LEVEL, "File not open");
         return(-1);
     }
     // Devices not powered on (i.e. no files are opened)
-    if(pwr == 0) {
+    if(ctx->pwr == 0) {
         logMessage(LOG_ERROR_LEVEL, "Device(s) not powered on");
         return(-1);
     }
@@ -375,79 +1028,114 @@ int lcread( LcFHandle fh, char *buf, size_t len ) {
     /* INITIALIZE READ */
     ////////////////////
     // Reset buffer
-    LcFile *open_file = &files[fh];
+    LcFile *open_file = &ctx->files[fh];
     memset(buf, 0, len);
-    char *tmp = calloc(LC_DEVICE_BLOCK_SIZE, sizeof(char));
 
-    // Number of reads that are performed
-    // (position in block) + (write length) / (block size) [rounded up]
-    int blocks_to_read = (open_file->pos % LC_DEVICE_BLOCK_SIZE + len + LC_DEVICE_BLOCK_SIZE) / LC_DEVICE_BLOCK_SIZE;
+    // Truncate read length if it goes beyond EOF
+    size_t read_len = len;
+    if(open_file->pos >= open_file->size) {
+        read_len = 0;
+    } else if(open_file->pos + read_len > open_file->size) {
+        read_len = open_file->size - open_file->pos;
+    }
+
+    // Plan the blocks the read touches
+    if(plan_io(ctx, open_file, open_file->pos, read_len, &ctx->io_plan) == -1 ||
+        io_reserve(ctx, ctx->io_plan.num_segs + ((open_file->advice == LC_ADV_SEQUENTIAL) ? LC_ADVISE_READAHEAD : 0) +
+            ((ctx->prefetch != NULL) ? LC_PREFETCH_DEGREE : 0) + ((open_file->will_first < open_file->will_end) ? LC_ADVISE_READAHEAD : 0)) == -1) {
+        return(-1);
+    }
 
     ////////////
     /* READS */
     //////////
-    // Length remaining in read
-    size_t current_len = len;
-
-    // Truncate read length if it goes beyond EOF
-    if(open_file->pos + current_len > open_file->size) {
-        // Change length of read to be until end of file
-        current_len = open_file->size - open_file->pos;
-    }
-
-    for(int i = 0; i < blocks_to_read; i++) {
-        // Calculate current block
-        int current_index = ((open_file->pos + LC_DEVICE_BLOCK_SIZE) / LC_DEVICE_BLOCK_SIZE) - 1;
-        
-        LcDeviceId dev = open_file->blocks[current_index].dev;
-        uint16_t sec = open_file->blocks[current_index].sec;
-        uint16_t blk = open_file->blocks[current_index].blk;
-        
-        // Calculate position within block
-        uint16_t block_pos = open_file->pos % LC_DEVICE_BLOCK_SIZE;
-
-        // Check if block is in cache
-        char *cache_blk;
-        if((cache_blk = lcloud_getcache(dev, sec, blk)) == NULL) {
-            // Read block from device
-            if((read_bus(tmp, dev, sec, blk)) == -1) {
-                logMessage(LOG_ERROR_LEVEL, "Read error on block [%d/%d/%d]", dev, sec, blk);
-                return(-1);
-            }
-            // Push block to cache
-            if(lcloud_putcache(dev, sec, blk, tmp) == -1) return(-1);
-        } 
-        // Copy retrieved cache block to tmp
-        else {
-            memcpy(tmp, cache_blk, LC_DEVICE_BLOCK_SIZE);
-            cache_blk = NULL;
+    // Holes and reserved blocks not yet written read as the zeros already in the
+    // buffer; copy out what the cache holds,
+    // collect the rest into one batch
+    int nmiss = 0, nholes = 0;
+    for(uint32_t i = 0; i < ctx->io_plan.num_segs; i++) {
+        LcIoSeg *seg = &ctx->io_plan.segs[i];
+        LcBlock *blk = &open_file->blocks[seg->index];
+        if(blk->dev == LC_BLOCK_HOLE || blk->unwritten) {
+            nholes++;
+            continue;
         }
 
-        // Remaining read length is larger than block size or continues into another block
-        if(current_len >= LC_DEVICE_BLOCK_SIZE || (open_file->pos + current_len + LC_DEVICE_BLOCK_SIZE) / LC_DEVICE_BLOCK_SIZE > (open_file->pos + LC_DEVICE_BLOCK_SIZE) / LC_DEVICE_BLOCK_SIZE) {
-            memcpy(buf + (len - current_len), tmp + block_pos,  LC_DEVICE_BLOCK_SIZE - block_pos);
-            current_len -= LC_DEVICE_BLOCK_SIZE - block_pos;
-            open_file->pos += LC_DEVICE_BLOCK_SIZE - block_pos;
+        char *cache_blk = lccache_get(ctx->cache, blk->dev, blk->sec, blk->blk);
+        if(ctx->block_observer != NULL) {
+            ctx->block_observer(LC_XFER_READ, blk->dev, blk->sec, blk->blk, cache_blk != NULL);
         }
-        // Read is entirely within block
-        else {
-            memcpy(buf + (len - current_len), tmp + block_pos, current_len);
-            open_file->pos += current_len;
+        lcloud_prefetch_access(ctx, fh, blk, cache_blk != NULL);
+        if(cache_blk != NULL) {
+            memcpy(buf + io_seg_data(&ctx->io_plan, i), cache_blk + blk->frag_off + seg->off, seg->len);
+        } else {
+            ctx->io_blks[nmiss] = blk;
+            ctx->io_bufs[nmiss] = &ctx->io_data[(size_t) i * LC_DEVICE_BLOCK_SIZE];
+            ctx->io_miss[nmiss] = i;
+            nmiss++;
         }
+    }
 
-        logMessage(LcDriverLLevel, "Success reading from block [%d/%d/%d]", dev, sec, blk);
+    // A sequential reader going to the devices reads ahead in the same batch
+    int nahead = 0;
+    uint32_t next = (nmiss > 0) ? ctx->io_plan.segs[ctx->io_plan.num_segs - 1].index + 1 : 0;
+    int window = (lccache_capacity(ctx->cache) / 2 < LC_ADVISE_READAHEAD) ? lccache_capacity(ctx->cache) / 2 : LC_ADVISE_READAHEAD;
+    if(nmiss > 0 && advice_at(open_file, next) == LC_ADV_SEQUENTIAL) {
+        nahead = fetch_range(ctx, open_file, next, (open_file->size + LC_DEVICE_BLOCK_SIZE - 1) / LC_DEVICE_BLOCK_SIZE,
+            nmiss, ctx->io_plan.num_segs, window);
+    }
+
+    // So do the blocks past misses say come next, unless the reader is random
+    int npred = 0;
+    if(nmiss > 0 && advice_at(open_file, ctx->io_plan.segs[ctx->io_plan.num_segs - 1].index) != LC_ADV_RANDOM) {
+        npred = lcloud_prefetch_predict(ctx, nmiss + nahead, ctx->io_plan.num_segs + nahead, LC_PREFETCH_DEGREE);
+    }
+
+    // And the WILLNEED range's blocks not yet fetched (past the ones this read needs)
+    int nwill = 0, nfetch = nmiss + nahead + npred;
+    if(nmiss > 0 && open_file->will_first < open_file->will_end) {
+        if(open_file->will_first >= ctx->io_plan.segs[0].index && open_file->will_first < next) open_file->will_first = next;
+        nwill = fetch_range(ctx, open_file, open_file->will_first, open_file->will_end, nfetch,
+            ctx->io_plan.num_segs + nahead + npred, window);
+    }
+
+    // Read the missing blocks from the devices, push them to the cache
+    if(nmiss > 0 && read_bus_ahead(ctx, fh, ctx->io_blks, ctx->io_bufs, nmiss, nfetch + nwill) == -1) {
+        return(-1);
+    }
+    for(int m = 0; m < nmiss; m++) {
+        LcIoSeg *seg = &ctx->io_plan.segs[ctx->io_miss[m]];
+        memcpy(buf + io_seg_data(&ctx->io_plan, ctx->io_miss[m]), ctx->io_bufs[m] + ctx->io_blks[m]->frag_off + seg->off, seg->len);
+        if(cache_fill(ctx, open_file, seg->index, ctx->io_bufs[m]) == -1) return(-1);
+    }
+    for(int m = nmiss; m < nmiss + nahead; m++) {
+        if(ctx->io_bufs[m] != NULL && cache_fill(ctx, open_file, ctx->io_miss[m], ctx->io_bufs[m]) == -1) return(-1);
+    }
+    for(int m = nmiss + nahead; m < nmiss + nahead + npred; m++) {
+        LcBlock *blk = ctx->io_blks[m];
+        if(ctx->io_bufs[m] != NULL && lccache_put(ctx->cache, blk->dev, blk->sec, blk->blk, ctx->io_bufs[m]) == -1) return(-1);
+    }
 
+    // The WILLNEED range goes on from the first block that did not go
+    if(nmiss > 0 && open_file->will_first < open_file->will_end) {
+        open_file->will_first = (nwill > 0) ? ctx->io_miss[nfetch + nwill - 1] + 1 : open_file->will_end;
+        for(int m = nfetch + nwill - 1; m >= nfetch; m--) {
+            if(ctx->io_bufs[m] == NULL) {
+                open_file->will_first = ctx->io_miss[m];
+            } else if(cache_fill(ctx, open_file, ctx->io_miss[m], ctx->io_bufs[m]) == -1) {
+                return(-1);
+            }
+        }
     }
 
     ///////////////
     /* CLEAN UP */
     /////////////
-    // Free tmp buffer
-    free(tmp);
-    tmp = NULL;
+    open_file->pos += read_len;
 
     // Log read
-    logMessage(LcDriverLLevel, "Read %d bytes from %s at position %d", len, open_file->path, open_file->pos - len);
+    logMessage(LcDriverLLevel, "Read %d bytes from %s at position %d (%d blocks in %d runs, %d holes, %d from devices, %d read ahead, %d predicted, %d WILLNEED)",
+        read_len, open_file->path, open_file->pos - read_len, ctx->io_plan.num_segs, ctx->io_plan.num_runs, nholes, nmiss, nahead, npred, nwill);
     
     open_file = NULL;
     
@@ -456,20 +1144,21 @@ int lcread( LcFHandle fh, char *buf, size_t len ) {
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : lcwrite
+// Function     : lcwrite_ctx
 // Description  : write data to the file
 //
-// Inputs       : fh - file handle for the file to write to
+// Inputs       : ctx - the filesystem
+//                fh - file handle for the file to write to
 //                buf - pointer to data to write
 //                len - the length of the write
 // Outputs      : number of bytes written if successful test, -1 if failure
-int lcwrite( LcFHandle fh, char *buf, size_t len ) {
+int lcwrite_ctx( LcContext *ctx, LcFHandle fh, char *buf, size_t len ) {
     // File handle is incorrent, file is not open
-    if(fh >= filec || files[fh].open == 0) {
+    if(fh >= ctx->filec || ctx->files[fh].open == 0) {
         return(-1);
     }
     // Devices not powered on (i.e. no files are opened)
-    if(pwr == 0) {
+    if(ctx->pwr == 0) {
         logMessage(LOG_ERROR_LEVEL, "Device(s) not powered on");
         return(-1);
     }
@@ -477,113 +1166,149 @@ int lcwrite( LcFHandle fh, char *buf, size_t len ) {
     ///////////////////////
     /* INITIALIZE WRITE */
     /////////////////////
-    LcFile *open_file = &files[fh];
-    char *tmp;
-    if((tmp = malloc(LC_DEVICE_BLOCK_SIZE)) == NULL) return(-1);
-
-    // Number of writes that are performed
-    // (position in block) + (write length) / (block size) [rounded up]
-    int blocks_to_write = (open_file->pos % LC_DEVICE_BLOCK_SIZE + len + LC_DEVICE_BLOCK_SIZE) / LC_DEVICE_BLOCK_SIZE;
+    LcFile *open_file = &ctx->files[fh];
 
     //////////////////////////////////////////
     /* ALLOCATE MEMORY AND ASSIGN BLOCKS */
     //////////////////////////////////////////
-    if(open_file->size == 0) {
-        // Allocate memory
-        if((open_file->blocks = (LcBlock*) malloc(blocks_to_write * sizeof(LcBlock))) == NULL) {
+    // Extend the block map up to the end of the write, new entries start as holes
+    size_t end = open_file->pos + len;
+    uint32_t needed = (end + LC_DEVICE_BLOCK_SIZE - 1) / LC_DEVICE_BLOCK_SIZE;
+    if(len > 0 && block_map_grow(open_file, needed) == -1) {
+        return(-1);
+    }
+
+    // Only the last block may be packed: move the packed one out if the file grows
+    // past it or it outgrows its fragment
+    size_t new_size = (len > 0 && end > open_file->size) ? end : open_file->size;
+    uint32_t last = (new_size == 0) ? 0 : (new_size - 1) / LC_DEVICE_BLOCK_SIZE;
+    size_t tail = new_size - (size_t) last * LC_DEVICE_BLOCK_SIZE;
+    if(new_size > open_file->size && open_file->size > 0) {
+        uint32_t old_last = (open_file->size - 1) / LC_DEVICE_BLOCK_SIZE;
+        LcBlock *old = &open_file->blocks[old_last];
+        if(old->frag_len > 0 && (old_last != last || old->frag_len < tail) &&
+            pack_move(ctx, open_file, old_last, open_file->size - (size_t) old_last * LC_DEVICE_BLOCK_SIZE,
+                (old_last == last) ? tail : LC_DEVICE_BLOCK_SIZE) == -1) {
             return(-1);
         }
+    }
 
-        // Search for available blocks to assign to newly created blocks
-        block_assign_helper(open_file, 0, blocks_to_write);
-        
-    } else if(open_file->pos + len > open_file->size) {
-        // Calculate number of new blocks to create and current blocks in file
-        int new_blocks = (open_file->size + len - open_file->pos + LC_DEVICE_BLOCK_SIZE) / LC_DEVICE_BLOCK_SIZE;
-        int total_blocks = (open_file->size + LC_DEVICE_BLOCK_SIZE) / LC_DEVICE_BLOCK_SIZE;
-
-        // Allocate new memory
-        if((open_file->blocks = (LcBlock*) realloc(open_file->blocks, (total_blocks + new_blocks) * sizeof(LcBlock))) == NULL) {
+    // Assign device blocks (or a packed fragment for a small last block) only to the
+    // holes the write lands in; those and any reserved blocks written for the first
+    // time start from zeros
+    uint32_t first = open_file->pos / LC_DEVICE_BLOCK_SIZE;
+    uint32_t count = (len == 0) ? 0 : needed - first;
+    if(io_reserve(ctx, count) == -1) {
+        return(-1);
+    }
+    for(uint32_t i = 0; i < count; i++) {
+        LcBlock *blk = &open_file->blocks[first + i];
+        uint32_t frag = (first + i == last) ? pack_size(ctx, tail) : 0;
+        int fresh;
+        ctx->io_fresh[i] = (blk->dev == LC_BLOCK_HOLE || blk->unwritten) ? LC_FRESH_ASSIGNED : LC_FRESH_NONE;
+        if(blk->dev == LC_BLOCK_HOLE && frag > 0) {
+            if((fresh = pack_alloc(ctx, blk, frag)) == -1) return(-1);
+            ctx->io_fresh[i] = fresh ? LC_FRESH_ASSIGNED : LC_FRESH_FRAGMENT;
+        } else if(blk->dev == LC_BLOCK_HOLE && block_assign_helper(ctx, open_file, first + i, first + i + 1) == -1) {
             return(-1);
         }
+    }
 
-        // Search for available blocks to assign to newly created blocks
-        block_assign_helper(open_file, total_blocks, total_blocks + new_blocks);
+    // Plan the blocks the write touches
+    if(plan_io(ctx, open_file, open_file->pos, len, &ctx->io_plan) == -1) {
+        return(-1);
     }
 
     ////////////
     /* WRITES */
     ////////////
-    // Length remaining in write
-    size_t current_len = len;
-
-    for(int i = 0; i < blocks_to_write; i++) {
-        // Calculate current block
-        int current_index = ((open_file->pos + LC_DEVICE_BLOCK_SIZE) / LC_DEVICE_BLOCK_SIZE) - 1;
-        
-        LcDeviceId dev = open_file->blocks[current_index].dev;
-        uint16_t sec = open_file->blocks[current_index].sec;
-        uint16_t blk = open_file->blocks[current_index].blk;
-
-        // Calculate position within block
-        int block_pos = open_file->pos % LC_DEVICE_BLOCK_SIZE;
-
-        // Read contents of current block
-        char *cache_blk;
-        // Check if block is in cache
-        if((cache_blk = lcloud_getcache(dev, sec, blk)) == NULL) {
-            // Read block from device
-            if((read_bus(tmp, dev, sec, blk)) == -1) {
-                logMessage(LOG_ERROR_LEVEL, "Read error on block [%d/%d/%d]", dev, sec, blk);
-                return(-1);
-            }
-        } 
-        // Copy retrieved cache block to tmp
-        else {
+    // Start each block from the cache, from zeros if the write replaces all of it
+    // or it holds no data yet (even if cached: it may have been freed and taken
+    // again), otherwise read it from the device (so, unless it is fresh or replaced
+    // unseen, the block's old contents are known)
+    int nmiss = 0;
+    for(uint32_t i = 0; i < ctx->io_plan.num_segs; i++) {
+        LcIoSeg *seg = &ctx->io_plan.segs[i];
+        LcBlock *blk = &open_file->blocks[seg->index];
+        char *tmp = &ctx->io_data[(size_t) i * LC_DEVICE_BLOCK_SIZE];
+
+        char *cache_blk = lccache_get(ctx->cache, blk->dev, blk->sec, blk->blk);
+        if(ctx->block_observer != NULL) {
+            ctx->block_observer(LC_XFER_WRITE, blk->dev, blk->sec, blk->blk, cache_blk != NULL);
+        }
+        if(cache_blk != NULL && ctx->io_fresh[i] != LC_FRESH_ASSIGNED) {
             memcpy(tmp, cache_blk, LC_DEVICE_BLOCK_SIZE);
-            cache_blk = NULL;
+        } else if(seg->len == LC_DEVICE_BLOCK_SIZE || ctx->io_fresh[i] == LC_FRESH_ASSIGNED) {
+            memset(tmp, 0, LC_DEVICE_BLOCK_SIZE);
+            if(ctx->io_fresh[i] == LC_FRESH_NONE) ctx->io_fresh[i] = LC_FRESH_WHOLE;
+        } else {
+            ctx->io_blks[nmiss] = blk;
+            ctx->io_bufs[nmiss] = tmp;
+            nmiss++;
         }
+    }
+    if(nmiss > 0 && read_bus(ctx, fh, ctx->io_blks, ctx->io_bufs, nmiss) == -1) {
+        return(-1);
+    }
 
-        // Remaining write length is larger than the block size or continues into another block
-        if(current_len >= LC_DEVICE_BLOCK_SIZE || (open_file->pos + current_len + LC_DEVICE_BLOCK_SIZE) / LC_DEVICE_BLOCK_SIZE > (open_file->pos + LC_DEVICE_BLOCK_SIZE) / LC_DEVICE_BLOCK_SIZE) {
-            memcpy(tmp + block_pos, buf + (len - current_len), LC_DEVICE_BLOCK_SIZE - block_pos);
-            current_len -= LC_DEVICE_BLOCK_SIZE - block_pos;
-            open_file->pos += LC_DEVICE_BLOCK_SIZE - block_pos;
+    // Merge in the new data and write every block it changes in one batch (a block
+    // whose known contents already hold the data is left alone, and so is one
+    // deduplicated to a device block holding its new contents)
+    int nwrite = 0, nshared = 0;
+    for(uint32_t i = 0; i < ctx->io_plan.num_segs; i++) {
+        LcIoSeg *seg = &ctx->io_plan.segs[i];
+        LcBlock *blk = &open_file->blocks[seg->index];
+        char *tmp = &ctx->io_data[(size_t) i * LC_DEVICE_BLOCK_SIZE];
+        if(ctx->io_fresh[i] == LC_FRESH_FRAGMENT) {
+            memset(tmp + blk->frag_off, 0, blk->frag_len);
         }
-        // Write is entirely within the block 
-        else {
-            memcpy(tmp + block_pos, buf + (len - current_len), current_len);
-            open_file->pos += current_len;
+        if(ctx->io_fresh[i] == LC_FRESH_NONE && memcmp(tmp + blk->frag_off + seg->off, buf + io_seg_data(&ctx->io_plan, i), seg->len) == 0) {
+            continue;
         }
-        
-        // Write contents of tmp to device
-        if((write_bus(tmp, dev, sec, blk)) == -1) {
-            logMessage(LOG_ERROR_LEVEL, "Write error in block [%d/%d/%d]", dev, sec, blk);
-            return(-1);
+        memcpy(tmp + blk->frag_off + seg->off, buf + io_seg_data(&ctx->io_plan, i), seg->len);
+        if(blk->frag_len == 0 && (ctx->dedup_blocks || ctx->dedup != NULL)) {
+            int shared = block_share_write(ctx, blk, tmp);
+            if(shared == -1) return(-1);
+            if(shared > 0) {
+                nshared += (shared == 1);
+                continue;
+            }
         }
-        // Push new block to cache
-        if(lcloud_putcache(dev, sec, blk, tmp) == -1) {
-            logMessage(LOG_ERROR_LEVEL, "Error writing block [%d/%d/%d] to cache", dev, sec, blk);
+        ctx->io_blks[nwrite] = blk;
+        ctx->io_bufs[nwrite] = tmp;
+        nwrite++;
+    }
+    if(nwrite > 0 && write_bus(ctx, fh, ctx->io_blks, ctx->io_bufs, nwrite) == -1) {
+        return(-1);
+    }
+    for(int w = 0; w < nwrite; w++) {
+        ctx->io_blks[w]->unwritten = 0;
+    }
+    ctx->stats.blocks_written += nwrite;
+    ctx->stats.writes_elided += ctx->io_plan.num_segs - nwrite - nshared;
+
+    // Push new blocks to cache
+    for(uint32_t i = 0; i < ctx->io_plan.num_segs; i++) {
+        LcBlock *blk = &open_file->blocks[ctx->io_plan.segs[i].index];
+        if(cache_fill(ctx, open_file, ctx->io_plan.segs[i].index, &ctx->io_data[(size_t) i * LC_DEVICE_BLOCK_SIZE]) == -1) {
+            logMessage(LOG_ERROR_LEVEL, "Error writing block [%d/%d/%d] to cache", blk->dev, blk->sec, blk->blk);
             return(-1);
         }
-
-        logMessage(LcDriverLLevel, "Success writing to block [%d/%d/%d]", dev, sec, blk);
     }
 
     /////////////
     /* CLEAN UP*/
     /////////////
-    // Free tmp buffer
-    free(tmp);
-    tmp = NULL;
-
-    // Update file size
-    if(open_file->pos > open_file->size) {
+    // Update file position and size
+    open_file->dirty = 1;
+    open_file->pos = end;
+    if(len > 0 && open_file->pos > open_file->size) {
         open_file->size = open_file->pos;
     }
     
     // Log write
-    logMessage(LcDriverLLevel, "Wrote %d bytes to %s (size %d bytes)", len, open_file->path, open_file->size);
+    logMessage(LcDriverLLevel, "Wrote %d bytes to %s (size %d bytes, %d blocks, %d read first, %d unchanged, %d shared)", len,
+        open_file->path, open_file->size, ctx->io_plan.num_segs, nmiss, ctx->io_plan.num_segs - nwrite - nshared, nshared);
 
     open_file = NULL;
 
@@ -592,73 +1317,515 @@ int lcwrite( LcFHandle fh, char *buf, size_t len ) {
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : lcseek
-// Description  : Seek to a specific place in the file
+// Function     : lcseek_ctx
+// Description  : Seek to a specific place in the file.  Seeking past the end is
+//                allowed: a write there leaves a hole that reads as zeros.
 //
-// Inputs       : fh - the file handle of the file to seek in
+// Inputs       : ctx - the filesystem
+//                fh - the file handle of the file to seek in
 //                off - offset within the file to seek to
+// Outputs      : new position if successful test, -1 if failure
+int lcseek_ctx( LcContext *ctx, LcFHandle fh, size_t off ) {
+    // File handle is incorrent, file is not open
+    if(fh >= ctx->filec || ctx->files[fh].open == 0) {
+        return(-1);
+    }
+
+    // Updates file position (the size only changes when data is written)
+    ctx->files[fh].pos = off;
+    return(ctx->files[fh].pos);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcfallocate_ctx
+// Description  : Reserve device blocks for a range of the file, as one contiguous extent
+//                on a device where possible, so later sequential I/O on the range moves
+//                consecutive device blocks.  The reserved blocks read as zeros until
+//                written; the file size does not change.
+//
+// Inputs       : ctx - the filesystem
+//                fh - the file handle of the file
+//                off, len - the byte range to reserve
 // Outputs      : 0 if successful test, -1 if failure
-int lcseek( LcFHandle fh, size_t off ) {
+int lcfallocate_ctx( LcContext *ctx, LcFHandle fh, size_t off, size_t len ) {
     // File handle is incorrent, file is not open
-    if(fh >= filec || files[fh].open == 0) {
+    if(fh >= ctx->filec || ctx->files[fh].open == 0) {
         return(-1);
     }
+    if(len == 0) {
+        return(0);
+    }
 
-    // Updates file position if off is within file size
-    if(off <= files[fh].size) {
-        files[fh].pos = off;
-        return(files[fh].pos);
+    // Reserve the holes in the range, marking them as not written
+    LcFile *file = &ctx->files[fh];
+    uint32_t first = off / LC_DEVICE_BLOCK_SIZE;
+    uint32_t end = (off + len + LC_DEVICE_BLOCK_SIZE - 1) / LC_DEVICE_BLOCK_SIZE;
+    if(block_map_grow(file, end) == -1) {
+        return(-1);
+    }
+    for(uint32_t b = first; b < end; b++) {
+        if(file->blocks[b].dev == LC_BLOCK_HOLE) file->blocks[b].unwritten = 1;
+    }
+    file->dirty = 1;
+    if(extent_assign_helper(ctx, file, first, end) == -1) {
+        for(uint32_t b = first; b < end; b++) {
+            if(file->blocks[b].dev == LC_BLOCK_HOLE) file->blocks[b].unwritten = 0;
+        }
+        return(-1);
     }
 
-    return(-1);
+    logMessage(LcDriverLLevel, "Reserved blocks %d to %d of %s", first, end - 1, file->path);
+    return(0);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : lcclose
+// Function     : lcclose_ctx
 // Description  : Close the file
 //
-// Inputs       : fh - the file handle of the file to close
+// Inputs       : ctx - the filesystem
+//                fh - the file handle of the file to close
 // Outputs      : 0 if successful test, -1 if failure
-int lcclose( LcFHandle fh ) {
+int lcclose_ctx( LcContext *ctx, LcFHandle fh ) {
     // File handle is incorrent, file is not open
-    if(fh >= filec || files[fh].open == 0) return(-1);
+    if(fh >= ctx->filec || ctx->files[fh].open == 0) return(-1);
 
-    files[fh].open = 0;
+    ctx->files[fh].open = 0;
+    ctx->files[fh].will_first = ctx->files[fh].will_end = 0;
 
     return(0);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : lcshutdown
+// Function     : lcclone_ctx
+// Description  : Make a new file that is a copy of another without moving its data:
+//                the copy's block map shares the source's device blocks, and either
+//                file's first write to a shared block copies it (only a packed tail
+//                is copied now).  Blocks reserved by lcfallocate and never written are
+//                not reserved in the copy.  The source may be open; the copy is closed.
+//                A clone that fails leaves no copy and the source's blocks as they were.
+//
+// Inputs       : ctx - the filesystem
+//                src - the path of the file to copy
+//                dst - the path of the copy (must not exist)
+// Outputs      : 0 if successful test, -1 if failure
+int lcclone_ctx( LcContext *ctx, const char *src, const char *dst ) {
+    // Bring the filesystem up if lcinit has not
+    if(ctx->pwr == 0 && lcinit_ctx(ctx, NULL) == -1) return(-1);
+
+    // Find the source, the copy must be a new file
+    int from = -1;
+    for(int i = 0; i < ctx->filec; i++) {
+        if(strcmp(ctx->files[i].path, dst) == 0) {
+            logMessage(LOG_ERROR_LEVEL, "Cannot clone to %s, the file exists", dst);
+            return(-1);
+        }
+        if(strcmp(ctx->files[i].path, src) == 0) from = i;
+    }
+    if(from == -1) {
+        logMessage(LOG_ERROR_LEVEL, "Cannot clone %s, no such file", src);
+        return(-1);
+    }
+    if(ctx->files[from].blocks == NULL && ctx->files[from].num_blocks > 0 && lcloud_meta_load_map(ctx, &ctx->files[from]) == -1) {
+        return(-1);
+    }
+
+    // Build the copy, the same size and all holes, before it joins the files
+    if(file_table_reserve(ctx, ctx->filec + 1) == -1) return(-1);
+    LcFile *file = &ctx->files[ctx->filec], *orig = &ctx->files[from];
+    uint32_t shared = 0;
+    memset(file, 0, sizeof(LcFile));
+    if((file->path = malloc(strlen(dst) + 1)) == NULL) {
+        logMessage(LOG_ERROR_LEVEL, "Memory allocation error");
+        goto fail;
+    }
+    strcpy(file->path, dst);
+    if(block_map_grow(file, orig->num_blocks) == -1) goto fail;
+    file->handle = ctx->filec;
+    file->dirty = 1;
+    file->advice = LC_ADV_NORMAL;
+    file->size = orig->size;
+
+    // Share the written device blocks
+    for(uint32_t b = 0; b < orig->num_blocks; b++) {
+        LcBlock *blk = &orig->blocks[b];
+        if(blk->dev == LC_BLOCK_HOLE || blk->unwritten || blk->frag_len > 0) continue;
+        if(lcloud_dedup_ref(ctx, blk) == -1) goto fail;
+        file->blocks[b] = *blk;
+        shared++;
+    }
+
+    // Copy a packed tail into a fragment or block of the copy's own
+    uint32_t last = (orig->size == 0) ? 0 : (orig->size - 1) / LC_DEVICE_BLOCK_SIZE;
+    if(orig->size > 0 && orig->blocks[last].dev != LC_BLOCK_HOLE && orig->blocks[last].frag_len > 0) {
+        char tmp[LC_DEVICE_BLOCK_SIZE];
+        size_t tail = orig->size - (size_t) last * LC_DEVICE_BLOCK_SIZE;
+        if(block_fetch(ctx, &orig->blocks[last], tmp) == -1) goto fail;
+        memmove(tmp, tmp + orig->blocks[last].frag_off, tail);
+        if(pack_place(ctx, &file->blocks[last], tmp, tail, tail) == -1) goto fail;
+    }
+
+    ctx->filec++;
+    ctx->stats.blocks_cloned += shared;
+    logMessage(LcDriverLLevel, "Cloned %s to %s (%d bytes, %u blocks shared)", src, dst, file->size, shared);
+    return(0);
+
+fail:
+    // Give back what the copy took: the shared blocks' references, its tail
+    for(uint32_t b = 0; file->blocks != NULL && b < file->num_blocks; b++) {
+        LcBlock *blk = &file->blocks[b];
+        if(blk->dev == LC_BLOCK_HOLE) continue;
+        if(blk->frag_len > 0) {
+            pack_release(ctx, blk);
+        } else {
+            lcloud_dedup_unref(ctx, blk);
+        }
+    }
+    free(file->path);
+    free(file->blocks);
+    memset(file, 0, sizeof(LcFile));
+    return(-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcadvise_ctx
+// Description  : Tell the filesystem how a range of the file will be used.  SEQUENTIAL,
+//                RANDOM and NOREUSE set the file's access pattern for the range until
+//                the next lcadvise or open (one range per file, NORMAL clears it): a
+//                sequential reader's trips to the devices read ahead, a NOREUSE range's
+//                blocks are cached as the next to evict.  WILLNEED queues the range's
+//                uncached blocks as prefetches: they ride in the round trips of the
+//                file's next reads from the devices (as many as a sequential read
+//                ahead at a time), so the caller does not wait for them.  DONTNEED
+//                takes the range's blocks out of the cache now.  Both leave the access
+//                pattern as it was.
+//
+// Inputs       : ctx - the filesystem
+//                fh - the file handle of the file
+//                off, len - the byte range (len 0 for the rest of the file)
+//                advice - the expected use
+// Outputs      : 0 if successful test, -1 if failure
+int lcadvise_ctx( LcContext *ctx, LcFHandle fh, size_t off, size_t len, LcAdvice advice ) {
+    // File handle is incorrent, file is not open
+    if(fh < 0 || fh >= ctx->filec || ctx->files[fh].open == 0) {
+        return(-1);
+    }
+    LcFile *file = &ctx->files[fh];
+    uint32_t first = off / LC_DEVICE_BLOCK_SIZE;
+    uint32_t end = (len == 0 || off + len > file->size) ? (file->size + LC_DEVICE_BLOCK_SIZE - 1) / LC_DEVICE_BLOCK_SIZE :
+        (off + len + LC_DEVICE_BLOCK_SIZE - 1) / LC_DEVICE_BLOCK_SIZE;
+
+    switch(advice) {
+    case LC_ADV_NORMAL:
+    case LC_ADV_SEQUENTIAL:
+    case LC_ADV_RANDOM:
+    case LC_ADV_NOREUSE:
+        file->advice = advice;
+        file->adv_off = off;
+        file->adv_len = len;
+        return(0);
+
+    case LC_ADV_WILLNEED:
+        // Left for the file's next reads from the devices to fetch as prefetches
+        file->will_first = first;
+        file->will_end = end;
+        logMessage(LcDriverLLevel, "Blocks %u to %u of %s queued for WILLNEED", first, end, file->path);
+        return(0);
+
+    case LC_ADV_DONTNEED:
+        for(uint32_t b = first; b < end && b < file->num_blocks; b++) {
+            LcBlock *blk = &file->blocks[b];
+            if(blk->dev != LC_BLOCK_HOLE) lccache_drop(ctx->cache, blk->dev, blk->sec, blk->blk);
+        }
+        if(file->will_first < end && first < file->will_end) file->will_first = file->will_end = 0;
+        return(0);
+    }
+    logMessage(LOG_ERROR_LEVEL, "Unknown advice %d", advice);
+    return(-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcpack_ctx
+// Description  : Turn packing of small files and file tails on or off.  While on, a
+//                file's last block, if small enough, is stored as a fragment of a device
+//                block shared with other files' tails.  Turning it off leaves the tails
+//                already packed in place.
+//
+// Inputs       : ctx - the filesystem
+//                enable - 1 to pack, 0 to give every block a device block of its own
+// Outputs      : 0 if successful test, -1 if failure
+int lcpack_ctx( LcContext *ctx, int enable ) {
+    ctx->pack_tails = (enable != 0);
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcpersist_ctx
+// Description  : Keep the filesystem metadata (files, block maps and allocation state)
+//                in a checkpoint file, written at shutdown and loaded at the next power
+//                on.  The devices must keep their contents between runs (e.g.
+//                lcloud_simserver -m).  The cipher key is not kept: set the same one
+//                (lcclient_set_cipher) before every power on, which fails if the
+//                checkpoint was written with another.  Set before the first lcopen.
+//
+// Inputs       : ctx - the filesystem
+//                path - the checkpoint file, NULL to stop keeping metadata
+// Outputs      : 0 if successful test, -1 if failure
+int lcpersist_ctx( LcContext *ctx, const char *path ) {
+    if(ctx->pwr == 1) {
+        logMessage(LOG_ERROR_LEVEL, "Metadata checkpoint must be set before power on");
+        return(-1);
+    }
+    return(lcloud_meta_configure(ctx, path));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcstats_ctx
+// Description  : Get the filesystem's counters (kept for the life of the instance)
+//
+// Inputs       : ctx - the filesystem
+//                stats - where to put them
+// Outputs      : 0 if successful test, -1 if failure
+int lcstats_ctx( LcContext *ctx, LcFsStats *stats ) {
+    *stats = ctx->stats;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcshutdown_ctx
 // Description  : Shut down the filesystem
 //
-// Inputs       : none
+// Inputs       : ctx - the filesystem
 // Outputs      : 0 if successful test, -1 if failure
-int lcshutdown( void ) {
+int lcshutdown_ctx( LcContext *ctx ) {
     // Don't need to shutdown filesystem if it's not on
-    if(pwr == 1) {
+    if(ctx->pwr == 1) {
+        // Run the async operations still queued
+        int saved = lcloud_async_close(ctx);
+
+        // Send the writebacks the scheduler holds
+        if(lcloud_sched_dispatch(ctx) == -1) saved = -1;
+
+        // Log the device blocks the files took
+        uint32_t used = 0;
+        for(int i = 0; i < ctx->devc; i++) {
+            used += (uint32_t) ctx->devices[i].num_sec * ctx->devices[i].num_blk - device_free(&ctx->devices[i]);
+        }
+        logMessage(LcDriverLLevel, "Files used %u device blocks (%u shared by packed tails, %u freed)", used - ctx->free_nblks,
+            ctx->pack_blocks, ctx->free_nblks);
+
+        // Checkpoint the metadata (while the cipher key is still there)
+        if(lcloud_meta_save(ctx) == -1) saved = -1;
+        lcloud_meta_close(ctx);
+
         // Free device data
-        free(devices);
-        devices = NULL;
+        free(ctx->devices);
+        ctx->devices = NULL;
 
         // Free file data
-        for(int i = 0; i < filec; i++) {
-            free(files[i].path);
-            free(files[i].blocks);
+        for(int i = 0; i < ctx->filec; i++) {
+            free(ctx->files[i].path);
+            free(ctx->files[i].blocks);
             
-            files[i].path = NULL;
-            files[i].blocks = NULL;
+            ctx->files[i].path = NULL;
+            ctx->files[i].blocks = NULL;
         }
-        free(files);
-        files = NULL;
-
-        // Close cache
-        lcloud_closecache();
+        free(ctx->files);
+        ctx->files = NULL;
+        ctx->filec = 0;
+        ctx->files_cap = 0;
+        ctx->devc = 0;
+
+        // Free I/O scratch space
+        free(ctx->io_plan.segs);
+        free(ctx->io_plan.runs);
+        free(ctx->io_data);
+        free(ctx->io_blks);
+        free(ctx->io_bufs);
+        free(ctx->io_miss);
+        free(ctx->io_fresh);
+        memset(&ctx->io_plan, 0, sizeof(ctx->io_plan));
+        ctx->io_data = NULL;
+        ctx->io_blks = NULL;
+        ctx->io_bufs = NULL;
+        ctx->io_miss = NULL;
+        ctx->io_fresh = NULL;
+        ctx->io_cap = 0;
+        lcloud_sched_close(ctx);
+
+        // Forget the packing state
+        free(ctx->pack_free);
+        ctx->pack_free = NULL;
+        ctx->pack_nfree = 0;
+        ctx->pack_free_cap = 0;
+        ctx->pack_blk.dev = LC_BLOCK_HOLE;
+        ctx->pack_fill = 0;
+        ctx->pack_blocks = 0;
+
+        // And the block sharing state
+        free(ctx->free_blks);
+        ctx->free_blks = NULL;
+        ctx->free_nblks = 0;
+        ctx->free_blks_cap = 0;
+        lcloud_dedup_close(ctx);
+
+        // The prefetcher's tables name device blocks that are going away
+        lcloud_prefetch_reset(ctx);
+
+        // Close cache (writing back its second tier)
+        if(lccache_close(ctx->cache) == -1) saved = -1;
 
         // Send power off signal
-        return(pwr_off_bus());
+        return((pwr_off_bus(ctx) == 0 && saved == 0) ? 0 : -1);
     }
     return(-1);
 } 
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcctx_create
+// Description  : Create a filesystem instance with its own connection, cache, devices
+//                and files.  Instances are independent: each may be driven by its own
+//                thread, but one instance is used by one thread at a time.
+//
+// Inputs       : none
+// Outputs      : the instance, NULL if failure
+LcContext * lcctx_create( void ) {
+    LcContext *ctx;
+    if((ctx = calloc(1, sizeof(LcContext))) == NULL) {
+        logMessage(LOG_ERROR_LEVEL, "Memory allocation error");
+        return(NULL);
+    }
+    ctx->pack_blk.dev = LC_BLOCK_HOLE;
+    if((ctx->client = lcclient_create()) == NULL || (ctx->cache = lccache_create()) == NULL) {
+        lcctx_destroy(ctx);
+        return(NULL);
+    }
+    return(ctx);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcctx_destroy
+// Description  : Shut down an instance made by lcctx_create (if it is up) and free it
+//
+// Inputs       : ctx - the instance
+// Outputs      : 0 if successful test, -1 if the shutdown failed
+int lcctx_destroy( LcContext *ctx ) {
+    int ret = 0;
+    if(ctx == NULL || ctx == &default_ctx) return(0);
+    if(ctx->pwr == 1) ret = lcshutdown_ctx(ctx);
+    lcloud_async_close(ctx);
+    lcprefetch_ctx(ctx, 0);
+    lcloud_sched_close(ctx);
+    lcloud_dedup_close(ctx);
+    lcloud_meta_configure(ctx, NULL);
+    if(ctx->client != NULL) lcclient_destroy(ctx->client);
+    if(ctx->cache != NULL) lccache_destroy(ctx->cache);
+    free(ctx);
+    return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcctx_default
+// Description  : Get the instance the functions without a context use (it runs on the
+//                default client and cache)
+//
+// Inputs       : none
+// Outputs      : the default instance
+LcContext * lcctx_default( void ) {
+    if(default_ctx.client == NULL) {
+        default_ctx.client = lcclient_default();
+        default_ctx.cache = lccache_default();
+    }
+    return(&default_ctx);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcctx_client
+// Description  : Get an instance's connection, e.g. to pick its transport
+//
+// Inputs       : ctx - the instance
+// Outputs      : the client
+LcClient * lcctx_client( LcContext *ctx ) {
+    return(ctx->client);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcctx_cache
+// Description  : Get an instance's block cache, e.g. to configure it
+//
+// Inputs       : ctx - the instance
+// Outputs      : the cache
+LcCache * lcctx_cache( LcContext *ctx ) {
+    return(ctx->cache);
+}
+
+//
+// The functions without a context work on the default instance
+
+int lcinit( LcInitStats *stats ) {
+    return(lcinit_ctx(lcctx_default(), stats));
+}
+
+LcFHandle lcopen( const char *path ) {
+    return(lcopen_ctx(lcctx_default(), path));
+}
+
+LcFHandle lcopen_hint( const char *path, size_t size ) {
+    return(lcopen_hint_ctx(lcctx_default(), path, size));
+}
+
+int lcread( LcFHandle fh, char *buf, size_t len ) {
+    return(lcread_ctx(lcctx_default(), fh, buf, len));
+}
+
+int lcwrite( LcFHandle fh, char *buf, size_t len ) {
+    return(lcwrite_ctx(lcctx_default(), fh, buf, len));
+}
+
+int lcseek( LcFHandle fh, size_t off ) {
+    return(lcseek_ctx(lcctx_default(), fh, off));
+}
+
+int lcfallocate( LcFHandle fh, size_t off, size_t len ) {
+    return(lcfallocate_ctx(lcctx_default(), fh, off, len));
+}
+
+int lcclose( LcFHandle fh ) {
+    return(lcclose_ctx(lcctx_default(), fh));
+}
+
+int lcclone( const char *src, const char *dst ) {
+    return(lcclone_ctx(lcctx_default(), src, dst));
+}
+
+int lcadvise( LcFHandle fh, size_t off, size_t len, LcAdvice advice ) {
+    return(lcadvise_ctx(lcctx_default(), fh, off, len, advice));
+}
+
+int lcpack( int enable ) {
+    return(lcpack_ctx(lcctx_default(), enable));
+}
+
+int lcpersist( const char *path ) {
+    return(lcpersist_ctx(lcctx_default(), path));
+}
+
+int lcstats( LcFsStats *stats ) {
+    return(lcstats_ctx(lcctx_default(), stats));
+}
+
+int lcshutdown( void ) {
+    return(lcshutdown_ctx(lcctx_default()));
+}
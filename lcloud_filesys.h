@@ -14,17 +14,75 @@
 // Includes
 #include <stddef.h>
 #include <stdint.h>
+#include <lcloud_registers.h>
 
 // Defines 
+#define LC_FILE_TABLE_INIT 64 // Files the file table has room for when brought up
+#define LC_ASYNC_DEPTH 256 // Operations the async submission ring holds
+#define LC_ASYNC_STAGE_BLOCKS 1024 // Blocks an async window stages (power of two)
+#define LC_ASYNC_POS ((size_t) -1) // Offset of an async operation at the file position
+#define LC_ADVISE_READAHEAD 32 // Blocks read ahead of a reader advised LC_ADV_SEQUENTIAL (or of a WILLNEED range)
+#define LC_PREFETCH_DEGREE 8 // Most blocks the correlation prefetcher reads per miss
 
 // Type definitions
 typedef int32_t LcFHandle;
 typedef uint64_t LCloudRegisterFrame;
+typedef struct LcContext LcContext; // A filesystem instance (see lcctx_create)
+typedef int64_t LcAsyncToken;
+
+typedef enum {
+    LC_ADV_NORMAL = 0, // No expectation (undoes the hints below)
+    LC_ADV_SEQUENTIAL = 1, // Read in order: read ahead of the reader
+    LC_ADV_RANDOM = 2, // Read in no order: never read ahead
+    LC_ADV_WILLNEED = 3, // Will be read soon: fetch the range into the cache now
+    LC_ADV_DONTNEED = 4, // Will not be read soon: its cached blocks go first
+    LC_ADV_NOREUSE = 5, // Read or written once: cache its blocks as the next to go
+} LcAdvice;
+
+typedef struct {
+    LcAsyncToken token; // The operation, as returned when it was queued
+    int result; // Bytes read or written, -1 if it failed
+    void *user; // The value given when it was queued
+} LcCompletion;
+
+typedef struct {
+    uint64_t meta_ns; // Loading the metadata checkpoint
+    uint64_t connect_ns; // Connecting to the server and setting up the cipher
+    uint64_t power_ns; // Powering on the devices
+    uint64_t probe_ns; // Probing for devices
+    uint64_t devinit_ns; // Initializing every device (pipelined on the bus)
+    uint64_t table_ns; // Allocating the file table and cache
+    uint64_t total_ns; // All of bring-up
+    int devices; // Devices found
+} LcInitStats;
+
+typedef struct {
+    uint64_t blocks_written; // Blocks writes sent to the devices
+    uint64_t writes_elided; // Blocks writes left alone because their contents did not change
+    uint64_t blocks_deduped; // Blocks writes mapped to a device block already holding their contents
+    uint64_t blocks_copied; // Shared device blocks copied because a write changed them
+    uint64_t blocks_cloned; // Blocks lcclone shared with the copy instead of copying
+} LcFsStats;
+
+typedef struct {
+    uint64_t issued; // Blocks read on a prediction
+    uint64_t useful; // Of those, read from the cache before they left it
+    uint64_t evicted; // Of those, evicted unread and then missed on (predicted too early)
+    uint64_t misses; // Blocks reads missed in the cache while the prefetcher was on
+    uint64_t throttles; // Times poor accuracy lowered the degree
+    int degree; // Blocks it reads per miss now (0 while throttled off)
+} LcPrefetchStats;
 
 // File system interface definitions
+int lcinit( LcInitStats *stats );
+    // Bring up the devices, cache and file table (the first open does it otherwise)
+
 LcFHandle lcopen( const char *path );
     // Open the file for for reading and writing
 
+LcFHandle lcopen_hint( const char *path, size_t size );
+    // Open the file, reserving contiguous device blocks for its expected size
+
 int lcread( LcFHandle fh, char *buf, size_t len );
     // Read data from the file hande
 
@@ -34,14 +92,96 @@ int lcwrite( LcFHandle fh, char *buf, size_t len );
 int lcseek( LcFHandle fh, size_t off );
     // Seek to a specific place in the file
 
+int lcfallocate( LcFHandle fh, size_t off, size_t len );
+    // Reserve contiguous device blocks for a range of the file
+
 int lcclose( LcFHandle fh );
     // Close the file
 
+int lcclone( const char *src, const char *dst );
+    // Make a new file dst that shares src's blocks until either is written
+
+int lcadvise( LcFHandle fh, size_t off, size_t len, LcAdvice advice );
+    // Tell the filesystem how a range of the file will be used (len 0: to the end)
+
+int lcpack( int enable );
+    // Pack small files and file tails into shared device blocks (1 on, 0 off)
+
+int lcdedup( int enable );
+    // Share one device block among the blocks with the same contents (1 on, 0 off)
+
+int lcprefetch( int degree );
+    // Prefetch up to degree blocks that past reads say follow a miss (0 off)
+
+int lcprefetch_stats( LcPrefetchStats *stats );
+    // Get the prefetcher's counters
+
+int lcpersist( const char *path );
+    // Keep the filesystem metadata in a checkpoint file across restarts (the
+    // cipher key is not kept in it: set it with client_set_cipher every run)
+
+int lcstats( LcFsStats *stats );
+    // Get the filesystem's counters
+
 int lcshutdown( void );
     // Shut down the filesystem
 
-int extract_lcloud_registers(LCloudRegisterFrame resp, int *b0, int *b1, int *c0, int *c1, 
-    int *c2, int *d0, int *d1);
-    // Helper function to extract information from register frame
+// Asynchronous interface: operations queue on a submission ring and run, in order,
+// at lcsubmit or lcwait, with their block transfers sharing pipelined bus batches
+LcAsyncToken lcread_async( LcFHandle fh, size_t off, char *buf, size_t len, void *user );
+    // Queue a read at off (LC_ASYNC_POS for the file position)
+
+LcAsyncToken lcwrite_async( LcFHandle fh, size_t off, char *buf, size_t len, void *user );
+    // Queue a write at off (LC_ASYNC_POS for the file position)
+
+int lcsubmit( void );
+    // Run the queued operations, posting their completions
+
+int lcpoll( LcCompletion *cqes, int max );
+    // Harvest up to max completions without running anything
+
+int lcwait( LcCompletion *cqes, int min, int max );
+    // Run the queued operations if fewer than min completed, then harvest
+
+// Filesystem instances: the functions above use the default instance, the
+// ones below the instance given (each instance is used by one thread at a time)
+LcContext * lcctx_create( void );
+    // Create a filesystem instance with its own connection, cache and files
+
+int lcctx_destroy( LcContext *ctx );
+    // Shut down an instance (if it is up) and free it
+
+LcContext * lcctx_default( void );
+    // The instance the functions without a context use
+
+struct LcClient * lcctx_client( LcContext *ctx );
+    // The instance's connection to the devices (to pick its transport)
+
+struct LcCache * lcctx_cache( LcContext *ctx );
+    // The instance's block cache (to configure it)
+
+int lcinit_ctx( LcContext *ctx, LcInitStats *stats );
+LcFHandle lcopen_ctx( LcContext *ctx, const char *path );
+LcFHandle lcopen_hint_ctx( LcContext *ctx, const char *path, size_t size );
+int lcread_ctx( LcContext *ctx, LcFHandle fh, char *buf, size_t len );
+int lcwrite_ctx( LcContext *ctx, LcFHandle fh, char *buf, size_t len );
+int lcseek_ctx( LcContext *ctx, LcFHandle fh, size_t off );
+int lcfallocate_ctx( LcContext *ctx, LcFHandle fh, size_t off, size_t len );
+int lcclose_ctx( LcContext *ctx, LcFHandle fh );
+int lcclone_ctx( LcContext *ctx, const char *src, const char *dst );
+int lcadvise_ctx( LcContext *ctx, LcFHandle fh, size_t off, size_t len, LcAdvice advice );
+int lcpack_ctx( LcContext *ctx, int enable );
+int lcdedup_ctx( LcContext *ctx, int enable );
+int lcprefetch_ctx( LcContext *ctx, int degree );
+int lcprefetch_stats_ctx( LcContext *ctx, LcPrefetchStats *stats );
+int lcpersist_ctx( LcContext *ctx, const char *path );
+int lcstats_ctx( LcContext *ctx, LcFsStats *stats );
+int lcshutdown_ctx( LcContext *ctx );
+LcAsyncToken lcread_async_ctx( LcContext *ctx, LcFHandle fh, size_t off, char *buf, size_t len, void *user );
+LcAsyncToken lcwrite_async_ctx( LcContext *ctx, LcFHandle fh, size_t off, char *buf, size_t len, void *user );
+int lcsubmit_ctx( LcContext *ctx );
+int lcpoll_ctx( LcContext *ctx, LcCompletion *cqes, int max );
+int lcwait_ctx( LcContext *ctx, LcCompletion *cqes, int min, int max );
+    // As the functions above, on the given instance
 
 #endif
@@ -0,0 +1,222 @@
+#ifndef LCLOUD_FSINTERNAL_INCLUDED
+#define LCLOUD_FSINTERNAL_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_fsinternal.h
+//  Description    : This is the filesystem's internal state (the LcContext
+//                   with its file table, device table and block allocator),
+//                   shared with the tools that drive the filesystem
+//                   primitives directly.
+//                   Programs using the filesystem only need lcloud_filesys.h.
+//
+//   Author        : Lucas Benning
+//   Last Modified : 4/30/20
+//
+
+// Includes
+#include <stddef.h>
+#include <stdint.h>
+#include <lcloud_filesys.h>
+#include <lcloud_network.h>
+#include <lcloud_cache.h>
+
+// Defines
+#define LC_BLOCK_HOLE 0xff // Device of a block no data has landed in (reads as zeros)
+#define LC_PACK_FRAG 32 // Packed tails are carved from shared blocks in multiples of this
+
+// Type definitions
+typedef struct {
+    uint16_t sec;
+    uint16_t blk;
+    LcDeviceId dev;
+    uint8_t unwritten; // 1 if reserved by lcfallocate and not yet written (reads as zeros)
+    uint8_t frag_off; // Packed tail: offset of the file's bytes in the shared block
+    uint8_t frag_len; // Packed tail: bytes of the shared block it holds, 0 if not packed
+} LcBlock;
+
+typedef struct {
+    char *path;
+    LcFHandle handle;
+    size_t pos;
+    size_t size;
+    LcBlock *blocks;
+    uint32_t num_blocks; // Entries in blocks (holes have dev LC_BLOCK_HOLE, only the last may be packed)
+    char open;
+    uint64_t map_off; // Offset of the block map in the metadata checkpoint, 0 if none
+                      // (blocks is NULL until the map is loaded)
+    char dirty; // 1 if the size or block map changed since the checkpoint
+    LcAdvice advice; // Access pattern given by lcadvise (reset at open)
+    size_t adv_off; // Range it covers
+    size_t adv_len; //   (0 to the end of the file)
+    uint32_t will_first; // Blocks lcadvise WILLNEED asked for that the file's next
+    uint32_t will_end;   //   reads from the devices fetch (none if equal, reset at open)
+} LcFile;
+
+typedef struct {
+    LcDeviceId id;
+    uint16_t num_sec;
+    uint16_t num_blk;
+    uint16_t next_sec;
+    uint16_t next_blk;
+    char full;
+} LcDevice;
+
+typedef struct {
+    uint32_t index; // Block of the file
+    uint16_t off; // First byte used within the block
+    uint16_t len; // Bytes used within the block
+} LcIoSeg;
+
+typedef struct {
+    uint32_t first; // First segment of the run
+    uint32_t count; // Segments in the run (consecutive device blocks)
+} LcIoRun;
+
+typedef struct {
+    LcIoSeg *segs; // One segment per block the range touches, in file order
+    uint32_t num_segs; // Entries in segs
+    LcIoRun *runs; // Segments grouped into physically contiguous runs
+    uint32_t num_runs; // Entries in runs
+    uint32_t cap; // Capacity of segs and runs
+} LcIoPlan;
+
+typedef enum {
+    LC_IO_DEMAND = 0, // A read or write is waiting for it
+    LC_IO_PREFETCH = 1, // Read ahead of need (may be dropped)
+    LC_IO_WRITEBACK = 2, // Written back in the background
+} LcIoClass;
+
+typedef enum {
+    LC_FRESH_NONE = 0, // The block held data before the write
+    LC_FRESH_ASSIGNED = 1, // The write just assigned the block (it starts zeroed)
+    LC_FRESH_FRAGMENT = 2, // The write just gave it a fragment of a shared block
+                           // (only the fragment starts zeroed)
+    LC_FRESH_WHOLE = 3, // The write replaces the block whole without knowing its contents
+} LcFresh;
+
+typedef void (*LcBlockObserver)( int op, LcDeviceId dev, uint16_t sec, uint16_t blk, int hit );
+    // Told of every block the filesystem touches: op is LC_XFER_READ or
+    // LC_XFER_WRITE, hit is 1 if the block was found in the cache
+
+typedef struct LcMeta LcMeta; // Metadata checkpoint state (lcloud_meta.h)
+typedef struct LcAsync LcAsync; // Async queues and staging area (lcloud_async.c)
+typedef struct LcPrefetch LcPrefetch; // Successor tables of the prefetcher (lcloud_prefetch.c)
+typedef struct LcSched LcSched; // Per-device request queues (lcloud_sched.c)
+typedef struct LcDedup LcDedup; // Block reference counts and content index (lcloud_dedup.c)
+
+struct LcContext {
+    LcClient *client; // Connection to the devices
+    LcCache *cache; // Block cache
+    LcFile *files; // Array of files
+    int filec; // Number of files
+    int files_cap; // Capacity of files
+    LcDevice *devices; // Array of present devices
+    int devc; // Number of devices
+    char pwr; // 1 if powered on, 0 if off
+    LcBlockObserver block_observer; // Block access observer, or NULL
+    LcFsStats stats; // Counters (lcstats)
+
+    // Scratch space for the read or write in progress (grown as needed)
+    LcIoPlan io_plan; // The byte range split into block segments
+    char *io_data; // One block buffer per segment
+    LcBlock **io_blks; // Blocks of a bus batch
+    char **io_bufs; // Buffers of a bus batch
+    uint32_t *io_miss; // Segments the batch reads
+    char *io_fresh; // LcFresh of each segment's block (what the write knows of its
+                    // old contents)
+    uint32_t io_cap; // Segments the scratch space holds
+
+    // Tail packing (lcpack)
+    int pack_tails; // 1 if small files and file tails are packed into shared blocks
+    LcBlock pack_blk; // Shared block new tails are carved from
+    uint16_t pack_fill; // Bytes of pack_blk handed out
+    uint32_t pack_blocks; // Shared blocks opened
+    LcBlock *pack_free; // Fragments left behind by tails that moved
+    uint32_t pack_nfree; // Entries in pack_free
+    uint32_t pack_free_cap; // Capacity of pack_free
+
+    // Block sharing (lcdedup, lcclone)
+    int dedup_blocks; // 1 if whole blocks are deduplicated by content
+    LcDedup *dedup; // Reference counts of shared device blocks and the content index,
+                    // NULL until a block is shared or indexed
+    LcBlock *free_blks; // Device blocks no file block maps any more (taken first)
+    uint32_t free_nblks; // Entries in free_blks
+    uint32_t free_blks_cap; // Capacity of free_blks
+
+    LcMeta *meta; // Metadata checkpoint, NULL if metadata is not kept
+    LcAsync *async; // Async queues, NULL until the first async operation
+    char staging; // 1 while an async window runs (transfers go through its staging area)
+    LcPrefetch *prefetch; // Correlation prefetcher, NULL if off
+    LcSched *sched; // Device request scheduler, NULL until the first transfer
+};
+
+//
+// Functional Prototypes
+
+int block_assign_helper( LcContext *ctx, LcFile *file, int start, int end );
+    // Assign the next free device blocks to blocks start .. end-1 of a file
+
+int extent_assign_helper( LcContext *ctx, LcFile *file, int start, int end );
+    // Assign the holes among blocks start .. end-1 of a file contiguous
+    // device blocks, on one device if any has room
+
+int device_xfer( LcContext *ctx, const char *dirs, LcBlock **blks, char **bufs, int n );
+    // Transfer a batch of blocks on the bus, each in its own direction, pipelined
+    // and in the order given
+
+int lcloud_sched_queue( LcContext *ctx, int dir, LcBlock **blks, char **bufs, int n, LcIoClass cls, LcFHandle fh );
+    // Queue block transfers for the next dispatch (writebacks are held past it)
+
+int lcloud_sched_dispatch( LcContext *ctx );
+    // Send the queued transfers and the writebacks held in scheduled round trips
+    // (bypasses async staging)
+
+void lcloud_sched_close( LcContext *ctx );
+    // Free the scheduler
+
+int lcloud_async_xfer( LcContext *ctx, int dir, LcBlock **blks, char **bufs, int n, LcFHandle fh );
+    // Transfer a batch of blocks through the staging area of the async window
+
+int lcloud_async_close( LcContext *ctx );
+    // Run the queued async operations and free the queues
+
+void lcloud_prefetch_access( LcContext *ctx, LcFHandle fh, LcBlock *blk, int hit );
+    // Tell the prefetcher of a block a read touched (hit is 1 if it was cached)
+
+int lcloud_prefetch_predict( LcContext *ctx, int n, uint32_t base, int limit );
+    // Add blocks predicted to follow the last miss to the I/O batch (n entries
+    // in it so far, io_data slots from base on free), up to a limit
+
+void lcloud_prefetch_reset( LcContext *ctx );
+    // Forget what the prefetcher learned (the device blocks are going away)
+
+uint32_t lcloud_dedup_refs( LcContext *ctx, LcBlock *blk );
+    // Count the file blocks mapped to a device block
+
+int lcloud_dedup_ref( LcContext *ctx, LcBlock *blk );
+    // Count one more file block mapped to a device block
+
+int lcloud_dedup_unref( LcContext *ctx, LcBlock *blk );
+    // Count one file block fewer mapped to a device block (freeing it if none is left)
+
+int lcloud_dedup_find( LcContext *ctx, char *data, LcBlock *blk );
+    // Look a block's contents up in the content index
+
+int lcloud_dedup_record( LcContext *ctx, LcBlock *blk );
+    // Index a device block under the contents last looked up
+
+void lcloud_dedup_forget( LcContext *ctx, LcBlock *blk );
+    // Drop a device block from the content index
+
+int lcloud_dedup_count( LcContext *ctx );
+    // Rebuild the reference counts from the block maps
+
+void lcloud_dedup_close( LcContext *ctx );
+    // Free the reference counts and content index
+
+int plan_io( LcContext *ctx, LcFile *file, size_t off, size_t len, LcIoPlan *plan );
+    // Split a byte range of a file into per-block segments and device runs
+    // (holes are never part of a run)
+
+#endif
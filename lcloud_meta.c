@@ -0,0 +1,528 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_meta.c
+//  Description    : This is the implementation of the filesystem metadata
+//                   checkpoint.  Loading maps the file and reads only the
+//                   directory; block maps stay in the mapping until their
+//                   file is opened.  Saving appends the maps that changed
+//                   and a new directory, or rewrites the file when most of
+//                   it is garbage.
+//
+//   Author        : Lucas Benning
+//   Last Modified : 5/2/20
+//
+
+// Include files
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <gcrypt.h>
+#include <cmpsc311_log.h>
+
+// Project include files
+#include <lcloud_meta.h>
+#include <lcloud_support.h>
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : meta_checksum
+// Description  : FNV-1a checksum of a record
+//
+// Inputs       : p - the record
+//                len - its length
+// Outputs      : the checksum
+
+static uint32_t meta_checksum( const char *p, size_t len ) {
+    uint32_t h = 2166136261u;
+    for(size_t i = 0; i < len; i++) {
+        h = (h ^ (uint8_t) p[i]) * 16777619u;
+    }
+    return(h);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : meta_pwrite
+// Description  : Write all of a buffer at an offset
+//
+// Inputs       : fd - the file
+//                buf, len - the data
+//                off - the offset
+// Outputs      : 0 if successful, -1 if failure
+
+static int meta_pwrite( int fd, const void *buf, size_t len, uint64_t off ) {
+    const char *p = buf;
+    ssize_t n;
+
+    while(len > 0) {
+        if((n = pwrite(fd, p, len, off)) == -1) {
+            if(errno == EINTR) continue;
+            return(-1);
+        }
+        p += n;
+        off += n;
+        len -= n;
+    }
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : meta_key_check
+// Description  : Check value of the cipher key and IV the client encrypts
+//                blocks with: a digest, so the checkpoint can tell the key
+//                without holding it
+//
+// Inputs       : ctx - the filesystem
+//                check - (output) LCLOUD_CIPHER_KEYLEN bytes
+// Outputs      : 0 if successful, -1 if the client has no key
+
+static int meta_key_check( LcContext *ctx, char *check ) {
+    char key[sizeof(LC_META_MAGIC) - 1 + 2 * LCLOUD_CIPHER_KEYLEN];
+    unsigned char digest[32];
+
+    memcpy(key, LC_META_MAGIC, sizeof(LC_META_MAGIC) - 1);
+    if(lcclient_get_cipher(ctx->client, key + sizeof(LC_META_MAGIC) - 1,
+        key + sizeof(LC_META_MAGIC) - 1 + LCLOUD_CIPHER_KEYLEN) == -1) {
+        return(-1);
+    }
+    gcry_md_hash_buffer(GCRY_MD_SHA256, digest, key, sizeof(key));
+    memcpy(check, digest, LCLOUD_CIPHER_KEYLEN);
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_meta_configure
+// Description  : Keep the filesystem metadata in a checkpoint file: it is
+//                loaded at power on if it exists and written at shutdown
+//
+// Inputs       : ctx - the filesystem
+//                path - the checkpoint file, NULL to stop keeping metadata
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_meta_configure( LcContext *ctx, const char *path ) {
+    LcMeta *meta = ctx->meta;
+
+    if(meta != NULL) {
+        lcloud_meta_close(ctx);
+        free(meta->path);
+        free(meta->tmp);
+        free(meta);
+        ctx->meta = NULL;
+    }
+    if(path == NULL) return(0);
+    if((meta = calloc(1, sizeof(LcMeta))) == NULL) return(-1);
+    if((meta->path = strdup(path)) == NULL || (meta->tmp = malloc(strlen(path) + 5)) == NULL) {
+        free(meta->path);
+        free(meta);
+        return(-1);
+    }
+    sprintf(meta->tmp, "%s.tmp", path);
+    ctx->meta = meta;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_meta_load
+// Description  : Map the checkpoint and load its directory into the file
+//                table, its packing state and free blocks (counting the
+//                file blocks of shared device blocks if it has any).  The
+//                client must have the cipher key the device blocks were
+//                written with.  No checkpoint yet is not an error (the
+//                filesystem starts empty); on any other failure nothing
+//                stays loaded.
+//
+// Inputs       : ctx - the filesystem
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_meta_load( LcContext *ctx ) {
+    LcMeta *meta = ctx->meta;
+    LcMetaDirHeader hdr;
+    LcMetaFile mf;
+    const char *dir, *names, *mfp;
+    char check[LCLOUD_CIPHER_KEYLEN];
+    struct timespec start, end;
+    struct stat st;
+    uint64_t need;
+    int fd;
+
+    if(meta == NULL) return(0);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if((fd = open(meta->path, O_RDONLY)) == -1) {
+        if(errno == ENOENT) {
+            logMessage(LcDriverLLevel, "No metadata checkpoint [%s], starting empty", meta->path);
+            return(0);
+        }
+        logMessage(LOG_ERROR_LEVEL, "Failure opening metadata checkpoint [%s]: %s", meta->path, strerror(errno));
+        return(-1);
+    }
+    if(fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(LcMetaSuper) ||
+        (meta->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        logMessage(LOG_ERROR_LEVEL, "Failure mapping metadata checkpoint [%s]", meta->path);
+        meta->map = NULL;
+        close(fd);
+        return(-1);
+    }
+    close(fd);
+    meta->map_len = st.st_size;
+
+    // Check the superblock and the directory it points at (records are copied
+    // out, nothing in the log is aligned)
+    memcpy(&meta->super, meta->map, sizeof(LcMetaSuper));
+    dir = meta->map + meta->super.dir_off;
+    if(memcmp(meta->super.magic, LC_META_MAGIC, sizeof(meta->super.magic)) != 0 ||
+        meta->super.version != LC_META_VERSION || meta->super.end > meta->map_len ||
+        meta->super.dir_len < sizeof(LcMetaDirHeader) || meta->super.dir_off > meta->super.end ||
+        meta->super.dir_len > meta->super.end - meta->super.dir_off ||
+        meta_checksum(dir, meta->super.dir_len) != meta->super.dir_sum) {
+        logMessage(LOG_ERROR_LEVEL, "Corrupt metadata checkpoint [%s]", meta->path);
+        lcloud_meta_close(ctx);
+        return(-1);
+    }
+    memcpy(&hdr, dir, sizeof(LcMetaDirHeader));
+    need = sizeof(LcMetaDirHeader) + (uint64_t) hdr.num_devices * sizeof(LcMetaDevice) +
+        (uint64_t) hdr.num_free * sizeof(LcBlock) + (uint64_t) hdr.num_files * sizeof(LcMetaFile);
+    if(need > meta->super.dir_len) {
+        logMessage(LOG_ERROR_LEVEL, "Corrupt metadata checkpoint directory [%s]", meta->path);
+        lcloud_meta_close(ctx);
+        return(-1);
+    }
+    if(meta_key_check(ctx, check) == -1 || memcmp(check, hdr.key_check, sizeof(check)) != 0) {
+        logMessage(LOG_ERROR_LEVEL, "Metadata checkpoint [%s] needs the cipher key its blocks were written with "
+            "(lcclient_set_cipher)", meta->path);
+        lcloud_meta_close(ctx);
+        return(-1);
+    }
+
+    // Device cursors (applied once the devices are up) and the packing state
+    meta->ndevs = hdr.num_devices;
+    if((meta->devs = malloc((meta->ndevs + 1) * sizeof(LcMetaDevice))) == NULL ||
+        (ctx->pack_free = malloc((hdr.num_free + 1) * sizeof(LcBlock))) == NULL) {
+        logMessage(LOG_ERROR_LEVEL, "Memory allocation error");
+        goto fail;
+    }
+    memcpy(meta->devs, dir + sizeof(LcMetaDirHeader), meta->ndevs * sizeof(LcMetaDevice));
+    memcpy(ctx->pack_free, dir + sizeof(LcMetaDirHeader) + meta->ndevs * sizeof(LcMetaDevice),
+        hdr.num_free * sizeof(LcBlock));
+    ctx->pack_nfree = hdr.num_free;
+    ctx->pack_free_cap = hdr.num_free + 1;
+
+    // Whole free blocks follow the fragments
+    while(ctx->pack_nfree > 0 && ctx->pack_free[ctx->pack_nfree - 1].frag_len == 0) {
+        ctx->pack_nfree--;
+    }
+    if(ctx->pack_nfree < hdr.num_free) {
+        ctx->free_nblks = hdr.num_free - ctx->pack_nfree;
+        if((ctx->free_blks = malloc(ctx->free_nblks * sizeof(LcBlock))) == NULL) {
+            logMessage(LOG_ERROR_LEVEL, "Memory allocation error");
+            goto fail;
+        }
+        memcpy(ctx->free_blks, ctx->pack_free + ctx->pack_nfree, ctx->free_nblks * sizeof(LcBlock));
+        ctx->free_blks_cap = ctx->free_nblks;
+    }
+    ctx->pack_blk = hdr.pack_blk;
+    ctx->pack_fill = hdr.pack_fill;
+    ctx->pack_blocks = hdr.pack_blocks;
+
+    // The directory: every file, block maps left in the checkpoint
+    ctx->filec = 0;
+    mfp = dir + need - (uint64_t) hdr.num_files * sizeof(LcMetaFile);
+    names = dir + need;
+    if((ctx->files = calloc(hdr.num_files + 1, sizeof(LcFile))) == NULL) {
+        logMessage(LOG_ERROR_LEVEL, "Memory allocation error");
+        goto fail;
+    }
+    ctx->files_cap = hdr.num_files + 1;
+    for(uint32_t i = 0; i < hdr.num_files; i++, mfp += sizeof(LcMetaFile)) {
+        LcFile *file = &ctx->files[i];
+        memcpy(&mf, mfp, sizeof(LcMetaFile));
+        if(mf.path_len > meta->super.dir_len - (names - dir) ||
+            (mf.num_blocks > 0 && (mf.map_off > meta->super.end ||
+            (uint64_t) mf.num_blocks * sizeof(LcBlock) > meta->super.end - mf.map_off)) ||
+            (file->path = malloc(mf.path_len + 1)) == NULL) {
+            logMessage(LOG_ERROR_LEVEL, "Corrupt metadata checkpoint entry %u [%s]", i, meta->path);
+            goto fail;
+        }
+        memcpy(file->path, names, mf.path_len);
+        file->path[mf.path_len] = '\0';
+        names += mf.path_len;
+        file->handle = i;
+        file->size = mf.size;
+        file->num_blocks = mf.num_blocks;
+        file->map_off = (mf.num_blocks > 0) ? mf.map_off : 0;
+        ctx->filec++;
+    }
+
+    // Count the file blocks each shared device block backs
+    if((hdr.flags & LC_META_SHARED) && lcloud_dedup_count(ctx) == -1) {
+        goto fail;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    logMessage(LcDriverLLevel, "Loaded metadata checkpoint [%s] generation %lu: %d files in %.3f ms",
+        meta->path, meta->super.generation, ctx->filec,
+        (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
+    return(0);
+
+fail:
+    lcloud_meta_unload(ctx);
+    return(-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_meta_unload
+// Description  : Forget the loaded directory: the file table, packing state,
+//                free blocks and block sharing counts, and the checkpoint
+//                mapping (so power on can be tried again)
+//
+// Inputs       : ctx - the filesystem
+// Outputs      : 0 if successful
+
+int lcloud_meta_unload( LcContext *ctx ) {
+    for(int i = 0; i < ctx->filec; i++) {
+        free(ctx->files[i].path);
+        free(ctx->files[i].blocks);
+    }
+    free(ctx->files);
+    ctx->files = NULL;
+    ctx->filec = 0;
+    ctx->files_cap = 0;
+    free(ctx->pack_free);
+    ctx->pack_free = NULL;
+    ctx->pack_nfree = 0;
+    ctx->pack_free_cap = 0;
+    ctx->pack_blk.dev = LC_BLOCK_HOLE;
+    ctx->pack_fill = 0;
+    ctx->pack_blocks = 0;
+    free(ctx->free_blks);
+    ctx->free_blks = NULL;
+    ctx->free_nblks = 0;
+    ctx->free_blks_cap = 0;
+    lcloud_dedup_close(ctx);
+    return(lcloud_meta_close(ctx));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_meta_devices
+// Description  : Restore the allocation cursor of each device in the
+//                checkpoint, which must match the device's geometry
+//
+// Inputs       : ctx - the filesystem
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_meta_devices( LcContext *ctx ) {
+    LcMeta *meta = ctx->meta;
+
+    if(meta == NULL) return(0);
+    for(uint32_t m = 0; m < meta->ndevs; m++) {
+        LcMetaDevice *md = &meta->devs[m];
+        int i;
+        for(i = 0; i < ctx->devc && ctx->devices[i].id != md->id; i++);
+        if(i == ctx->devc || ctx->devices[i].num_sec != md->num_sec || ctx->devices[i].num_blk != md->num_blk) {
+            logMessage(LOG_ERROR_LEVEL, "Metadata checkpoint does not match device %d", md->id);
+            return(-1);
+        }
+        ctx->devices[i].next_sec = md->next_sec;
+        ctx->devices[i].next_blk = md->next_blk;
+        ctx->devices[i].full = md->full;
+    }
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_meta_load_map
+// Description  : Load a file's block map from the checkpoint
+//
+// Inputs       : ctx - the filesystem
+//                file - the file (blocks NULL, map_off set)
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_meta_load_map( LcContext *ctx, LcFile *file ) {
+    LcMeta *meta = ctx->meta;
+    size_t len = (size_t) file->num_blocks * sizeof(LcBlock);
+
+    if(meta == NULL || meta->map == NULL || file->map_off == 0) {
+        logMessage(LOG_ERROR_LEVEL, "No block map for [%s] in the metadata checkpoint", file->path);
+        return(-1);
+    }
+    if((file->blocks = malloc(len)) == NULL) {
+        logMessage(LOG_ERROR_LEVEL, "Memory allocation error");
+        return(-1);
+    }
+    memcpy(file->blocks, meta->map + file->map_off, len);
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_meta_save
+// Description  : Write a checkpoint: append the block maps that changed and
+//                a directory, then point the superblock at it.  When less
+//                than half of the file would be live the checkpoint is
+//                written whole to a new file that replaces the old one.
+//
+// Inputs       : ctx - the filesystem
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_meta_save( LcContext *ctx ) {
+    LcMeta *meta = ctx->meta;
+    char *dir, *p;
+    uint64_t live = sizeof(LcMetaSuper), dir_len, off;
+    LcMetaDirHeader hdr;
+    LcMetaSuper super;
+    int fd, compact, ret = -1;
+
+    if(meta == NULL) return(0);
+
+    // Nothing to do if no file changed since the checkpoint was loaded
+    int dirty = (meta->map == NULL);
+    for(int i = 0; i < ctx->filec && !dirty; i++) {
+        dirty = ctx->files[i].dirty;
+    }
+    if(!dirty) return(0);
+
+    // What the checkpoint will reference
+    dir_len = sizeof(LcMetaDirHeader) + (uint64_t) ctx->devc * sizeof(LcMetaDevice) +
+        (uint64_t) (ctx->pack_nfree + ctx->free_nblks) * sizeof(LcBlock) + (uint64_t) ctx->filec * sizeof(LcMetaFile);
+    for(int i = 0; i < ctx->filec; i++) {
+        dir_len += strlen(ctx->files[i].path);
+        live += (uint64_t) ctx->files[i].num_blocks * sizeof(LcBlock);
+    }
+    live += dir_len;
+
+    // Append to the log, or start it over when most of it is garbage
+    compact = (meta->map == NULL || meta->super.end > 2 * live);
+    if(compact) {
+        fd = open(meta->tmp, O_RDWR | O_CREAT | O_TRUNC, 0600);
+        off = sizeof(LcMetaSuper);
+    } else {
+        fd = open(meta->path, O_RDWR);
+        off = meta->super.end;
+    }
+    if(fd == -1 || (dir = malloc(dir_len)) == NULL) {
+        logMessage(LOG_ERROR_LEVEL, "Failure writing metadata checkpoint [%s]: %s", meta->path, strerror(errno));
+        if(fd != -1) close(fd);
+        return(-1);
+    }
+
+    // The block maps that changed (all of them when starting over)
+    for(int i = 0; i < ctx->filec; i++) {
+        LcFile *file = &ctx->files[i];
+        size_t len = (size_t) file->num_blocks * sizeof(LcBlock);
+        if(len == 0 || (!compact && !file->dirty && file->map_off != 0)) continue;
+        if(meta_pwrite(fd, (file->blocks != NULL) ? (char *) file->blocks : meta->map + file->map_off, len, off) == -1) {
+            goto done;
+        }
+        file->map_off = off;
+        off += len;
+    }
+
+    // The directory
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.num_files = ctx->filec;
+    hdr.num_devices = ctx->devc;
+    hdr.num_free = ctx->pack_nfree + ctx->free_nblks;
+    hdr.flags = (ctx->dedup != NULL) ? LC_META_SHARED : 0;
+    hdr.pack_blocks = ctx->pack_blocks;
+    hdr.pack_blk = ctx->pack_blk;
+    hdr.pack_fill = ctx->pack_fill;
+    if(meta_key_check(ctx, hdr.key_check) == -1) {
+        logMessage(LOG_ERROR_LEVEL, "No cipher key to record the check value of in the metadata checkpoint");
+        goto done;
+    }
+    p = dir;
+    memcpy(p, &hdr, sizeof(hdr));
+    p += sizeof(hdr);
+    for(int i = 0; i < ctx->devc; i++, p += sizeof(LcMetaDevice)) {
+        LcMetaDevice md = { ctx->devices[i].id, ctx->devices[i].full, ctx->devices[i].num_sec, ctx->devices[i].num_blk,
+            ctx->devices[i].next_sec, ctx->devices[i].next_blk };
+        memcpy(p, &md, sizeof(md));
+    }
+    if(ctx->pack_nfree > 0) {
+        memcpy(p, ctx->pack_free, ctx->pack_nfree * sizeof(LcBlock));
+        p += ctx->pack_nfree * sizeof(LcBlock);
+    }
+    if(ctx->free_nblks > 0) {
+        memcpy(p, ctx->free_blks, ctx->free_nblks * sizeof(LcBlock));
+        p += ctx->free_nblks * sizeof(LcBlock);
+    }
+    for(int i = 0; i < ctx->filec; i++, p += sizeof(LcMetaFile)) {
+        LcMetaFile mf = { ctx->files[i].size, (ctx->files[i].num_blocks > 0) ? ctx->files[i].map_off : 0,
+            ctx->files[i].num_blocks, strlen(ctx->files[i].path) };
+        memcpy(p, &mf, sizeof(mf));
+    }
+    for(int i = 0; i < ctx->filec; i++) {
+        memcpy(p, ctx->files[i].path, strlen(ctx->files[i].path));
+        p += strlen(ctx->files[i].path);
+    }
+    if(meta_pwrite(fd, dir, dir_len, off) == -1 || fsync(fd) == -1) {
+        goto done;
+    }
+
+    // Commit: the superblock goes last
+    memset(&super, 0, sizeof(super));
+    memcpy(super.magic, LC_META_MAGIC, sizeof(super.magic));
+    super.version = LC_META_VERSION;
+    super.generation = (meta->map != NULL) ? meta->super.generation + 1 : 1;
+    super.dir_off = off;
+    super.dir_len = dir_len;
+    super.end = off + dir_len;
+    super.live = live;
+    super.dir_sum = meta_checksum(dir, dir_len);
+    if(meta_pwrite(fd, &super, sizeof(super), 0) == -1 || fsync(fd) == -1 ||
+        (compact && rename(meta->tmp, meta->path) == -1)) {
+        goto done;
+    }
+    meta->super = super;
+    for(int i = 0; i < ctx->filec; i++) {
+        ctx->files[i].dirty = 0;
+    }
+    logMessage(LcDriverLLevel, "Wrote metadata checkpoint [%s] generation %lu: %d files, %lu of %lu bytes live%s",
+        meta->path, super.generation, ctx->filec, live, super.end, compact ? " (rewritten)" : "");
+    ret = 0;
+
+done:
+    if(ret == -1) {
+        logMessage(LOG_ERROR_LEVEL, "Failure writing metadata checkpoint [%s]: %s", meta->path, strerror(errno));
+    }
+    free(dir);
+    close(fd);
+    return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_meta_close
+// Description  : Release the loaded checkpoint
+//
+// Inputs       : ctx - the filesystem
+// Outputs      : 0 if successful
+
+int lcloud_meta_close( LcContext *ctx ) {
+    LcMeta *meta = ctx->meta;
+
+    if(meta == NULL) return(0);
+    if(meta->map != NULL) {
+        munmap(meta->map, meta->map_len);
+    }
+    meta->map = NULL;
+    meta->map_len = 0;
+    free(meta->devs);
+    meta->devs = NULL;
+    meta->ndevs = 0;
+    return(0);
+}
@@ -0,0 +1,111 @@
+#ifndef LCLOUD_META_INCLUDED
+#define LCLOUD_META_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_meta.h
+//  Description    : This is the interface of the filesystem metadata
+//                   checkpoint, a local file that lets the filesystem come
+//                   back after a restart.  The file is a log: block map
+//                   records and directory records (every file's size and
+//                   map location, the device allocation cursors, the packing
+//                   state, the free blocks and a check value of the key the
+//                   device blocks are encrypted with)
+//                   are appended, and the superblock at the front, written
+//                   last, points at the current directory.  A checkpoint
+//                   that does not complete leaves the previous one in place.
+//                   The key itself is never written: the caller gives it to
+//                   the client (lcclient_set_cipher) at every power on, and
+//                   the check value refuses a checkpoint written with
+//                   another key.
+//
+//   Author        : Lucas Benning
+//   Last Modified : 5/2/20
+//
+
+// Includes
+#include <stddef.h>
+#include <stdint.h>
+#include <lcloud_network.h>
+#include <lcloud_fsinternal.h>
+
+// Defines
+#define LC_META_MAGIC "LCMD" // First four bytes of a checkpoint
+#define LC_META_VERSION 2
+#define LC_META_SHARED 0x1 // Directory flag: some device blocks back several file blocks
+
+// Type definitions
+typedef struct {
+    char magic[4]; // LC_META_MAGIC
+    uint32_t version; // LC_META_VERSION
+    uint64_t generation; // Checkpoints written to the file
+    uint64_t dir_off; // Offset of the current directory record
+    uint64_t dir_len; // Its length
+    uint64_t end; // End of the log
+    uint64_t live; // Bytes the current checkpoint uses (the rest is garbage)
+    uint32_t dir_sum; // Checksum of the directory record
+    uint32_t reserved;
+} LcMetaSuper;
+
+typedef struct {
+    uint32_t num_files; // Entries that follow, in this order:
+    uint32_t num_devices; //   LcMetaDevice[num_devices]
+    uint32_t num_free; //   LcBlock[num_free] (free packed fragments, then free blocks)
+    uint32_t pack_blocks; //   LcMetaFile[num_files], then their paths
+    LcBlock pack_blk; // Packing state
+    uint16_t pack_fill;
+    uint16_t flags; // LC_META_SHARED
+    char key_check[LCLOUD_CIPHER_KEYLEN]; // Check value of the device blocks' cipher key and IV
+} LcMetaDirHeader;
+
+typedef struct {
+    uint8_t id; // Device allocation cursor
+    uint8_t full;
+    uint16_t num_sec;
+    uint16_t num_blk;
+    uint16_t next_sec;
+    uint16_t next_blk;
+} LcMetaDevice;
+
+typedef struct {
+    uint64_t size; // File size
+    uint64_t map_off; // Offset of the block map record, 0 if no blocks
+    uint32_t num_blocks; // Entries in the block map
+    uint32_t path_len; // Length of the path (no terminator)
+} LcMetaFile;
+
+struct LcMeta {
+    char *path; // The checkpoint file
+    char *tmp; // The file a checkpoint written whole goes to first
+    char *map; // The loaded checkpoint, NULL if none
+    size_t map_len; // Length of the mapping
+    LcMetaSuper super; // Its superblock
+    LcMetaDevice *devs; // Its device cursors
+    uint32_t ndevs; // Entries in devs
+};
+
+//
+// Functional Prototypes
+
+int lcloud_meta_configure( LcContext *ctx, const char *path );
+    // Keep the metadata in a checkpoint file (NULL to stop)
+
+int lcloud_meta_load( LcContext *ctx );
+    // Load the checkpoint's directory (at power on, with the client's cipher key set)
+
+int lcloud_meta_unload( LcContext *ctx );
+    // Forget the loaded directory (power on failed after loading it)
+
+int lcloud_meta_devices( LcContext *ctx );
+    // Restore the device allocation cursors (after the devices are initialized)
+
+int lcloud_meta_load_map( LcContext *ctx, LcFile *file );
+    // Load a file's block map from the checkpoint
+
+int lcloud_meta_save( LcContext *ctx );
+    // Write a checkpoint of the current metadata
+
+int lcloud_meta_close( LcContext *ctx );
+    // Release the loaded checkpoint
+
+#endif
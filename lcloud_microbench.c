@@ -0,0 +1,670 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_microbench.c
+//  Description    : This is the microbenchmark harness for the client's hot
+//                   primitives: the block cache (every policy, several
+//                   capacities, sequential, uniform and Zipfian key
+//                   streams), the block allocator, the I/O planner and the
+//                   register frame codec.  Each benchmark runs in a tight loop over keys
+//                   generated up front, with warmup passes and repeated
+//                   timed passes, and reports the median, minimum and
+//                   standard deviation of ns/op plus TSC cycles/op.
+//
+//   Author        : Lucas Benning
+//   Last Modified : 4/30/20
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Project Includes
+#include <cmpsc311_log.h>
+#include <lcloud_controller.h>
+#include <lcloud_support.h>
+#include <lcloud_cache.h>
+#include <lcloud_registers.h>
+#include <lcloud_fsinternal.h>
+
+// Defines
+#define LC_MICROBENCH_ARGUMENTS "hvn:r:w:f:"
+#define LC_MB_MAX_REPS 101 // Most timed repetitions
+#define LC_MB_ALLOC_DEVICES 4 // Devices the allocator benchmark spreads over
+#define USAGE                                                                         \
+    "USAGE: lcloud_microbench [-h] [-v] [-n <ops>] [-r <reps>] [-w <warmup>] [-f <filter>]\n" \
+    "\n"                                                                              \
+    "where:\n"                                                                        \
+    "    -h - help mode (display this message)\n"                                     \
+    "    -v - verbose output\n"                                                       \
+    "    -n - operations per repetition (default 1000000)\n"                          \
+    "    -r - timed repetitions, the median is reported (default 7)\n"                \
+    "    -w - untimed warmup repetitions (default 1)\n"                               \
+    "    -f - only run benchmarks whose name contains <filter>\n"                     \
+    "\n"
+
+// Type definitions
+typedef enum {
+    MB_SEQUENTIAL = 0, // Cyclic scan over the key space
+    MB_UNIFORM = 1, // Every key equally likely
+    MB_ZIPF = 2, // Popularity falls off as 1/rank^0.99
+    MB_MAX_STREAM = 3,
+} LcMbStream;
+
+typedef struct {
+    LcDeviceId dev;
+    uint16_t sec;
+    uint16_t blk;
+} LcMbKey;
+
+typedef struct {
+    uint64_t ops; // Operations per repetition
+    int reps; // Timed repetitions
+    int warmup; // Untimed repetitions
+    const char *filter; // Benchmark name filter, or NULL
+    uint64_t rng; // xorshift64* state
+    volatile uint64_t sink; // Results the loops fold in, so nothing is optimized away
+} LcMicrobench;
+
+typedef struct {
+    double median_ns; // Median ns/op over the timed repetitions
+    double min_ns; // Fastest repetition
+    double stddev_ns; // Standard deviation of ns/op
+    double median_cycles; // Median TSC cycles/op
+} LcMbResult;
+
+typedef void (*LcMbBody)( LcMicrobench *mb, void *arg );
+
+// Benchmark arguments
+typedef struct {
+    LcMbKey *keys; // The key stream
+    char block[LC_DEVICE_BLOCK_SIZE]; // Data inserted on a miss
+} LcMbCacheArg;
+
+typedef struct {
+    int *fields; // Seven register values per frame
+    LCloudRegisterFrame *frames; // Packed frames
+} LcMbCodecArg;
+
+typedef struct {
+    LcFile file; // The file blocks are assigned to
+    int chunk; // Blocks per call
+    int capacity; // Blocks across the devices
+} LcMbAllocArg;
+
+typedef struct {
+    LcFile file; // The file ranges are planned on
+    size_t *offs; // Offset of each range
+    uint32_t *lens; // Length of each range
+    LcIoPlan plan; // The plan (reused)
+} LcMbPlanArg;
+
+const char *stream_names[MB_MAX_STREAM] = { "seq", "uniform", "zipf" };
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mb_rand
+// Description  : Next value of the benchmark's xorshift64* stream
+//
+// Inputs       : mb - the benchmark state
+// Outputs      : 64 random bits
+
+static uint64_t mb_rand( LcMicrobench *mb ) {
+    mb->rng ^= mb->rng >> 12;
+    mb->rng ^= mb->rng << 25;
+    mb->rng ^= mb->rng >> 27;
+    return(mb->rng * 0x2545F4914F6CDD1DULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mb_now
+// Description  : Monotonic time in nanoseconds
+//
+// Inputs       : none
+// Outputs      : the time
+
+static uint64_t mb_now( void ) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return((uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mb_cycles
+// Description  : Read the time stamp counter (0 where there is none)
+//
+// Inputs       : none
+// Outputs      : the counter
+
+static uint64_t mb_cycles( void ) {
+#if defined(__x86_64__) || defined(__i386__)
+    return(__rdtsc());
+#else
+    return(0);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mb_compare
+// Description  : qsort comparison of two doubles
+//
+// Inputs       : a, b - the values
+// Outputs      : <0, 0 or >0
+
+static int mb_compare( const void *a, const void *b ) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return((x > y) - (x < y));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mb_selected
+// Description  : Check a benchmark name against the filter
+//
+// Inputs       : mb - the benchmark state
+//                name - the benchmark name
+// Outputs      : 1 if the benchmark should run, 0 if not
+
+static int mb_selected( LcMicrobench *mb, const char *name ) {
+    return(mb->filter == NULL || strstr(name, mb->filter) != NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mb_measure
+// Description  : Run a benchmark body through the warmup and timed
+//                repetitions
+//
+// Inputs       : mb - the benchmark state
+//                body - runs mb->ops operations
+//                arg - the body's argument
+//                res - (output) the timings
+// Outputs      : none
+
+static void mb_measure( LcMicrobench *mb, LcMbBody body, void *arg, LcMbResult *res ) {
+    double ns[LC_MB_MAX_REPS], cyc[LC_MB_MAX_REPS], mean = 0, var = 0;
+    uint64_t t0, c0;
+    int i;
+
+    for(i = 0; i < mb->warmup; i++) {
+        body(mb, arg);
+    }
+    for(i = 0; i < mb->reps; i++) {
+        t0 = mb_now();
+        c0 = mb_cycles();
+        body(mb, arg);
+        cyc[i] = (double) (mb_cycles() - c0) / mb->ops;
+        ns[i] = (double) (mb_now() - t0) / mb->ops;
+        mean += ns[i];
+    }
+
+    mean /= mb->reps;
+    for(i = 0; i < mb->reps; i++) {
+        var += (ns[i] - mean) * (ns[i] - mean);
+    }
+    qsort(ns, mb->reps, sizeof(double), mb_compare);
+    qsort(cyc, mb->reps, sizeof(double), mb_compare);
+    res->median_ns = ns[mb->reps / 2];
+    res->min_ns = ns[0];
+    res->stddev_ns = (mb->reps > 1) ? sqrt(var / (mb->reps - 1)) : 0.0;
+    res->median_cycles = cyc[mb->reps / 2];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mb_report
+// Description  : Print a benchmark's row
+//
+// Inputs       : name - the benchmark name
+//                res - the timings
+//                note - extra column (may be empty)
+// Outputs      : none
+
+static void mb_report( const char *name, LcMbResult *res, const char *note ) {
+    printf("%-28s %10.2f %10.2f %9.2f %11.1f  %s\n", name, res->median_ns, res->min_ns,
+        res->stddev_ns, res->median_cycles, note);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mb_make_keys
+// Description  : Generate a block key stream over a key space
+//
+// Inputs       : mb - the benchmark state
+//                stream - the access pattern
+//                space - number of distinct keys
+// Outputs      : the keys (mb->ops of them), NULL if failure
+
+static LcMbKey * mb_make_keys( LcMicrobench *mb, LcMbStream stream, uint32_t space ) {
+    LcMbKey *keys;
+    double *cdf = NULL, sum = 0, u;
+    uint32_t k, lo, hi;
+
+    if((keys = malloc(mb->ops * sizeof(LcMbKey))) == NULL) return(NULL);
+    if(stream == MB_ZIPF) {
+        if((cdf = malloc(space * sizeof(double))) == NULL) {
+            free(keys);
+            return(NULL);
+        }
+        for(k = 0; k < space; k++) {
+            sum += 1.0 / pow(k + 1, 0.99);
+            cdf[k] = sum;
+        }
+    }
+
+    for(uint64_t i = 0; i < mb->ops; i++) {
+        if(stream == MB_SEQUENTIAL) {
+            k = i % space;
+        } else if(stream == MB_UNIFORM) {
+            k = mb_rand(mb) % space;
+        } else {
+            u = (mb_rand(mb) >> 11) * (1.0 / 9007199254740992.0) * sum;
+            for(lo = 0, hi = space - 1; lo < hi; ) {
+                k = (lo + hi) / 2;
+                if(cdf[k] < u) lo = k + 1; else hi = k;
+            }
+            // Scatter the popular ranks over the key space
+            k = (uint32_t) ((lo * 2654435761ULL) % space);
+        }
+        keys[i].dev = k / (256 * 256);
+        keys[i].sec = (k / 256) % 256;
+        keys[i].blk = k % 256;
+    }
+    free(cdf);
+    return(keys);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mb_cache_body
+// Description  : Look up every key, inserting the block on a miss (the
+//                filesystem's read path)
+//
+// Inputs       : mb - the benchmark state
+//                arg - the LcMbCacheArg
+// Outputs      : none
+
+static void mb_cache_body( LcMicrobench *mb, void *arg ) {
+    LcMbCacheArg *c = arg;
+    uint64_t hits = 0;
+    char *blk;
+
+    for(uint64_t i = 0; i < mb->ops; i++) {
+        if((blk = lcloud_getcache(c->keys[i].dev, c->keys[i].sec, c->keys[i].blk)) != NULL) {
+            hits += blk[0];
+        } else {
+            lcloud_putcache(c->keys[i].dev, c->keys[i].sec, c->keys[i].blk, c->block);
+        }
+    }
+    mb->sink += hits;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mb_cache
+// Description  : Run the cache benchmarks: every policy and stream at each
+//                capacity, over a key space twice the capacity
+//
+// Inputs       : mb - the benchmark state
+// Outputs      : 0 if successful, -1 if failure
+
+static int mb_cache( LcMicrobench *mb ) {
+    static const int sizes[] = { 64, 1024, 16384 };
+    LcMbCacheArg arg;
+    LcMbResult res;
+    LcCacheStats st;
+    char name[64], note[64];
+
+    memset(arg.block, 1, sizeof(arg.block));
+    for(int s = 0; s < (int) (sizeof(sizes) / sizeof(sizes[0])); s++) {
+        for(int str = 0; str < MB_MAX_STREAM; str++) {
+            arg.keys = NULL;
+            for(int p = 0; p < LC_CACHE_MAX_POLICY; p++) {
+                lcloud_cache_configure(sizes[s], p);
+                snprintf(name, sizeof(name), "cache/%s/%d/%s", lcloud_cache_policy_name(), sizes[s], stream_names[str]);
+                if(!mb_selected(mb, name)) continue;
+
+                if(arg.keys == NULL && (arg.keys = mb_make_keys(mb, str, 2 * sizes[s])) == NULL) {
+                    return(-1);
+                }
+                if(lcloud_initcache(sizes[s]) == -1) {
+                    free(arg.keys);
+                    return(-1);
+                }
+                mb_measure(mb, mb_cache_body, &arg, &res);
+                lcloud_cache_stats(&st);
+                lcloud_closecache();
+                snprintf(note, sizeof(note), "hit %.1f%%", 100.0 * st.hits / (st.hits + st.misses));
+                mb_report(name, &res, note);
+            }
+            free(arg.keys);
+        }
+    }
+    lcloud_cache_configure(-1, LC_CACHE_LRU);
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mb_devices
+// Description  : Install an empty device cluster like the assignment
+//                manifests (64 sectors of 64 blocks each) as the
+//                filesystem's device table
+//
+// Inputs       : devs - LC_MB_ALLOC_DEVICES devices to set up
+// Outputs      : none
+
+static void mb_devices( LcDevice *devs ) {
+    for(int d = 0; d < LC_MB_ALLOC_DEVICES; d++) {
+        memset(&devs[d], 0, sizeof(LcDevice));
+        devs[d].id = d;
+        devs[d].num_sec = 64;
+        devs[d].num_blk = 64;
+    }
+    lcctx_default()->devices = devs;
+    lcctx_default()->devc = LC_MB_ALLOC_DEVICES;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mb_alloc_body
+// Description  : Assign device blocks to a file chunk by chunk, starting
+//                over with empty devices when they fill up
+//
+// Inputs       : mb - the benchmark state
+//                arg - the LcMbAllocArg
+// Outputs      : none
+
+static void mb_alloc_body( LcMicrobench *mb, void *arg ) {
+    LcMbAllocArg *a = arg;
+    int used = a->capacity;
+
+    for(uint64_t i = 0; i < mb->ops; i += a->chunk) {
+        if(used + a->chunk > a->capacity) {
+            for(int d = 0; d < lcctx_default()->devc; d++) {
+                lcctx_default()->devices[d].next_sec = lcctx_default()->devices[d].next_blk = 0;
+                lcctx_default()->devices[d].full = 0;
+            }
+            used = 0;
+        }
+        block_assign_helper(lcctx_default(), &a->file, used, used + a->chunk);
+        used += a->chunk;
+    }
+    mb->sink += a->file.blocks[used - 1].blk;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mb_alloc
+// Description  : Run the block allocator benchmarks (single block and
+//                multi-block extensions, as small and large writes make)
+//
+// Inputs       : mb - the benchmark state
+// Outputs      : 0 if successful, -1 if failure
+
+static int mb_alloc( LcMicrobench *mb ) {
+    static const int chunks[] = { 1, 16 };
+    LcDevice devs[LC_MB_ALLOC_DEVICES];
+    LcMbAllocArg arg;
+    LcMbResult res;
+    char name[64];
+
+    mb_devices(devs);
+    memset(&arg, 0, sizeof(arg));
+    arg.capacity = LC_MB_ALLOC_DEVICES * 64 * 64;
+    if((arg.file.blocks = malloc(arg.capacity * sizeof(LcBlock))) == NULL) return(-1);
+    for(int c = 0; c < (int) (sizeof(chunks) / sizeof(chunks[0])); c++) {
+        snprintf(name, sizeof(name), "alloc/%d", chunks[c]);
+        if(!mb_selected(mb, name)) continue;
+        arg.chunk = chunks[c];
+        mb_measure(mb, mb_alloc_body, &arg, &res);
+        mb_report(name, &res, "per block");
+    }
+
+    free(arg.file.blocks);
+    lcctx_default()->devices = NULL;
+    lcctx_default()->devc = 0;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mb_plan_body
+// Description  : Plan byte ranges of a file
+//
+// Inputs       : mb - the benchmark state
+//                arg - the LcMbPlanArg
+// Outputs      : none
+
+static void mb_plan_body( LcMicrobench *mb, void *arg ) {
+    LcMbPlanArg *p = arg;
+    uint64_t runs = 0;
+
+    for(uint64_t i = 0; i < mb->ops; i++) {
+        plan_io(lcctx_default(), &p->file, p->offs[i], p->lens[i], &p->plan);
+        runs += p->plan.num_runs;
+    }
+    mb->sink += runs;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mb_plan
+// Description  : Run the I/O planner benchmarks: random ranges up to 1 KB
+//                and up to 10 KB (the largest workload operation) over a
+//                file filling the devices
+//
+// Inputs       : mb - the benchmark state
+// Outputs      : 0 if successful, -1 if failure
+
+static int mb_plan( LcMicrobench *mb ) {
+    static const uint32_t maxlens[] = { 1024, 10240 };
+    LcDevice devs[LC_MB_ALLOC_DEVICES];
+    uint32_t nblocks = LC_MB_ALLOC_DEVICES * 64 * 64;
+    size_t fsize = (size_t) nblocks * LC_DEVICE_BLOCK_SIZE;
+    LcMbPlanArg arg;
+    LcMbResult res;
+    char name[64];
+    int ret = 0;
+
+    mb_devices(devs);
+    memset(&arg, 0, sizeof(arg));
+    arg.file.blocks = malloc(nblocks * sizeof(LcBlock));
+    arg.offs = malloc(mb->ops * sizeof(size_t));
+    arg.lens = malloc(mb->ops * sizeof(uint32_t));
+    if(arg.file.blocks == NULL || arg.offs == NULL || arg.lens == NULL ||
+        block_assign_helper(lcctx_default(), &arg.file, 0, nblocks) == -1) {
+        ret = -1;
+    }
+    arg.file.num_blocks = nblocks;
+
+    for(int l = 0; ret == 0 && l < (int) (sizeof(maxlens) / sizeof(maxlens[0])); l++) {
+        snprintf(name, sizeof(name), "plan/%u", maxlens[l]);
+        if(!mb_selected(mb, name)) continue;
+        for(uint64_t i = 0; i < mb->ops; i++) {
+            arg.lens[i] = 1 + mb_rand(mb) % maxlens[l];
+            arg.offs[i] = mb_rand(mb) % (fsize - arg.lens[i]);
+        }
+        mb_measure(mb, mb_plan_body, &arg, &res);
+        mb_report(name, &res, "per range");
+    }
+
+    free(arg.file.blocks);
+    free(arg.offs);
+    free(arg.lens);
+    free(arg.plan.segs);
+    free(arg.plan.runs);
+    lcctx_default()->devices = NULL;
+    lcctx_default()->devc = 0;
+    return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mb_create_body
+// Description  : Pack register frames
+//
+// Inputs       : mb - the benchmark state
+//                arg - the LcMbCodecArg
+// Outputs      : none
+
+static void mb_create_body( LcMicrobench *mb, void *arg ) {
+    LcMbCodecArg *c = arg;
+    LCloudRegisterFrame acc = 0;
+    int *f;
+
+    for(uint64_t i = 0; i < mb->ops; i++) {
+        f = &c->fields[i * 7];
+        acc ^= create_lcloud_register(f[0], f[1], f[2], f[3], f[4], f[5], f[6]);
+    }
+    mb->sink += acc;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mb_extract_body
+// Description  : Unpack register frames
+//
+// Inputs       : mb - the benchmark state
+//                arg - the LcMbCodecArg
+// Outputs      : none
+
+static void mb_extract_body( LcMicrobench *mb, void *arg ) {
+    LcMbCodecArg *c = arg;
+    int b0, b1, c0, c1, c2, d0, d1;
+    uint64_t acc = 0;
+
+    for(uint64_t i = 0; i < mb->ops; i++) {
+        extract_lcloud_registers(c->frames[i], &b0, &b1, &c0, &c1, &c2, &d0, &d1);
+        acc += b0 + b1 + c0 + c1 + c2 + d0 + d1;
+    }
+    mb->sink += acc;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mb_codec
+// Description  : Run the register codec benchmarks over random block
+//                transfer frames
+//
+// Inputs       : mb - the benchmark state
+// Outputs      : 0 if successful, -1 if failure
+
+static int mb_codec( LcMicrobench *mb ) {
+    LcMbCodecArg arg;
+    LcMbResult res;
+    int *f;
+
+    if(!mb_selected(mb, "codec/create") && !mb_selected(mb, "codec/extract")) return(0);
+    arg.fields = malloc(mb->ops * 7 * sizeof(int));
+    arg.frames = malloc(mb->ops * sizeof(LCloudRegisterFrame));
+    if(arg.fields == NULL || arg.frames == NULL) {
+        free(arg.fields);
+        free(arg.frames);
+        return(-1);
+    }
+    for(uint64_t i = 0; i < mb->ops; i++) {
+        f = &arg.fields[i * 7];
+        f[0] = f[1] = 0;
+        f[2] = LC_BLOCK_XFER;
+        f[3] = mb_rand(mb) % 16;
+        f[4] = mb_rand(mb) % 2 ? LC_XFER_READ : LC_XFER_WRITE;
+        f[5] = mb_rand(mb) % 256;
+        f[6] = mb_rand(mb) % 256;
+        arg.frames[i] = create_lcloud_register(1, 1, f[2], f[3], f[4], f[5], f[6]);
+    }
+
+    if(mb_selected(mb, "codec/create")) {
+        mb_measure(mb, mb_create_body, &arg, &res);
+        mb_report("codec/create", &res, "");
+    }
+    if(mb_selected(mb, "codec/extract")) {
+        mb_measure(mb, mb_extract_body, &arg, &res);
+        mb_report("codec/extract", &res, "");
+    }
+    free(arg.fields);
+    free(arg.frames);
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the microbenchmark harness
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] ) {
+    LcMicrobench mb;
+    int ch, verbose = 0;
+
+    memset(&mb, 0, sizeof(mb));
+    mb.ops = 1000000;
+    mb.reps = 7;
+    mb.warmup = 1;
+    mb.rng = 0x9E3779B97F4A7C15ULL;
+
+    // Process the command line parameters
+    while((ch = getopt(argc, argv, LC_MICROBENCH_ARGUMENTS)) != -1) {
+        switch(ch) {
+        case 'h': // Help, print usage
+            fprintf(stderr, USAGE);
+            return(-1);
+
+        case 'v': // Verbose Flag
+            verbose = 1;
+            break;
+
+        case 'n': // Operations per repetition
+            mb.ops = strtoull(optarg, NULL, 10);
+            break;
+
+        case 'r': // Repetitions
+            mb.reps = atoi(optarg);
+            break;
+
+        case 'w': // Warmup
+            mb.warmup = atoi(optarg);
+            break;
+
+        case 'f': // Filter
+            mb.filter = optarg;
+            break;
+
+        default: // Default (unknown)
+            fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+            return(-1);
+        }
+    }
+    if(mb.ops == 0 || mb.reps < 1 || mb.reps > LC_MB_MAX_REPS || mb.warmup < 0) {
+        fprintf(stderr, "Bad benchmark parameters, use -h to see usage, aborting.\n");
+        return(-1);
+    }
+    initializeLogWithFilehandle(CMPSC311_LOG_STDERR);
+    LcDriverLLevel = registerLogLevel("LCLOUD_DRIVER", 0);
+    if(verbose) {
+        enableLogLevels(LcDriverLLevel);
+    }
+
+    printf("%-28s %10s %10s %9s %11s\n", "benchmark", "ns/op", "min ns/op", "stddev", "cycles/op");
+    if(mb_cache(&mb) == -1 || mb_alloc(&mb) == -1 || mb_plan(&mb) == -1 || mb_codec(&mb) == -1) {
+        fprintf(stderr, "Benchmark setup failed (out of memory), aborting.\n");
+        return(-1);
+    }
+    return(0);
+}
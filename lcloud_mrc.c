@@ -0,0 +1,600 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_mrc.c
+//  Description    : This is the offline miss ratio curve tool.  It replays a
+//                   workload through the filesystem (against in-process
+//                   devices, with the cache disabled) to collect the block
+//                   keys every operation touches, or reads them from a block
+//                   trace (lcloud_client -T), then computes the miss
+//                   ratio at every cache capacity: exactly for LRU from the
+//                   reuse (stack) distances, and by simulating FIFO and
+//                   CLOCK at each capacity in a single pass over the keys.
+//                   With -r only a spatially hashed sample of the blocks is
+//                   analysed (SHARDS) and capacities are scaled to match.
+//
+//   Author        : Lucas Benning
+//   Last Modified : 4/30/20
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <cmpsc311_assocarr.h>
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+
+// Project Includes
+#include <lcloud_controller.h>
+#include <lcloud_support.h>
+#include <lcloud_cache.h>
+#include <lcloud_filesys.h>
+#include <lcloud_fsinternal.h>
+#include <lcloud_network.h>
+#include <lcloud_trace.h>
+#include <lcloud_workload.h>
+
+// Defines
+#define LC_MRC_ARGUMENTS "hvm:r:C:o:"
+#define LC_MRC_MAX_CAPS 64 // Most capacities on a curve
+#define LC_MRC_SAMPLE_BITS 24 // Precision of the sampling threshold
+#define USAGE                                                                         \
+    "USAGE: lcloud_mrc [-h] [-v] [-m <manifest>] [-r <rate>] [-C <blocks>[,<blocks>...]]\n" \
+    "                  [-o <csv-out>] <workload-or-trace-file>\n"                \
+    "\n"                                                                              \
+    "where:\n"                                                                        \
+    "    -h - help mode (display this message)\n"                                     \
+    "    -v - verbose output\n"                                                       \
+    "    -m - hardware manifest the workload runs on (not needed for traces)\n"       \
+    "    -r - sample this fraction of the blocks, 0 < rate <= 1 (default 1)\n"        \
+    "    -C - capacities to report (default powers of two up to the working set)\n"   \
+    "    -o - also write the curve to <csv-out>\n"                                    \
+    "\n"                                                                              \
+    "    <workload-or-trace-file> - the workload (text, or compiled with\n"           \
+    "                               lcloud_wlcompile) or a block trace\n"           \
+    "\n"
+
+// Type definitions
+typedef struct {
+    // Parameters
+    double rate; // Fraction of the blocks sampled
+    uint32_t threshold; // Sample a block if its hash is below this
+    uint32_t caps[LC_MRC_MAX_CAPS]; // Capacities on the curve
+    int num_caps; // Entries in caps
+
+    // Sampled key stream, as dense block ids
+    uint32_t *ids; // Block id of every sampled access
+    uint64_t num_ids; // Entries in ids
+    uint64_t ids_cap; // Capacity of ids
+    uint64_t accesses; // Accesses seen (sampled or not)
+    uint64_t reads, writes; // Of which reads and writes
+
+    // Block key to dense id
+    uint64_t *hkeys; // Key + 1, 0 if empty
+    uint32_t *hids; // Id of the key
+    uint64_t hcap; // Buckets (power of two)
+    uint32_t distinct; // Distinct sampled blocks (ids handed out)
+
+    // Results (miss ratios per capacity)
+    double lru[LC_MRC_MAX_CAPS];
+    double fifo[LC_MRC_MAX_CAPS];
+    double clock[LC_MRC_MAX_CAPS];
+    uint64_t lru_floor; // Smallest capacity where LRU only takes cold misses
+} LcMrc;
+
+typedef struct {
+    uint32_t cap; // Slots
+    uint32_t used; // Slots filled so far
+    uint32_t hand; // Next victim (FIFO) or slot to inspect (CLOCK)
+    uint32_t *slots; // Block id in each slot
+    char *ref; // CLOCK reference bits
+    int32_t *slot_of; // Slot of every block id, -1 if not cached
+    uint64_t misses; // Misses so far
+} LcMrcSim;
+
+// The curve being collected (the block observer has no argument)
+LcMrc *mrc_active = NULL;
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mrc_hash
+// Description  : Mix a block key (splitmix64 finalizer)
+//
+// Inputs       : key - the block key
+// Outputs      : the hash
+
+static uint64_t mrc_hash( uint64_t key ) {
+    key ^= key >> 30;
+    key *= 0xBF58476D1CE4E5B9ULL;
+    key ^= key >> 27;
+    key *= 0x94D049BB133111EBULL;
+    key ^= key >> 31;
+    return(key);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mrc_block_id
+// Description  : Find the dense id of a block key, handing out the next id
+//                to a new key
+//
+// Inputs       : m - the curve
+//                key - the block key
+//                hash - mrc_hash(key)
+// Outputs      : the id, -1 if failure
+
+static int64_t mrc_block_id( LcMrc *m, uint64_t key, uint64_t hash ) {
+    uint64_t i, *okeys = m->hkeys, ocap = m->hcap;
+    uint32_t *oids = m->hids;
+
+    // Keep the table at most half full
+    if(2 * ((uint64_t) m->distinct + 1) > m->hcap) {
+        m->hcap = (ocap == 0) ? 4096 : ocap * 2;
+        m->hkeys = calloc(m->hcap, sizeof(uint64_t));
+        m->hids = malloc(m->hcap * sizeof(uint32_t));
+        if(m->hkeys == NULL || m->hids == NULL) return(-1);
+        for(uint64_t j = 0; j < ocap; j++) {
+            if(okeys[j] == 0) continue;
+            for(i = mrc_hash(okeys[j] - 1) & (m->hcap - 1); m->hkeys[i] != 0; i = (i + 1) & (m->hcap - 1));
+            m->hkeys[i] = okeys[j];
+            m->hids[i] = oids[j];
+        }
+        free(okeys);
+        free(oids);
+    }
+
+    for(i = hash & (m->hcap - 1); m->hkeys[i] != 0; i = (i + 1) & (m->hcap - 1)) {
+        if(m->hkeys[i] == key + 1) return(m->hids[i]);
+    }
+    m->hkeys[i] = key + 1;
+    m->hids[i] = m->distinct;
+    return(m->distinct++);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mrc_access
+// Description  : Add a block access to the key stream (if its block is
+//                sampled)
+//
+// Inputs       : m - the curve
+//                op - LC_XFER_READ or LC_XFER_WRITE
+//                dev, sec, blk - the block address
+// Outputs      : 0 if successful, -1 if failure
+
+static int mrc_access( LcMrc *m, int op, LcDeviceId dev, uint16_t sec, uint16_t blk ) {
+    uint64_t key = ((uint64_t) dev << 32) | ((uint32_t) sec << 16) | blk, hash = mrc_hash(key);
+    int64_t id;
+
+    m->accesses++;
+    if(op == LC_XFER_READ) m->reads++; else m->writes++;
+    if((hash & ((1 << LC_MRC_SAMPLE_BITS) - 1)) >= m->threshold) return(0);
+
+    if((id = mrc_block_id(m, key, hash)) == -1) return(-1);
+    if(m->num_ids == m->ids_cap) {
+        m->ids_cap = (m->ids_cap == 0) ? 65536 : m->ids_cap * 2;
+        if((m->ids = realloc(m->ids, m->ids_cap * sizeof(uint32_t))) == NULL) return(-1);
+    }
+    m->ids[m->num_ids++] = id;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mrc_observer
+// Description  : Filesystem block observer, feeds the active curve
+//
+// Inputs       : op - LC_XFER_READ or LC_XFER_WRITE
+//                dev, sec, blk - the block address
+//                hit - cache hit (always 0, the cache is disabled)
+// Outputs      : none
+
+static void mrc_observer( int op, LcDeviceId dev, uint16_t sec, uint16_t blk, int hit ) {
+    if(mrc_access(mrc_active, op, dev, sec, blk) == -1) {
+        logMessage(LOG_ERROR_LEVEL, "Out of memory recording block accesses, aborting");
+        exit(-1);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mrc_replay_workload
+// Description  : Run a workload through the filesystem, collecting the
+//                block accesses it makes
+//
+// Inputs       : m - the curve
+//                wload - the workload file
+//                manifest - the hardware manifest
+// Outputs      : 0 if successful, -1 if failure
+
+static int mrc_replay_workload( LcMrc *m, const char *wload, const char *manifest ) {
+    char spec[1024], buf[LC_MAX_OPERATION_SIZE];
+    LcWorkload state;
+    LcWlOp op;
+    AssocArray fhTable;
+    LcFHandle *fh;
+    int ret = 0;
+
+    snprintf(spec, sizeof(spec), "shm:%s", manifest);
+    if(client_set_transport(spec) == -1 || lcloud_cache_configure(0, LC_CACHE_LRU) == -1) {
+        logMessage(LOG_ERROR_LEVEL, "Cannot set up devices from manifest [%s]", manifest);
+        return(-1);
+    }
+    if(lcloud_workload_open(&state, wload) == -1) {
+        logMessage(LOG_ERROR_LEVEL, "Failed opening workload [%s]", wload);
+        return(-1);
+    }
+    init_assoc(&fhTable, stringCompareCallback, pointerCompareCallback);
+    mrc_active = m;
+    lcctx_default()->block_observer = mrc_observer;
+
+    // Only the block addresses matter, so the data read is not checked
+    do {
+        if(lcloud_workload_next(&state, &op) == -1) {
+            ret = -1;
+            break;
+        }
+        fh = (op.op == WL_EOF) ? NULL : find_assoc(&fhTable, (char *) op.objname);
+
+        switch(op.op) {
+        case WL_OPEN:
+            if(fh == NULL) {
+                if((fh = malloc(sizeof(LcFHandle))) == NULL) {
+                    ret = -1;
+                    break;
+                }
+                insert_assoc(&fhTable, strdup(op.objname), fh);
+            }
+            if((*fh = lcopen(op.objname)) == -1) ret = -1;
+            break;
+
+        case WL_READ:
+            if(fh == NULL || lcseek(*fh, op.pos) != op.pos || lcread(*fh, buf, op.size) != op.size) ret = -1;
+            break;
+
+        case WL_WRITE:
+            if(fh == NULL || lcseek(*fh, op.pos) != op.pos || lcwrite(*fh, (char *) op.data, op.size) != op.size) ret = -1;
+            break;
+
+        case WL_CLOSE:
+            if(fh == NULL || lcclose(*fh) != 0) ret = -1;
+            break;
+
+        case WL_EOF:
+            lcshutdown();
+            break;
+
+        default:
+            ret = -1;
+        }
+        if(ret == -1) {
+            logMessage(LOG_ERROR_LEVEL, "Workload [%s] failed at operation %u", wload, state.lineno);
+        }
+    } while(ret == 0 && op.op != WL_EOF);
+
+    lcctx_default()->block_observer = NULL;
+    mrc_active = NULL;
+    lcloud_workload_close(&state);
+    return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mrc_replay_trace
+// Description  : Collect the block accesses recorded in a trace (the cache
+//                lookups, whatever cache the recording ran with)
+//
+// Inputs       : m - the curve
+//                path - the trace file
+// Outputs      : 0 if successful, -1 if failure
+
+static int mrc_replay_trace( LcMrc *m, const char *path ) {
+    LcTrace tr;
+    int ret = 0;
+
+    if(lcloud_trace_open(&tr, path) == -1) return(-1);
+    for(uint64_t i = 0; i < tr.num_recs && ret == 0; i++) {
+        if(tr.recs[i].kind == LC_TRACE_ACCESS) {
+            ret = mrc_access(m, tr.recs[i].op, tr.recs[i].dev, tr.recs[i].sec, tr.recs[i].blk);
+        }
+    }
+    lcloud_trace_close(&tr);
+    return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mrc_lru
+// Description  : Compute the LRU curve from the reuse distances.  A block's
+//                distance is the number of distinct blocks used since its
+//                last use, counted with a Fenwick tree holding a mark at the
+//                latest access of every block; LRU hits exactly the accesses
+//                whose distance is below the capacity.
+//
+// Inputs       : m - the curve
+// Outputs      : 0 if successful, -1 if failure
+
+static int mrc_lru( LcMrc *m ) {
+    uint32_t *tree, *hist;
+    int64_t *last;
+    uint64_t t, i, before, cold = 0, max_dist = 0, hits, limit;
+
+    tree = calloc(m->num_ids + 1, sizeof(uint32_t));
+    hist = calloc(m->distinct + 1, sizeof(uint32_t));
+    last = malloc((m->distinct + 1) * sizeof(int64_t));
+    if(tree == NULL || hist == NULL || last == NULL) {
+        free(tree);
+        free(hist);
+        free(last);
+        return(-1);
+    }
+    memset(last, 0xff, (m->distinct + 1) * sizeof(int64_t));
+
+    for(t = 1; t <= m->num_ids; t++) {
+        uint32_t id = m->ids[t - 1];
+        if(last[id] == -1) {
+            cold++;
+        } else {
+            // Every block seen so far (cold) has one mark, those after the
+            // last access are the distinct blocks used since
+            before = 0;
+            for(i = last[id]; i > 0; i -= i & -i) before += tree[i];
+            hist[cold - before]++;
+            if(cold - before > max_dist) max_dist = cold - before;
+            for(i = last[id]; i <= m->num_ids; i += i & -i) tree[i]--;
+        }
+        for(i = t; i <= m->num_ids; i += i & -i) tree[i]++;
+        last[id] = t;
+    }
+
+    // Sampled distances scale up by 1/rate: hit if distance < capacity * rate
+    for(int c = 0; c < m->num_caps; c++) {
+        limit = (uint64_t) (m->caps[c] * m->rate);
+        if(limit < m->caps[c] * m->rate) limit++;
+        hits = 0;
+        for(uint64_t d = 0; d < limit && d <= m->distinct; d++) hits += hist[d];
+        m->lru[c] = (m->num_ids == 0) ? 0.0 : 1.0 - (double) hits / m->num_ids;
+    }
+    m->lru_floor = (cold == m->num_ids) ? 1 : (uint64_t) ((max_dist + 1) / m->rate + 0.5);
+
+    free(tree);
+    free(hist);
+    free(last);
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mrc_sim_access
+// Description  : Feed one access to a FIFO or CLOCK cache simulation (the
+//                same replacement as lcloud_cache.c: free slots fill in
+//                order, FIFO evicts in insertion order, CLOCK inserts with
+//                the reference bit set and sweeps clearing bits)
+//
+// Inputs       : s - the simulation
+//                id - the block id
+//                clock - 1 for CLOCK, 0 for FIFO
+// Outputs      : none
+
+static void mrc_sim_access( LcMrcSim *s, uint32_t id, int clock ) {
+    uint32_t i;
+
+    if(s->slot_of[id] != -1) {
+        if(clock) s->ref[s->slot_of[id]] = 1;
+        return;
+    }
+    s->misses++;
+    if(s->used < s->cap) {
+        i = s->used++;
+    } else {
+        if(clock) {
+            while(s->ref[s->hand]) {
+                s->ref[s->hand] = 0;
+                s->hand = (s->hand + 1) % s->cap;
+            }
+        }
+        i = s->hand;
+        s->hand = (s->hand + 1) % s->cap;
+        s->slot_of[s->slots[i]] = -1;
+    }
+    s->slots[i] = id;
+    s->ref[i] = 1;
+    s->slot_of[id] = i;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mrc_simulate
+// Description  : Compute the FIFO and CLOCK curves, simulating every
+//                capacity side by side in one pass over the key stream
+//
+// Inputs       : m - the curve
+// Outputs      : 0 if successful, -1 if failure
+
+static int mrc_simulate( LcMrc *m ) {
+    int n = 2 * m->num_caps, ret = 0;
+    LcMrcSim *sims;
+
+    if((sims = calloc(n, sizeof(LcMrcSim))) == NULL) return(-1);
+    for(int j = 0; j < n; j++) {
+        sims[j].cap = (uint32_t) (m->caps[j / 2] * m->rate + 0.5);
+        if(sims[j].cap == 0) sims[j].cap = 1;
+        sims[j].slots = malloc(sims[j].cap * sizeof(uint32_t));
+        sims[j].ref = malloc(sims[j].cap);
+        sims[j].slot_of = malloc((m->distinct + 1) * sizeof(int32_t));
+        if(sims[j].slots == NULL || sims[j].ref == NULL || sims[j].slot_of == NULL) {
+            ret = -1;
+            break;
+        }
+        memset(sims[j].slot_of, 0xff, (m->distinct + 1) * sizeof(int32_t));
+    }
+
+    if(ret == 0) {
+        for(uint64_t t = 0; t < m->num_ids; t++) {
+            for(int j = 0; j < n; j++) {
+                mrc_sim_access(&sims[j], m->ids[t], j % 2);
+            }
+        }
+        for(int c = 0; c < m->num_caps; c++) {
+            m->fifo[c] = (m->num_ids == 0) ? 0.0 : (double) sims[2 * c].misses / m->num_ids;
+            m->clock[c] = (m->num_ids == 0) ? 0.0 : (double) sims[2 * c + 1].misses / m->num_ids;
+        }
+    }
+
+    for(int j = 0; j < n; j++) {
+        free(sims[j].slots);
+        free(sims[j].ref);
+        free(sims[j].slot_of);
+    }
+    free(sims);
+    return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mrc_report
+// Description  : Print the working set and the curves, optionally to CSV too
+//
+// Inputs       : m - the curve
+//                wload - the workload name
+//                csv - CSV output path, or NULL
+// Outputs      : 0 if successful, -1 if failure
+
+static int mrc_report( LcMrc *m, const char *wload, const char *csv ) {
+    uint64_t wss = (uint64_t) (m->distinct / m->rate + 0.5);
+    FILE *f = NULL;
+
+    printf("workload        : %s\n", wload);
+    printf("block accesses  : %lu (%lu reads, %lu writes)\n", m->accesses, m->reads, m->writes);
+    if(m->rate < 1.0) {
+        printf("sampled         : %lu accesses, %u blocks (rate %g)\n", m->num_ids, m->distinct, m->rate);
+    }
+    printf("working set     : %lu blocks (%lu bytes)\n", wss, wss * LC_DEVICE_BLOCK_SIZE);
+    printf("cold miss ratio : %.4f\n", (m->num_ids == 0) ? 0.0 : (double) m->distinct / m->num_ids);
+    printf("lru floor       : %lu blocks (smallest LRU cache with only cold misses)\n\n", m->lru_floor);
+    printf("%10s %8s %8s %8s\n", "blocks", "lru", "fifo", "clock");
+    for(int c = 0; c < m->num_caps; c++) {
+        printf("%10u %8.4f %8.4f %8.4f\n", m->caps[c], m->lru[c], m->fifo[c], m->clock[c]);
+    }
+
+    if(csv == NULL) return(0);
+    if((f = fopen(csv, "w")) == NULL) {
+        logMessage(LOG_ERROR_LEVEL, "Cannot write curve to [%s]", csv);
+        return(-1);
+    }
+    fprintf(f, "workload,blocks,lru,fifo,clock,working_set_blocks\n");
+    for(int c = 0; c < m->num_caps; c++) {
+        fprintf(f, "%s,%u,%.6f,%.6f,%.6f,%lu\n", wload, m->caps[c], m->lru[c], m->fifo[c], m->clock[c], wss);
+    }
+    fclose(f);
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the miss ratio curve tool
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] ) {
+    char *manifest = NULL, *csv = NULL, *tok, *save = NULL;
+    int ch, verbose = 0, trace;
+    uint64_t wss;
+    LcMrc m;
+
+    memset(&m, 0, sizeof(m));
+    m.rate = 1.0;
+
+    // Process the command line parameters
+    while((ch = getopt(argc, argv, LC_MRC_ARGUMENTS)) != -1) {
+        switch(ch) {
+        case 'h': // Help, print usage
+            fprintf(stderr, USAGE);
+            return(-1);
+
+        case 'v': // Verbose Flag
+            verbose = 1;
+            break;
+
+        case 'm': // Hardware manifest
+            manifest = optarg;
+            break;
+
+        case 'r': // Sampling rate
+            m.rate = atof(optarg);
+            break;
+
+        case 'C': // Capacities
+            for(tok = strtok_r(optarg, ",", &save); tok != NULL && m.num_caps < LC_MRC_MAX_CAPS;
+                tok = strtok_r(NULL, ",", &save)) {
+                if((m.caps[m.num_caps++] = strtoul(tok, NULL, 10)) == 0) {
+                    fprintf(stderr, "Bad capacity [%s], aborting.\n", tok);
+                    return(-1);
+                }
+            }
+            break;
+
+        case 'o': // CSV output
+            csv = optarg;
+            break;
+
+        default: // Default (unknown)
+            fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+            return(-1);
+        }
+    }
+
+    initializeLogWithFilehandle(CMPSC311_LOG_STDERR);
+    LcControllerLLevel = registerLogLevel("LCLOUD_CONTROLLER", 0);
+    LcDriverLLevel = registerLogLevel("LCLOUD_DRIVER", 0);
+    if(verbose) {
+        enableLogLevels(LOG_INFO_LEVEL);
+        enableLogLevels(LcControllerLLevel | LcDriverLLevel);
+    }
+
+    if(optind != argc - 1 || (trace = lcloud_trace_detect(argv[optind])) == -1 ||
+        (!trace && manifest == NULL)) {
+        fprintf(stderr, "Missing workload (or its manifest), use -h to see usage, aborting.\n");
+        return(-1);
+    }
+    if(m.rate <= 0.0 || m.rate > 1.0) {
+        fprintf(stderr, "Sampling rate must be in (0, 1], aborting.\n");
+        return(-1);
+    }
+    m.threshold = (uint32_t) (m.rate * (1 << LC_MRC_SAMPLE_BITS) + 0.5);
+
+    // Collect the block key stream
+    if((trace ? mrc_replay_trace(&m, argv[optind]) : mrc_replay_workload(&m, argv[optind], manifest)) == -1) {
+        return(-1);
+    }
+
+    // Default curve: powers of two until the cache holds the working set
+    if(m.num_caps == 0) {
+        wss = (uint64_t) (m.distinct / m.rate + 0.5);
+        do {
+            m.caps[m.num_caps] = 1U << m.num_caps;
+            m.num_caps++;
+        } while(m.caps[m.num_caps - 1] < wss && m.num_caps < 31);
+    }
+
+    if(mrc_lru(&m) == -1 || mrc_simulate(&m) == -1) {
+        logMessage(LOG_ERROR_LEVEL, "Out of memory computing the curves, aborting");
+        return(-1);
+    }
+    if(mrc_report(&m, argv[optind], csv) == -1) {
+        return(-1);
+    }
+    free(m.ids);
+    free(m.hkeys);
+    free(m.hids);
+    freeLogRegistrations();
+    return(0);
+}
@@ -21,15 +21,79 @@
 #define LCLOUD_NET_HEADER_SIZE sizeof(LCloudRegisterFrame)
 #define LCLOUD_DEFAULT_IP "127.0.0.1"
 #define LCLOUD_DEFAULT_PORT 24567
+#define LCLOUD_RXBUF_SIZE 16384 // Client receive buffer (many responses per recv)
+#define LCLOUD_SOCKBUF_SIZE 262144 // Kernel socket buffer size requested by the client
+#define LCLOUD_MAX_BATCH 64 // Maximum requests pipelined in one gather write
+#define LCLOUD_CIPHER_KEYLEN 16 // Bytes of the block cipher key (and of its IV)
+
+// Type definitions
+typedef struct {
+    uint64_t requests; // Register frames sent to the server
+    uint64_t block_reads; // Block read transfers
+    uint64_t block_writes; // Block write transfers
+    uint64_t round_trips; // Send/receive exchanges (one per pipelined batch)
+} LcClientStats;
+
+typedef struct LcClient LcClient; // A connection to a server (lcloud_client.c)
 
 // Global data
 
 //
 // Functional Prototypes
 
+LcClient *lcclient_create(void);
+	// Create a client with its own transport, cipher and counters
+
+int lcclient_destroy(LcClient *client);
+	// Disconnect (if connected) and free a client
+
+LcClient *lcclient_default(void);
+	// The client the client_ functions below use
+
+int lcclient_set_transport(LcClient *client, const char *spec);
+	// Select a client's transport to the server
+
+int lcclient_connect(LcClient *client);
+	// Set up a client's cipher and connect it (requests connect on demand)
+
+LCloudRegisterFrame lcclient_request(LcClient *client, LCloudRegisterFrame reg, void *buf);
+	// Send one request over a client
+
+int lcclient_batch(LcClient *client, LCloudRegisterFrame *regs, void **bufs, LCloudRegisterFrame *resps, int n);
+	// Pipeline a batch of requests over a client, collecting the responses
+
+void lcclient_get_stats(LcClient *client, LcClientStats *stats);
+	// Get a client's bus counters
+
+int lcclient_set_cipher(LcClient *client, const char *key, const char *iv);
+	// Encrypt a client's blocks with this key and IV from its next connection on
+
+int lcclient_get_cipher(LcClient *client, char *key, char *iv);
+	// Get the key and IV of a client's open connection (the preset ones if none)
+
 LCloudRegisterFrame client_lcloud_bus_request(LCloudRegisterFrame reg, void *buf);
 	// This is the implementation of the client operation, as implemented 
 	//  by the 311 student code.
 
+int client_set_transport(const char *spec);
+	// Select the transport to the server ("tcp[:ip[:port]]", "uring[:ip[:port]]",
+	//  "unix[:path]", "shm:<manifest>")
+
+int client_lcloud_bus_batch(LCloudRegisterFrame *regs, void **bufs, LCloudRegisterFrame *resps, int n);
+	// Pipeline a batch of requests to the server, collecting the responses
+
+int client_connect(void);
+	// Set up the cipher and connect to the server (requests connect on demand)
+
+void client_get_stats(LcClientStats *stats);
+	// Get the bus counters of the default client
+
+int client_set_cipher(const char *key, const char *iv);
+	// Encrypt blocks with this key and IV from the next connection on (NULL for random)
+
+int client_get_cipher(char *key, char *iv);
+	// Get the key and IV blocks are encrypted with on the open connection (the
+	// preset ones if none)
+
 
 #endif
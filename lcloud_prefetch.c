@@ -0,0 +1,377 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_prefetch.c
+//  Description    : This is the implementation of the correlation prefetcher.
+//                   It watches the stream of blocks reads miss on and learns,
+//                   in successor tables, which device block tends to follow
+//                   which (and which block is read first in the file that
+//                   follows a file).  When a read goes to the devices, the
+//                   blocks predicted to follow it ride along in the same bus
+//                   batch.  Predictions are scored as the reads come in, and
+//                   the number made per miss is halved while too few of them
+//                   pay off, down to none; while off, predictions are still
+//                   made and scored, but not fetched, so it can come back.
+//
+//   Author        : Lucas Benning
+//   Last Modified : 5/5/20
+//
+
+// Include files
+#include <stdlib.h>
+#include <string.h>
+#include <cmpsc311_log.h>
+
+// Project include files
+#include <lcloud_filesys.h>
+#include <lcloud_fsinternal.h>
+#include <lcloud_cache.h>
+#include <lcloud_support.h>
+
+// Defines
+#define LC_PREFETCH_TABLE 4096 // Entries of each successor table (power of two)
+#define LC_PREFETCH_WAYS 2 // Successors an entry remembers, most recent first
+#define LC_PREFETCH_PENDING 1024 // Slots tracking predictions not yet judged (power of two)
+#define LC_PREFETCH_EPOCH 128 // Predictions made between throttle decisions
+#define LC_PREFETCH_LOW 0.25 // Accuracy under which the degree is halved
+#define LC_PREFETCH_HIGH 0.5 // Accuracy over which it is doubled
+
+// Type definitions
+typedef struct {
+    uint64_t key; // Block (or file) the entry is for, 0 if empty
+    uint64_t next[LC_PREFETCH_WAYS]; // Blocks seen to follow it, 0 if none
+} LcSuccessor;
+
+typedef struct {
+    uint64_t key; // Block predicted, 0 if the slot is free
+    char shadow; // 1 if it was predicted while throttled off (not fetched)
+    uint64_t when; // Misses counted when it was predicted
+} LcPending;
+
+struct LcPrefetch {
+    LcSuccessor blocks[LC_PREFETCH_TABLE]; // Block to the blocks missed on after it
+    LcSuccessor files[LC_PREFETCH_TABLE]; // File to the first block missed on in the next file
+    LcPending pending[LC_PREFETCH_PENDING]; // Predictions waiting for a read to judge them
+    uint64_t last; // Last block of the miss stream, 0 if none
+    LcFHandle last_fh; // Its file
+    int max_degree; // Degree set by lcprefetch
+    int degree; // Blocks fetched per miss now
+    uint32_t made; // Predictions made this epoch
+    uint32_t right; // Of those, proved right so far
+    LcBlock pick[LC_PREFETCH_DEGREE]; // Blocks of the prediction in flight
+    LcPrefetchStats stats; // Counters
+};
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : block_key
+// Description  : Name a device block in the successor tables
+//
+// Inputs       : blk - the device block
+// Outputs      : the key (never 0)
+
+static uint64_t block_key( LcBlock *blk ) {
+    return((((uint64_t) blk->dev << 32) | ((uint64_t) blk->sec << 16) | blk->blk) + 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : key_hash
+// Description  : Spread a key over a table
+//
+// Inputs       : key - the key
+//                size - entries of the table (power of two)
+// Outputs      : the slot
+
+static uint32_t key_hash( uint64_t key, uint32_t size ) {
+    return((uint32_t) ((key * 0x9e3779b97f4a7c15ULL) >> 32) & (size - 1));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : successor_find
+// Description  : Find the entry of a key in a successor table
+//
+// Inputs       : table - the table
+//                key - the block or file
+// Outputs      : the entry, NULL if the table has none for the key
+
+static LcSuccessor * successor_find( LcSuccessor *table, uint64_t key ) {
+    LcSuccessor *e = &table[key_hash(key, LC_PREFETCH_TABLE)];
+    return((e->key == key) ? e : NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : successor_learn
+// Description  : Record that a block followed a key, as its most recent successor
+//                (the key takes the entry over from any other it collides with)
+//
+// Inputs       : table - the table
+//                key - the block or file
+//                next - the block that followed it
+// Outputs      : none
+
+static void successor_learn( LcSuccessor *table, uint64_t key, uint64_t next ) {
+    LcSuccessor *e = &table[key_hash(key, LC_PREFETCH_TABLE)];
+    int w;
+
+    if(e->key != key) {
+        memset(e, 0, sizeof(LcSuccessor));
+        e->key = key;
+    }
+    for(w = 0; w < LC_PREFETCH_WAYS - 1 && e->next[w] != next; w++);
+    memmove(&e->next[1], &e->next[0], w * sizeof(uint64_t));
+    e->next[0] = next;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : prefetch_throttle
+// Description  : At the end of an epoch, halve the degree if too few predictions
+//                were right, or double it (up to the degree set) if most were
+//
+// Inputs       : pf - the prefetcher
+// Outputs      : none
+
+static void prefetch_throttle( LcPrefetch *pf ) {
+    double accuracy;
+
+    if(pf->made < LC_PREFETCH_EPOCH) return;
+    accuracy = (double) pf->right / pf->made;
+    if(accuracy < LC_PREFETCH_LOW && pf->degree > 0) {
+        pf->degree /= 2;
+        pf->stats.throttles++;
+        logMessage(LcDriverLLevel, "Prefetch accuracy %.2f, degree down to %d", accuracy, pf->degree);
+    } else if(accuracy > LC_PREFETCH_HIGH && pf->degree < pf->max_degree) {
+        pf->degree = (pf->degree == 0) ? 1 : ((2 * pf->degree < pf->max_degree) ? 2 * pf->degree : pf->max_degree);
+        logMessage(LcDriverLLevel, "Prefetch accuracy %.2f, degree up to %d", accuracy, pf->degree);
+    }
+    pf->made = 0;
+    pf->right = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : prefetch_pick
+// Description  : Take a predicted block into the prediction unless it is cached,
+//                already in the batch or already picked
+//
+// Inputs       : ctx - the filesystem
+//                key - the predicted block
+//                n - entries in the I/O batch
+//                count - blocks picked so far
+// Outputs      : 1 if picked, 0 if not
+
+static int prefetch_pick( LcContext *ctx, uint64_t key, int n, int count ) {
+    LcPrefetch *pf = ctx->prefetch;
+    LcBlock *blk = &pf->pick[count];
+
+    memset(blk, 0, sizeof(LcBlock));
+    blk->dev = (LcDeviceId) ((key - 1) >> 32);
+    blk->sec = (uint16_t) ((key - 1) >> 16);
+    blk->blk = (uint16_t) (key - 1);
+    if(lccache_holds(ctx->cache, blk->dev, blk->sec, blk->blk)) return(0);
+    for(int i = 0; i < count; i++) {
+        if(block_key(&pf->pick[i]) == key) return(0);
+    }
+    for(int i = 0; i < n; i++) {
+        if(block_key(ctx->io_blks[i]) == key) return(0);
+    }
+    return(1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_prefetch_access
+// Description  : Tell the prefetcher of a block a read touched.  A miss, or a
+//                hit on a block it fetched, judges any prediction of the block
+//                and extends the miss stream the tables learn from.  A block
+//                predicted while throttled off counts as right only if, fetched,
+//                it would still have been cached (fewer misses than the cache
+//                holds came between).
+//
+// Inputs       : ctx - the filesystem
+//                fh - the file read
+//                blk - the device block
+//                hit - 1 if the block was found in the cache
+// Outputs      : none
+
+void lcloud_prefetch_access( LcContext *ctx, LcFHandle fh, LcBlock *blk, int hit ) {
+    LcPrefetch *pf = ctx->prefetch;
+    uint64_t key;
+    LcPending *p;
+    int stream = !hit;
+
+    if(pf == NULL) return;
+
+    // Judge the prediction of the block, if there was one
+    key = block_key(blk);
+    p = &pf->pending[key_hash(key, LC_PREFETCH_PENDING)];
+    if(p->key == key) {
+        if(hit && !p->shadow) {
+            pf->stats.useful++;
+            pf->right++;
+            stream = 1;
+        } else if(!hit && p->shadow) {
+            if(pf->stats.misses - p->when < (uint64_t) lccache_capacity(ctx->cache)) pf->right++;
+        } else if(!hit) {
+            pf->stats.evicted++;
+        }
+        p->key = 0;
+    }
+    if(!hit) pf->stats.misses++;
+    if(!stream) return;
+
+    // Learn what followed the last block of the stream, and its file
+    if(pf->last != 0) {
+        successor_learn(pf->blocks, pf->last, key);
+        if(pf->last_fh != fh) successor_learn(pf->files, (uint64_t) pf->last_fh + 1, key);
+    }
+    pf->last = key;
+    pf->last_fh = fh;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_prefetch_predict
+// Description  : Predict the blocks that follow the last miss, following the block
+//                table's chain of most recent successors, then the file table, and
+//                add the ones not cached to the I/O batch.  While throttled off the
+//                prediction is recorded to be judged, but nothing is added.
+//
+// Inputs       : ctx - the filesystem
+//                n - entries already in the batch (io_data has room for limit more
+//                    after slot base)
+//                base - first io_data slot to use
+//                limit - blocks to add at most
+// Outputs      : blocks added
+
+int lcloud_prefetch_predict( LcContext *ctx, int n, uint32_t base, int limit ) {
+    LcPrefetch *pf = ctx->prefetch;
+    LcSuccessor *e;
+    uint64_t cur, cand[LC_PREFETCH_DEGREE * (LC_PREFETCH_WAYS + 1)];
+    int want, count = 0, ncand = 0;
+
+    if(pf == NULL || pf->last == 0) return(0);
+    prefetch_throttle(pf);
+    want = (pf->degree > 0) ? pf->degree : 1;
+    if(want > limit) want = limit;
+
+    // Gather the candidates, nearest first
+    cur = pf->last;
+    for(int hop = 0; hop < want && (e = successor_find(pf->blocks, cur)) != NULL; hop++) {
+        for(int w = 0; w < LC_PREFETCH_WAYS && e->next[w] != 0; w++) {
+            cand[ncand++] = e->next[w];
+        }
+        cur = e->next[0];
+    }
+    if((e = successor_find(pf->files, (uint64_t) pf->last_fh + 1)) != NULL) {
+        for(int w = 0; w < LC_PREFETCH_WAYS && e->next[w] != 0; w++) {
+            cand[ncand++] = e->next[w];
+        }
+    }
+
+    // Pick the ones worth reading, remember them to be judged
+    for(int c = 0; c < ncand && count < want; c++) {
+        if(cand[c] == pf->last || !prefetch_pick(ctx, cand[c], n, count)) continue;
+        LcPending *p = &pf->pending[key_hash(cand[c], LC_PREFETCH_PENDING)];
+        p->key = cand[c];
+        p->shadow = (pf->degree == 0);
+        p->when = pf->stats.misses;
+        pf->made++;
+        if(pf->degree > 0) {
+            ctx->io_blks[n + count] = &pf->pick[count];
+            ctx->io_bufs[n + count] = &ctx->io_data[(size_t) (base + count) * LC_DEVICE_BLOCK_SIZE];
+            pf->stats.issued++;
+        }
+        count++;
+    }
+    return((pf->degree > 0) ? count : 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_prefetch_reset
+// Description  : Forget the successor tables and the predictions in flight (the
+//                device blocks they name go away with the filesystem); the
+//                counters and degree stay
+//
+// Inputs       : ctx - the filesystem
+// Outputs      : none
+
+void lcloud_prefetch_reset( LcContext *ctx ) {
+    LcPrefetch *pf = ctx->prefetch;
+
+    if(pf == NULL) return;
+    memset(pf->blocks, 0, sizeof(pf->blocks));
+    memset(pf->files, 0, sizeof(pf->files));
+    memset(pf->pending, 0, sizeof(pf->pending));
+    pf->last = 0;
+    pf->made = 0;
+    pf->right = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcprefetch_ctx
+// Description  : Turn the correlation prefetcher on or off.  While on, a read
+//                that goes to the devices also reads up to degree blocks that
+//                past reads say come next, in the same bus batch; the degree
+//                falls, down to none, while the predictions do not pay off.
+//
+// Inputs       : ctx - the filesystem
+//                degree - most blocks read per miss (up to LC_PREFETCH_DEGREE), 0 for off
+// Outputs      : 0 if successful, -1 if failure
+
+int lcprefetch_ctx( LcContext *ctx, int degree ) {
+    if(degree < 0 || degree > LC_PREFETCH_DEGREE) {
+        logMessage(LOG_ERROR_LEVEL, "Bad prefetch degree %d (0 to %d)", degree, LC_PREFETCH_DEGREE);
+        return(-1);
+    }
+    if(degree == 0) {
+        free(ctx->prefetch);
+        ctx->prefetch = NULL;
+        return(0);
+    }
+    if(ctx->prefetch == NULL && (ctx->prefetch = calloc(1, sizeof(LcPrefetch))) == NULL) {
+        logMessage(LOG_ERROR_LEVEL, "Memory allocation error");
+        return(-1);
+    }
+    ctx->prefetch->max_degree = degree;
+    ctx->prefetch->degree = degree;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcprefetch_stats_ctx
+// Description  : Get the prefetcher's counters (all zero while it is off).
+//                Accuracy is useful / issued, coverage useful / (useful + misses).
+//
+// Inputs       : ctx - the filesystem
+//                stats - where to put them
+// Outputs      : 0 if successful, -1 if failure
+
+int lcprefetch_stats_ctx( LcContext *ctx, LcPrefetchStats *stats ) {
+    if(ctx->prefetch == NULL) {
+        memset(stats, 0, sizeof(LcPrefetchStats));
+        return(0);
+    }
+    *stats = ctx->prefetch->stats;
+    stats->degree = ctx->prefetch->degree;
+    return(0);
+}
+
+//
+// The functions without a context work on the default instance
+
+int lcprefetch( int degree ) {
+    return(lcprefetch_ctx(lcctx_default(), degree));
+}
+
+int lcprefetch_stats( LcPrefetchStats *stats ) {
+    return(lcprefetch_stats_ctx(lcctx_default(), stats));
+}
@@ -0,0 +1,63 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_registers.c
+//  Description    : This is the implementation of the LionCloud register
+//                   frame packing and unpacking.
+//
+//   Author        : Lucas Benning
+//   Last Modified : 4/10/20
+//
+
+// Include files
+#include <stdint.h>
+
+// Project include files
+#include <lcloud_registers.h>
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : create_lcloud_register
+// Description  : Packs registers b0 through d1 into an LCloudRegisterFrame (unsigned 64 bit integer)
+//
+// Inputs       : b0 ... d1: the values of each LCloud register
+// Outputs      : packed LCloudRegisterframe
+LCloudRegisterFrame create_lcloud_register(int b0, int b1, int c0, int c1, int c2, int d0, int d1) {
+    uint32_t b, c, d;
+    LCloudRegisterFrame out;
+
+    b = b0 << 4 | b1; 
+    c = c0 << 16 | c1 << 8 | c2;
+    d = d0 << 16 | d1;
+
+    out = b;
+    out = out << 24 | c;
+    out = out << 32 | d;
+    return(out);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : extract_lcloud_registers
+// Description  : Extracts packed LCloudRegisterFrame into its constituent registers
+//
+// Inputs       : resp: packed register frame
+//                b0 ... d1: pointers for the values of each LCloud register
+// Outputs      : 0 if success
+int extract_lcloud_registers(LCloudRegisterFrame resp, int *b0, int *b1, int *c0, int *c1,
+ int *c2, int *d0, int *d1) {
+    // Query bits and assign to appropriate register
+    *b0 = ((resp & 0xF000000000000000) >> 60);
+    *b1 = ((resp & 0x0F00000000000000) >> 56);
+    *c0 = ((resp & 0x00FF000000000000) >> 48);
+    *c1 = ((resp & 0x0000FF0000000000) >> 40);
+    *c2 = ((resp & 0x000000FF00000000) >> 32);
+    *d0 = ((resp & 0x00000000FFFF0000) >> 16);
+    *d1 = (resp & 0x000000000000FFFF);
+
+    // Check if any error occurred from response
+    if (*b0 == 1 && *b1 != 1) {
+        return(-1);
+    }
+
+    return(0);
+}
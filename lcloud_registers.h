@@ -0,0 +1,29 @@
+#ifndef LCLOUD_REGISTERS_INCLUDED
+#define LCLOUD_REGISTERS_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_registers.h
+//  Description    : This is the interface for packing and unpacking the
+//                   LionCloud register frames, shared by the client side
+//                   and the in-tree device emulation.
+//
+//   Author        : Lucas Benning
+//   Last Modified : 4/10/20
+//
+
+// Includes
+#include <stdint.h>
+#include <lcloud_controller.h>
+
+//
+// Functional Prototypes
+
+LCloudRegisterFrame create_lcloud_register(int b0, int b1, int c0, int c1, int c2, int d0, int d1);
+    // Pack the register values into a register frame
+
+int extract_lcloud_registers(LCloudRegisterFrame resp, int *b0, int *b1, int *c0, int *c1,
+    int *c2, int *d0, int *d1);
+    // Helper function to extract information from register frame
+
+#endif
@@ -0,0 +1,280 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_replay.c
+//  Description    : This is the block trace replay tool.  It powers on the
+//                   devices and issues the block transfers of a recorded
+//                   trace (lcloud_client -T) straight on the bus, without
+//                   the filesystem or cache, at the recorded pace, scaled,
+//                   or as fast as the transport allows, then reports the
+//                   throughput, transfer latency and how far the replay
+//                   fell behind the trace's schedule.
+//
+//   Author        : Lucas Benning
+//   Last Modified : 5/1/20
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <cmpsc311_log.h>
+
+// Project Includes
+#include <lcloud_controller.h>
+#include <lcloud_support.h>
+#include <lcloud_registers.h>
+#include <lcloud_network.h>
+#include <lcloud_trace.h>
+
+// Defines
+#define LC_REPLAY_ARGUMENTS "hvt:s:"
+#define USAGE                                                                         \
+    "USAGE: lcloud_replay [-h] [-v] [-t <transport>] [-s <speed>] <trace-file>\n"     \
+    "\n"                                                                              \
+    "where:\n"                                                                        \
+    "    -h - help mode (display this message)\n"                                     \
+    "    -v - verbose output\n"                                                       \
+    "    -t - server transport: tcp[:ip[:port]], uring[:ip[:port]],\n"                \
+    "         unix[:path] or shm:<manifest> (default tcp)\n"                          \
+    "    -s - speed relative to the recording: 1 keeps the original timing\n"         \
+    "         (default), 2 replays twice as fast, 0 as fast as possible\n"            \
+    "\n"                                                                              \
+    "    <trace-file> - block trace recorded with lcloud_client -T\n"                 \
+    "\n"
+
+// Type definitions
+typedef struct {
+    uint64_t xfers; // Transfers issued
+    uint64_t reads, writes; // Of which reads and writes
+    uint64_t errors; // Transfers the devices failed
+    uint64_t *latency; // Latency of every transfer (nsec)
+    uint64_t lag_total; // Sum of the start delays past schedule (nsec)
+    uint64_t lag_max; // Largest start delay past schedule (nsec)
+} LcReplayStats;
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_now
+// Description  : Monotonic time in nanoseconds
+//
+// Inputs       : none
+// Outputs      : the time
+
+static uint64_t replay_now( void ) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return((uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_control
+// Description  : Send a control request and check the response
+//
+// Inputs       : c0 - the operation
+//                c1 - the device (DEVINIT)
+//                d0 - (output) the response's d0, may be NULL
+// Outputs      : 0 if successful, -1 if failure
+
+static int replay_control( int c0, int c1, int *d0 ) {
+    int b0, b1, rc0, rc1, rc2, rd0, rd1;
+    LCloudRegisterFrame resp;
+
+    if((resp = client_lcloud_bus_request(create_lcloud_register(0, 0, c0, c1, 0, 0, 0), NULL)) == -1 ||
+        extract_lcloud_registers(resp, &b0, &b1, &rc0, &rc1, &rc2, &rd0, &rd1) == -1 ||
+        b0 != 1 || b1 != 1 || rc0 != c0) {
+        logMessage(LOG_ERROR_LEVEL, "Replay control operation %d failed", c0);
+        return(-1);
+    }
+    if(d0 != NULL) *d0 = rd0;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_compare
+// Description  : qsort comparison of two latencies
+//
+// Inputs       : a, b - the latencies
+// Outputs      : <0, 0 or >0
+
+static int replay_compare( const void *a, const void *b ) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return((x > y) - (x < y));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_trace
+// Description  : Issue the trace's bus transfers, each no earlier than its
+//                recorded time (relative to the first transfer) / speed
+//
+// Inputs       : tr - the trace
+//                speed - speed relative to the recording, 0 for no pacing
+//                st - (output) the statistics
+// Outputs      : 0 if successful, -1 if failure
+
+static int replay_trace( LcTrace *tr, double speed, LcReplayStats *st ) {
+    char buf[LC_DEVICE_BLOCK_SIZE];
+    int b0, b1, c0, c1, c2, d0, d1, present;
+    uint64_t base = 0, first = 0, due, start;
+    LCloudRegisterFrame resp;
+    struct timespec ts;
+    const LcTraceRec *r;
+
+    // Bring the devices up the way the filesystem does
+    if(replay_control(LC_POWER_ON, 0, NULL) == -1 || replay_control(LC_DEVPROBE, 0, &present) == -1) {
+        return(-1);
+    }
+    for(int i = 0; i < 16; i++) {
+        if((present & (1 << i)) && replay_control(LC_DEVINIT, i, NULL) == -1) return(-1);
+    }
+
+    for(uint64_t i = 0; i < tr->num_recs; i++) {
+        r = &tr->recs[i];
+        if(r->kind != LC_TRACE_BUS) continue;
+
+        // Wait for the transfer's slot in the schedule
+        if(st->xfers == 0) {
+            base = replay_now();
+            first = r->time;
+        }
+        due = base + ((speed > 0) ? (uint64_t) ((r->time - first) / speed) : 0);
+        if(speed > 0 && replay_now() < due) {
+            ts.tv_sec = due / 1000000000ULL;
+            ts.tv_nsec = due % 1000000000ULL;
+            while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+        }
+
+        // Writes carry the block address, so device contents can be checked
+        if(r->op == LC_XFER_WRITE) {
+            memset(buf, 0, sizeof(buf));
+            snprintf(buf, sizeof(buf), "replay %d/%d/%d", r->dev, r->sec, r->blk);
+        }
+        start = replay_now();
+        if(start > due) {
+            st->lag_total += start - due;
+            if(start - due > st->lag_max) st->lag_max = start - due;
+        }
+        resp = client_lcloud_bus_request(create_lcloud_register(0, 0, LC_BLOCK_XFER, r->dev, r->op, r->sec, r->blk), buf);
+        st->latency[st->xfers++] = replay_now() - start;
+        if(r->op == LC_XFER_READ) st->reads++; else st->writes++;
+
+        if(resp == -1) {
+            logMessage(LOG_ERROR_LEVEL, "Bus failure replaying transfer %lu", st->xfers);
+            return(-1);
+        }
+        if(extract_lcloud_registers(resp, &b0, &b1, &c0, &c1, &c2, &d0, &d1) == -1 || b1 != 1) {
+            logMessage(LcDriverLLevel, "Transfer [%d/%d/%d] failed on the device", r->dev, r->sec, r->blk);
+            st->errors++;
+        }
+    }
+
+    return(replay_control(LC_POWER_OFF, 0, NULL));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the trace replay tool
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] ) {
+    char *transport = NULL;
+    int ch, verbose = 0, ret;
+    double speed = 1.0, seconds, recorded;
+    uint64_t start, bus = 0, first = 0, last = 0;
+    LcReplayStats st;
+    LcTrace tr;
+
+    // Process the command line parameters
+    while((ch = getopt(argc, argv, LC_REPLAY_ARGUMENTS)) != -1) {
+        switch(ch) {
+        case 'h': // Help, print usage
+            fprintf(stderr, USAGE);
+            return(-1);
+
+        case 'v': // Verbose Flag
+            verbose = 1;
+            break;
+
+        case 't': // Server transport
+            transport = optarg;
+            break;
+
+        case 's': // Replay speed
+            speed = atof(optarg);
+            break;
+
+        default: // Default (unknown)
+            fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+            return(-1);
+        }
+    }
+
+    initializeLogWithFilehandle(CMPSC311_LOG_STDERR);
+    LcControllerLLevel = registerLogLevel("LCLOUD_CONTROLLER", 0);
+    LcDriverLLevel = registerLogLevel("LCLOUD_DRIVER", 0);
+    if(verbose) {
+        enableLogLevels(LOG_INFO_LEVEL);
+        enableLogLevels(LcControllerLLevel | LcDriverLLevel);
+    }
+
+    if(optind != argc - 1 || speed < 0) {
+        fprintf(stderr, "Missing trace file or bad speed, use -h to see usage, aborting.\n");
+        return(-1);
+    }
+    if(client_set_transport(transport) == -1) {
+        fprintf(stderr, "Bad transport specification [%s], aborting.\n", transport);
+        return(-1);
+    }
+    if(lcloud_trace_open(&tr, argv[optind]) == -1) {
+        return(-1);
+    }
+
+    // Room for a latency per transfer, and the span the transfers were recorded over
+    memset(&st, 0, sizeof(st));
+    for(uint64_t i = 0; i < tr.num_recs; i++) {
+        if(tr.recs[i].kind != LC_TRACE_BUS) continue;
+        if(bus++ == 0) first = tr.recs[i].time;
+        last = tr.recs[i].time;
+    }
+    recorded = (last - first) / 1e9;
+    if((st.latency = malloc((bus + 1) * sizeof(uint64_t))) == NULL) {
+        lcloud_trace_close(&tr);
+        return(-1);
+    }
+
+    start = replay_now();
+    ret = replay_trace(&tr, speed, &st);
+    seconds = (replay_now() - start) / 1e9;
+    lcloud_trace_close(&tr);
+
+    qsort(st.latency, st.xfers, sizeof(uint64_t), replay_compare);
+    printf("trace           : %s (%lu transfers over %.3f s)\n", argv[optind], bus, recorded);
+    printf("replayed        : %lu transfers (%lu reads, %lu writes, %lu failed) in %.3f s\n",
+        st.xfers, st.reads, st.writes, st.errors, seconds);
+    printf("throughput      : %.0f transfers/s\n", (seconds > 0) ? st.xfers / seconds : 0.0);
+    if(st.xfers > 0) {
+        printf("latency (us)    : p50 %.1f, p90 %.1f, p99 %.1f, max %.1f\n",
+            st.latency[st.xfers / 2] / 1e3, st.latency[st.xfers * 90 / 100] / 1e3,
+            st.latency[st.xfers * 99 / 100] / 1e3, st.latency[st.xfers - 1] / 1e3);
+        if(speed > 0) {
+            printf("schedule lag    : mean %.1f us, max %.1f us\n",
+                st.lag_total / 1e3 / st.xfers, st.lag_max / 1e3);
+        }
+    }
+    free(st.latency);
+    freeLogRegistrations();
+    return((ret == 0 && st.errors == 0) ? 0 : -1);
+}
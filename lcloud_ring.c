@@ -0,0 +1,210 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_ring.c
+//  Description    : This is the implementation of the lock-free SPSC byte
+//                   ring.  The producer only ever advances head and the
+//                   consumer only ever advances tail, so no locks are needed.
+//                   Waiters spin briefly and then sleep on a futex so an idle
+//                   peer does not burn a core.
+//
+//   Author        : Lucas Benning
+//   Last Modified : 4/22/20
+//
+
+// Include files
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// Project include files
+#include <lcloud_ring.h>
+
+// Defines
+#if defined(__x86_64__) || defined(__i386__)
+#define LC_RING_RELAX() __builtin_ia32_pause()
+#else
+#define LC_RING_RELAX() atomic_signal_fence(memory_order_seq_cst)
+#endif
+
+//
+// Global data
+static atomic_int ring_spins = -1; // Busy polls before sleeping (0 on uniprocessors, set on first wait)
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ring_wake
+// Description  : Announce progress on the ring, waking any sleeping peer
+//
+// Inputs       : ring - the ring
+// Outputs      : none
+
+static void ring_wake( LcRing *ring ) {
+    atomic_fetch_add(&ring->seq, 1);
+    if(atomic_load(&ring->sleepers) > 0) {
+        syscall(SYS_futex, &ring->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ring_wait
+// Description  : Wait until the reader (want_data) or writer (!want_data)
+//                can make progress
+//
+// Inputs       : ring - the ring
+//                want_data - 1 to wait for data, 0 to wait for space
+// Outputs      : bytes available to read/write, 0 if the ring is closed
+
+static uint64_t ring_wait( LcRing *ring, int want_data ) {
+    uint64_t avail;
+    uint32_t seq;
+    int spins = 0, max_spins;
+
+    // Spinning only helps if the peer is running on another CPU (rings of several
+    // instances may get here at once, they all store the same value)
+    if((max_spins = atomic_load_explicit(&ring_spins, memory_order_relaxed)) == -1) {
+        max_spins = (sysconf(_SC_NPROCESSORS_ONLN) > 1) ? LC_RING_SPINS : 0;
+        atomic_store_explicit(&ring_spins, max_spins, memory_order_relaxed);
+    }
+
+    for(;;) {
+        uint64_t used = atomic_load_explicit(&ring->head, memory_order_acquire) -
+            atomic_load_explicit(&ring->tail, memory_order_acquire);
+        avail = want_data ? used : ring->size - used;
+        if(avail > 0) return(avail);
+        if(atomic_load(&ring->closed)) return(0);
+
+        if(spins < max_spins) {
+            spins++;
+            LC_RING_RELAX();
+            continue;
+        }
+
+        // Register as a sleeper, then recheck so a wake cannot be lost
+        seq = atomic_load(&ring->seq);
+        atomic_fetch_add(&ring->sleepers, 1);
+        used = atomic_load(&ring->head) - atomic_load(&ring->tail);
+        avail = want_data ? used : ring->size - used;
+        if(avail == 0 && !atomic_load(&ring->closed)) {
+            syscall(SYS_futex, &ring->seq, FUTEX_WAIT, seq, NULL, NULL, 0);
+        }
+        atomic_fetch_sub(&ring->sleepers, 1);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_ring_footprint
+// Description  : Bytes of shared memory needed for a ring of the given capacity
+//
+// Inputs       : size - ring capacity in bytes
+// Outputs      : the number of bytes to map
+
+size_t lcloud_ring_footprint( size_t size ) {
+    return(sizeof(LcRing) + size);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_ring_init
+// Description  : Format a ring in the given memory
+//
+// Inputs       : mem - at least lcloud_ring_footprint(size) bytes
+//                size - ring capacity (power of two)
+// Outputs      : the ring, NULL if failure
+
+LcRing * lcloud_ring_init( void *mem, size_t size ) {
+    LcRing *ring = (LcRing*) mem;
+    if(mem == NULL || size == 0 || (size & (size - 1)) != 0) return(NULL);
+
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->seq, 0);
+    atomic_init(&ring->sleepers, 0);
+    atomic_init(&ring->closed, 0);
+    ring->size = size;
+    return(ring);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_ring_write
+// Description  : Write all of buf to the ring (producer only)
+//
+// Inputs       : ring - the ring
+//                buf - the bytes to write
+//                len - the number of bytes
+// Outputs      : 0 if successful, -1 if the ring was closed
+
+int lcloud_ring_write( LcRing *ring, const void *buf, size_t len ) {
+    const char *src = (const char*) buf;
+    while(len > 0) {
+        uint64_t space, head, off, n, first;
+        if((space = ring_wait(ring, 0)) == 0) return(-1);
+
+        // Copy as much as fits, wrapping around the end of the storage
+        head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        n = (len < space) ? len : space;
+        off = head & (ring->size - 1);
+        first = (n < ring->size - off) ? n : ring->size - off;
+        memcpy(&ring->data[off], src, first);
+        memcpy(ring->data, src + first, n - first);
+
+        // Publish the bytes to the consumer
+        atomic_store_explicit(&ring->head, head + n, memory_order_release);
+        ring_wake(ring);
+        src += n;
+        len -= n;
+    }
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_ring_read
+// Description  : Read exactly len bytes from the ring (consumer only)
+//
+// Inputs       : ring - the ring
+//                buf - where to place the bytes
+//                len - the number of bytes
+// Outputs      : 0 if successful, -1 if the ring was closed and drained
+
+int lcloud_ring_read( LcRing *ring, void *buf, size_t len ) {
+    char *dst = (char*) buf;
+    while(len > 0) {
+        uint64_t avail, tail, off, n, first;
+        if((avail = ring_wait(ring, 1)) == 0) return(-1);
+
+        tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        n = (len < avail) ? len : avail;
+        off = tail & (ring->size - 1);
+        first = (n < ring->size - off) ? n : ring->size - off;
+        memcpy(dst, &ring->data[off], first);
+        memcpy(dst + first, ring->data, n - first);
+
+        // Release the space back to the producer
+        atomic_store_explicit(&ring->tail, tail + n, memory_order_release);
+        ring_wake(ring);
+        dst += n;
+        len -= n;
+    }
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_ring_close
+// Description  : Mark the ring closed and wake anyone waiting on it
+//
+// Inputs       : ring - the ring
+// Outputs      : none
+
+void lcloud_ring_close( LcRing *ring ) {
+    atomic_store(&ring->closed, 1);
+    ring_wake(ring);
+}
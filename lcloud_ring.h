@@ -0,0 +1,62 @@
+#ifndef LCLOUD_RING_INCLUDED
+#define LCLOUD_RING_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_ring.h
+//  Description    : This is the interface of the lock-free single-producer
+//                   single-consumer byte ring used to pass register frames
+//                   and payloads through shared memory.
+//
+//   Author        : Lucas Benning
+//   Last Modified : 4/22/20
+//
+
+// Includes
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Defines
+#define LC_RING_CACHELINE 64 // Keep producer and consumer state on separate lines
+#define LC_RING_SPINS 2048 // Busy polls before a waiter sleeps on the futex
+
+// Type definitions
+typedef struct {
+    // Producer side (written only by the producer)
+    _Atomic uint64_t head; // Total bytes ever written
+    char pad0[LC_RING_CACHELINE - sizeof(uint64_t)];
+
+    // Consumer side (written only by the consumer)
+    _Atomic uint64_t tail; // Total bytes ever read
+    char pad1[LC_RING_CACHELINE - sizeof(uint64_t)];
+
+    // Sleep/wake state shared by both sides
+    _Atomic uint32_t seq; // Bumped on every publish/consume, used as futex word
+    _Atomic uint32_t sleepers; // Number of threads blocked on seq
+    _Atomic uint32_t closed; // Set once the producer will write no more
+    char pad2[LC_RING_CACHELINE - 3 * sizeof(uint32_t)];
+
+    uint64_t size; // Capacity of data (power of two)
+    char data[]; // The ring storage
+} LcRing;
+
+//
+// Functional Prototypes
+
+size_t lcloud_ring_footprint( size_t size );
+    // Bytes of shared memory needed for a ring of the given capacity
+
+LcRing * lcloud_ring_init( void *mem, size_t size );
+    // Format a ring in the given memory (size must be a power of two)
+
+int lcloud_ring_write( LcRing *ring, const void *buf, size_t len );
+    // Write all of buf to the ring, waiting for space as needed
+
+int lcloud_ring_read( LcRing *ring, void *buf, size_t len );
+    // Read exactly len bytes from the ring, waiting for data as needed
+
+void lcloud_ring_close( LcRing *ring );
+    // Mark the ring closed, readers fail once the remaining data is drained
+
+#endif
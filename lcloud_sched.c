@@ -0,0 +1,431 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_sched.c
+//  Description    : This is the implementation of the device request
+//                   scheduler that sits between the filesystem and the
+//                   client.  Block transfers are queued with a class
+//                   (demand, prefetch or writeback) and the file they are
+//                   for, then dispatched together: requests for the same
+//                   block are merged, each device's queue is put in
+//                   elevator (C-SCAN) order from where the device last was,
+//                   and round trips are filled from the devices in turn so
+//                   they all work in parallel.  Demand transfers go first;
+//                   within a class every file gets turns of a few blocks,
+//                   so one streaming file cannot hold back the rest.
+//                   Prefetches only ride in the round trips demand
+//                   transfers need anyway.  Writebacks are held, in the
+//                   scheduler's own copy, until the next dispatch (or
+//                   lcshutdown): they go out behind the demand transfers
+//                   of whatever is sent next, and reads of a block held
+//                   for writing are served from the copy.
+//
+//   Author        : Lucas Benning
+//   Last Modified : 5/6/20
+//
+
+// Include files
+#include <stdlib.h>
+#include <string.h>
+#include <cmpsc311_log.h>
+
+// Project include files
+#include <lcloud_filesys.h>
+#include <lcloud_fsinternal.h>
+#include <lcloud_network.h>
+#include <lcloud_support.h>
+
+// Defines
+#define LC_SCHED_QUANTUM 8 // Blocks of one file a device takes before the other files' turn
+#define LC_SCHED_DEVICES 256 // Device ids (every LcDeviceId)
+#define LC_SCHED_WRITEBACK LC_ASYNC_STAGE_BLOCKS // Writebacks held before they are sent on their own
+
+// Type definitions
+typedef struct {
+    LcBlock *blk; // The device block
+    char **bufp; // Where the caller keeps its buffer (set to NULL if dropped)
+    int dir; // LC_XFER_READ or LC_XFER_WRITE
+    LcIoClass cls; // Its class
+    uint32_t group; // Turn of its file it goes in (its rank in the file / quantum)
+    uint64_t scan; // Position in the device's elevator sweep
+    uint32_t seq; // Order it was queued in
+    int32_t alias; // Request it was merged into, -1 if none
+} LcSchedReq;
+
+typedef struct {
+    LcFHandle fh; // The file
+    LcIoClass cls; // The class
+    uint32_t count; // Its requests queued so far
+} LcSchedShare;
+
+struct LcSched {
+    LcSchedReq *reqs; // Queued requests
+    uint32_t nreqs; // Entries in reqs
+    uint32_t cap; // Capacity of reqs
+    LcSchedShare *shares; // Requests per file and class
+    uint32_t nshares; // Entries in shares
+    uint32_t shares_cap; // Capacity of shares
+    uint32_t nreads; // Reads among them
+    LcBlock wb_blks[LC_SCHED_WRITEBACK]; // Blocks of the writebacks held (the caller's may go away)
+    char *wb_bufs[LC_SCHED_WRITEBACK]; // Their buffer entries, into wb_data
+    char *wb_data; // Their contents, NULL until the first writeback
+    uint32_t nwb; // Writebacks held
+    uint32_t head[LC_SCHED_DEVICES]; // Last position (sec, blk) served on each device
+    LcBlock *batch_blks[LCLOUD_MAX_BATCH]; // Round trip being built
+    char *batch_bufs[LCLOUD_MAX_BATCH];
+    char batch_dirs[LCLOUD_MAX_BATCH];
+};
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : block_pos
+// Description  : Position of a block on its device
+//
+// Inputs       : blk - the device block
+// Outputs      : the position
+
+static uint32_t block_pos( LcBlock *blk ) {
+    return(((uint32_t) blk->sec << 16) | blk->blk);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : compare_block
+// Description  : Order requests by block, then in the order they were queued
+//
+// Inputs       : a, b - the requests
+// Outputs      : <0, 0 or >0
+
+static int compare_block( const void *a, const void *b ) {
+    const LcSchedReq *x = a, *y = b;
+    if(x->blk->dev != y->blk->dev) return((x->blk->dev < y->blk->dev) ? -1 : 1);
+    if(block_pos(x->blk) != block_pos(y->blk)) return((block_pos(x->blk) < block_pos(y->blk)) ? -1 : 1);
+    return((x->seq > y->seq) - (x->seq < y->seq));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : compare_sched
+// Description  : Order requests into per-device queues: by device, class, turn
+//                of their file, then elevator position
+//
+// Inputs       : a, b - the requests
+// Outputs      : <0, 0 or >0
+
+static int compare_sched( const void *a, const void *b ) {
+    const LcSchedReq *x = a, *y = b;
+    if(x->blk->dev != y->blk->dev) return((x->blk->dev < y->blk->dev) ? -1 : 1);
+    if(x->cls != y->cls) return((x->cls < y->cls) ? -1 : 1);
+    if(x->group != y->group) return((x->group < y->group) ? -1 : 1);
+    if(x->scan != y->scan) return((x->scan < y->scan) ? -1 : 1);
+    return((x->seq > y->seq) - (x->seq < y->seq));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sched_merge
+// Description  : Merge the requests for the same block.  Its writes all come
+//                before its reads (lcloud_sched_queue sends reads ahead of a
+//                write), so the last write's data is the one sent and the
+//                reads get a copy of it; reads of a block nothing writes share
+//                the first one's transfer.  The request kept takes the most
+//                urgent class and earliest turn of those going its way.
+//
+// Inputs       : sq - the scheduler
+// Outputs      : requests merged away
+
+static uint32_t sched_merge( LcSched *sq ) {
+    uint32_t merged = 0, i, j, keep;
+
+    qsort(sq->reqs, sq->nreqs, sizeof(LcSchedReq), compare_block);
+    for(i = 0; i < sq->nreqs; i = j) {
+        keep = i;
+        for(j = i; j < sq->nreqs && sq->reqs[j].blk->dev == sq->reqs[i].blk->dev &&
+            block_pos(sq->reqs[j].blk) == block_pos(sq->reqs[i].blk); j++) {
+            if(sq->reqs[j].dir == LC_XFER_WRITE) keep = j;
+        }
+        for(uint32_t k = i; k < j; k++) {
+            if(k == keep) continue;
+            if(sq->reqs[k].dir == sq->reqs[keep].dir) {
+                if(sq->reqs[k].cls < sq->reqs[keep].cls) sq->reqs[keep].cls = sq->reqs[k].cls;
+                if(sq->reqs[k].group < sq->reqs[keep].group) sq->reqs[keep].group = sq->reqs[k].group;
+            }
+            sq->reqs[k].alias = (int32_t) sq->reqs[keep].seq;
+            merged++;
+        }
+    }
+    return(merged);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sched_reset
+// Description  : Forget what is queued (sent, or it cannot go)
+//
+// Inputs       : sq - the scheduler
+// Outputs      : none
+
+static void sched_reset( LcSched *sq ) {
+    sq->nreqs = 0;
+    sq->nshares = 0;
+    sq->nreads = 0;
+    sq->nwb = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sched_share
+// Description  : Find how many requests a file has in a class already
+//
+// Inputs       : sq - the scheduler
+//                fh - the file, -1 if none
+//                cls - the class
+// Outputs      : its entry, NULL if failure
+
+static LcSchedShare * sched_share( LcSched *sq, LcFHandle fh, LcIoClass cls ) {
+    LcSchedShare *share;
+
+    for(uint32_t s = 0; s < sq->nshares; s++) {
+        if(sq->shares[s].fh == fh && sq->shares[s].cls == cls) return(&sq->shares[s]);
+    }
+    if(sq->nshares == sq->shares_cap) {
+        uint32_t cap = (sq->shares_cap == 0) ? 8 : 2 * sq->shares_cap;
+        LcSchedShare *shares = realloc(sq->shares, cap * sizeof(LcSchedShare));
+        if(shares == NULL) {
+            logMessage(LOG_ERROR_LEVEL, "Memory allocation error");
+            return(NULL);
+        }
+        sq->shares = shares;
+        sq->shares_cap = cap;
+    }
+    share = &sq->shares[sq->nshares++];
+    share->fh = fh;
+    share->cls = cls;
+    share->count = 0;
+    return(share);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_sched_queue
+// Description  : Queue block transfers for the next dispatch.  A write sends
+//                the reads queued before it first.  Writebacks are copied
+//                and held until a later dispatch; if there is no room to
+//                hold them, those held are sent first.
+//
+// Inputs       : ctx - the filesystem
+//                dir - LC_XFER_READ or LC_XFER_WRITE
+//                blks - the blocks
+//                bufs - buffer for each block (except for writebacks, the array must
+//                       stay until the dispatch, which sets the entries of dropped
+//                       prefetches to NULL)
+//                n - number of blocks
+//                cls - their class
+//                fh - the file they are for, -1 if none
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_sched_queue( LcContext *ctx, int dir, LcBlock **blks, char **bufs, int n, LcIoClass cls, LcFHandle fh ) {
+    LcSched *sq = ctx->sched;
+    LcSchedShare *share;
+
+    // Create the scheduler on first use
+    if(sq == NULL) {
+        if((sq = calloc(1, sizeof(LcSched))) == NULL) {
+            logMessage(LOG_ERROR_LEVEL, "Memory allocation error");
+            return(-1);
+        }
+        ctx->sched = sq;
+    }
+    if(cls == LC_IO_WRITEBACK && sq->wb_data == NULL &&
+        (sq->wb_data = malloc((size_t) LC_SCHED_WRITEBACK * LC_DEVICE_BLOCK_SIZE)) == NULL) {
+        logMessage(LOG_ERROR_LEVEL, "Memory allocation error");
+        return(-1);
+    }
+
+    // The reads queued want the contents from before the write
+    if(dir == LC_XFER_WRITE && sq->nreads > 0 && lcloud_sched_dispatch(ctx) == -1) return(-1);
+
+    // Make room
+    if(sq->nreqs + n > sq->cap) {
+        uint32_t cap = (sq->cap == 0) ? LCLOUD_MAX_BATCH : sq->cap;
+        while(cap < sq->nreqs + n) cap *= 2;
+        LcSchedReq *reqs = realloc(sq->reqs, cap * sizeof(LcSchedReq));
+        if(reqs == NULL) {
+            logMessage(LOG_ERROR_LEVEL, "Memory allocation error");
+            sched_reset(sq); // What was queued for the dispatch cannot go either
+            return(-1);
+        }
+        sq->reqs = reqs;
+        sq->cap = cap;
+    }
+
+    for(int i = 0; i < n; i++) {
+        LcSchedReq *req = &sq->reqs[sq->nreqs];
+        LcBlock *blk = blks[i];
+        char **bufp = &bufs[i];
+        if(cls == LC_IO_WRITEBACK) {
+            if(sq->nwb == LC_SCHED_WRITEBACK && lcloud_sched_dispatch(ctx) == -1) return(-1);
+            req = &sq->reqs[sq->nreqs];
+            blk = &sq->wb_blks[sq->nwb];
+            *blk = *blks[i];
+            bufp = &sq->wb_bufs[sq->nwb];
+            *bufp = &sq->wb_data[(size_t) sq->nwb++ * LC_DEVICE_BLOCK_SIZE];
+            memcpy(*bufp, bufs[i], LC_DEVICE_BLOCK_SIZE);
+        }
+        if((share = sched_share(sq, fh, cls)) == NULL) {
+            sched_reset(sq);
+            return(-1);
+        }
+        uint32_t pos = block_pos(blk);
+        req->blk = blk;
+        req->bufp = bufp;
+        req->dir = dir;
+        req->cls = cls;
+        req->group = share->count++ / LC_SCHED_QUANTUM;
+        req->scan = (pos >= sq->head[blk->dev]) ? pos : pos + (1ULL << 32);
+        req->seq = sq->nreqs++;
+        req->alias = -1;
+        if(dir == LC_XFER_READ) sq->nreads++;
+    }
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_sched_dispatch
+// Description  : Send the queued transfers, with the writebacks held.  Each
+//                round trip takes one request from each device queue in
+//                turn, most urgent class first.  If demand transfers are
+//                queued, prefetches only fill the round trips they need: the
+//                rest are dropped (their buffer entry set to NULL).
+//                Writebacks are never dropped.
+//
+// Inputs       : ctx - the filesystem
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_sched_dispatch( LcContext *ctx ) {
+    LcSched *sq = ctx->sched;
+    uint32_t merged, dropped = 0, trips = 0, *cursor = NULL, *qend = NULL, ndev = 0, left, demand = 0;
+    LcSchedReq **primary = NULL;
+    int had_demand, ret = 0;
+
+    if(sq == NULL || sq->nreqs == 0) return(0);
+
+    // Merge, then lay the requests out as per-device queues
+    merged = sched_merge(sq);
+    for(uint32_t i = 0; i < sq->nreqs; i++) {
+        if(sq->reqs[i].alias == -1 && sq->reqs[i].cls == LC_IO_DEMAND) demand++;
+    }
+    had_demand = (demand > 0);
+    qsort(sq->reqs, sq->nreqs, sizeof(LcSchedReq), compare_sched);
+    if((cursor = malloc(2 * sq->nreqs * sizeof(uint32_t))) == NULL ||
+        (primary = malloc(sq->nreqs * sizeof(LcSchedReq *))) == NULL) {
+        logMessage(LOG_ERROR_LEVEL, "Memory allocation error");
+        ret = -1;
+        goto done;
+    }
+    qend = &cursor[sq->nreqs];
+    for(uint32_t i = 0; i < sq->nreqs; i++) {
+        primary[sq->reqs[i].seq] = &sq->reqs[i];
+        if(i == 0 || sq->reqs[i].blk->dev != sq->reqs[i - 1].blk->dev) cursor[ndev++] = i;
+        qend[ndev - 1] = i + 1;
+    }
+
+    // Fill round trips from the device queues in turn
+    left = sq->nreqs - merged;
+    for(uint32_t d = 0; d < ndev; d++) {
+        while(cursor[d] < qend[d] && sq->reqs[cursor[d]].alias != -1) cursor[d]++;
+    }
+    while(left > 0) {
+        int cnt = 0;
+
+        // Once the demand transfers are out, the prefetches left are dropped
+        for(uint32_t d = 0; d < ndev && had_demand && demand == 0; d++) {
+            for(; cursor[d] < qend[d] && (sq->reqs[cursor[d]].alias != -1 || sq->reqs[cursor[d]].cls == LC_IO_PREFETCH);
+                cursor[d]++) {
+                if(sq->reqs[cursor[d]].alias == -1) {
+                    *sq->reqs[cursor[d]].bufp = NULL;
+                    dropped++;
+                    left--;
+                }
+            }
+        }
+        for(LcIoClass cls = LC_IO_DEMAND; cls <= LC_IO_WRITEBACK && cnt < LCLOUD_MAX_BATCH; cls++) {
+            int took = 1;
+            while(took && cnt < LCLOUD_MAX_BATCH) {
+                took = 0;
+                for(uint32_t d = 0; d < ndev && cnt < LCLOUD_MAX_BATCH; d++) {
+                    if(cursor[d] == qend[d] || sq->reqs[cursor[d]].cls != cls) continue;
+                    LcSchedReq *req = &sq->reqs[cursor[d]];
+                    sq->batch_blks[cnt] = req->blk;
+                    sq->batch_bufs[cnt] = *req->bufp;
+                    sq->batch_dirs[cnt] = req->dir;
+                    cnt++;
+                    took = 1;
+                    if(cls == LC_IO_DEMAND) demand--;
+                    sq->head[req->blk->dev] = block_pos(req->blk);
+                    for(cursor[d]++; cursor[d] < qend[d] && sq->reqs[cursor[d]].alias != -1; cursor[d]++);
+                }
+            }
+        }
+        if(cnt == 0) break;
+        if(device_xfer(ctx, sq->batch_dirs, sq->batch_blks, sq->batch_bufs, cnt) == -1) {
+            ret = -1;
+            goto done;
+        }
+        left -= cnt;
+        trips++;
+    }
+
+    // Drop the prefetches that did not go, hand merged reads their copy
+    for(uint32_t d = 0; d < ndev; d++) {
+        for(; cursor[d] < qend[d]; cursor[d]++) {
+            if(sq->reqs[cursor[d]].alias == -1) {
+                *sq->reqs[cursor[d]].bufp = NULL;
+                dropped++;
+            }
+        }
+    }
+    for(uint32_t i = 0; i < sq->nreqs; i++) {
+        LcSchedReq *req = &sq->reqs[i];
+        if(req->alias == -1) continue;
+        LcSchedReq *to = primary[req->alias];
+        if(*to->bufp == NULL) {
+            *req->bufp = NULL;
+        } else if(req->dir == LC_XFER_READ) {
+            memcpy(*req->bufp, *to->bufp, LC_DEVICE_BLOCK_SIZE);
+        }
+    }
+    if(merged > 0 || dropped > 0) {
+        logMessage(LcDriverLLevel, "Scheduled %u transfers in %u round trips (%u merged, %u prefetches dropped)",
+            sq->nreqs, trips, merged, dropped);
+    }
+
+done:
+    free(cursor);
+    free(primary);
+    sched_reset(sq);
+    return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_sched_close
+// Description  : Free the scheduler (the writebacks held are lost: dispatch
+//                them first)
+//
+// Inputs       : ctx - the filesystem
+// Outputs      : none
+
+void lcloud_sched_close( LcContext *ctx ) {
+    LcSched *sq = ctx->sched;
+
+    if(sq == NULL) return;
+    free(sq->reqs);
+    free(sq->shares);
+    free(sq->wb_data);
+    free(sq);
+    ctx->sched = NULL;
+}
@@ -17,37 +17,72 @@
 #include <fcntl.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 // Project Includes
+#include <lcloud_cache.h>
 #include <lcloud_controller.h>
 #include <lcloud_filesys.h>
+#include <lcloud_network.h>
 #include <lcloud_support.h>
+#include <lcloud_trace.h>
+#include <lcloud_workload.h>
 
 // Defines
-#define LCLOUD_ARGUMENTS "hvl:x:"
+#define LCLOUD_ARGUMENTS "hvl:t:c:e:L:pP:Dm:k:s:T:x:"
 #define USAGE                                                       \
-    "USAGE: lcloud_sim [-h] [-v] [-l <logfile>] <workload-file>\n"  \
+    "USAGE: lcloud_sim [-h] [-v] [-l <logfile>] [-t <transport>] [-c <blocks>]\n" \
+    "                  [-e <policy>] [-L <file>[:<blocks>]] [-p] [-P <degree>]\n" \
+    "                  [-D] [-m <checkpoint> -k <key-file>] [-s <stats-file>]\n" \
+    "                  [-T <trace-file>]\n" \
+    "                  <workload-file>\n"                          \
     "\n"                                                            \
     "where:\n"                                                      \
     "    -h - help mode (display this message)\n"                   \
     "    -v - verbose output\n"                                     \
     "    -l - write log messages to the filename <logfile>\n"       \
+    "    -t - server transport: tcp[:ip[:port]], uring[:ip[:port]],\n" \
+    "         unix[:path] or\n"                                     \
+    "         shm:<manifest> (in-process devices, default tcp)\n"   \
+    "    -c - cache capacity in blocks (0 disables the cache, default 64)\n" \
+    "    -e - cache eviction policy: lru (default), fifo or clock\n" \
+    "    -L - back the cache with a second tier of <blocks> (default 4096)\n" \
+    "         in the local <file>, kept across runs with -m\n" \
+    "    -p - pack small files and file tails into shared device blocks\n" \
+    "    -P - prefetch up to <degree> blocks (1-8) that past reads say follow\n" \
+    "         a miss (default off)\n" \
+    "    -D - store blocks with the same contents once (deduplicate)\n" \
+    "    -m - keep the filesystem metadata in <checkpoint> across runs\n" \
+    "         (the devices must keep their contents, lcloud_simserver -m)\n" \
+    "    -k - encrypt blocks with the key and IV in <key-file> (32 bytes,\n" \
+    "         e.g. from /dev/urandom); -m needs it, the checkpoint does not\n" \
+    "         keep the key\n" \
+    "    -s - append run statistics to <stats-file> (CSV, or JSON if it\n" \
+    "         ends in .json)\n"                                     \
+    "    -T - record a block I/O trace to <trace-file>\n"            \
     "\n"                                                            \
-    "    <workload-file> - file contain the workload to simulate\n" \
+    "    <workload-file> - file contain the workload to simulate (text, or\n" \
+    "                      compiled with lcloud_wlcompile)\n"          \
     "\n"
 
 //
 // Global Data
 int verbose;
+uint64_t* op_latency = NULL; // Latency (nsec) of every read and write
+size_t op_latency_count = 0; // Entries in op_latency
+size_t op_latency_cap = 0; // Capacity of op_latency
 
 //
 // Functional Prototypes
 
 int simulateLionCloud(char* wload); // LionCloud simulation
+int writeSimulationStats(const char* path, const char* wload, const char* transport,
+    int cache_blocks, double seconds); // Append the run statistics
 
 //
 // Functions
@@ -65,7 +100,12 @@ int main(int argc, char* argv[])
 {
 
     // Local variables
-    int ch, verbose = 0, log_initialized = 0;
+    int ch, verbose = 0, log_initialized = 0, cache_blocks = LC_CACHE_MAXBLOCKS, policy = LC_CACHE_LRU, pack = 0, prefetch = 0, dedup = 0, ret;
+    int l2_blocks = LC_CACHE_L2_BLOCKS;
+    char *transport = NULL, *stats_file = NULL, *trace_file = NULL, *checkpoint = NULL, *l2_file = NULL, *key_file = NULL, *sep;
+    char key[2 * LCLOUD_CIPHER_KEYLEN];
+    FILE *kf;
+    struct timespec start, end;
 
     // Process the command line parameters
     while ((ch = getopt(argc, argv, LCLOUD_ARGUMENTS)) != -1) {
@@ -84,6 +124,57 @@ int main(int argc, char* argv[])
             log_initialized = 1;
             break;
 
+        case 't': // Set the server transport
+            transport = optarg;
+            break;
+
+        case 'c': // Set the cache capacity
+            cache_blocks = atoi(optarg);
+            break;
+
+        case 'e': // Set the cache eviction policy
+            if ((policy = lcloud_cache_policy(optarg)) == -1) {
+                fprintf(stderr, "Unknown cache policy (%s), aborting.\n", optarg);
+                return (-1);
+            }
+            break;
+
+        case 'L': // Set the second tier cache file and capacity
+            l2_file = optarg;
+            if ((sep = strrchr(optarg, ':')) != NULL) {
+                *sep = '\0';
+                l2_blocks = atoi(sep + 1);
+            }
+            break;
+
+        case 'p': // Pack small files and tails
+            pack = 1;
+            break;
+
+        case 'P': // Set the prefetch degree
+            prefetch = atoi(optarg);
+            break;
+
+        case 'D': // Deduplicate blocks
+            dedup = 1;
+            break;
+
+        case 'm': // Set the metadata checkpoint
+            checkpoint = optarg;
+            break;
+
+        case 'k': // Set the cipher key file
+            key_file = optarg;
+            break;
+
+        case 's': // Set the statistics file
+            stats_file = optarg;
+            break;
+
+        case 'T': // Set the block trace file
+            trace_file = optarg;
+            break;
+
         default: // Default (unknown)
             fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
             return (-1);
@@ -102,21 +193,78 @@ int main(int argc, char* argv[])
         enableLogLevels(LcControllerLLevel | LcDriverLLevel | LcSimulatorLLevel);
     }
 
+    // Select the transport to the server
+    if (client_set_transport(transport) == -1) {
+        fprintf(stderr, "Bad transport specification [%s], aborting.\n", transport);
+        return (-1);
+    }
+
+    // Size the cache
+    if (cache_blocks < 0 || lcloud_cache_configure(cache_blocks, policy) == -1 ||
+        (l2_file != NULL && lcloud_cache_l2_configure(l2_file, l2_blocks) == -1)) {
+        fprintf(stderr, "Bad cache configuration, aborting.\n");
+        return (-1);
+    }
+
+    // Select the block layout, prefetching and where the metadata is kept
+    lcpack(pack);
+    lcdedup(dedup);
+    if (lcprefetch(prefetch) == -1) {
+        fprintf(stderr, "Bad prefetch degree [%d], aborting.\n", prefetch);
+        return (-1);
+    }
+    if (key_file != NULL) {
+        if ((kf = fopen(key_file, "rb")) == NULL || fread(key, 1, sizeof(key), kf) != sizeof(key)) {
+            fprintf(stderr, "Cannot read %zu bytes of cipher key from [%s], aborting.\n", sizeof(key), key_file);
+            if (kf != NULL) fclose(kf);
+            return (-1);
+        }
+        fclose(kf);
+        client_set_cipher(key, key + LCLOUD_CIPHER_KEYLEN);
+    } else if (checkpoint != NULL) {
+        fprintf(stderr, "A metadata checkpoint needs the cipher key (-k), aborting.\n");
+        return (-1);
+    }
+    if (checkpoint != NULL && lcpersist(checkpoint) == -1) {
+        fprintf(stderr, "Bad metadata checkpoint [%s], aborting.\n", checkpoint);
+        return (-1);
+    }
+
     // The filename should be the next option
     if (argv[optind] == NULL) {
         fprintf(stderr, "Missing command line parameters, use -h to see usage, aborting.\n");
         return (-1);
     }
 
-    // Run the simulation
-    if (simulateLionCloud(argv[optind]) == 0) {
+    // Start the block trace
+    if (trace_file != NULL && lcloud_trace_start(trace_file) == -1) {
+        fprintf(stderr, "Cannot record block trace [%s], aborting.\n", trace_file);
+        return (-1);
+    }
+
+    // Bring the filesystem up ahead of the first request, then run the simulation
+    ret = lcinit(NULL);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (ret == 0) {
+        ret = simulateLionCloud(argv[optind]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (trace_file != NULL && lcloud_trace_stop() == -1) {
+        ret = -1;
+    }
+    if (ret == 0) {
         logMessage(LOG_INFO_LEVEL, "LionCloud simulation completed successfully!!!\n\n");
+        if (stats_file != NULL) {
+            writeSimulationStats(stats_file, argv[optind], (transport != NULL) ? transport : "tcp", cache_blocks,
+                (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+        }
     } else {
         logMessage(LOG_INFO_LEVEL, "LionCloud simulation failed.\n\n");
     }
 
     // Do some cleanup
     freeLogRegistrations();
+    free(op_latency);
 
     // Return successfully
     return (0);
@@ -142,27 +290,29 @@ int simulateLionCloud(char* wload)
     } fsysdata;
 
     /* Local variables */
-    workload_state state;
-    workload_operation operation;
+    LcWorkload state;
+    LcWlOp operation;
     LcFHandle fh;
     AssocArray fhTable;
     char buf[LC_MAX_OPERATION_SIZE];
     int opens, reads, writes, seeks, closes;
     fsysdata* fdata;
+    struct timespec op_start, op_end;
 
     /* Init fh table, open the workload for processing */
     init_assoc(&fhTable, stringCompareCallback, pointerCompareCallback);
-    if (openCmpsc311Workload(&state, wload)) {
+    if (lcloud_workload_open(&state, wload)) {
         logMessage(LOG_ERROR_LEVEL, "CMPSC311 lcloud workload: failed opening workload [%s]", wload);
         return (-1);
     }
 
     /* Loop until we are done with the workload */
-    logMessage(LcSimulatorLLevel, "CMPSC311 lcloud : executing workload [%s]", state.filename);
+    logMessage(LcSimulatorLLevel, "CMPSC311 lcloud : executing %s workload [%s]",
+        state.binary ? "compiled" : "text", wload);
     do {
 
         /* Get the next operation to process */
-        if (readCmpsc311Workload(&state, &operation)) {
+        if (lcloud_workload_next(&state, &operation)) {
             logMessage(LOG_ERROR_LEVEL, "CMPSC311 workload unit test failed at line %d, get op", state.lineno);
             return (-1);
         }
@@ -177,6 +327,7 @@ int simulateLionCloud(char* wload)
         }
 
         /* Switch on the operation type */
+        clock_gettime(CLOCK_MONOTONIC, &op_start);
         switch (operation.op) {
 
         case WL_OPEN: /* Open the file for reading/writing, check error */
@@ -202,7 +353,7 @@ int simulateLionCloud(char* wload)
         case WL_READ: /* Read a block of data from the file */
 
             /* Find the file for processing */
-            if ((fdata = find_assoc(&fhTable, operation.objname)) == NULL) {
+            if ((fdata = find_assoc(&fhTable, (char*)operation.objname)) == NULL) {
                 logMessage(LOG_ERROR_LEVEL, "CMPSC311 error reading unknown file [%s], aborting",
                     operation.objname);
                 return (-1);
@@ -244,7 +395,7 @@ int simulateLionCloud(char* wload)
         case WL_WRITE: /* Write a block of data to the file */
 
             /* Find the file for processing */
-            if ((fdata = find_assoc(&fhTable, operation.objname)) == NULL) {
+            if ((fdata = find_assoc(&fhTable, (char*)operation.objname)) == NULL) {
                 logMessage(LOG_ERROR_LEVEL, "CMPSC311 error writing unknown file [%s], aborting",
                     operation.objname);
                 return (-1);
@@ -262,7 +413,7 @@ int simulateLionCloud(char* wload)
             }
 
             /* Now do the write to the file */
-            if (lcwrite(fdata->fhandle, operation.data, operation.size) != operation.size) {
+            if (lcwrite(fdata->fhandle, (char*)operation.data, operation.size) != operation.size) {
                 logMessage(LOG_ERROR_LEVEL, "CMPSC311 error write failed [%s, pos=%d, size=%d], aborting",
                     operation.objname, operation.pos, operation.size);
                 return (-1);
@@ -278,7 +429,7 @@ int simulateLionCloud(char* wload)
         case WL_CLOSE:
 
             /* Find the file for processing */
-            if ((fdata = find_assoc(&fhTable, operation.objname)) == NULL) {
+            if ((fdata = find_assoc(&fhTable, (char*)operation.objname)) == NULL) {
                 logMessage(LOG_ERROR_LEVEL, "CMPSC311 error closing unknown file [%s], aborting",
                     operation.objname);
                 return (-1);
@@ -309,6 +460,20 @@ int simulateLionCloud(char* wload)
             return (-1);
         }
 
+        /* Record the latency of reads and writes */
+        if ((operation.op == WL_READ) || (operation.op == WL_WRITE)) {
+            clock_gettime(CLOCK_MONOTONIC, &op_end);
+            if (op_latency_count == op_latency_cap) {
+                op_latency_cap = (op_latency_cap == 0) ? 4096 : op_latency_cap * 2;
+                if ((op_latency = realloc(op_latency, op_latency_cap * sizeof(uint64_t))) == NULL) {
+                    logMessage(LOG_ERROR_LEVEL, "CMPSC311 out of memory recording latencies");
+                    return (-1);
+                }
+            }
+            op_latency[op_latency_count++] = (op_end.tv_sec - op_start.tv_sec) * 1000000000ULL
+                + (op_end.tv_nsec - op_start.tv_nsec);
+        }
+
         /* Sanity check the operation state */
         if (operation.op > WL_EOF) {
             logMessage(LOG_ERROR_LEVEL, "CMPSC311 lion clound bad POST HOC op code [%d]", operation.op);
@@ -318,6 +483,96 @@ int simulateLionCloud(char* wload)
     } while (operation.op < WL_EOF);
 
     /* Log, close workload and delete the local file, return successfully  */
-    closeCmpsc311Workload(&state);
+    lcloud_workload_close(&state);
     return (0);
 }
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : compareLatency
+// Description  : qsort comparison for operation latencies
+//
+// Inputs       : a, b - the latencies
+// Outputs      : <0, 0, >0 as a is less, equal or greater than b
+
+static int compareLatency(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return ((x > y) - (x < y));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : writeSimulationStats
+// Description  : Append one line of run statistics (throughput, cache hit
+//                ratio, bus traffic, latency percentiles, prefetch
+//                accuracy, elided and deduplicated writes) to a CSV file,
+//                or a JSON object per line if the name ends in .json
+//
+// Inputs       : path - the statistics file
+//                wload - the workload that was run
+//                transport - the transport specification
+//                cache_blocks - the cache capacity
+//                seconds - the wall clock time of the run
+// Outputs      : 0 if successful, -1 if failure
+
+int writeSimulationStats(const char* path, const char* wload, const char* transport,
+    int cache_blocks, double seconds)
+{
+    LcCacheStats cache;
+    LcClientStats bus;
+    LcPrefetchStats pf;
+    LcFsStats fs;
+    FILE* fhandle;
+    const char *name, *colon;
+    double pct[4] = { 0.50, 0.90, 0.99, 1.0 }, lat[4] = { 0, 0, 0, 0 }, hit_ratio, per_op, pf_accuracy, pf_coverage;
+    int json, tlen;
+
+    /* Gather the counters, sort the latencies for the percentiles */
+    lcloud_cache_stats(&cache);
+    client_get_stats(&bus);
+    hit_ratio = (cache.hits + cache.misses == 0) ? 0.0 : (double)cache.hits / (cache.hits + cache.misses);
+    per_op = (op_latency_count == 0) ? 0.0 : (double)(bus.block_reads + bus.block_writes) / op_latency_count;
+    lcprefetch_stats(&pf);
+    lcstats(&fs);
+    pf_accuracy = (pf.issued == 0) ? 0.0 : (double)pf.useful / pf.issued;
+    pf_coverage = (pf.useful + pf.misses == 0) ? 0.0 : (double)pf.useful / (pf.useful + pf.misses);
+    if (op_latency_count > 0) {
+        qsort(op_latency, op_latency_count, sizeof(uint64_t), compareLatency);
+        for (int i = 0; i < 4; i++) {
+            lat[i] = op_latency[(size_t)(pct[i] * (op_latency_count - 1))] / 1000.0;
+        }
+    }
+
+    /* Label by workload file and transport kind */
+    name = ((name = strrchr(wload, '/')) != NULL) ? name + 1 : wload;
+    tlen = ((colon = strchr(transport, ':')) != NULL) ? (int)(colon - transport) : (int)strlen(transport);
+    json = (strlen(path) > 5) && (strcmp(path + strlen(path) - 5, ".json") == 0);
+
+    if ((fhandle = fopen(path, "a")) == NULL) {
+        logMessage(LOG_ERROR_LEVEL, "CMPSC311 cannot open statistics file [%s]", path);
+        return (-1);
+    }
+    if (json) {
+        fprintf(fhandle, "{\"workload\": \"%s\", \"transport\": \"%.*s\", \"cache_blocks\": %d, "
+                         "\"policy\": \"%s\", \"ops\": %zu, \"seconds\": %.6f, \"ops_per_sec\": %.1f, "
+                         "\"hit_ratio\": %.6f, \"bus_ops\": %lu, \"bus_ops_per_op\": %.4f, \"round_trips\": %lu, "
+                         "\"p50_us\": %.1f, \"p90_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f, "
+                         "\"prefetch_issued\": %lu, \"prefetch_accuracy\": %.4f, \"prefetch_coverage\": %.4f, "
+                         "\"writes_elided\": %lu, \"blocks_deduped\": %lu}\n",
+            name, tlen, transport, cache_blocks, lcloud_cache_policy_name(), op_latency_count, seconds,
+            op_latency_count / seconds, hit_ratio, bus.block_reads + bus.block_writes, per_op, bus.round_trips,
+            lat[0], lat[1], lat[2], lat[3], pf.issued, pf_accuracy, pf_coverage, fs.writes_elided, fs.blocks_deduped);
+    } else {
+        if (ftell(fhandle) == 0) {
+            fprintf(fhandle, "workload,transport,cache_blocks,policy,ops,seconds,ops_per_sec,hit_ratio,"
+                             "bus_ops,bus_ops_per_op,round_trips,p50_us,p90_us,p99_us,max_us,"
+                             "prefetch_issued,prefetch_accuracy,prefetch_coverage,writes_elided,blocks_deduped\n");
+        }
+        fprintf(fhandle, "%s,%.*s,%d,%s,%zu,%.6f,%.1f,%.6f,%lu,%.4f,%lu,%.1f,%.1f,%.1f,%.1f,%lu,%.4f,%.4f,%lu,%lu\n",
+            name, tlen, transport, cache_blocks, lcloud_cache_policy_name(), op_latency_count, seconds,
+            op_latency_count / seconds, hit_ratio, bus.block_reads + bus.block_writes, per_op, bus.round_trips,
+            lat[0], lat[1], lat[2], lat[3], pf.issued, pf_accuracy, pf_coverage, fs.writes_elided, fs.blocks_deduped);
+    }
+    return ((fclose(fhandle) == 0) ? 0 : -1);
+}
@@ -0,0 +1,537 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_simserver.c
+//  Description    : This is an in-tree stand-in for the LionCloud server.  It
+//                   speaks the same register-frame protocol, builds its
+//                   devices from a hardware manifest (optionally backed by
+//                   memory-mapped image files), injects per-device latency
+//                   and bandwidth, and serves any number of TCP and
+//                   Unix-domain clients from a single epoll loop.
+//
+//   Author        : Lucas Benning
+//   Last Modified : 4/26/20
+//
+
+// Include Files
+#define _GNU_SOURCE // accept4
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+// Project Includes
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+#include <lcloud_controller.h>
+#include <lcloud_network.h>
+#include <lcloud_registers.h>
+#include <lcloud_devsim.h>
+#include <lcloud_support.h>
+
+// Defines
+#define LC_SRV_ARGUMENTS "hvl:p:u:m:L:B:"
+#define LC_SRV_BACKLOG 128 // Pending connections on each listener
+#define LC_SRV_MAX_EVENTS 64 // Events handled per epoll_wait
+#define LC_SRV_INBUF (64 * (LCLOUD_NET_HEADER_SIZE + LC_DEVICE_BLOCK_SIZE)) // Per-connection input
+#define LC_SRV_RESP_SIZE (LCLOUD_NET_HEADER_SIZE + LC_DEVICE_BLOCK_SIZE) // Largest response
+#define USAGE                                                                     \
+    "USAGE: lcloud_simserver [-h] [-v] [-l <logfile>] [-p <port>] [-u <path>]\n"  \
+    "                        [-m <dir>] [-L <usec>] [-B <KB/s>] <hardware-manifest>\n" \
+    "\n"                                                                          \
+    "where:\n"                                                                    \
+    "    -h - help mode (display this message)\n"                                 \
+    "    -v - verbose output\n"                                                   \
+    "    -l - write log messages to the filename <logfile>\n"                     \
+    "    -p - TCP port to listen on (0 disables TCP, default 24567)\n"            \
+    "    -u - also listen on the Unix-domain socket <path>\n"                     \
+    "    -m - back devices with memory-mapped image files in <dir>\n"             \
+    "    -L - default per-transfer device latency in microseconds\n"              \
+    "    -B - default device bandwidth in KB/s (0 is unlimited)\n"                \
+    "\n"                                                                          \
+    "    <hardware-manifest> - file containing the simulated hardware definitions,\n" \
+    "                          lines are <dev> <sectors> <blocks> [<usec> [<KB/s>]]\n" \
+    "\n"
+
+// Type definitions
+typedef struct LcSrvResp {
+    uint64_t due; // Time (usec) the device model completes the request
+    size_t len; // Bytes in the response
+    char bytes[LC_SRV_RESP_SIZE]; // Frame (network order) and any read payload
+    struct LcSrvResp *next; // Next response on the connection, in request order
+} LcSrvResp;
+
+typedef struct LcSrvConn {
+    int fd; // The client socket
+    int listener; // 1 if this is a listening socket
+    char in[LC_SRV_INBUF]; // Received, unparsed request bytes
+    size_t in_len; // Bytes in the input buffer
+    LcSrvResp *head; // Oldest pending response
+    LcSrvResp *tail; // Newest pending response
+    char out[LC_SRV_INBUF]; // Due responses not yet written
+    size_t out_off; // First unwritten byte of out
+    size_t out_len; // Bytes in out
+    int want_out; // 1 if EPOLLOUT is armed
+    struct LcSrvConn *next; // Next live connection
+} LcSrvConn;
+
+//
+// Global Data
+LcDevSim srv_sim; // The emulated devices shared by every client
+LcSrvConn *srv_conns = NULL; // Live client connections
+int srv_epoll = -1; // The epoll instance
+volatile sig_atomic_t srv_stop = 0; // Set by the signal handler
+uint64_t srv_requests = 0; // Requests served
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : srv_now
+// Description  : Current monotonic time in microseconds
+//
+// Inputs       : none
+// Outputs      : the time
+
+static uint64_t srv_now( void ) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return((uint64_t) ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : srv_signal
+// Description  : Ask the event loop to exit cleanly
+//
+// Inputs       : sig - the signal
+// Outputs      : none
+
+static void srv_signal( int sig ) {
+    srv_stop = 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : srv_add
+// Description  : Register a socket with the event loop
+//
+// Inputs       : fd - the (non-blocking) socket
+//                listener - 1 if the socket is listening
+// Outputs      : the connection, NULL if failure
+
+static LcSrvConn * srv_add( int fd, int listener ) {
+    struct epoll_event ev;
+    LcSrvConn *conn;
+
+    if((conn = calloc(1, sizeof(LcSrvConn))) == NULL) return(NULL);
+    conn->fd = fd;
+    conn->listener = listener;
+    ev.events = EPOLLIN;
+    ev.data.ptr = conn;
+    if(epoll_ctl(srv_epoll, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        free(conn);
+        return(NULL);
+    }
+    if(!listener) {
+        conn->next = srv_conns;
+        srv_conns = conn;
+    }
+    return(conn);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : srv_drop
+// Description  : Close a client connection and release its state
+//
+// Inputs       : conn - the connection
+// Outputs      : none
+
+static void srv_drop( LcSrvConn *conn ) {
+    LcSrvConn **pp;
+    LcSrvResp *resp;
+
+    for(pp = &srv_conns; *pp != NULL; pp = &(*pp)->next) {
+        if(*pp == conn) {
+            *pp = conn->next;
+            break;
+        }
+    }
+    while((resp = conn->head) != NULL) {
+        conn->head = resp->next;
+        free(resp);
+    }
+    epoll_ctl(srv_epoll, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    logMessage(LcControllerLLevel, "Client connection %d closed", conn->fd);
+    free(conn);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : srv_listen
+// Description  : Create a non-blocking listening socket
+//
+// Inputs       : port - the TCP port (if path is NULL)
+//                path - the Unix-domain socket path, or NULL for TCP
+// Outputs      : the socket, -1 if failure
+
+static int srv_listen( uint16_t port, const char *path ) {
+    struct sockaddr_in in_addr;
+    struct sockaddr_un un_addr;
+    struct sockaddr *addr;
+    socklen_t addrlen;
+    int fd, one = 1;
+
+    if(path == NULL) {
+        memset(&in_addr, 0, sizeof(in_addr));
+        in_addr.sin_family = AF_INET;
+        in_addr.sin_port = htons(port);
+        in_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr = (struct sockaddr*) &in_addr;
+        addrlen = sizeof(in_addr);
+    } else {
+        if(strlen(path) >= sizeof(un_addr.sun_path)) return(-1);
+        memset(&un_addr, 0, sizeof(un_addr));
+        un_addr.sun_family = AF_UNIX;
+        strcpy(un_addr.sun_path, path);
+        unlink(path);
+        addr = (struct sockaddr*) &un_addr;
+        addrlen = sizeof(un_addr);
+    }
+
+    if((fd = socket(addr->sa_family, SOCK_STREAM | SOCK_NONBLOCK, 0)) == -1) return(-1);
+    if(path == NULL) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if(bind(fd, addr, addrlen) == -1 || listen(fd, LC_SRV_BACKLOG) == -1) {
+        logMessage(LOG_ERROR_LEVEL, "Cannot listen on %s [%s]", (path != NULL) ? path : "TCP port", strerror(errno));
+        close(fd);
+        return(-1);
+    }
+    return(fd);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : srv_accept
+// Description  : Accept every pending connection on a listener
+//
+// Inputs       : lconn - the listening connection
+// Outputs      : none
+
+static void srv_accept( LcSrvConn *lconn ) {
+    int fd, one = 1;
+    while((fd = accept4(lconn->fd, NULL, NULL, SOCK_NONBLOCK)) != -1) {
+        // Harmless on Unix-domain sockets, essential for TCP
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if(srv_add(fd, 0) == NULL) {
+            close(fd);
+            continue;
+        }
+        logMessage(LcControllerLLevel, "Client connection %d accepted", fd);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : srv_parse
+// Description  : Serve every complete request in the input buffer.  The
+//                devices are updated immediately; the response is held on
+//                the connection until the device model says it is done.
+//
+// Inputs       : conn - the connection
+//                now - the current time (usec)
+// Outputs      : 0 if successful, -1 if failure
+
+static int srv_parse( LcSrvConn *conn, uint64_t now ) {
+    int b0, b1, c0, c1, c2, d0, d1;
+    LCloudRegisterFrame inet_reg, reg, resp;
+    size_t off = 0, need;
+    LcSrvResp *pending;
+    char blk[LC_DEVICE_BLOCK_SIZE];
+
+    while(conn->in_len - off >= LCLOUD_NET_HEADER_SIZE) {
+        memcpy(&inet_reg, &conn->in[off], sizeof(inet_reg));
+        reg = ntohll64(inet_reg);
+        extract_lcloud_registers(reg, &b0, &b1, &c0, &c1, &c2, &d0, &d1);
+        need = LCLOUD_NET_HEADER_SIZE;
+        if(c0 == LC_BLOCK_XFER && c2 == LC_XFER_WRITE) need += LC_DEVICE_BLOCK_SIZE;
+        if(conn->in_len - off < need) break;
+
+        // Run the request and queue its response in arrival order
+        if((pending = malloc(sizeof(LcSrvResp))) == NULL) return(-1);
+        if(need > LCLOUD_NET_HEADER_SIZE) memcpy(blk, &conn->in[off + LCLOUD_NET_HEADER_SIZE], LC_DEVICE_BLOCK_SIZE);
+        resp = htonll64(lcloud_devsim_request(&srv_sim, reg, blk));
+        memcpy(pending->bytes, &resp, sizeof(resp));
+        pending->len = LCLOUD_NET_HEADER_SIZE;
+        if(c0 == LC_BLOCK_XFER && c2 == LC_XFER_READ) {
+            memcpy(&pending->bytes[LCLOUD_NET_HEADER_SIZE], blk, LC_DEVICE_BLOCK_SIZE);
+            pending->len += LC_DEVICE_BLOCK_SIZE;
+        }
+        pending->due = lcloud_devsim_due(&srv_sim, reg, now);
+        pending->next = NULL;
+        if(conn->tail != NULL) {
+            conn->tail->next = pending;
+        } else {
+            conn->head = pending;
+        }
+        conn->tail = pending;
+        srv_requests++;
+        off += need;
+    }
+
+    // Keep any partial request for the next read
+    memmove(conn->in, &conn->in[off], conn->in_len - off);
+    conn->in_len -= off;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : srv_flush
+// Description  : Move due responses to the output buffer (stopping at the
+//                first one still in progress, so order is preserved) and
+//                write as much as the socket takes
+//
+// Inputs       : conn - the connection
+//                now - the current time (usec)
+// Outputs      : 0 if successful, -1 if the connection failed
+
+static int srv_flush( LcSrvConn *conn, uint64_t now ) {
+    struct epoll_event ev;
+    LcSrvResp *resp;
+    ssize_t n;
+
+    for(;;) {
+        // Compact and refill the output buffer with due responses
+        if(conn->out_off == conn->out_len) conn->out_off = conn->out_len = 0;
+        while((resp = conn->head) != NULL && resp->due <= now &&
+            conn->out_len + resp->len <= sizeof(conn->out)) {
+            memcpy(&conn->out[conn->out_len], resp->bytes, resp->len);
+            conn->out_len += resp->len;
+            conn->head = resp->next;
+            if(conn->head == NULL) conn->tail = NULL;
+            free(resp);
+        }
+        if(conn->out_off == conn->out_len) break;
+
+        if((n = send(conn->fd, &conn->out[conn->out_off], conn->out_len - conn->out_off, MSG_NOSIGNAL)) == -1) {
+            if(errno == EINTR) continue;
+            if(errno != EAGAIN && errno != EWOULDBLOCK) return(-1);
+            break;
+        }
+        conn->out_off += n;
+        if(conn->out_off > 0 && conn->out_off < conn->out_len) {
+            memmove(conn->out, &conn->out[conn->out_off], conn->out_len - conn->out_off);
+            conn->out_len -= conn->out_off;
+            conn->out_off = 0;
+        }
+    }
+
+    // Only wait for writability while the socket is backed up
+    int want = (conn->out_off < conn->out_len);
+    if(want != conn->want_out) {
+        ev.events = EPOLLIN | (want ? EPOLLOUT : 0);
+        ev.data.ptr = conn;
+        epoll_ctl(srv_epoll, EPOLL_CTL_MOD, conn->fd, &ev);
+        conn->want_out = want;
+    }
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : srv_read
+// Description  : Drain the socket into the input buffer, serving requests
+//
+// Inputs       : conn - the connection
+//                now - the current time (usec)
+// Outputs      : 0 if successful, -1 if the connection closed or failed
+
+static int srv_read( LcSrvConn *conn, uint64_t now ) {
+    ssize_t n;
+    for(;;) {
+        n = recv(conn->fd, &conn->in[conn->in_len], sizeof(conn->in) - conn->in_len, 0);
+        if(n == -1) {
+            if(errno == EINTR) continue;
+            return((errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1);
+        }
+        if(n == 0) return(-1);
+        conn->in_len += n;
+        if(srv_parse(conn, now) == -1) return(-1);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : srv_loop
+// Description  : The event loop: accept clients, serve requests, and release
+//                responses as the device model completes them
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+static int srv_loop( void ) {
+    struct epoll_event events[LC_SRV_MAX_EVENTS];
+    LcSrvConn *conn, *next;
+    uint64_t now, wake;
+    int nev, timeout;
+
+    while(!srv_stop) {
+        // Sleep until the next response is due (or forever if none are waiting)
+        now = srv_now();
+        wake = UINT64_MAX;
+        for(conn = srv_conns; conn != NULL; conn = conn->next) {
+            if(conn->head != NULL && conn->head->due < wake) wake = conn->head->due;
+        }
+        timeout = (wake == UINT64_MAX) ? -1 : (wake <= now) ? 0 : (int) ((wake - now + 999) / 1000);
+
+        if((nev = epoll_wait(srv_epoll, events, LC_SRV_MAX_EVENTS, timeout)) == -1) {
+            if(errno == EINTR) continue;
+            logMessage(LOG_ERROR_LEVEL, "epoll_wait failed [%s]", strerror(errno));
+            return(-1);
+        }
+
+        now = srv_now();
+        for(int i = 0; i < nev; i++) {
+            conn = (LcSrvConn*) events[i].data.ptr;
+            if(conn->listener) {
+                srv_accept(conn);
+            } else if((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && srv_read(conn, now) == -1) {
+                srv_drop(conn);
+            }
+        }
+
+        // Release whatever the devices have finished
+        for(conn = srv_conns; conn != NULL; conn = next) {
+            next = conn->next;
+            if((conn->head != NULL || conn->out_len > 0) && srv_flush(conn, now) == -1) srv_drop(conn);
+        }
+    }
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the LionCloud stand-in server
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] ) {
+    int ch, verbose = 0, log_initialized = 0, port = LCLOUD_DEFAULT_PORT, fd;
+    char *unix_path = NULL, *backing = NULL;
+    uint32_t latency = 0, kbps = 0;
+    struct sigaction sa;
+
+    // Process the command line parameters
+    while((ch = getopt(argc, argv, LC_SRV_ARGUMENTS)) != -1) {
+        switch(ch) {
+        case 'h': // Help, print usage
+            fprintf(stderr, USAGE);
+            return(-1);
+
+        case 'v': // Verbose Flag
+            verbose = 1;
+            break;
+
+        case 'l': // Set the log filename
+            initializeLogWithFilename(optarg);
+            log_initialized = 1;
+            break;
+
+        case 'p': // TCP port
+            port = atoi(optarg);
+            break;
+
+        case 'u': // Unix-domain socket path
+            unix_path = optarg;
+            break;
+
+        case 'm': // Backing image directory
+            backing = optarg;
+            break;
+
+        case 'L': // Default device latency
+            latency = strtoul(optarg, NULL, 10);
+            break;
+
+        case 'B': // Default device bandwidth
+            kbps = strtoul(optarg, NULL, 10);
+            break;
+
+        default: // Default (unknown)
+            fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+            return(-1);
+        }
+    }
+
+    // Setup the log as needed
+    if(!log_initialized) {
+        initializeLogWithFilehandle(CMPSC311_LOG_STDERR);
+    }
+    LcControllerLLevel = registerLogLevel("LCLOUD_CONTROLLER", 0);
+    LcDriverLLevel = registerLogLevel("LCLOUD_DRIVER", 0);
+    LcSimulatorLLevel = registerLogLevel("LCLOUD_SIMULATOR", 0);
+    if(verbose) {
+        enableLogLevels(LOG_INFO_LEVEL);
+        enableLogLevels(LcControllerLLevel);
+    }
+
+    // The manifest should be the next option
+    if(argv[optind] == NULL) {
+        fprintf(stderr, "Missing manifest file, use -h to see usage, aborting.\n");
+        return(-1);
+    }
+
+    // Build the devices
+    if(lcloud_devsim_init(&srv_sim, argv[optind]) == -1) return(-1);
+    if(backing != NULL && lcloud_devsim_set_backing(&srv_sim, backing) == -1) return(-1);
+    lcloud_devsim_set_model(&srv_sim, latency, (uint64_t) kbps * 1024);
+
+    // Open the listeners
+    if((srv_epoll = epoll_create1(0)) == -1) return(-1);
+    if(port > 0) {
+        if((fd = srv_listen(port, NULL)) == -1 || srv_add(fd, 1) == NULL) return(-1);
+        logMessage(LOG_INFO_LEVEL, "LionCloud stand-in listening on port %d", port);
+    }
+    if(unix_path != NULL) {
+        if((fd = srv_listen(0, unix_path)) == -1 || srv_add(fd, 1) == NULL) return(-1);
+        logMessage(LOG_INFO_LEVEL, "LionCloud stand-in listening on %s", unix_path);
+    }
+
+    // Exit the loop cleanly on interrupt so mapped devices are flushed
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = srv_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    srv_loop();
+
+    // Report and clean up
+    for(int i = 0; i < LC_DEVSIM_MAX_DEVICES; i++) {
+        if(srv_sim.present & (1 << i)) {
+            logMessage(LOG_INFO_LEVEL, "Device %d: %lu reads, %lu writes", i,
+                srv_sim.devices[i].reads, srv_sim.devices[i].writes);
+        }
+    }
+    logMessage(LOG_INFO_LEVEL, "LionCloud stand-in served %lu requests", srv_requests);
+    while(srv_conns != NULL) srv_drop(srv_conns);
+    if(unix_path != NULL) unlink(unix_path);
+    lcloud_devsim_close(&srv_sim);
+    freeLogRegistrations();
+    return(0);
+}
@@ -0,0 +1,260 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_trace.c
+//  Description    : This is the implementation of the block I/O trace: the
+//                   recorder the filesystem feeds while a trace is running,
+//                   and the reader the replay and cache analysis tools use.
+//
+//   Author        : Lucas Benning
+//   Last Modified : 5/1/20
+//
+
+// Include files
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cmpsc311_log.h>
+
+// Project include files
+#include <lcloud_trace.h>
+#include <lcloud_fsinternal.h>
+
+// Defines
+#define LC_TRACE_BUFRECS 4096 // Records buffered between writes
+
+// Recorder state
+static FILE *trace_file = NULL; // The trace being written, NULL if not recording
+static LcTraceHeader trace_hdr; // Its header (written again at the end)
+static LcTraceRec trace_buf[LC_TRACE_BUFRECS]; // Records not yet written
+static int trace_buffered; // Entries in trace_buf
+static struct timespec trace_epoch; // Monotonic time the trace started
+static int trace_failed; // 1 if a write failed (recording stops)
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : trace_flush
+// Description  : Write the buffered records
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+static int trace_flush( void ) {
+    if(trace_buffered > 0 && !trace_failed &&
+        fwrite(trace_buf, sizeof(LcTraceRec), trace_buffered, trace_file) != (size_t) trace_buffered) {
+        logMessage(LOG_ERROR_LEVEL, "Failure writing block trace: %s", strerror(errno));
+        trace_failed = 1;
+    }
+    trace_buffered = 0;
+    return(trace_failed ? -1 : 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : trace_record
+// Description  : Append a record to the trace being written
+//
+// Inputs       : kind - LC_TRACE_ACCESS or LC_TRACE_BUS
+//                op - LC_XFER_READ or LC_XFER_WRITE
+//                dev, sec, blk - the block address
+//                hit - 1 if the cache held the block (accesses)
+// Outputs      : none
+
+static void trace_record( int kind, int op, LcDeviceId dev, uint16_t sec, uint16_t blk, int hit ) {
+    struct timespec now;
+    LcTraceRec *r;
+
+    if(trace_file == NULL || trace_failed) return;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    r = &trace_buf[trace_buffered++];
+    r->time = (now.tv_sec - trace_epoch.tv_sec) * 1000000000ULL + (now.tv_nsec - trace_epoch.tv_nsec);
+    r->kind = kind;
+    r->op = op;
+    r->dev = dev;
+    r->hit = hit;
+    r->sec = sec;
+    r->blk = blk;
+    trace_hdr.num_recs++;
+    if(trace_buffered == LC_TRACE_BUFRECS) {
+        trace_flush();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : trace_access
+// Description  : Block observer installed while recording
+//
+// Inputs       : op - LC_XFER_READ or LC_XFER_WRITE
+//                dev, sec, blk - the block address
+//                hit - 1 if the cache held the block
+// Outputs      : none
+
+static void trace_access( int op, LcDeviceId dev, uint16_t sec, uint16_t blk, int hit ) {
+    trace_record(LC_TRACE_ACCESS, op, dev, sec, blk, hit);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_trace_start
+// Description  : Start recording the filesystem's block accesses and bus
+//                transfers to a trace file
+//
+// Inputs       : path - the trace file
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_trace_start( const char *path ) {
+    struct timespec wall;
+
+    if(trace_file != NULL) return(-1);
+    if((trace_file = fopen(path, "w")) == NULL) {
+        logMessage(LOG_ERROR_LEVEL, "Failure creating block trace [%s]: %s", path, strerror(errno));
+        return(-1);
+    }
+
+    clock_gettime(CLOCK_REALTIME, &wall);
+    clock_gettime(CLOCK_MONOTONIC, &trace_epoch);
+    memset(&trace_hdr, 0, sizeof(trace_hdr));
+    memcpy(trace_hdr.magic, LC_TRACE_MAGIC, sizeof(trace_hdr.magic));
+    trace_hdr.version = LC_TRACE_VERSION;
+    trace_hdr.start = wall.tv_sec * 1000000000ULL + wall.tv_nsec;
+    trace_buffered = 0;
+    trace_failed = 0;
+
+    // The header is written again with the record count at the end
+    if(fwrite(&trace_hdr, sizeof(trace_hdr), 1, trace_file) != 1) {
+        logMessage(LOG_ERROR_LEVEL, "Failure writing block trace [%s]: %s", path, strerror(errno));
+        fclose(trace_file);
+        trace_file = NULL;
+        return(-1);
+    }
+    lcctx_default()->block_observer = trace_access;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_trace_bus
+// Description  : Record a block transfer, if a trace is being recorded
+//
+// Inputs       : op - LC_XFER_READ or LC_XFER_WRITE
+//                dev, sec, blk - the block address
+// Outputs      : none
+
+void lcloud_trace_bus( int op, LcDeviceId dev, uint16_t sec, uint16_t blk ) {
+    trace_record(LC_TRACE_BUS, op, dev, sec, blk, 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_trace_stop
+// Description  : Stop recording: write the remaining records and the final
+//                header, close the file
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_trace_stop( void ) {
+    int ret;
+
+    if(trace_file == NULL) return(-1);
+    if(lcctx_default()->block_observer == trace_access) {
+        lcctx_default()->block_observer = NULL;
+    }
+    ret = trace_flush();
+    if(ret == 0 && (fseek(trace_file, 0, SEEK_SET) == -1 ||
+        fwrite(&trace_hdr, sizeof(trace_hdr), 1, trace_file) != 1)) {
+        logMessage(LOG_ERROR_LEVEL, "Failure completing block trace: %s", strerror(errno));
+        ret = -1;
+    }
+    if(fclose(trace_file) != 0) ret = -1;
+    trace_file = NULL;
+    logMessage(LOG_INFO_LEVEL, "Block trace complete, %lu records", trace_hdr.num_recs);
+    return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_trace_open
+// Description  : Map a trace for reading.  A trace whose recorder did not
+//                finish (header count 0) is read up to its last whole record.
+//
+// Inputs       : tr - the trace
+//                path - the trace file
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_trace_open( LcTrace *tr, const char *path ) {
+    struct stat st;
+    uint64_t avail;
+    int fd;
+
+    memset(tr, 0, sizeof(LcTrace));
+    if((fd = open(path, O_RDONLY)) == -1) {
+        logMessage(LOG_ERROR_LEVEL, "Failure opening block trace [%s]: %s", path, strerror(errno));
+        return(-1);
+    }
+    if(fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(LcTraceHeader) ||
+        (tr->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        logMessage(LOG_ERROR_LEVEL, "Failure mapping block trace [%s]", path);
+        tr->map = NULL;
+        close(fd);
+        return(-1);
+    }
+    close(fd);
+    tr->map_len = st.st_size;
+    madvise(tr->map, tr->map_len, MADV_SEQUENTIAL);
+
+    tr->hdr = (const LcTraceHeader *) tr->map;
+    tr->recs = (const LcTraceRec *) (tr->map + sizeof(LcTraceHeader));
+    avail = (tr->map_len - sizeof(LcTraceHeader)) / sizeof(LcTraceRec);
+    if(memcmp(tr->hdr->magic, LC_TRACE_MAGIC, sizeof(tr->hdr->magic)) != 0 ||
+        tr->hdr->version != LC_TRACE_VERSION || tr->hdr->num_recs > avail) {
+        logMessage(LOG_ERROR_LEVEL, "Corrupt block trace [%s]", path);
+        lcloud_trace_close(tr);
+        return(-1);
+    }
+    tr->num_recs = (tr->hdr->num_recs == 0) ? avail : tr->hdr->num_recs;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_trace_close
+// Description  : Unmap a trace
+//
+// Inputs       : tr - the trace
+// Outputs      : 0 if successful
+
+int lcloud_trace_close( LcTrace *tr ) {
+    if(tr->map != NULL) {
+        munmap(tr->map, tr->map_len);
+    }
+    memset(tr, 0, sizeof(LcTrace));
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_trace_detect
+// Description  : Check whether a file is a block trace
+//
+// Inputs       : path - the file
+// Outputs      : 1 if it is a trace, 0 if not, -1 if it cannot be read
+
+int lcloud_trace_detect( const char *path ) {
+    char magic[4];
+    int fd, ret;
+
+    if((fd = open(path, O_RDONLY)) == -1) return(-1);
+    ret = (read(fd, magic, sizeof(magic)) == sizeof(magic) && memcmp(magic, LC_TRACE_MAGIC, sizeof(magic)) == 0);
+    close(fd);
+    return(ret);
+}
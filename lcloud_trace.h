@@ -0,0 +1,76 @@
+#ifndef LCLOUD_TRACE_INCLUDED
+#define LCLOUD_TRACE_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_trace.h
+//  Description    : This is the interface of the block I/O trace.  A trace
+//                   is a header followed by fixed-size records, one per
+//                   cache lookup the filesystem makes (with hit or miss) and
+//                   one per block transfer it puts on the bus, so the bus
+//                   stream can be replayed exactly and the lookups can be
+//                   fed to cache analysis.
+//
+//   Author        : Lucas Benning
+//   Last Modified : 5/1/20
+//
+
+// Includes
+#include <stddef.h>
+#include <stdint.h>
+#include <lcloud_controller.h>
+
+// Defines
+#define LC_TRACE_MAGIC "LCBT" // First four bytes of a trace
+#define LC_TRACE_VERSION 1
+#define LC_TRACE_ACCESS 0 // Record kind: the filesystem looked the block up
+#define LC_TRACE_BUS 1 // Record kind: the block went over the bus
+
+// Type definitions
+typedef struct {
+    char magic[4]; // LC_TRACE_MAGIC
+    uint32_t version; // LC_TRACE_VERSION
+    uint64_t num_recs; // Records that follow
+    uint64_t start; // Wall clock time the trace started (nsec since the epoch)
+} LcTraceHeader;
+
+typedef struct {
+    uint64_t time; // Nanoseconds since the trace started
+    uint8_t kind; // LC_TRACE_ACCESS or LC_TRACE_BUS
+    uint8_t op; // LC_XFER_READ or LC_XFER_WRITE
+    uint8_t dev; // The block address
+    uint8_t hit; // Accesses: 1 if the cache held the block
+    uint16_t sec;
+    uint16_t blk;
+} LcTraceRec;
+
+typedef struct {
+    char *map; // The mapped file
+    size_t map_len; // Length of the mapping
+    const LcTraceHeader *hdr; // The header (start of the mapping)
+    const LcTraceRec *recs; // The records
+    uint64_t num_recs; // Entries in recs
+} LcTrace;
+
+//
+// Functional Prototypes
+
+int lcloud_trace_start( const char *path );
+    // Start recording the filesystem's block accesses and bus transfers
+
+void lcloud_trace_bus( int op, LcDeviceId dev, uint16_t sec, uint16_t blk );
+    // Record a block transfer (no-op unless recording)
+
+int lcloud_trace_stop( void );
+    // Stop recording, complete the trace file
+
+int lcloud_trace_open( LcTrace *tr, const char *path );
+    // Map a trace for reading
+
+int lcloud_trace_close( LcTrace *tr );
+    // Unmap a trace
+
+int lcloud_trace_detect( const char *path );
+    // 1 if the file is a trace, 0 if not, -1 if it cannot be read
+
+#endif
@@ -0,0 +1,412 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_transport.c
+//  Description    : This is the implementation of the LionCloud client
+//                   transports: TCP and Unix-domain sockets, and an
+//                   in-process backend that passes frames through a pair of
+//                   lock-free SPSC rings in shared memory to a co-located
+//                   device emulation thread.
+//
+//   Author        : Lucas Benning
+//   Last Modified : 4/22/20
+//
+
+// Include Files
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+// Project Include Files
+#include <lcloud_transport.h>
+#include <lcloud_registers.h>
+#include <lcloud_devsim.h>
+#include <lcloud_ring.h>
+#include <lcloud_support.h>
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+
+// Type definitions
+typedef struct {
+    void *mem; // The shared mapping holding both rings
+    size_t len; // Length of the mapping
+    LcRing *req; // Client -> server ring
+    LcRing *resp; // Server -> client ring
+    LcDevSim sim; // The co-located devices
+    pthread_t thread; // The server thread
+} LcShmTransport;
+
+//
+// Socket backends
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sock_send
+// Description  : Gather-writes the io vectors to the socket, looping on short
+//                writes and retrying when interrupted by a signal
+//
+// Inputs       : t - the transport
+//                iov - the io vectors to write (modified as they are consumed)
+//                iovcnt - the number of io vectors
+// Outputs      : 0 if successful, -1 if failure
+
+static int sock_send( LcTransport *t, struct iovec *iov, int iovcnt ) {
+    ssize_t n;
+    while(iovcnt > 0) {
+        if((n = writev(t->fd, iov, iovcnt)) == -1) {
+            if(errno == EINTR) continue;
+            logMessage(LOG_ERROR_LEVEL, "Error writing to LionCloud server [%s]", strerror(errno));
+            return(-1);
+        }
+        // Skip past the vectors (or part of a vector) that were written
+        while(iovcnt > 0 && (size_t) n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if(iovcnt > 0) {
+            iov->iov_base = (char*) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sock_recv
+// Description  : Fills the io vectors exactly from the connection through the
+//                receive buffer.  A single recv may pull in several responses,
+//                the remainder stays buffered for the next call.
+//
+// Inputs       : t - the transport
+//                iov - where to place the bytes
+//                iovcnt - the number of io vectors
+// Outputs      : 0 if successful, -1 if failure (or connection closed)
+
+static int sock_recv( LcTransport *t, struct iovec *iov, int iovcnt ) {
+    ssize_t n;
+    for(int i = 0; i < iovcnt; i++) {
+        char *out = (char*) iov[i].iov_base;
+        size_t len = iov[i].iov_len;
+        while(len > 0) {
+            // Serve whatever is already buffered
+            if(t->rx_head < t->rx_tail) {
+                size_t avail = t->rx_tail - t->rx_head;
+                size_t take = (avail < len) ? avail : len;
+                memcpy(out, &t->rx_buf[t->rx_head], take);
+                t->rx_head += take;
+                out += take;
+                len -= take;
+                continue;
+            }
+
+            // Buffer is drained, refill it from the start
+            t->rx_head = t->rx_tail = 0;
+            if((n = recv(t->fd, t->rx_buf, LCLOUD_RXBUF_SIZE, 0)) == -1) {
+                if(errno == EINTR) continue;
+                logMessage(LOG_ERROR_LEVEL, "Error reading from LionCloud server [%s]", strerror(errno));
+                return(-1);
+            }
+            if(n == 0) {
+                logMessage(LOG_ERROR_LEVEL, "LionCloud server closed the connection");
+                return(-1);
+            }
+            t->rx_tail = n;
+        }
+    }
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sock_close
+// Description  : Close a socket transport
+//
+// Inputs       : t - the transport
+// Outputs      : 0 if successful, -1 if failure
+
+static int sock_close( LcTransport *t ) {
+    int ret = close(t->fd);
+    t->fd = -1;
+    t->rx_head = t->rx_tail = 0;
+    return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sock_set_bufsizes
+// Description  : Leave room in the kernel for a full batch of pipelined requests
+//
+// Inputs       : sock - the socket
+// Outputs      : 0 if successful, -1 if failure
+
+static int sock_set_bufsizes( int sock ) {
+    int bufsz = LCLOUD_SOCKBUF_SIZE;
+    if(setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &bufsz, sizeof(bufsz)) == -1) return(-1);
+    if(setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &bufsz, sizeof(bufsz)) == -1) return(-1);
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tcp_open
+// Description  : Connect to the LionCloud server over TCP
+//
+// Inputs       : t - the transport
+// Outputs      : 0 if successful, -1 if failure
+
+static int tcp_open( LcTransport *t ) {
+    struct sockaddr_in addr;
+    int one = 1;
+
+    // Specify connection type and port, convert address string to binary address
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(t->port);
+    if(inet_aton(t->address, &(addr.sin_addr)) == 0) return(-1);
+
+    // Create socket with address data
+    if((t->fd = socket(AF_INET, SOCK_STREAM, 0)) == -1) return(-1);
+
+    // Frames are tiny and every request waits for a response, so Nagle would
+    // only hold our writes back until the server's delayed ACK fires
+    if(setsockopt(t->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) == -1 ||
+        sock_set_bufsizes(t->fd) == -1) {
+        logMessage(LOG_ERROR_LEVEL, "Error setting socket options [%s]", strerror(errno));
+        sock_close(t);
+        return(-1);
+    }
+
+    // Connect to server
+    if(connect(t->fd, (const struct sockaddr*) &addr, sizeof(addr)) == -1) {
+        logMessage(LOG_ERROR_LEVEL, "Error connecting to %s:%d [%s]", t->address, t->port, strerror(errno));
+        sock_close(t);
+        return(-1);
+    }
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : unix_open
+// Description  : Connect to the LionCloud server over a Unix-domain socket
+//
+// Inputs       : t - the transport
+// Outputs      : 0 if successful, -1 if failure
+
+static int unix_open( LcTransport *t ) {
+    struct sockaddr_un addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(t->address) >= sizeof(addr.sun_path)) {
+        logMessage(LOG_ERROR_LEVEL, "Unix socket path too long [%s]", t->address);
+        return(-1);
+    }
+    strcpy(addr.sun_path, t->address);
+
+    if((t->fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) return(-1);
+    if(sock_set_bufsizes(t->fd) == -1 ||
+        connect(t->fd, (const struct sockaddr*) &addr, sizeof(addr)) == -1) {
+        logMessage(LOG_ERROR_LEVEL, "Error connecting to %s [%s]", t->address, strerror(errno));
+        sock_close(t);
+        return(-1);
+    }
+    return(0);
+}
+
+//
+// In-process shared memory backend
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shm_server
+// Description  : The co-located server thread.  Reads request frames (and
+//                write payloads) from the request ring, runs them against the
+//                device emulation and writes the responses back.
+//
+// Inputs       : arg - the shared memory transport state
+// Outputs      : NULL
+
+static void * shm_server( void *arg ) {
+    LcShmTransport *shm = (LcShmTransport*) arg;
+    int b0, b1, c0, c1, c2, d0, d1;
+    LCloudRegisterFrame inet_reg, reg, resp;
+    char blk[LC_DEVICE_BLOCK_SIZE];
+
+    while(lcloud_ring_read(shm->req, &inet_reg, sizeof(inet_reg)) == 0) {
+        reg = ntohll64(inet_reg);
+        extract_lcloud_registers(reg, &b0, &b1, &c0, &c1, &c2, &d0, &d1);
+        if(c0 == LC_BLOCK_XFER && c2 == LC_XFER_WRITE &&
+            lcloud_ring_read(shm->req, blk, LC_DEVICE_BLOCK_SIZE) == -1) {
+            break;
+        }
+
+        resp = htonll64(lcloud_devsim_request(&shm->sim, reg, blk));
+        if(lcloud_ring_write(shm->resp, &resp, sizeof(resp)) == -1) break;
+        if(c0 == LC_BLOCK_XFER && c2 == LC_XFER_READ &&
+            lcloud_ring_write(shm->resp, blk, LC_DEVICE_BLOCK_SIZE) == -1) {
+            break;
+        }
+    }
+    return(NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shm_open_transport
+// Description  : Map the rings, build the devices and start the server thread
+//
+// Inputs       : t - the transport (address is the hardware manifest)
+// Outputs      : 0 if successful, -1 if failure
+
+static int shm_open_transport( LcTransport *t ) {
+    LcShmTransport *shm;
+    size_t ringsz = lcloud_ring_footprint(LC_SHM_RING_SIZE);
+
+    if((shm = calloc(1, sizeof(LcShmTransport))) == NULL) return(-1);
+    if(lcloud_devsim_init(&shm->sim, t->address) == -1) {
+        free(shm);
+        return(-1);
+    }
+
+    // One shared mapping holds both rings, so a forked server could use it too
+    shm->len = 2 * ringsz;
+    shm->mem = mmap(NULL, shm->len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(shm->mem == MAP_FAILED) {
+        lcloud_devsim_close(&shm->sim);
+        free(shm);
+        return(-1);
+    }
+    shm->req = lcloud_ring_init(shm->mem, LC_SHM_RING_SIZE);
+    shm->resp = lcloud_ring_init((char*) shm->mem + ringsz, LC_SHM_RING_SIZE);
+
+    if(pthread_create(&shm->thread, NULL, shm_server, shm) != 0) {
+        munmap(shm->mem, shm->len);
+        lcloud_devsim_close(&shm->sim);
+        free(shm);
+        return(-1);
+    }
+    t->priv = shm;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shm_send
+// Description  : Write the io vectors into the request ring
+//
+// Inputs       : t - the transport
+//                iov - the io vectors to write
+//                iovcnt - the number of io vectors
+// Outputs      : 0 if successful, -1 if failure
+
+static int shm_send( LcTransport *t, struct iovec *iov, int iovcnt ) {
+    LcShmTransport *shm = (LcShmTransport*) t->priv;
+    for(int i = 0; i < iovcnt; i++) {
+        if(lcloud_ring_write(shm->req, iov[i].iov_base, iov[i].iov_len) == -1) return(-1);
+    }
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shm_recv
+// Description  : Fill the io vectors exactly from the response ring
+//
+// Inputs       : t - the transport
+//                iov - where to place the bytes
+//                iovcnt - the number of io vectors
+// Outputs      : 0 if successful, -1 if failure
+
+static int shm_recv( LcTransport *t, struct iovec *iov, int iovcnt ) {
+    LcShmTransport *shm = (LcShmTransport*) t->priv;
+    for(int i = 0; i < iovcnt; i++) {
+        if(lcloud_ring_read(shm->resp, iov[i].iov_base, iov[i].iov_len) == -1) return(-1);
+    }
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shm_close
+// Description  : Stop the server thread and release the rings and devices
+//
+// Inputs       : t - the transport
+// Outputs      : 0 if successful
+
+static int shm_close( LcTransport *t ) {
+    LcShmTransport *shm = (LcShmTransport*) t->priv;
+    if(shm == NULL) return(0);
+
+    lcloud_ring_close(shm->req);
+    lcloud_ring_close(shm->resp);
+    pthread_join(shm->thread, NULL);
+    munmap(shm->mem, shm->len);
+    lcloud_devsim_close(&shm->sim);
+    free(shm);
+    t->priv = NULL;
+    return(0);
+}
+
+//
+// Static Data
+
+const LcTransportOps lcloud_tcp_transport = { "tcp", tcp_open, sock_send, sock_recv, sock_close };
+const LcTransportOps lcloud_unix_transport = { "unix", unix_open, sock_send, sock_recv, sock_close };
+const LcTransportOps lcloud_shm_transport = { "shm", shm_open_transport, shm_send, shm_recv, shm_close };
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_transport_parse
+// Description  : Set up a (closed) transport from a specification string:
+//
+//                  tcp[:<ip>[:<port>]]  - TCP to the LionCloud server
+//                  uring[:<ip>[:<port>]] - TCP submitted in batches via io_uring
+//                  unix[:<path>]        - Unix-domain socket to the server
+//                  shm:<manifest>       - in-process devices built from manifest
+//
+// Inputs       : t - the transport to set up
+//                spec - the specification (NULL for the default TCP server)
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_transport_parse( LcTransport *t, const char *spec ) {
+    const char *arg;
+    char *colon;
+
+    memset(t, 0, sizeof(LcTransport));
+    t->fd = -1;
+    if(spec == NULL) spec = "tcp";
+    arg = strchr(spec, ':');
+
+    if((strncmp(spec, "tcp", 3) == 0 && (spec[3] == '\0' || spec[3] == ':')) ||
+        (strncmp(spec, "uring", 5) == 0 && (spec[5] == '\0' || spec[5] == ':'))) {
+        t->ops = (spec[0] == 'u') ? &lcloud_uring_transport : &lcloud_tcp_transport;
+        strncpy(t->address, (arg != NULL) ? arg + 1 : LCLOUD_DEFAULT_IP, LC_TRANSPORT_ADDRLEN - 1);
+        t->port = LCLOUD_DEFAULT_PORT;
+        if((colon = strchr(t->address, ':')) != NULL) {
+            *colon = '\0';
+            t->port = atoi(colon + 1);
+        }
+    } else if(strncmp(spec, "unix", 4) == 0 && (spec[4] == '\0' || spec[4] == ':')) {
+        t->ops = &lcloud_unix_transport;
+        strncpy(t->address, (arg != NULL) ? arg + 1 : LCLOUD_DEFAULT_UNIX_PATH, LC_TRANSPORT_ADDRLEN - 1);
+    } else if(strncmp(spec, "shm:", 4) == 0 && spec[4] != '\0') {
+        t->ops = &lcloud_shm_transport;
+        strncpy(t->address, arg + 1, LC_TRANSPORT_ADDRLEN - 1);
+    } else {
+        logMessage(LOG_ERROR_LEVEL, "Unknown LionCloud transport [%s]", spec);
+        return(-1);
+    }
+    return(0);
+}
@@ -0,0 +1,64 @@
+#ifndef LCLOUD_TRANSPORT_INCLUDED
+#define LCLOUD_TRANSPORT_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_transport.h
+//  Description    : This is the interface of the pluggable transports that
+//                   carry LionCloud register frames and payloads between the
+//                   client and a server.  Each backend moves an exact byte
+//                   stream; the framing and encryption stay in the client.
+//
+//   Author        : Lucas Benning
+//   Last Modified : 4/22/20
+//
+
+// Includes
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <lcloud_network.h>
+
+// Defines
+#define LC_TRANSPORT_ADDRLEN 256 // Longest host name, socket path or manifest
+#define LCLOUD_DEFAULT_UNIX_PATH "/tmp/lcloud.sock"
+#define LC_SHM_RING_SIZE 65536 // Bytes in each direction of the in-process ring
+
+// Type definitions
+typedef struct LcTransport LcTransport;
+
+typedef struct {
+    const char *name; // Name used in transport specifications
+    int (*open)( LcTransport *t ); // Connect to the server
+    int (*send)( LcTransport *t, struct iovec *iov, int iovcnt ); // Gather-write all bytes
+    int (*recv)( LcTransport *t, struct iovec *iov, int iovcnt ); // Scatter-read exact bytes
+    int (*close)( LcTransport *t ); // Disconnect from the server
+} LcTransportOps;
+
+struct LcTransport {
+    const LcTransportOps *ops; // The backend implementation
+    char address[LC_TRANSPORT_ADDRLEN]; // Host, socket path or manifest (backend specific)
+    uint16_t port; // TCP port
+    int fd; // Socket descriptor (socket backends), -1 if closed
+    char rx_buf[LCLOUD_RXBUF_SIZE]; // Receive buffer (socket backends)
+    size_t rx_head; // First unconsumed byte in rx_buf
+    size_t rx_tail; // End of received bytes in rx_buf
+    void *priv; // Backend private state
+};
+
+//
+// Static Data
+
+extern const LcTransportOps lcloud_tcp_transport; // AF_INET stream socket
+extern const LcTransportOps lcloud_unix_transport; // AF_UNIX stream socket
+extern const LcTransportOps lcloud_shm_transport; // SPSC ring to an in-process device emulation
+extern const LcTransportOps lcloud_uring_transport; // TCP driven through io_uring (lcloud_uring.c)
+
+//
+// Functional Prototypes
+
+int lcloud_transport_parse( LcTransport *t, const char *spec );
+    // Set up a transport from "tcp[:host[:port]]", "uring[:host[:port]]",
+    //  "unix[:path]" or "shm:<manifest>"
+
+#endif
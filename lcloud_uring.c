@@ -0,0 +1,390 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_uring.c
+//  Description    : This is the io_uring transport for the LionCloud client.
+//                   It talks TCP like the default transport, but sends are
+//                   staged into a registered (fixed) buffer and only handed
+//                   to the kernel together with the matching receives, so a
+//                   whole batch of block requests costs one io_uring_enter:
+//
+//                     - one linked WRITE_FIXED SQE per request (frame+payload)
+//                     - one linked READ_FIXED SQE per response (frame+payload)
+//                     - all completions reaped in bulk from the CQ ring
+//
+//                   The raw system calls are used so no liburing is needed.
+//
+//   Author        : Lucas Benning
+//   Last Modified : 4/24/20
+//
+
+// Include Files
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+// Project Include Files
+#include <lcloud_transport.h>
+#include <lcloud_support.h>
+#include <cmpsc311_log.h>
+
+// Defines
+#define LC_URING_SLOT_SIZE (LCLOUD_NET_HEADER_SIZE + LC_DEVICE_BLOCK_SIZE) // One frame and payload
+#define LC_URING_SLOTS LCLOUD_MAX_BATCH // Requests staged per direction
+#define LC_URING_ENTRIES (2 * LC_URING_SLOTS) // Submission queue depth
+#define LC_URING_TXBUF 0 // Registered buffer index of the send slots
+#define LC_URING_RXBUF 1 // Registered buffer index of the receive slots
+
+// Type definitions
+typedef struct {
+    size_t len; // Bytes in this slot
+    size_t done; // Bytes the kernel has transferred so far
+} LcUringSlot;
+
+typedef struct {
+    int fd; // The ring descriptor
+    int sock; // The connected socket the transfers go to
+
+    // Submission queue (mapped from the kernel)
+    void *sq_map;
+    size_t sq_map_len;
+    _Atomic unsigned *sq_head;
+    _Atomic unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+
+    // Completion queue (mapped from the kernel)
+    void *cq_map;
+    size_t cq_map_len;
+    _Atomic unsigned *cq_head;
+    _Atomic unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    // Registered buffers, one slot per outstanding request
+    char *txbuf;
+    char *rxbuf;
+    LcUringSlot tx[LC_URING_SLOTS];
+    LcUringSlot rx[LC_URING_SLOTS];
+    int ntx; // Staged send slots
+    int nrx; // Posted receive slots
+} LcUring;
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : uring_get_sqe
+// Description  : Claim the next submission queue entry
+//
+// Inputs       : ur - the ring
+// Outputs      : the (zeroed) entry
+
+static struct io_uring_sqe * uring_get_sqe( LcUring *ur ) {
+    unsigned tail = atomic_load_explicit(ur->sq_tail, memory_order_relaxed);
+    unsigned idx = tail & *ur->sq_mask;
+    struct io_uring_sqe *sqe = &ur->sqes[idx];
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ur->sq_array[idx] = idx;
+    atomic_store_explicit(ur->sq_tail, tail + 1, memory_order_release);
+    return(sqe);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : uring_prep_chain
+// Description  : Queue one linked chain of fixed-buffer transfers for the
+//                unfinished part of every slot, in slot order
+//
+// Inputs       : ur - the ring
+//                opcode - IORING_OP_WRITE_FIXED or IORING_OP_READ_FIXED
+//                slots, nslots - the slots to transfer
+//                buf, bufidx - the registered buffer holding the slots
+//                tag - high bits of user_data identifying the direction
+// Outputs      : number of entries queued
+
+static int uring_prep_chain( LcUring *ur, int opcode, LcUringSlot *slots, int nslots,
+        char *buf, int bufidx, uint64_t tag ) {
+    struct io_uring_sqe *sqe = NULL;
+    int queued = 0;
+
+    for(int i = 0; i < nslots; i++) {
+        if(slots[i].done == slots[i].len) continue;
+        sqe = uring_get_sqe(ur);
+        sqe->opcode = opcode;
+        sqe->fd = ur->sock;
+        sqe->addr = (uint64_t) (uintptr_t) (buf + i * LC_URING_SLOT_SIZE + slots[i].done);
+        sqe->len = slots[i].len - slots[i].done;
+        sqe->buf_index = bufidx;
+        sqe->flags = IOSQE_IO_LINK; // Stream order must be preserved
+        sqe->user_data = tag | i;
+        queued++;
+    }
+    // The last entry ends the chain
+    if(sqe != NULL) sqe->flags &= ~IOSQE_IO_LINK;
+    return(queued);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : uring_run
+// Description  : Submit all staged sends and posted receives in a single
+//                io_uring_enter, reap the completions in bulk and resubmit
+//                whatever was left short until every slot is complete
+//
+// Inputs       : t - the transport
+// Outputs      : 0 if successful, -1 if failure
+
+static int uring_run( LcTransport *t ) {
+    LcUring *ur = (LcUring*) t->priv;
+    unsigned head, tail;
+    int queued, ret;
+
+    for(;;) {
+        // Queue the remaining part of every slot (writes and reads are
+        // separate chains so the reads can wait while writes drain)
+        queued = uring_prep_chain(ur, IORING_OP_WRITE_FIXED, ur->tx, ur->ntx, ur->txbuf, LC_URING_TXBUF, 0);
+        queued += uring_prep_chain(ur, IORING_OP_READ_FIXED, ur->rx, ur->nrx, ur->rxbuf, LC_URING_RXBUF, 1ULL << 32);
+        if(queued == 0) break;
+
+        // Submit everything and wait for every completion in one call
+        do {
+            ret = syscall(__NR_io_uring_enter, ur->fd, queued, queued, IORING_ENTER_GETEVENTS, NULL, 0);
+        } while(ret == -1 && errno == EINTR);
+        if(ret == -1) {
+            logMessage(LOG_ERROR_LEVEL, "io_uring_enter failed [%s]", strerror(errno));
+            return(-1);
+        }
+
+        // Reap the completions in bulk
+        head = atomic_load_explicit(ur->cq_head, memory_order_relaxed);
+        tail = atomic_load_explicit(ur->cq_tail, memory_order_acquire);
+        while(head != tail) {
+            struct io_uring_cqe *cqe = &ur->cqes[head & *ur->cq_mask];
+            LcUringSlot *slot = (cqe->user_data >> 32) ? &ur->rx[cqe->user_data & 0xffffffff] :
+                &ur->tx[cqe->user_data & 0xffffffff];
+            if(cqe->res > 0) {
+                slot->done += cqe->res;
+            } else if(cqe->res == 0 && (cqe->user_data >> 32)) {
+                logMessage(LOG_ERROR_LEVEL, "LionCloud server closed the connection");
+                atomic_store_explicit(ur->cq_head, tail, memory_order_release);
+                return(-1);
+            } else if(cqe->res < 0 && cqe->res != -ECANCELED && cqe->res != -EINTR && cqe->res != -EAGAIN) {
+                // Short transfers break the chain and cancel the rest, which
+                // is retried above; anything else is a real error
+                logMessage(LOG_ERROR_LEVEL, "io_uring transfer failed [%s]", strerror(-cqe->res));
+                atomic_store_explicit(ur->cq_head, tail, memory_order_release);
+                return(-1);
+            }
+            head++;
+        }
+        atomic_store_explicit(ur->cq_head, head, memory_order_release);
+    }
+
+    ur->ntx = 0;
+    ur->nrx = 0;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : uring_open
+// Description  : Connect over TCP, then set up the ring and register the
+//                send and receive slot buffers
+//
+// Inputs       : t - the transport
+// Outputs      : 0 if successful, -1 if failure
+
+static int uring_open( LcTransport *t ) {
+    struct io_uring_params params;
+    struct iovec bufs[2];
+    LcUring *ur;
+
+    if(lcloud_tcp_transport.open(t) == -1) return(-1);
+    if((ur = calloc(1, sizeof(LcUring))) == NULL) goto fail;
+    ur->fd = -1;
+    ur->sock = t->fd;
+    t->priv = ur;
+
+    memset(&params, 0, sizeof(params));
+    if((ur->fd = syscall(__NR_io_uring_setup, LC_URING_ENTRIES, &params)) == -1) {
+        logMessage(LOG_ERROR_LEVEL, "io_uring_setup failed [%s]", strerror(errno));
+        goto fail;
+    }
+
+    // Map the submission and completion rings and the entry array
+    ur->sq_map_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ur->cq_map_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        if(ur->cq_map_len > ur->sq_map_len) ur->sq_map_len = ur->cq_map_len;
+        ur->cq_map_len = ur->sq_map_len;
+    }
+    ur->sq_map = mmap(NULL, ur->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        ur->fd, IORING_OFF_SQ_RING);
+    if(ur->sq_map == MAP_FAILED) goto fail;
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        ur->cq_map = ur->sq_map;
+    } else {
+        ur->cq_map = mmap(NULL, ur->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            ur->fd, IORING_OFF_CQ_RING);
+        if(ur->cq_map == MAP_FAILED) goto fail;
+    }
+    ur->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    ur->sqes = mmap(NULL, ur->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        ur->fd, IORING_OFF_SQES);
+    if(ur->sqes == MAP_FAILED) goto fail;
+
+    ur->sq_head = (_Atomic unsigned*) ((char*) ur->sq_map + params.sq_off.head);
+    ur->sq_tail = (_Atomic unsigned*) ((char*) ur->sq_map + params.sq_off.tail);
+    ur->sq_mask = (unsigned*) ((char*) ur->sq_map + params.sq_off.ring_mask);
+    ur->sq_array = (unsigned*) ((char*) ur->sq_map + params.sq_off.array);
+    ur->cq_head = (_Atomic unsigned*) ((char*) ur->cq_map + params.cq_off.head);
+    ur->cq_tail = (_Atomic unsigned*) ((char*) ur->cq_map + params.cq_off.tail);
+    ur->cq_mask = (unsigned*) ((char*) ur->cq_map + params.cq_off.ring_mask);
+    ur->cqes = (struct io_uring_cqe*) ((char*) ur->cq_map + params.cq_off.cqes);
+
+    // Register the slot buffers so the kernel pins them once, not per transfer
+    ur->txbuf = aligned_alloc(4096, LC_URING_SLOTS * LC_URING_SLOT_SIZE + 4096);
+    ur->rxbuf = aligned_alloc(4096, LC_URING_SLOTS * LC_URING_SLOT_SIZE + 4096);
+    if(ur->txbuf == NULL || ur->rxbuf == NULL) goto fail;
+    bufs[LC_URING_TXBUF].iov_base = ur->txbuf;
+    bufs[LC_URING_TXBUF].iov_len = LC_URING_SLOTS * LC_URING_SLOT_SIZE;
+    bufs[LC_URING_RXBUF].iov_base = ur->rxbuf;
+    bufs[LC_URING_RXBUF].iov_len = LC_URING_SLOTS * LC_URING_SLOT_SIZE;
+    if(syscall(__NR_io_uring_register, ur->fd, IORING_REGISTER_BUFFERS, bufs, 2) == -1) {
+        logMessage(LOG_ERROR_LEVEL, "io_uring buffer registration failed [%s]", strerror(errno));
+        goto fail;
+    }
+    return(0);
+
+fail:
+    t->ops->close(t);
+    return(-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : uring_stage
+// Description  : Copy io vectors into slots, starting a new slot at every
+//                register frame so each request gets its own entry
+//
+// Inputs       : slots, nslots - the slot array and number in use (updated)
+//                buf - the slot buffer
+//                iov, iovcnt - the bytes to stage
+//                copy_in - 1 to copy iov into the slots, 0 to only size them
+// Outputs      : index of the first iov not staged (slots full), or iovcnt
+
+static int uring_stage( LcUringSlot *slots, int *nslots, char *buf, struct iovec *iov, int iovcnt, int copy_in ) {
+    int i;
+    for(i = 0; i < iovcnt; i++) {
+        LcUringSlot *slot = (*nslots > 0) ? &slots[*nslots - 1] : NULL;
+        if(slot == NULL || iov[i].iov_len == LCLOUD_NET_HEADER_SIZE ||
+            slot->len + iov[i].iov_len > LC_URING_SLOT_SIZE) {
+            if(*nslots == LC_URING_SLOTS) break;
+            slot = &slots[(*nslots)++];
+            slot->len = 0;
+            slot->done = 0;
+        }
+        if(copy_in) {
+            memcpy(buf + (slot - slots) * LC_URING_SLOT_SIZE + slot->len, iov[i].iov_base, iov[i].iov_len);
+        }
+        slot->len += iov[i].iov_len;
+    }
+    return(i);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : uring_send
+// Description  : Stage the bytes to send.  Nothing is submitted until the
+//                responses are requested, unless the send slots fill up.
+//
+// Inputs       : t - the transport
+//                iov, iovcnt - the bytes to send
+// Outputs      : 0 if successful, -1 if failure
+
+static int uring_send( LcTransport *t, struct iovec *iov, int iovcnt ) {
+    LcUring *ur = (LcUring*) t->priv;
+    int staged;
+    while(iovcnt > 0) {
+        staged = uring_stage(ur->tx, &ur->ntx, ur->txbuf, iov, iovcnt, 1);
+        iov += staged;
+        iovcnt -= staged;
+        if(iovcnt > 0 && uring_run(t) == -1) return(-1);
+    }
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : uring_recv
+// Description  : Post a receive per response alongside the staged sends,
+//                run them all, then copy the responses out of the slots
+//
+// Inputs       : t - the transport
+//                iov, iovcnt - where to place the received bytes
+// Outputs      : 0 if successful, -1 if failure
+
+static int uring_recv( LcTransport *t, struct iovec *iov, int iovcnt ) {
+    LcUring *ur = (LcUring*) t->priv;
+    int staged, slot, off;
+
+    while(iovcnt > 0) {
+        staged = uring_stage(ur->rx, &ur->nrx, ur->rxbuf, iov, iovcnt, 0);
+        if(uring_run(t) == -1) return(-1);
+
+        // Scatter the slots back out to the caller's vectors
+        slot = -1;
+        off = 0;
+        for(int i = 0; i < staged; i++) {
+            if(slot == -1 || iov[i].iov_len == LCLOUD_NET_HEADER_SIZE ||
+                off + iov[i].iov_len > LC_URING_SLOT_SIZE) {
+                slot++;
+                off = 0;
+            }
+            memcpy(iov[i].iov_base, ur->rxbuf + slot * LC_URING_SLOT_SIZE + off, iov[i].iov_len);
+            off += iov[i].iov_len;
+        }
+        iov += staged;
+        iovcnt -= staged;
+    }
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : uring_close
+// Description  : Flush staged sends, tear down the ring and close the socket
+//
+// Inputs       : t - the transport
+// Outputs      : 0 if successful, -1 if failure
+
+static int uring_close( LcTransport *t ) {
+    LcUring *ur = (LcUring*) t->priv;
+    if(ur != NULL) {
+        if(ur->ntx > 0 && ur->fd >= 0) uring_run(t);
+        if(ur->sqes != NULL && ur->sqes != MAP_FAILED) munmap(ur->sqes, ur->sqes_len);
+        if(ur->cq_map != NULL && ur->cq_map != MAP_FAILED && ur->cq_map != ur->sq_map) munmap(ur->cq_map, ur->cq_map_len);
+        if(ur->sq_map != NULL && ur->sq_map != MAP_FAILED) munmap(ur->sq_map, ur->sq_map_len);
+        if(ur->fd >= 0) close(ur->fd);
+        free(ur->txbuf);
+        free(ur->rxbuf);
+        free(ur);
+        t->priv = NULL;
+    }
+    return(lcloud_tcp_transport.close(t));
+}
+
+//
+// Static Data
+
+const LcTransportOps lcloud_uring_transport = { "uring", uring_open, uring_send, uring_recv, uring_close };
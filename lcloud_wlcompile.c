@@ -0,0 +1,78 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_wlcompile.c
+//  Description    : This is the workload compiler, it converts a text
+//                   workload into the compiled format lcloud_client replays
+//                   through mmap.
+//
+//   Author        : Lucas Benning
+//   Last Modified : 4/28/20
+//
+
+// Include Files
+#include <stdio.h>
+#include <unistd.h>
+
+// Project Includes
+#include <cmpsc311_log.h>
+#include <lcloud_workload.h>
+
+// Defines
+#define LC_WLC_ARGUMENTS "hv"
+#define USAGE                                                              \
+    "USAGE: lcloud_wlcompile [-h] [-v] <workload-file> <compiled-file>\n"  \
+    "\n"                                                                   \
+    "where:\n"                                                             \
+    "    -h - help mode (display this message)\n"                          \
+    "    -v - verbose output\n"                                            \
+    "\n"                                                                   \
+    "    <workload-file> - text workload to compile\n"                     \
+    "    <compiled-file> - compiled workload to create\n"                  \
+    "\n"
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the workload compiler
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] ) {
+    int ch, verbose = 0, ret;
+
+    // Process the command line parameters
+    while((ch = getopt(argc, argv, LC_WLC_ARGUMENTS)) != -1) {
+        switch(ch) {
+        case 'h': // Help, print usage
+            fprintf(stderr, USAGE);
+            return(-1);
+
+        case 'v': // Verbose Flag
+            verbose = 1;
+            break;
+
+        default: // Default (unknown)
+            fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+            return(-1);
+        }
+    }
+
+    initializeLogWithFilehandle(CMPSC311_LOG_STDERR);
+    if(verbose) {
+        enableLogLevels(LOG_INFO_LEVEL);
+    }
+
+    if(argc - optind != 2) {
+        fprintf(stderr, "Missing command line parameters, use -h to see usage, aborting.\n");
+        return(-1);
+    }
+
+    ret = lcloud_workload_compile(argv[optind], argv[optind + 1]);
+    freeLogRegistrations();
+    return(ret);
+}
@@ -0,0 +1,667 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_wlgen.c
+//  Description    : This is the synthetic workload generator.  It produces
+//                   self-checking workloads (every read carries the bytes
+//                   the object must hold at that point) over any number of
+//                   objects, with uniform, Zipfian, hotspot or large-object
+//                   access profiles, a configurable read/write mix and
+//                   object-size distribution, and phase changes that move
+//                   the hot set.  Output is the text workload format, the
+//                   compiled format, or both, plus a hardware manifest
+//                   sized to hold the result.
+//
+//   Author        : Lucas Benning
+//   Last Modified : 4/29/20
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Project Includes
+#include <cmpsc311_log.h>
+#include <lcloud_controller.h>
+#include <lcloud_workload.h>
+
+// Defines
+#define LC_WLGEN_ARGUMENTS "hvp:o:n:r:z:H:S:M:x:P:s:N:t:c:m:"
+#define LC_WLGEN_MAX_PHASES 64 // Most read percentages in a -r list
+#define LC_WLGEN_MAX_DEVICES 16 // Devices in a generated manifest
+#define LC_WLGEN_DEV_BLOCKS 256 // Blocks per sector in a generated manifest
+#define USAGE                                                                         \
+    "USAGE: lcloud_wlgen [-h] [-v] [-p <profile>] [-o <ops>] [-n <objects>]\n"        \
+    "                    [-r <read%%>[,<read%%>...]] [-z <theta>] [-H <obj%%>:<access%%>]\n" \
+    "                    [-S <sizes>] [-M <bytes>] [-x <bytes>] [-P <phases>] [-s <seed>]\n" \
+    "                    [-N <name>] [-t <text-out>] [-c <compiled-out>] [-m <manifest-out>]\n" \
+    "\n"                                                                              \
+    "where:\n"                                                                        \
+    "    -h - help mode (display this message)\n"                                     \
+    "    -v - verbose output\n"                                                       \
+    "    -p - access profile: uniform, zipf (default), hotspot or large\n"            \
+    "    -o - number of read/write operations (default 100000)\n"                     \
+    "    -n - number of objects (default 1000)\n"                                     \
+    "    -r - read percentage, a list gives one per phase (default 70)\n"             \
+    "    -z - Zipf skew (default 0.99)\n"                                             \
+    "    -H - hotspot: <obj%%> of the objects receive <access%%> of accesses (10:90)\n" \
+    "    -S - object sizes: fixed:<n>, uniform:<min>:<max>, lognormal:<median>:<sigma>\n" \
+    "         or pareto:<min>:<alpha>\n"                                              \
+    "    -M - largest object size in bytes\n"                                         \
+    "    -x - largest operation size in bytes (at most 10240)\n"                      \
+    "    -P - number of phases, each moves the popular objects (default 1)\n"         \
+    "    -s - random seed (default 1)\n"                                              \
+    "    -N - object name prefix (default lcgen)\n"                                   \
+    "    -t - write the workload as text to <text-out>\n"                             \
+    "    -c - write the workload compiled to <compiled-out>\n"                        \
+    "    -m - write a hardware manifest that fits the workload to <manifest-out>\n"   \
+    "\n"
+
+// Type definitions
+typedef enum {
+    WLGEN_UNIFORM = 0, // Every object equally likely
+    WLGEN_ZIPF = 1, // Popularity falls off as 1/rank^theta
+    WLGEN_HOTSPOT = 2, // A hot fraction of objects takes most accesses
+    WLGEN_LARGE = 3, // Few large objects, streamed sequentially
+} LcWlGenProfile;
+
+typedef enum {
+    WLGEN_SZ_FIXED = 0,
+    WLGEN_SZ_UNIFORM = 1,
+    WLGEN_SZ_LOGNORMAL = 2,
+    WLGEN_SZ_PARETO = 3,
+} LcWlGenSizeDist;
+
+typedef struct {
+    uint64_t store; // Offset of the object's contents in the content store
+    uint32_t target; // Size the object grows to
+    uint32_t size; // Bytes written so far
+    uint32_t cursor; // Next position for sequential access
+    char opened; // 1 once the OPEN has been emitted
+} LcWlGenObject;
+
+typedef struct {
+    // Parameters
+    LcWlGenProfile profile; // Access profile
+    uint64_t num_ops; // Read/write operations to generate
+    uint32_t num_objs; // Objects in the workload
+    int read_pct[LC_WLGEN_MAX_PHASES]; // Read percentage per phase
+    int num_read_pct; // Entries in read_pct
+    double theta; // Zipf skew
+    double hot_objs; // Fraction of objects in the hot set
+    double hot_access; // Fraction of accesses to the hot set
+    LcWlGenSizeDist size_dist; // Object size distribution
+    double size_a, size_b; // Distribution parameters
+    uint32_t max_obj; // Largest object
+    uint32_t max_op; // Largest operation
+    uint32_t phases; // Phases in the workload
+    uint64_t seed; // Random seed
+    const char *prefix; // Object name prefix
+
+    // Generation state
+    uint64_t rng; // xorshift64* state
+    double *zipf_cdf; // Cumulative popularity by rank (zipf/large)
+    LcWlGenObject *objs; // The objects
+    char *content; // Current contents of every object
+    size_t content_len; // Length of the content store
+    uint64_t perm_a, perm_b; // Rank to object permutation for this phase
+    FILE *text; // Text output, or NULL
+    LcWlWriter bin; // Compiled output
+    char bin_open; // 1 if writing compiled output
+
+    // Statistics
+    uint64_t reads, writes, read_bytes, write_bytes, touched;
+    uint64_t blocks_bound; // Upper bound on device blocks the workload allocates
+} LcWlGen;
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : gen_rand
+// Description  : Next value of the generator's xorshift64* stream (the
+//                workload depends only on the seed, not on the platform)
+//
+// Inputs       : g - the generator
+// Outputs      : 64 random bits
+
+static uint64_t gen_rand( LcWlGen *g ) {
+    g->rng ^= g->rng >> 12;
+    g->rng ^= g->rng << 25;
+    g->rng ^= g->rng >> 27;
+    return(g->rng * 0x2545F4914F6CDD1DULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : gen_unit
+// Description  : Uniform double in [0, 1)
+//
+// Inputs       : g - the generator
+// Outputs      : the value
+
+static double gen_unit( LcWlGen *g ) {
+    return((gen_rand(g) >> 11) * (1.0 / 9007199254740992.0));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : gen_object_size
+// Description  : Draw an object size from the configured distribution
+//
+// Inputs       : g - the generator
+// Outputs      : the size (1 .. max_obj)
+
+static uint32_t gen_object_size( LcWlGen *g ) {
+    double sz, u;
+
+    switch(g->size_dist) {
+    case WLGEN_SZ_FIXED:
+        sz = g->size_a;
+        break;
+    case WLGEN_SZ_UNIFORM:
+        sz = g->size_a + gen_unit(g) * (g->size_b - g->size_a + 1);
+        break;
+    case WLGEN_SZ_LOGNORMAL: // Box-Muller around log(median)
+        u = gen_unit(g);
+        sz = g->size_a * exp(g->size_b * sqrt(-2.0 * log(1.0 - u)) * cos(2.0 * M_PI * gen_unit(g)));
+        break;
+    default: // Pareto by inversion
+        sz = g->size_a / pow(1.0 - gen_unit(g), 1.0 / g->size_b);
+        break;
+    }
+    if(sz < 1) sz = 1;
+    if(sz > g->max_obj) sz = g->max_obj;
+    return((uint32_t) sz);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : gen_op_size
+// Description  : Draw an operation size (large objects move big chunks)
+//
+// Inputs       : g - the generator
+// Outputs      : the size (1 .. max_op)
+
+static uint32_t gen_op_size( LcWlGen *g ) {
+    uint32_t lo = (g->profile == WLGEN_LARGE) ? g->max_op / 2 : 1;
+    return(lo + gen_rand(g) % (g->max_op - lo + 1));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : gen_pick_object
+// Description  : Choose the object for the next operation.  Popularity is by
+//                rank; the phase's permutation decides which object holds
+//                each rank, so a phase change moves the hot set.
+//
+// Inputs       : g - the generator
+// Outputs      : the object index
+
+static uint32_t gen_pick_object( LcWlGen *g ) {
+    uint64_t rank, hot = (uint64_t) (g->hot_objs * g->num_objs);
+    uint32_t lo, hi, mid;
+    double u;
+
+    switch(g->profile) {
+    case WLGEN_UNIFORM:
+        rank = gen_rand(g) % g->num_objs;
+        break;
+    case WLGEN_HOTSPOT:
+        if(hot == 0) hot = 1;
+        if(hot >= g->num_objs || gen_unit(g) < g->hot_access) {
+            rank = gen_rand(g) % hot;
+        } else {
+            rank = hot + gen_rand(g) % (g->num_objs - hot);
+        }
+        break;
+    default: // Zipf by binary search of the cumulative popularity
+        u = gen_unit(g);
+        lo = 0;
+        hi = g->num_objs - 1;
+        while(lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            if(g->zipf_cdf[mid] < u) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        rank = lo;
+        break;
+    }
+    return((rank * g->perm_a + g->perm_b) % g->num_objs);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : gen_new_phase
+// Description  : Pick a new rank to object permutation, (rank * a + b) mod n
+//                with a coprime to n
+//
+// Inputs       : g - the generator
+// Outputs      : none
+
+static void gen_new_phase( LcWlGen *g ) {
+    uint64_t a, x, y, t;
+
+    do {
+        a = 1 + gen_rand(g) % g->num_objs;
+        for(x = a, y = g->num_objs; y != 0; t = x % y, x = y, y = t);
+    } while(x != 1);
+    g->perm_a = a;
+    g->perm_b = gen_rand(g) % g->num_objs;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : gen_emit
+// Description  : Write an operation to every configured output
+//
+// Inputs       : g - the generator
+//                op - the operation
+//                obj - the object index
+//                pos, len - the region (reads and writes)
+// Outputs      : 0 if successful, -1 if failure
+
+static int gen_emit( LcWlGen *g, workload_operations_type op, uint32_t obj, uint32_t pos, uint32_t len ) {
+    char name[LC_WLBIN_NAMELEN];
+    const char *data = g->content + g->objs[obj].store + pos;
+
+    snprintf(name, sizeof(name), "%s-%u", g->prefix, obj);
+    if(g->text != NULL) {
+        if(op == WL_READ || op == WL_WRITE) {
+            fprintf(g->text, "%s %s %u %u %.*s\n", name, workload_operations_strings[op], pos, len, (int) len, data);
+        } else {
+            fprintf(g->text, "%s %s\n", name, workload_operations_strings[op]);
+        }
+    }
+    if(g->bin_open && lcloud_wlwriter_add(&g->bin, op, name, pos, len, data) == -1) return(-1);
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : gen_operation
+// Description  : Generate one read or write.  Objects grow by appends until
+//                they reach their target size and are then overwritten in
+//                place; reads only touch bytes already written.
+//
+// Inputs       : g - the generator
+//                phase - the current phase
+// Outputs      : 0 if successful, -1 if failure
+
+static int gen_operation( LcWlGen *g, uint32_t phase ) {
+    uint32_t idx = gen_pick_object(g), pos, len = gen_op_size(g);
+    LcWlGenObject *obj = &g->objs[idx];
+    int sequential = (g->profile == WLGEN_LARGE);
+    char *dst;
+
+    if(!obj->opened) {
+        if(gen_emit(g, WL_OPEN, idx, 0, 0) == -1) return(-1);
+        obj->opened = 1;
+        g->touched++;
+    }
+
+    if(obj->size > 0 && (int) (gen_rand(g) % 100) < g->read_pct[phase % g->num_read_pct]) {
+        pos = (sequential && obj->cursor < obj->size) ? obj->cursor :
+            sequential ? 0 : gen_rand(g) % obj->size;
+        if(len > obj->size - pos) len = obj->size - pos;
+        obj->cursor = pos + len;
+        g->reads++;
+        g->read_bytes += len;
+        return(gen_emit(g, WL_READ, idx, pos, len));
+    }
+
+    if(obj->size < obj->target) {
+        pos = obj->size;
+        if(len > obj->target - pos) len = obj->target - pos;
+        // Any write that grows a file may start a fresh device block
+        g->blocks_bound += (len + LC_DEVICE_BLOCK_SIZE - 1) / LC_DEVICE_BLOCK_SIZE + 1;
+    } else {
+        pos = (sequential && obj->cursor < obj->size) ? obj->cursor :
+            sequential ? 0 : gen_rand(g) % obj->size;
+        if(len > obj->size - pos) len = obj->size - pos;
+    }
+
+    // New printable contents (no newlines, so the text format stays line based)
+    dst = g->content + obj->store + pos;
+    for(uint32_t i = 0; i < len; i++) {
+        dst[i] = ' ' + gen_rand(g) % 95;
+    }
+    if(pos + len > obj->size) obj->size = pos + len;
+    obj->cursor = pos + len;
+    g->writes++;
+    g->write_bytes += len;
+    return(gen_emit(g, WL_WRITE, idx, pos, len));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : gen_setup
+// Description  : Size the objects, build the popularity table and reserve
+//                the content store
+//
+// Inputs       : g - the generator
+// Outputs      : 0 if successful, -1 if failure
+
+static int gen_setup( LcWlGen *g ) {
+    double sum = 0;
+
+    g->rng = g->seed * 0x9E3779B97F4A7C15ULL + 1;
+    if((g->objs = calloc(g->num_objs, sizeof(LcWlGenObject))) == NULL) return(-1);
+    for(uint32_t i = 0; i < g->num_objs; i++) {
+        g->objs[i].store = g->content_len;
+        g->objs[i].target = gen_object_size(g);
+        g->content_len += g->objs[i].target;
+    }
+
+    // Only touched pages are ever backed, so this scales with bytes written
+    g->content = mmap(NULL, g->content_len, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(g->content == MAP_FAILED) {
+        logMessage(LOG_ERROR_LEVEL, "Cannot reserve %zu bytes of object contents", g->content_len);
+        return(-1);
+    }
+
+    if(g->profile == WLGEN_ZIPF || g->profile == WLGEN_LARGE) {
+        if((g->zipf_cdf = malloc(g->num_objs * sizeof(double))) == NULL) return(-1);
+        for(uint32_t i = 0; i < g->num_objs; i++) {
+            sum += 1.0 / pow(i + 1, g->theta);
+            g->zipf_cdf[i] = sum;
+        }
+        for(uint32_t i = 0; i < g->num_objs; i++) {
+            g->zipf_cdf[i] /= sum;
+        }
+    }
+
+    g->perm_a = 1;
+    g->perm_b = 0;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : gen_manifest
+// Description  : Write a hardware manifest with room for every block the
+//                workload can allocate (plus 10% headroom)
+//
+// Inputs       : g - the generator
+//                path - the manifest to create
+// Outputs      : 0 if successful, -1 if failure
+
+static int gen_manifest( LcWlGen *g, const char *path ) {
+    uint64_t need = g->blocks_bound + g->blocks_bound / 10 + LC_WLGEN_DEV_BLOCKS, per, sec;
+    int devs;
+    FILE *fhandle;
+
+    for(devs = 4; devs < LC_WLGEN_MAX_DEVICES; devs++) {
+        per = (need + devs - 1) / devs;
+        if((per + LC_WLGEN_DEV_BLOCKS - 1) / LC_WLGEN_DEV_BLOCKS <= UINT16_MAX) break;
+    }
+    per = (need + devs - 1) / devs;
+    sec = (per + LC_WLGEN_DEV_BLOCKS - 1) / LC_WLGEN_DEV_BLOCKS;
+    if(sec > UINT16_MAX) {
+        logMessage(LOG_ERROR_LEVEL, "Workload needs %lu blocks, more than a manifest can hold", need);
+        return(-1);
+    }
+
+    if((fhandle = fopen(path, "w")) == NULL) {
+        logMessage(LOG_ERROR_LEVEL, "Failure creating manifest [%s]", path);
+        return(-1);
+    }
+    fprintf(fhandle, "# Hardware configuration for generated workload %s\n", g->prefix);
+    fprintf(fhandle, "# %lu blocks needed (worst case), %d devices\n\n", g->blocks_bound, devs);
+    for(int i = 0; i < devs; i++) {
+        fprintf(fhandle, "%d %lu %d\n", i, sec, LC_WLGEN_DEV_BLOCKS);
+    }
+    return((fclose(fhandle) == 0) ? 0 : -1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : gen_parse_sizes
+// Description  : Parse an object size distribution specification
+//
+// Inputs       : g - the generator
+//                spec - the specification
+// Outputs      : 0 if successful, -1 if failure
+
+static int gen_parse_sizes( LcWlGen *g, const char *spec ) {
+    if(sscanf(spec, "fixed:%lf", &g->size_a) == 1) {
+        g->size_dist = WLGEN_SZ_FIXED;
+    } else if(sscanf(spec, "uniform:%lf:%lf", &g->size_a, &g->size_b) == 2 && g->size_b >= g->size_a) {
+        g->size_dist = WLGEN_SZ_UNIFORM;
+    } else if(sscanf(spec, "lognormal:%lf:%lf", &g->size_a, &g->size_b) == 2) {
+        g->size_dist = WLGEN_SZ_LOGNORMAL;
+    } else if(sscanf(spec, "pareto:%lf:%lf", &g->size_a, &g->size_b) == 2 && g->size_b > 0) {
+        g->size_dist = WLGEN_SZ_PARETO;
+    } else {
+        return(-1);
+    }
+    return((g->size_a >= 1) ? 0 : -1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : gen_parse_profile
+// Description  : Select an access profile and its default sizes
+//
+// Inputs       : g - the generator
+//                name - the profile name
+// Outputs      : 0 if successful, -1 if failure
+
+static int gen_parse_profile( LcWlGen *g, const char *name ) {
+    if(strcmp(name, "uniform") == 0) {
+        g->profile = WLGEN_UNIFORM;
+    } else if(strcmp(name, "zipf") == 0) {
+        g->profile = WLGEN_ZIPF;
+    } else if(strcmp(name, "hotspot") == 0) {
+        g->profile = WLGEN_HOTSPOT;
+    } else if(strcmp(name, "large") == 0) {
+        g->profile = WLGEN_LARGE;
+        g->size_dist = WLGEN_SZ_PARETO;
+        g->size_a = 262144;
+        g->size_b = 1.2;
+        g->max_obj = 64 * 1024 * 1024;
+        g->max_op = CMPSC311_MAX_OPSIZE_MAXIMUM;
+        g->theta = 0.8;
+    } else {
+        return(-1);
+    }
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the workload generator
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] ) {
+    int ch, verbose = 0, ret = 0;
+    char *text_out = NULL, *bin_out = NULL, *manifest_out = NULL, *tok, *save = NULL;
+    double hot_objs, hot_access;
+    uint32_t phase = 0;
+    LcWlGen g;
+
+    // Defaults: a Zipf-skewed, read-mostly mix over lognormal objects
+    memset(&g, 0, sizeof(g));
+    g.profile = WLGEN_ZIPF;
+    g.num_ops = 100000;
+    g.num_objs = 1000;
+    g.read_pct[0] = 70;
+    g.num_read_pct = 1;
+    g.theta = 0.99;
+    g.hot_objs = 0.10;
+    g.hot_access = 0.90;
+    g.size_dist = WLGEN_SZ_LOGNORMAL;
+    g.size_a = 8192;
+    g.size_b = 1.0;
+    g.max_obj = 1024 * 1024;
+    g.max_op = 1024;
+    g.phases = 1;
+    g.seed = 1;
+    g.prefix = "lcgen";
+
+    // Process the command line parameters
+    while((ch = getopt(argc, argv, LC_WLGEN_ARGUMENTS)) != -1) {
+        switch(ch) {
+        case 'h': // Help, print usage
+            fprintf(stderr, USAGE);
+            return(-1);
+
+        case 'v': // Verbose Flag
+            verbose = 1;
+            break;
+
+        case 'p': // Access profile (sets size defaults, so later options win)
+            if(gen_parse_profile(&g, optarg) == -1) {
+                fprintf(stderr, "Unknown profile [%s], aborting.\n", optarg);
+                return(-1);
+            }
+            break;
+
+        case 'o': // Operations
+            g.num_ops = strtoull(optarg, NULL, 10);
+            break;
+
+        case 'n': // Objects
+            g.num_objs = strtoul(optarg, NULL, 10);
+            break;
+
+        case 'r': // Read percentage(s)
+            g.num_read_pct = 0;
+            for(tok = strtok_r(optarg, ",", &save); tok != NULL && g.num_read_pct < LC_WLGEN_MAX_PHASES;
+                tok = strtok_r(NULL, ",", &save)) {
+                g.read_pct[g.num_read_pct++] = atoi(tok);
+            }
+            break;
+
+        case 'z': // Zipf skew
+            g.theta = atof(optarg);
+            break;
+
+        case 'H': // Hot set
+            if(sscanf(optarg, "%lf:%lf", &hot_objs, &hot_access) != 2) {
+                fprintf(stderr, "Bad hotspot [%s], aborting.\n", optarg);
+                return(-1);
+            }
+            g.hot_objs = hot_objs / 100.0;
+            g.hot_access = hot_access / 100.0;
+            break;
+
+        case 'S': // Object size distribution
+            if(gen_parse_sizes(&g, optarg) == -1) {
+                fprintf(stderr, "Bad size distribution [%s], aborting.\n", optarg);
+                return(-1);
+            }
+            break;
+
+        case 'M': // Largest object
+            g.max_obj = strtoul(optarg, NULL, 10);
+            break;
+
+        case 'x': // Largest operation
+            g.max_op = strtoul(optarg, NULL, 10);
+            break;
+
+        case 'P': // Phases
+            g.phases = strtoul(optarg, NULL, 10);
+            break;
+
+        case 's': // Seed
+            g.seed = strtoull(optarg, NULL, 10);
+            break;
+
+        case 'N': // Name prefix
+            g.prefix = optarg;
+            break;
+
+        case 't': // Text output
+            text_out = optarg;
+            break;
+
+        case 'c': // Compiled output
+            bin_out = optarg;
+            break;
+
+        case 'm': // Manifest output
+            manifest_out = optarg;
+            break;
+
+        default: // Default (unknown)
+            fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+            return(-1);
+        }
+    }
+
+    initializeLogWithFilehandle(CMPSC311_LOG_STDERR);
+    if(verbose) {
+        enableLogLevels(LOG_INFO_LEVEL);
+    }
+
+    if(text_out == NULL && bin_out == NULL) {
+        fprintf(stderr, "Missing output (-t and/or -c), use -h to see usage, aborting.\n");
+        return(-1);
+    }
+    if(g.num_objs == 0 || g.num_read_pct == 0 || g.phases == 0 || g.max_obj == 0 ||
+        g.max_op == 0 || g.max_op > CMPSC311_MAX_OPSIZE_MAXIMUM) {
+        fprintf(stderr, "Bad workload parameters, use -h to see usage, aborting.\n");
+        return(-1);
+    }
+
+    if(gen_setup(&g) == -1) return(-1);
+    if(text_out != NULL) {
+        if((g.text = fopen(text_out, "w")) == NULL) {
+            logMessage(LOG_ERROR_LEVEL, "Failure creating workload [%s]", text_out);
+            return(-1);
+        }
+        fprintf(g.text, "# CMPSC311 Workload : %s\n", g.prefix);
+        fprintf(g.text, "# Output       : %s\n", text_out);
+        fprintf(g.text, "# Type/params  : lcloud_wlgen, #ops=%lu, #objs=%u, seed=%lu, phases=%u\n",
+            g.num_ops, g.num_objs, g.seed, g.phases);
+        fprintf(g.text, "# Total bytes : %zu\n", g.content_len);
+    }
+    if(bin_out != NULL) {
+        if(lcloud_wlwriter_open(&g.bin, bin_out) == -1) return(-1);
+        g.bin_open = 1;
+    }
+
+    // Generate the operations, then close everything that was opened
+    for(uint64_t i = 0; i < g.num_ops && ret == 0; i++) {
+        if(i * g.phases / g.num_ops != phase) {
+            phase = i * g.phases / g.num_ops;
+            gen_new_phase(&g);
+        }
+        ret = gen_operation(&g, phase);
+    }
+    for(uint32_t i = 0; i < g.num_objs && ret == 0; i++) {
+        if(g.objs[i].opened) ret = gen_emit(&g, WL_CLOSE, i, 0, 0);
+    }
+
+    if(g.text != NULL && fclose(g.text) != 0) ret = -1;
+    if(g.bin_open) {
+        if(ret == 0) ret = lcloud_wlwriter_add(&g.bin, WL_EOF, "", 0, 0, NULL);
+        if(lcloud_wlwriter_close(&g.bin) == -1) ret = -1;
+    }
+    if(ret == 0 && manifest_out != NULL) ret = gen_manifest(&g, manifest_out);
+
+    logMessage(LOG_INFO_LEVEL, "Generated %lu reads (%lu bytes), %lu writes (%lu bytes) over %lu of %u objects",
+        g.reads, g.read_bytes, g.writes, g.write_bytes, g.touched, g.num_objs);
+
+    munmap(g.content, g.content_len);
+    free(g.objs);
+    free(g.zipf_cdf);
+    freeLogRegistrations();
+    return(ret);
+}
@@ -0,0 +1,470 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_workload.c
+//  Description    : This is the implementation of the compiled workload
+//                   format: the writer used by the compiler (and anything
+//                   else that produces workloads) and the reader the
+//                   simulator replays from.
+//
+//   Author        : Lucas Benning
+//   Last Modified : 4/28/20
+//
+
+// Include files
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cmpsc311_log.h>
+
+// Project include files
+#include <lcloud_workload.h>
+
+// Defines
+#define LC_WLBIN_DEDUP_INIT 1024 // Initial buckets in the dedup hash
+#define LC_WLBIN_OPS_INIT 1024 // Initial capacity of the operation table
+
+// Type definitions
+struct LcWlDedup {
+    uint64_t hash; // FNV-1a hash of the data
+    uint64_t off; // Offset of the data in the data section
+    uint32_t len; // Length of the data
+    uint32_t used; // 1 if the bucket holds an entry
+};
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : wl_hash
+// Description  : FNV-1a hash of an operation's data
+//
+// Inputs       : data - the data
+//                len - its length
+// Outputs      : the hash
+
+static uint64_t wl_hash( const char *data, size_t len ) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for(size_t i = 0; i < len; i++) {
+        h = (h ^ (uint8_t) data[i]) * 0x100000001b3ULL;
+    }
+    return(h);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : wl_dedup_grow
+// Description  : Double the size of the dedup hash
+//
+// Inputs       : w - the writer
+// Outputs      : 0 if successful, -1 if failure
+
+static int wl_dedup_grow( LcWlWriter *w ) {
+    uint32_t cap = (w->dedup_cap == 0) ? LC_WLBIN_DEDUP_INIT : w->dedup_cap * 2;
+    struct LcWlDedup *table;
+
+    if((table = calloc(cap, sizeof(struct LcWlDedup))) == NULL) return(-1);
+    for(uint32_t i = 0; i < w->dedup_cap; i++) {
+        if(!w->dedup[i].used) continue;
+        uint32_t b = w->dedup[i].hash & (cap - 1);
+        while(table[b].used) b = (b + 1) & (cap - 1);
+        table[b] = w->dedup[i];
+    }
+    free(w->dedup);
+    w->dedup = table;
+    w->dedup_cap = cap;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : wl_store_data
+// Description  : Place operation data in the data section, reusing an
+//                identical earlier copy if there is one
+//
+// Inputs       : w - the writer
+//                data - the data
+//                len - its length
+//                off - (output) offset of the data in the data section
+// Outputs      : 0 if successful, -1 if failure
+
+static int wl_store_data( LcWlWriter *w, const char *data, size_t len, uint64_t *off ) {
+    uint64_t hash = wl_hash(data, len);
+    char *prior;
+    uint32_t b;
+
+    if(len == 0) {
+        *off = 0;
+        return(0);
+    }
+
+    // Look for the same bytes already in the file (hash hits are verified)
+    for(b = hash & (w->dedup_cap - 1); w->dedup[b].used; b = (b + 1) & (w->dedup_cap - 1)) {
+        if(w->dedup[b].hash != hash || w->dedup[b].len != len) continue;
+        if((prior = malloc(len)) == NULL) return(-1);
+        fflush(w->fhandle);
+        if(pread(fileno(w->fhandle), prior, len, sizeof(LcWlBinHeader) + w->dedup[b].off) == (ssize_t) len &&
+            memcmp(prior, data, len) == 0) {
+            free(prior);
+            *off = w->dedup[b].off;
+            w->dup_bytes += len;
+            return(0);
+        }
+        free(prior);
+    }
+
+    // New data, append it NUL terminated so it can also be logged as a string
+    if(fwrite(data, 1, len, w->fhandle) != len || fputc('\0', w->fhandle) == EOF) return(-1);
+    w->dedup[b].hash = hash;
+    w->dedup[b].off = w->data_len;
+    w->dedup[b].len = len;
+    w->dedup[b].used = 1;
+    *off = w->data_len;
+    w->data_len += len + 1;
+    if(++w->dedup_used * 2 > w->dedup_cap) return(wl_dedup_grow(w));
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : wl_name_index
+// Description  : Find (or add) an object name in the name table
+//
+// Inputs       : w - the writer
+//                objname - the name
+// Outputs      : the index, -1 if failure
+
+static int64_t wl_name_index( LcWlWriter *w, const char *objname ) {
+    uint32_t mask, b, *table, cap;
+    void *names;
+
+    // Look the name up by hash (workloads may have hundreds of thousands)
+    mask = w->name_hash_cap - 1;
+    for(b = wl_hash(objname, strlen(objname)) & mask; w->name_hash[b] != 0; b = (b + 1) & mask) {
+        if(strncmp(w->names[w->name_hash[b] - 1], objname, LC_WLBIN_NAMELEN) == 0) {
+            return(w->name_hash[b] - 1);
+        }
+    }
+
+    if(strlen(objname) >= LC_WLBIN_NAMELEN) {
+        logMessage(LOG_ERROR_LEVEL, "Workload object name too long [%s]", objname);
+        return(-1);
+    }
+    if(w->num_names == 0 || (w->num_names & (w->num_names - 1)) == 0) {
+        cap = (w->num_names == 0) ? 16 : w->num_names * 2;
+        if((names = realloc(w->names, (size_t) cap * LC_WLBIN_NAMELEN)) == NULL) return(-1);
+        w->names = names;
+    }
+    memset(w->names[w->num_names], 0, LC_WLBIN_NAMELEN);
+    strcpy(w->names[w->num_names], objname);
+    w->name_hash[b] = ++w->num_names;
+
+    // Keep the hash at most half full
+    if(w->num_names * 2 > w->name_hash_cap) {
+        cap = w->name_hash_cap * 2;
+        if((table = calloc(cap, sizeof(uint32_t))) == NULL) return(-1);
+        for(uint32_t i = 0; i < w->num_names; i++) {
+            for(b = wl_hash(w->names[i], strlen(w->names[i])) & (cap - 1); table[b] != 0; b = (b + 1) & (cap - 1));
+            table[b] = i + 1;
+        }
+        free(w->name_hash);
+        w->name_hash = table;
+        w->name_hash_cap = cap;
+    }
+    return(w->num_names - 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_wlwriter_open
+// Description  : Start writing a compiled workload
+//
+// Inputs       : w - the writer
+//                path - the file to create
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_wlwriter_open( LcWlWriter *w, const char *path ) {
+    LcWlBinHeader hdr;
+
+    memset(w, 0, sizeof(LcWlWriter));
+    if((w->fhandle = fopen(path, "w+")) == NULL) {
+        logMessage(LOG_ERROR_LEVEL, "Failure creating compiled workload [%s]: %s", path, strerror(errno));
+        return(-1);
+    }
+
+    // Reserve the header, the data section streams out behind it
+    memset(&hdr, 0, sizeof(hdr));
+    w->name_hash_cap = LC_WLBIN_DEDUP_INIT;
+    if(fwrite(&hdr, sizeof(hdr), 1, w->fhandle) != 1 || wl_dedup_grow(w) == -1 ||
+        (w->name_hash = calloc(w->name_hash_cap, sizeof(uint32_t))) == NULL) {
+        fclose(w->fhandle);
+        return(-1);
+    }
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_wlwriter_add
+// Description  : Append an operation to a compiled workload
+//
+// Inputs       : w - the writer
+//                op - the operation type
+//                objname - the object name
+//                pos - position in the object
+//                size - size of the operation
+//                data - the operation data (size bytes, reads and writes)
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_wlwriter_add( LcWlWriter *w, workload_operations_type op, const char *objname,
+    size_t pos, size_t size, const char *data ) {
+    LcWlBinOp *entry;
+    int64_t name;
+    void *ops;
+
+    // Only reads and writes carry a position and data
+    if(op != WL_READ && op != WL_WRITE) pos = size = 0;
+    if(op >= WLT_MAX_WORKLOAD_OP_TYPE || pos > UINT32_MAX || size > CMPSC311_MAX_OPSIZE_MAXIMUM) {
+        logMessage(LOG_ERROR_LEVEL, "Bad workload operation [%d, pos=%zu, size=%zu]", op, pos, size);
+        return(-1);
+    }
+
+    if(w->num_ops == w->ops_cap) {
+        w->ops_cap = (w->ops_cap == 0) ? LC_WLBIN_OPS_INIT : w->ops_cap * 2;
+        if((ops = realloc(w->ops, w->ops_cap * sizeof(LcWlBinOp))) == NULL) return(-1);
+        w->ops = ops;
+    }
+    if((name = wl_name_index(w, objname)) == -1) return(-1);
+
+    entry = &w->ops[w->num_ops];
+    memset(entry, 0, sizeof(LcWlBinOp));
+    entry->op = op;
+    entry->name = name;
+    entry->pos = pos;
+    entry->size = size;
+    if(wl_store_data(w, data, size, &entry->data) == -1) return(-1);
+    w->num_ops++;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_wlwriter_close
+// Description  : Write the name and operation tables and the header
+//
+// Inputs       : w - the writer
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_wlwriter_close( LcWlWriter *w ) {
+    LcWlBinHeader hdr;
+    int ret = 0;
+
+    // Tables follow the data section, padded to keep the ops aligned
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, LC_WLBIN_MAGIC, sizeof(hdr.magic));
+    hdr.version = LC_WLBIN_VERSION;
+    hdr.num_ops = w->num_ops;
+    hdr.num_names = w->num_names;
+    hdr.data_off = sizeof(LcWlBinHeader);
+    hdr.data_len = w->data_len;
+    hdr.names_off = (hdr.data_off + hdr.data_len + 7) & ~7ULL;
+    hdr.ops_off = hdr.names_off + (uint64_t) w->num_names * LC_WLBIN_NAMELEN;
+
+    while(hdr.data_off + w->data_len < hdr.names_off) {
+        fputc('\0', w->fhandle);
+        w->data_len++;
+    }
+    if(fwrite(w->names, LC_WLBIN_NAMELEN, w->num_names, w->fhandle) != w->num_names ||
+        fwrite(w->ops, sizeof(LcWlBinOp), w->num_ops, w->fhandle) != w->num_ops ||
+        fseek(w->fhandle, 0, SEEK_SET) != 0 || fwrite(&hdr, sizeof(hdr), 1, w->fhandle) != 1) {
+        logMessage(LOG_ERROR_LEVEL, "Failure writing compiled workload: %s", strerror(errno));
+        ret = -1;
+    }
+    if(fclose(w->fhandle) != 0) ret = -1;
+
+    free(w->ops);
+    free(w->names);
+    free(w->dedup);
+    free(w->name_hash);
+    w->name_hash = NULL;
+    w->ops = NULL;
+    w->names = NULL;
+    w->dedup = NULL;
+    return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_workload_compile
+// Description  : Convert a text workload into a compiled workload
+//
+// Inputs       : text - the text workload
+//                binary - the compiled workload to create
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_workload_compile( const char *text, const char *binary ) {
+    LcWorkload wl;
+    LcWlWriter w;
+    LcWlOp op;
+
+    if(lcloud_workload_open(&wl, text) == -1) return(-1);
+    if(lcloud_wlwriter_open(&w, binary) == -1) {
+        lcloud_workload_close(&wl);
+        return(-1);
+    }
+
+    do {
+        if(lcloud_workload_next(&wl, &op) == -1 ||
+            lcloud_wlwriter_add(&w, op.op, op.objname, op.pos, op.size, op.data) == -1) {
+            logMessage(LOG_ERROR_LEVEL, "Failure compiling workload [%s] at line %u", text, wl.lineno);
+            lcloud_workload_close(&wl);
+            lcloud_wlwriter_close(&w);
+            unlink(binary);
+            return(-1);
+        }
+    } while(op.op != WL_EOF);
+
+    logMessage(LOG_INFO_LEVEL, "Compiled [%s]: %u ops, %u objects, %lu data bytes (%lu deduplicated)",
+        text, w.num_ops, w.num_names, w.data_len, w.dup_bytes);
+    lcloud_workload_close(&wl);
+    return(lcloud_wlwriter_close(&w));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : wl_map
+// Description  : Map a compiled workload and check its tables fit the file
+//
+// Inputs       : wl - the workload
+//                fd - the open file
+// Outputs      : 0 if successful, -1 if failure
+
+static int wl_map( LcWorkload *wl, int fd ) {
+    const LcWlBinHeader *hdr;
+    struct stat st;
+
+    if(fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(LcWlBinHeader)) return(-1);
+    wl->map_len = st.st_size;
+    if((wl->map = mmap(NULL, wl->map_len, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        wl->map = NULL;
+        return(-1);
+    }
+    madvise(wl->map, wl->map_len, MADV_SEQUENTIAL);
+
+    hdr = wl->hdr = (const LcWlBinHeader *) wl->map;
+    if(hdr->version != LC_WLBIN_VERSION ||
+        hdr->data_off + hdr->data_len > wl->map_len ||
+        hdr->names_off + (uint64_t) hdr->num_names * LC_WLBIN_NAMELEN > wl->map_len ||
+        hdr->ops_off + (uint64_t) hdr->num_ops * sizeof(LcWlBinOp) > wl->map_len ||
+        (hdr->ops_off % sizeof(uint64_t)) != 0) {
+        return(-1);
+    }
+    wl->data = wl->map + hdr->data_off;
+    wl->names = wl->map + hdr->names_off;
+    wl->ops = (const LcWlBinOp *) (wl->map + hdr->ops_off);
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_workload_open
+// Description  : Open a workload, compiled workloads are recognized by their
+//                magic number and mapped, anything else is read as text
+//
+// Inputs       : wl - the workload
+//                path - the workload file
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_workload_open( LcWorkload *wl, const char *path ) {
+    char magic[4];
+    int fd;
+
+    memset(wl, 0, sizeof(LcWorkload));
+    if((fd = open(path, O_RDONLY)) == -1) {
+        logMessage(LOG_ERROR_LEVEL, "Failure opening workload [%s]: %s", path, strerror(errno));
+        return(-1);
+    }
+
+    if(read(fd, magic, sizeof(magic)) == sizeof(magic) && memcmp(magic, LC_WLBIN_MAGIC, sizeof(magic)) == 0) {
+        wl->binary = 1;
+        if(wl_map(wl, fd) == -1) {
+            logMessage(LOG_ERROR_LEVEL, "Corrupt compiled workload [%s]", path);
+            close(fd);
+            lcloud_workload_close(wl);
+            return(-1);
+        }
+        close(fd);
+        return(0);
+    }
+
+    close(fd);
+    return((openCmpsc311Workload(&wl->text, path) == 0) ? 0 : -1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_workload_next
+// Description  : Get the next operation, a compiled workload that runs out of
+//                operations reports WL_EOF
+//
+// Inputs       : wl - the workload
+//                op - (output) the operation
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_workload_next( LcWorkload *wl, LcWlOp *op ) {
+    const LcWlBinOp *entry;
+
+    if(!wl->binary) {
+        if(readCmpsc311Workload(&wl->text, &wl->text_op)) return(-1);
+        wl->lineno = wl->text.lineno;
+        op->objname = wl->text_op.objname;
+        op->op = wl->text_op.op;
+        op->pos = wl->text_op.pos;
+        op->size = wl->text_op.size;
+        op->data = wl->text_op.data;
+        return(0);
+    }
+
+    if(wl->lineno >= wl->hdr->num_ops) {
+        memset(op, 0, sizeof(LcWlOp));
+        op->objname = "";
+        op->op = WL_EOF;
+        return(0);
+    }
+
+    // Everything points into the mapping, only the bounds are checked
+    entry = &wl->ops[wl->lineno++];
+    if(entry->op >= WLT_MAX_WORKLOAD_OP_TYPE || entry->name >= wl->hdr->num_names ||
+        entry->size > CMPSC311_MAX_OPSIZE_MAXIMUM || entry->data + entry->size > wl->hdr->data_len) {
+        logMessage(LOG_ERROR_LEVEL, "Corrupt compiled workload operation %u", wl->lineno);
+        return(-1);
+    }
+    op->objname = wl->names + (size_t) entry->name * LC_WLBIN_NAMELEN;
+    op->op = entry->op;
+    op->pos = entry->pos;
+    op->size = entry->size;
+    op->data = wl->data + entry->data;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_workload_close
+// Description  : Close the workload
+//
+// Inputs       : wl - the workload
+// Outputs      : 0 if successful
+
+int lcloud_workload_close( LcWorkload *wl ) {
+    if(wl->binary) {
+        if(wl->map != NULL) munmap(wl->map, wl->map_len);
+        wl->map = NULL;
+    } else {
+        closeCmpsc311Workload(&wl->text);
+    }
+    return(0);
+}
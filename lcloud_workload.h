@@ -0,0 +1,116 @@
+#ifndef LCLOUD_WORKLOAD_INCLUDED
+#define LCLOUD_WORKLOAD_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_workload.h
+//  Description    : This is the interface of the compiled (binary) workload
+//                   format and of the reader the simulator replays from.
+//                   A compiled workload is a header, a deduplicated data
+//                   section, a table of fixed-size object names and a table
+//                   of fixed-size operations pointing into both, so it can
+//                   be replayed straight out of an mmap with no parsing.
+//
+//   Author        : Lucas Benning
+//   Last Modified : 4/28/20
+//
+
+// Includes
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <cmpsc311_workload.h>
+
+// Defines
+#define LC_WLBIN_MAGIC "LCWB" // First four bytes of a compiled workload
+#define LC_WLBIN_VERSION 1
+#define LC_WLBIN_NAMELEN 128 // Bytes per object name (NUL terminated)
+
+// Type definitions
+typedef struct {
+    char magic[4]; // LC_WLBIN_MAGIC
+    uint32_t version; // LC_WLBIN_VERSION
+    uint32_t num_ops; // Entries in the operation table
+    uint32_t num_names; // Entries in the name table
+    uint64_t data_off; // File offset of the data section
+    uint64_t data_len; // Bytes in the data section
+    uint64_t names_off; // File offset of the name table
+    uint64_t ops_off; // File offset of the operation table
+} LcWlBinHeader;
+
+typedef struct {
+    uint8_t op; // The workload_operations_type
+    uint8_t reserved[3];
+    uint32_t name; // Index into the name table
+    uint32_t pos; // Position in the object
+    uint32_t size; // Size of the operation
+    uint64_t data; // Offset of the operation data in the data section
+} LcWlBinOp;
+
+typedef struct {
+    const char *objname; // The object name
+    workload_operations_type op; // The operation performed
+    size_t pos; // Position in the object
+    size_t size; // Size of the operation
+    const char *data; // The data for the operation (not copied)
+} LcWlOp;
+
+typedef struct {
+    char binary; // 1 if replaying a compiled workload
+    uint32_t lineno; // Current line (text) or operation (compiled)
+
+    // Text workloads
+    workload_state text; // The cmpsc311 workload reader
+    workload_operation text_op; // The last operation read
+
+    // Compiled workloads
+    char *map; // The mapped file
+    size_t map_len; // Length of the mapping
+    const LcWlBinHeader *hdr; // The header (start of the mapping)
+    const LcWlBinOp *ops; // The operation table
+    const char *names; // The name table
+    const char *data; // The data section
+} LcWorkload;
+
+typedef struct {
+    FILE *fhandle; // The output file
+    uint32_t num_ops; // Operations written so far
+    uint64_t data_len; // Bytes in the data section so far
+    LcWlBinOp *ops; // The operation table (written at close)
+    uint32_t ops_cap; // Capacity of ops
+    char (*names)[LC_WLBIN_NAMELEN]; // The name table (written at close)
+    uint32_t num_names; // Names in the table
+    uint32_t *name_hash; // Name table index + 1 by name hash, 0 if empty
+    uint32_t name_hash_cap; // Buckets in name_hash (power of two)
+    struct LcWlDedup *dedup; // Hash of data already written
+    uint32_t dedup_cap; // Buckets in the hash (power of two)
+    uint32_t dedup_used; // Buckets in use
+    uint64_t dup_bytes; // Bytes saved by deduplication
+} LcWlWriter;
+
+//
+// Functional Prototypes
+
+int lcloud_workload_open( LcWorkload *wl, const char *path );
+    // Open a text or compiled workload (detected from the contents)
+
+int lcloud_workload_next( LcWorkload *wl, LcWlOp *op );
+    // Get the next operation, pointers stay valid until the next call
+
+int lcloud_workload_close( LcWorkload *wl );
+    // Close the workload
+
+int lcloud_wlwriter_open( LcWlWriter *w, const char *path );
+    // Start writing a compiled workload
+
+int lcloud_wlwriter_add( LcWlWriter *w, workload_operations_type op, const char *objname,
+    size_t pos, size_t size, const char *data );
+    // Append an operation (data is deduplicated against earlier operations)
+
+int lcloud_wlwriter_close( LcWlWriter *w );
+    // Write the tables and header, close the file
+
+int lcloud_workload_compile( const char *text, const char *binary );
+    // Convert a text workload into a compiled workload
+
+#endif